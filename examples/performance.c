@@ -9,9 +9,30 @@
 GthreeScene *scene;
 GthreePerspectiveCamera *camera;
 
+#define N_OBJECTS 5000
+
 GList *objects;
+GthreeGroup *group;
+GthreeInstancedMesh *instanced;
+graphene_point3d_t instance_pos[N_OBJECTS];
+graphene_euler_t instance_rot[N_OBJECTS];
+float instance_scale[N_OBJECTS];
+gboolean use_instancing;
 float pointer_x, pointer_y;
 
+static void
+update_instance_matrix (int i)
+{
+  graphene_matrix_t m;
+  graphene_quaternion_t q;
+
+  graphene_matrix_init_scale (&m, instance_scale[i], instance_scale[i], instance_scale[i]);
+  graphene_quaternion_init_from_euler (&q, &instance_rot[i]);
+  graphene_matrix_rotate_quaternion (&m, &q);
+  graphene_matrix_translate (&m, &instance_pos[i]);
+  gthree_instanced_mesh_set_matrix_at (instanced, i, &m);
+}
+
 GthreeScene *
 init_scene (void)
 {
@@ -31,14 +52,21 @@ init_scene (void)
 
   scene = gthree_scene_new ();
 
+  group = gthree_group_new ();
+  gthree_object_add_child (GTHREE_OBJECT (scene), GTHREE_OBJECT (group));
+
+  instanced = gthree_instanced_mesh_new (geometry, GTHREE_MATERIAL (material), N_OBJECTS);
+  gthree_object_set_visible (GTHREE_OBJECT (instanced), FALSE);
+  gthree_object_add_child (GTHREE_OBJECT (scene), GTHREE_OBJECT (instanced));
+
   pos.x = 0;
   pos.y = 0;
   pos.z = 0;
 
-  for (i = 0; i < 5000; i++)
+  for (i = 0; i < N_OBJECTS; i++)
     {
       mesh = gthree_mesh_new (geometry, GTHREE_MATERIAL (material));
-      gthree_object_add_child (GTHREE_OBJECT (scene), GTHREE_OBJECT (mesh));
+      gthree_object_add_child (GTHREE_OBJECT (group), GTHREE_OBJECT (mesh));
       pos.x = g_random_double_range (-4000, 4000);
       pos.y = g_random_double_range (-4000, 4000);
       pos.z = g_random_double_range (-4000, 4000);
@@ -51,6 +79,11 @@ init_scene (void)
                            0);
       gthree_object_set_rotation (GTHREE_OBJECT (mesh), &rot);
       objects = g_list_prepend (objects, mesh);
+
+      instance_pos[i] = pos;
+      instance_rot[i] = rot;
+      instance_scale[i] = scale.x;
+      update_instance_matrix (i);
     }
 
   return scene;
@@ -65,6 +98,7 @@ tick (GtkWidget     *widget,
   const graphene_euler_t *old_rot;
   graphene_point3d_t pos;
   GList *l;
+  int i;
 
   graphene_point3d_init_from_vec3 (&pos,
                                    gthree_object_get_position (GTHREE_OBJECT (camera)));
@@ -75,16 +109,32 @@ tick (GtkWidget     *widget,
   gthree_object_look_at (GTHREE_OBJECT (camera),
                          graphene_point3d_init (&pos, 0, 0, 0));
 
-  for (l = objects; l != NULL; l = l->next)
+  if (use_instancing)
     {
-      GthreeObject *obj = l->data;
-
-      old_rot = gthree_object_get_rotation (obj);
-      graphene_euler_init (&rot,
-                           graphene_euler_get_x (old_rot) + 0.5,
-                           graphene_euler_get_y (old_rot) + 1.0,
-                           0);
-      gthree_object_set_rotation (obj, &rot);
+      for (i = 0; i < N_OBJECTS; i++)
+        {
+          old_rot = &instance_rot[i];
+          graphene_euler_init (&rot,
+                               graphene_euler_get_x (old_rot) + 0.5,
+                               graphene_euler_get_y (old_rot) + 1.0,
+                               0);
+          instance_rot[i] = rot;
+          update_instance_matrix (i);
+        }
+    }
+  else
+    {
+      for (l = objects; l != NULL; l = l->next)
+        {
+          GthreeObject *obj = l->data;
+
+          old_rot = gthree_object_get_rotation (obj);
+          graphene_euler_init (&rot,
+                               graphene_euler_get_x (old_rot) + 0.5,
+                               graphene_euler_get_y (old_rot) + 1.0,
+                               0);
+          gthree_object_set_rotation (obj, &rot);
+        }
     }
 
   gtk_widget_queue_draw (widget);
@@ -101,6 +151,14 @@ resize_area (GthreeArea *area,
   gthree_perspective_camera_set_aspect (camera, (float)width / (float)(height));
 }
 
+static void
+instanced_toggled (GtkToggleButton *button)
+{
+  use_instancing = gtk_toggle_button_get_active (button);
+  gthree_object_set_visible (GTHREE_OBJECT (group), !use_instancing);
+  gthree_object_set_visible (GTHREE_OBJECT (instanced), use_instancing);
+}
+
 static gboolean
 motion_event (GtkWidget      *widget,
               GdkEventMotion *event)
@@ -153,6 +211,11 @@ main (int argc, char *argv[])
 
   gtk_widget_add_tick_callback (GTK_WIDGET (area), tick, area, NULL);
 
+  button = gtk_check_button_new_with_label ("Instanced");
+  gtk_container_add (GTK_CONTAINER (box), button);
+  g_signal_connect (button, "toggled", G_CALLBACK (instanced_toggled), NULL);
+  gtk_widget_show (button);
+
   button = gtk_button_new_with_label ("Quit");
   gtk_widget_set_hexpand (button, TRUE);
   gtk_container_add (GTK_CONTAINER (box), button);
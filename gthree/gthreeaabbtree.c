@@ -0,0 +1,582 @@
+#include <math.h>
+
+#include "gthreeprivate.h"
+
+/* Dynamic AABB tree, as popularized by Box2D. Leaves hold slightly
+ * enlarged ("fat") boxes so that objects that move a little don't need
+ * to be reinserted, and the tree is kept balanced with rotations on the
+ * way back up after each insert or remove. */
+
+#define NULL_NODE -1
+
+/* Fraction of the box size leaves are grown by */
+#define FAT_MARGIN 0.1f
+
+typedef struct {
+  float min[3];
+  float max[3];
+  gpointer data;
+  int parent;   /* Or next free node while on the free list */
+  int child1;
+  int child2;   /* NULL_NODE for leaves */
+  int height;   /* 0 for leaves, -1 for free nodes */
+} AabbNode;
+
+struct _GthreeAabbTree {
+  GArray *nodes;
+  int root;
+  int free_list;
+  int n_leaves;
+};
+
+#define NODE(_tree, _i) (&g_array_index ((_tree)->nodes, AabbNode, (_i)))
+
+static inline gboolean
+node_is_leaf (const AabbNode *node)
+{
+  return node->child1 == NULL_NODE;
+}
+
+static inline float
+area (const float *min, const float *max)
+{
+  float dx = max[0] - min[0];
+  float dy = max[1] - min[1];
+  float dz = max[2] - min[2];
+
+  return 2.0f * (dx * dy + dy * dz + dz * dx);
+}
+
+static inline float
+union_area (const AabbNode *a, const AabbNode *b)
+{
+  float min[3], max[3];
+
+  for (int i = 0; i < 3; i++)
+    {
+      min[i] = fminf (a->min[i], b->min[i]);
+      max[i] = fmaxf (a->max[i], b->max[i]);
+    }
+
+  return area (min, max);
+}
+
+static inline void
+node_set_union (AabbNode *node, const AabbNode *a, const AabbNode *b)
+{
+  for (int i = 0; i < 3; i++)
+    {
+      node->min[i] = fminf (a->min[i], b->min[i]);
+      node->max[i] = fmaxf (a->max[i], b->max[i]);
+    }
+}
+
+GthreeAabbTree *
+gthree_aabb_tree_new (void)
+{
+  GthreeAabbTree *tree = g_new0 (GthreeAabbTree, 1);
+
+  tree->nodes = g_array_new (FALSE, FALSE, sizeof (AabbNode));
+  tree->root = NULL_NODE;
+  tree->free_list = NULL_NODE;
+
+  return tree;
+}
+
+void
+gthree_aabb_tree_free (GthreeAabbTree *tree)
+{
+  g_array_unref (tree->nodes);
+  g_free (tree);
+}
+
+int
+gthree_aabb_tree_get_n_leaves (GthreeAabbTree *tree)
+{
+  return tree->n_leaves;
+}
+
+static int
+allocate_node (GthreeAabbTree *tree)
+{
+  AabbNode *node;
+  int id;
+
+  if (tree->free_list != NULL_NODE)
+    {
+      id = tree->free_list;
+      tree->free_list = NODE (tree, id)->parent;
+    }
+  else
+    {
+      id = tree->nodes->len;
+      g_array_set_size (tree->nodes, id + 1);
+    }
+
+  node = NODE (tree, id);
+  node->data = NULL;
+  node->parent = NULL_NODE;
+  node->child1 = NULL_NODE;
+  node->child2 = NULL_NODE;
+  node->height = 0;
+
+  return id;
+}
+
+static void
+free_node (GthreeAabbTree *tree, int id)
+{
+  AabbNode *node = NODE (tree, id);
+
+  node->parent = tree->free_list;
+  node->height = -1;
+  tree->free_list = id;
+}
+
+/* Rotates the subtree at a if it is unbalanced, returns the new subtree root */
+static int
+balance (GthreeAabbTree *tree, int ia)
+{
+  AabbNode *a = NODE (tree, ia);
+  AabbNode *b, *c;
+  int ib, ic, balance;
+
+  if (node_is_leaf (a) || a->height < 2)
+    return ia;
+
+  ib = a->child1;
+  ic = a->child2;
+  b = NODE (tree, ib);
+  c = NODE (tree, ic);
+
+  balance = c->height - b->height;
+
+  if (balance > 1)
+    {
+      /* Rotate c up */
+      int i_f = c->child1, ig = c->child2;
+      AabbNode *f = NODE (tree, i_f), *g = NODE (tree, ig);
+
+      c->child1 = ia;
+      c->parent = a->parent;
+      a->parent = ic;
+
+      if (c->parent != NULL_NODE)
+        {
+          AabbNode *p = NODE (tree, c->parent);
+          if (p->child1 == ia)
+            p->child1 = ic;
+          else
+            p->child2 = ic;
+        }
+      else
+        tree->root = ic;
+
+      if (f->height > g->height)
+        {
+          c->child2 = i_f;
+          a->child2 = ig;
+          g->parent = ia;
+          node_set_union (a, b, g);
+          node_set_union (c, a, f);
+          a->height = 1 + MAX (b->height, g->height);
+          c->height = 1 + MAX (a->height, f->height);
+        }
+      else
+        {
+          c->child2 = ig;
+          a->child2 = i_f;
+          f->parent = ia;
+          node_set_union (a, b, f);
+          node_set_union (c, a, g);
+          a->height = 1 + MAX (b->height, f->height);
+          c->height = 1 + MAX (a->height, g->height);
+        }
+
+      return ic;
+    }
+
+  if (balance < -1)
+    {
+      /* Rotate b up */
+      int id = b->child1, ie = b->child2;
+      AabbNode *d = NODE (tree, id), *e = NODE (tree, ie);
+
+      b->child1 = ia;
+      b->parent = a->parent;
+      a->parent = ib;
+
+      if (b->parent != NULL_NODE)
+        {
+          AabbNode *p = NODE (tree, b->parent);
+          if (p->child1 == ia)
+            p->child1 = ib;
+          else
+            p->child2 = ib;
+        }
+      else
+        tree->root = ib;
+
+      if (d->height > e->height)
+        {
+          b->child2 = id;
+          a->child1 = ie;
+          e->parent = ia;
+          node_set_union (a, c, e);
+          node_set_union (b, a, d);
+          a->height = 1 + MAX (c->height, e->height);
+          b->height = 1 + MAX (a->height, d->height);
+        }
+      else
+        {
+          b->child2 = ie;
+          a->child1 = id;
+          d->parent = ia;
+          node_set_union (a, c, d);
+          node_set_union (b, a, e);
+          a->height = 1 + MAX (c->height, d->height);
+          b->height = 1 + MAX (a->height, e->height);
+        }
+
+      return ib;
+    }
+
+  return ia;
+}
+
+static void
+refit_ancestors (GthreeAabbTree *tree, int index)
+{
+  while (index != NULL_NODE)
+    {
+      AabbNode *node;
+
+      index = balance (tree, index);
+      node = NODE (tree, index);
+
+      node_set_union (node, NODE (tree, node->child1), NODE (tree, node->child2));
+      node->height = 1 + MAX (NODE (tree, node->child1)->height, NODE (tree, node->child2)->height);
+
+      index = node->parent;
+    }
+}
+
+static void
+insert_leaf (GthreeAabbTree *tree, int leaf)
+{
+  AabbNode *leaf_node = NODE (tree, leaf);
+  int sibling, old_parent, new_parent;
+
+  if (tree->root == NULL_NODE)
+    {
+      tree->root = leaf;
+      leaf_node->parent = NULL_NODE;
+      return;
+    }
+
+  /* Walk down picking the child where the leaf increases the total area least */
+  sibling = tree->root;
+  while (!node_is_leaf (NODE (tree, sibling)))
+    {
+      AabbNode *node = NODE (tree, sibling);
+      AabbNode *child1 = NODE (tree, node->child1);
+      AabbNode *child2 = NODE (tree, node->child2);
+      float node_area = area (node->min, node->max);
+      float combined_area = union_area (node, leaf_node);
+      float cost = 2.0f * combined_area;
+      float inheritance_cost = 2.0f * (combined_area - node_area);
+      float cost1, cost2;
+
+      cost1 = union_area (child1, leaf_node) + inheritance_cost;
+      if (!node_is_leaf (child1))
+        cost1 -= area (child1->min, child1->max);
+
+      cost2 = union_area (child2, leaf_node) + inheritance_cost;
+      if (!node_is_leaf (child2))
+        cost2 -= area (child2->min, child2->max);
+
+      if (cost < cost1 && cost < cost2)
+        break;
+
+      sibling = cost1 < cost2 ? node->child1 : node->child2;
+    }
+
+  old_parent = NODE (tree, sibling)->parent;
+  new_parent = allocate_node (tree);
+
+  /* allocate_node may have moved the array */
+  {
+    AabbNode *parent = NODE (tree, new_parent);
+    AabbNode *sib = NODE (tree, sibling);
+
+    leaf_node = NODE (tree, leaf);
+    parent->parent = old_parent;
+    node_set_union (parent, leaf_node, sib);
+    parent->height = sib->height + 1;
+    parent->child1 = sibling;
+    parent->child2 = leaf;
+    sib->parent = new_parent;
+    leaf_node->parent = new_parent;
+
+    if (old_parent != NULL_NODE)
+      {
+        AabbNode *op = NODE (tree, old_parent);
+        if (op->child1 == sibling)
+          op->child1 = new_parent;
+        else
+          op->child2 = new_parent;
+      }
+    else
+      tree->root = new_parent;
+  }
+
+  refit_ancestors (tree, NODE (tree, leaf)->parent);
+}
+
+static void
+remove_leaf (GthreeAabbTree *tree, int leaf)
+{
+  int parent, grand_parent, sibling;
+  AabbNode *parent_node;
+
+  if (leaf == tree->root)
+    {
+      tree->root = NULL_NODE;
+      return;
+    }
+
+  parent = NODE (tree, leaf)->parent;
+  parent_node = NODE (tree, parent);
+  grand_parent = parent_node->parent;
+  sibling = parent_node->child1 == leaf ? parent_node->child2 : parent_node->child1;
+
+  if (grand_parent != NULL_NODE)
+    {
+      AabbNode *gp = NODE (tree, grand_parent);
+      if (gp->child1 == parent)
+        gp->child1 = sibling;
+      else
+        gp->child2 = sibling;
+      NODE (tree, sibling)->parent = grand_parent;
+      free_node (tree, parent);
+
+      refit_ancestors (tree, grand_parent);
+    }
+  else
+    {
+      tree->root = sibling;
+      NODE (tree, sibling)->parent = NULL_NODE;
+      free_node (tree, parent);
+    }
+}
+
+static void
+set_fat_box (AabbNode *node, const graphene_box_t *box)
+{
+  graphene_point3d_t min, max;
+
+  graphene_box_get_min (box, &min);
+  graphene_box_get_max (box, &max);
+
+  node->min[0] = min.x - (max.x - min.x) * FAT_MARGIN;
+  node->min[1] = min.y - (max.y - min.y) * FAT_MARGIN;
+  node->min[2] = min.z - (max.z - min.z) * FAT_MARGIN;
+  node->max[0] = max.x + (max.x - min.x) * FAT_MARGIN;
+  node->max[1] = max.y + (max.y - min.y) * FAT_MARGIN;
+  node->max[2] = max.z + (max.z - min.z) * FAT_MARGIN;
+}
+
+/* Returns the proxy id of the new leaf */
+int
+gthree_aabb_tree_insert (GthreeAabbTree       *tree,
+                         const graphene_box_t *box,
+                         gpointer              data)
+{
+  int leaf = allocate_node (tree);
+  AabbNode *node = NODE (tree, leaf);
+
+  set_fat_box (node, box);
+  node->data = data;
+
+  insert_leaf (tree, leaf);
+  tree->n_leaves++;
+
+  return leaf;
+}
+
+void
+gthree_aabb_tree_remove (GthreeAabbTree *tree,
+                         int             proxy)
+{
+  remove_leaf (tree, proxy);
+  free_node (tree, proxy);
+  tree->n_leaves--;
+}
+
+/* Only reinserts the leaf if the box escaped its fat box. Returns
+ * TRUE if the tree changed. */
+gboolean
+gthree_aabb_tree_move (GthreeAabbTree       *tree,
+                       int                   proxy,
+                       const graphene_box_t *box)
+{
+  AabbNode *node = NODE (tree, proxy);
+  graphene_point3d_t min, max;
+
+  graphene_box_get_min (box, &min);
+  graphene_box_get_max (box, &max);
+
+  if (min.x >= node->min[0] && min.y >= node->min[1] && min.z >= node->min[2] &&
+      max.x <= node->max[0] && max.y <= node->max[1] && max.z <= node->max[2])
+    return FALSE;
+
+  remove_leaf (tree, proxy);
+  set_fat_box (NODE (tree, proxy), box);
+  insert_leaf (tree, proxy);
+
+  return TRUE;
+}
+
+static void
+report_subtree (GthreeAabbTree     *tree,
+                int                 index,
+                GthreeAabbTreeFunc  func,
+                gpointer            user_data)
+{
+  AabbNode *node = NODE (tree, index);
+
+  if (node_is_leaf (node))
+    func (node->data, user_data);
+  else
+    {
+      report_subtree (tree, node->child1, func, user_data);
+      report_subtree (tree, node->child2, func, user_data);
+    }
+}
+
+/* Calls func for every leaf whose box is (possibly) inside the
+ * frustum. Once a subtree is entirely inside no more planes are
+ * tested for it. */
+void
+gthree_aabb_tree_query_frustum (GthreeAabbTree           *tree,
+                                const graphene_frustum_t *frustum,
+                                GthreeAabbTreeFunc        func,
+                                gpointer                  user_data)
+{
+  graphene_plane_t planes[6];
+  float normals[6][3], constants[6];
+  int stack[128];
+  int stack_len = 0;
+  int i;
+
+  if (tree->root == NULL_NODE)
+    return;
+
+  graphene_frustum_get_planes (frustum, planes);
+  for (i = 0; i < 6; i++)
+    {
+      graphene_vec3_t n;
+
+      graphene_plane_get_normal (&planes[i], &n);
+      graphene_vec3_to_float (&n, normals[i]);
+      constants[i] = graphene_plane_get_constant (&planes[i]);
+    }
+
+  stack[stack_len++] = tree->root;
+  while (stack_len > 0)
+    {
+      int index = stack[--stack_len];
+      AabbNode *node = NODE (tree, index);
+      gboolean inside = TRUE;
+
+      for (i = 0; i < 6; i++)
+        {
+          const float *n = normals[i];
+          float far_dist, near_dist;
+
+          far_dist = constants[i] +
+            n[0] * (n[0] > 0 ? node->max[0] : node->min[0]) +
+            n[1] * (n[1] > 0 ? node->max[1] : node->min[1]) +
+            n[2] * (n[2] > 0 ? node->max[2] : node->min[2]);
+          if (far_dist < 0)
+            break;
+
+          near_dist = constants[i] +
+            n[0] * (n[0] > 0 ? node->min[0] : node->max[0]) +
+            n[1] * (n[1] > 0 ? node->min[1] : node->max[1]) +
+            n[2] * (n[2] > 0 ? node->min[2] : node->max[2]);
+          if (near_dist < 0)
+            inside = FALSE;
+        }
+
+      if (i < 6)
+        continue; /* Outside one of the planes */
+
+      if (inside || node_is_leaf (node))
+        report_subtree (tree, index, func, user_data);
+      else if ((guint) stack_len + 2 <= G_N_ELEMENTS (stack))
+        {
+          stack[stack_len++] = node->child1;
+          stack[stack_len++] = node->child2;
+        }
+      else
+        report_subtree (tree, index, func, user_data);
+    }
+}
+
+/* Calls func for every leaf whose box is hit by the ray */
+void
+gthree_aabb_tree_query_ray (GthreeAabbTree       *tree,
+                            const graphene_ray_t *ray,
+                            GthreeAabbTreeFunc    func,
+                            gpointer              user_data)
+{
+  graphene_point3d_t origin_p;
+  graphene_vec3_t dir_v;
+  float origin[3], dir[3], inv_dir[3];
+  int stack[128];
+  int stack_len = 0;
+  int i;
+
+  if (tree->root == NULL_NODE)
+    return;
+
+  graphene_ray_get_origin (ray, &origin_p);
+  graphene_ray_get_direction (ray, &dir_v);
+  origin[0] = origin_p.x;
+  origin[1] = origin_p.y;
+  origin[2] = origin_p.z;
+  graphene_vec3_to_float (&dir_v, dir);
+  for (i = 0; i < 3; i++)
+    inv_dir[i] = 1.0f / dir[i];
+
+  stack[stack_len++] = tree->root;
+  while (stack_len > 0)
+    {
+      int index = stack[--stack_len];
+      AabbNode *node = NODE (tree, index);
+      float tmin = 0, tmax = INFINITY;
+
+      for (i = 0; i < 3; i++)
+        {
+          float t1 = (node->min[i] - origin[i]) * inv_dir[i];
+          float t2 = (node->max[i] - origin[i]) * inv_dir[i];
+
+          tmin = fmaxf (tmin, fminf (t1, t2));
+          tmax = fminf (tmax, fmaxf (t1, t2));
+        }
+
+      if (tmin > tmax)
+        continue;
+
+      if (node_is_leaf (node))
+        func (node->data, user_data);
+      else if ((guint) stack_len + 2 <= G_N_ELEMENTS (stack))
+        {
+          stack[stack_len++] = node->child1;
+          stack[stack_len++] = node->child2;
+        }
+      else
+        report_subtree (tree, index, func, user_data);
+    }
+}
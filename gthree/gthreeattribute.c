@@ -10,18 +10,23 @@ struct _GthreeAttributeArray {
   GthreeAttributeType type;
   int stride; /* in nr of type items */
   int count;  /* in nr of stride items */
-  int version;
-  /* TODO: move this to per-array? it can be in different ranges when reusing arrays interleaved or stacked */
-  int update_range_offset;
-  int update_range_count;
+  int version; /* Bumped when the data is marked as changed */
+  /* Sorted, non-overlapping element ranges to upload. Empty when dirty means everything */
+  GArray *dirty_ranges;
   gboolean dynamic;
+  gboolean streaming;
 
   /* realized state */
 
   guint gl_buffer;
   gboolean dirty;
 
-  guint8 data[0];
+  /* Either inline_data, a heap copy, or borrowed from bytes until written to */
+  guint8 *data;
+  GBytes *bytes;
+  gpointer copied_data;
+
+  guint8 inline_data[0];
 };
 
 static gsize attribute_type_size[] = { 8, 4, 4, 4, 2, 2, 1, 1};
@@ -42,6 +47,16 @@ gthree_attribute_type_length (GthreeAttributeType type)
   return attribute_type_size[type];
 }
 
+/* 0xffff is kept free as it is the primitive restart index on some drivers.
+ * 8bit indices are not used, as they are emulated (slowly) on many GL implementations. */
+GthreeAttributeType
+gthree_attribute_type_for_index (guint64 n_vertices)
+{
+  if (n_vertices <= 0xffff)
+    return GTHREE_ATTRIBUTE_TYPE_UINT16;
+  return GTHREE_ATTRIBUTE_TYPE_UINT32;
+}
+
 GthreeAttributeArray *
 gthree_attribute_array_new   (GthreeAttributeType   type,
                               int                   count,
@@ -57,11 +72,73 @@ gthree_attribute_array_new   (GthreeAttributeType   type,
   array->type = type;
   array->count = count;
   array->stride = stride;
-  array->update_range_count = -1;
+  array->data = array->inline_data;
 
   return array;
 }
 
+/* Wraps count * stride elements at offset in bytes without copying
+ * them. The data is only copied if something asks for a writable
+ * pointer to it, so bytes can be backed by a read-only GMappedFile. */
+GthreeAttributeArray *
+gthree_attribute_array_new_from_bytes (GthreeAttributeType   type,
+                                       GBytes               *bytes,
+                                       gsize                 offset,
+                                       int                   count,
+                                       int                   stride)
+{
+  GthreeAttributeArray *array;
+  gsize size;
+  const guint8 *data;
+
+  g_assert (type < 8);
+
+  data = g_bytes_get_data (bytes, &size);
+  g_return_val_if_fail (offset + (gsize)count * stride * attribute_type_size[type] <= size, NULL);
+
+  array = g_new0 (GthreeAttributeArray, 1);
+  array->ref_count = 1;
+  array->type = type;
+  array->count = count;
+  array->stride = stride;
+  array->bytes = g_bytes_ref (bytes);
+  array->data = (guint8 *)data + offset;
+
+  return array;
+}
+
+static void
+gthree_attribute_array_ensure_writable (GthreeAttributeArray *array)
+{
+  gsize size;
+
+  if (array->bytes == NULL)
+    return;
+
+  size = gthree_attribute_array_get_len (array) * attribute_type_size[array->type];
+  array->copied_data = g_malloc (size);
+  memcpy (array->copied_data, array->data, size);
+  array->data = array->copied_data;
+  g_clear_pointer (&array->bytes, g_bytes_unref);
+}
+
+static inline gconstpointer
+gthree_attribute_array_read_at (GthreeAttributeArray *array,
+                                int                   index,
+                                int                   offset)
+{
+  int n = array->stride * index + offset;
+  g_assert (n < array->count * array->stride);
+
+  return array->data + n * attribute_type_size[array->type];
+}
+
+gboolean
+gthree_attribute_array_is_borrowed (GthreeAttributeArray *array)
+{
+  return array->bytes != NULL;
+}
+
 GthreeAttributeArray *
 gthree_attribute_array_new_from_float (float                *data,
                                        int                   count,
@@ -143,6 +220,11 @@ gthree_attribute_array_unref (GthreeAttributeArray *array)
   if (array->ref_count == 0)
     {
       g_assert (array->gl_buffer == 0);
+      if (array->bytes)
+        g_bytes_unref (array->bytes);
+      if (array->dirty_ranges)
+        g_array_unref (array->dirty_ranges);
+      g_free (array->copied_data);
       g_free (array);
     }
 }
@@ -171,54 +253,165 @@ gthree_attribute_array_get_stride (GthreeAttributeArray *array)
   return array->stride;
 }
 
+typedef struct {
+  int start;
+  int end;
+} DirtyRange;
+
+/* Uploading a small gap is cheaper than an extra glBufferSubData() call */
+#define DIRTY_RANGE_MERGE_GAP 64
+/* With more ranges than this we just upload everything */
+#define DIRTY_RANGE_MAX 32
+
+static int
+gthree_attribute_array_get_usage (GthreeAttributeArray *array)
+{
+  if (array->streaming)
+    return GL_STREAM_DRAW;
+  return array->dynamic ? GL_DYNAMIC_DRAW : GL_STATIC_DRAW;
+}
+
+static void
+gthree_attribute_array_clear_dirty (GthreeAttributeArray *array)
+{
+  array->dirty = FALSE;
+  if (array->dirty_ranges)
+    g_array_set_size (array->dirty_ranges, 0);
+}
+
+static void
+gthree_attribute_array_set_dirty (GthreeAttributeArray *array)
+{
+  array->version++;
+  array->dirty = TRUE;
+  if (array->dirty_ranges)
+    g_array_set_size (array->dirty_ranges, 0);
+}
+
+/* Marks the elements from start to end (exclusive) as needing upload,
+ * merging with any overlapping or nearby ranges */
+static void
+gthree_attribute_array_add_dirty_range (GthreeAttributeArray *array,
+                                        int                   start,
+                                        int                   end)
+{
+  DirtyRange range = { start, end };
+  DirtyRange *ranges;
+  guint i, j;
+
+  array->version++;
+
+  /* Already uploading everything */
+  if (array->dirty && (array->dirty_ranges == NULL || array->dirty_ranges->len == 0))
+    return;
+
+  if (array->dirty_ranges == NULL)
+    array->dirty_ranges = g_array_new (FALSE, FALSE, sizeof (DirtyRange));
+
+  array->dirty = TRUE;
+  ranges = (DirtyRange *)array->dirty_ranges->data;
+
+  i = 0;
+  while (i < array->dirty_ranges->len && ranges[i].end + DIRTY_RANGE_MERGE_GAP < start)
+    i++;
+
+  j = i;
+  while (j < array->dirty_ranges->len && ranges[j].start <= end + DIRTY_RANGE_MERGE_GAP)
+    {
+      range.start = MIN (range.start, ranges[j].start);
+      range.end = MAX (range.end, ranges[j].end);
+      j++;
+    }
+
+  g_array_remove_range (array->dirty_ranges, i, j - i);
+  g_array_insert_val (array->dirty_ranges, i, range);
+
+  if (array->dirty_ranges->len > DIRTY_RANGE_MAX)
+    g_array_set_size (array->dirty_ranges, 0);
+}
+
+static gint buffer_generation = 0;
+
+/* Changes whenever a buffer used by some attribute is deleted or
+ * swapped out, so cached vertex array objects can be revalidated */
+guint
+gthree_attribute_get_buffer_generation (void)
+{
+  return (guint) g_atomic_int_get (&buffer_generation);
+}
+
+/* Index buffers are uploaded through the copy target, as binding
+ * GL_ELEMENT_ARRAY_BUFFER would change the current vertex array object */
+static int
+get_upload_target (int buffer_type)
+{
+  if (buffer_type == GL_ELEMENT_ARRAY_BUFFER)
+    return GL_COPY_WRITE_BUFFER;
+  return buffer_type;
+}
+
 static void
 gthree_attribute_array_create_buffer (GthreeAttributeArray *array, int buffer_type)
 {
-  int usage = array->dynamic ? GL_DYNAMIC_DRAW : GL_STATIC_DRAW;
   int element_size = attribute_type_size[array->type];
 
+  buffer_type = get_upload_target (buffer_type);
+
   if (array->gl_buffer == 0)
     glGenBuffers (1, &array->gl_buffer);
 
   glBindBuffer (buffer_type, array->gl_buffer);
 
-  glBufferData (buffer_type, gthree_attribute_array_get_len (array) * element_size, &array->data[0], usage);
-  array->dirty = FALSE;
+  glBufferData (buffer_type, gthree_attribute_array_get_len (array) * element_size, array->data,
+                gthree_attribute_array_get_usage (array));
+  gthree_attribute_array_clear_dirty (array);
 }
 
 static void
 gthree_attribute_array_update_buffer (GthreeAttributeArray *array, int buffer_type)
 {
-  int usage = array->dynamic ? GL_DYNAMIC_DRAW : GL_STATIC_DRAW;
   int element_size = attribute_type_size[array->type];
+  gsize size = gthree_attribute_array_get_len (array) * element_size;
+  guint i;
 
+  buffer_type = get_upload_target (buffer_type);
   glBindBuffer (buffer_type, array->gl_buffer);
-  if (!array->dynamic)
+  if (array->streaming)
+    {
+      /* Respecifying the storage orphans the old one, so we never
+       * wait for the GPU to finish drawing from last frames data */
+      glBufferData (buffer_type, size, NULL, GL_STREAM_DRAW);
+      glBufferSubData (buffer_type, 0, size, array->data);
+    }
+  else if (array->dirty_ranges && array->dirty_ranges->len > 0)
     {
-      glBufferData (buffer_type, gthree_attribute_array_get_len (array) * element_size, &array->data[0], usage);
+      for (i = 0; i < array->dirty_ranges->len; i++)
+        {
+          DirtyRange *range = &g_array_index (array->dirty_ranges, DirtyRange, i);
+
+          glBufferSubData (buffer_type, range->start * element_size,
+                           (range->end - range->start) * element_size,
+                           array->data + range->start * element_size);
+        }
     }
-  else if (array->update_range_count == -1)
+  else if (!array->dynamic)
     {
-      // Not using update ranges
-      glBufferSubData (buffer_type, 0,
-                       gthree_attribute_array_get_len (array) * element_size, &array->data[0]);
+      glBufferData (buffer_type, size, array->data, GL_STATIC_DRAW);
     }
   else
     {
-      glBufferSubData (buffer_type, array->update_range_offset * element_size,
-                       array->update_range_count * element_size,
-                       ((guint8 *)&array->data[0]) + array->update_range_offset * element_size);
-      array->update_range_count = -1; // reset range
+      glBufferSubData (buffer_type, 0, size, array->data);
     }
 
-  array->dirty = FALSE;
+  gthree_attribute_array_clear_dirty (array);
 }
 
 guint8 *
 gthree_attribute_array_peek_uint8 (GthreeAttributeArray *array)
 {
   g_assert (array->type == GTHREE_ATTRIBUTE_TYPE_UINT8 || GTHREE_ATTRIBUTE_TYPE_INT8);
-  return (guint8*)&array->data[0];
+  gthree_attribute_array_ensure_writable (array);
+  return (guint8*)array->data;
 }
 
 guint8 *
@@ -236,7 +429,8 @@ gint8 *
 gthree_attribute_array_peek_int8 (GthreeAttributeArray *array)
 {
   g_assert (array->type == GTHREE_ATTRIBUTE_TYPE_UINT8 || GTHREE_ATTRIBUTE_TYPE_INT8);
-  return (gint8*)&array->data[0];
+  gthree_attribute_array_ensure_writable (array);
+  return (gint8*)array->data;
 }
 
 gint8 *
@@ -254,7 +448,8 @@ gint16 *
 gthree_attribute_array_peek_int16 (GthreeAttributeArray *array)
 {
   g_assert (array->type == GTHREE_ATTRIBUTE_TYPE_UINT16 || GTHREE_ATTRIBUTE_TYPE_INT16);
-  return (gint16*)&array->data[0];
+  gthree_attribute_array_ensure_writable (array);
+  return (gint16*)array->data;
 }
 
 gint16 *
@@ -272,7 +467,8 @@ guint16 *
 gthree_attribute_array_peek_uint16 (GthreeAttributeArray *array)
 {
   g_assert (array->type == GTHREE_ATTRIBUTE_TYPE_UINT16 || GTHREE_ATTRIBUTE_TYPE_INT16);
-  return (guint16*)&array->data[0];
+  gthree_attribute_array_ensure_writable (array);
+  return (guint16*)array->data;
 }
 
 guint16 *
@@ -290,7 +486,8 @@ gint32 *
 gthree_attribute_array_peek_int32 (GthreeAttributeArray *array)
 {
   g_assert (array->type == GTHREE_ATTRIBUTE_TYPE_UINT32 || GTHREE_ATTRIBUTE_TYPE_INT32);
-  return (gint32*)&array->data[0];
+  gthree_attribute_array_ensure_writable (array);
+  return (gint32*)array->data;
 }
 
 gint32 *
@@ -308,7 +505,8 @@ guint32 *
 gthree_attribute_array_peek_uint32 (GthreeAttributeArray *array)
 {
   g_assert (array->type == GTHREE_ATTRIBUTE_TYPE_UINT32 || GTHREE_ATTRIBUTE_TYPE_INT32);
-  return (guint32*)&array->data[0];
+  gthree_attribute_array_ensure_writable (array);
+  return (guint32*)array->data;
 }
 
 guint32 *
@@ -326,14 +524,16 @@ float *
 gthree_attribute_array_peek_float (GthreeAttributeArray *array)
 {
   g_assert (array->type == GTHREE_ATTRIBUTE_TYPE_FLOAT);
-  return (float*)&array->data[0];
+  gthree_attribute_array_ensure_writable (array);
+  return (float*)array->data;
 }
 
 graphene_point3d_t *
 gthree_attribute_array_peek_point3d   (GthreeAttributeArray *array)
 {
   g_assert (array->type == GTHREE_ATTRIBUTE_TYPE_FLOAT);
-  return (graphene_point3d_t*)&array->data[0];
+  gthree_attribute_array_ensure_writable (array);
+  return (graphene_point3d_t*)array->data;
 }
 
 graphene_point3d_t *
@@ -360,14 +560,16 @@ gthree_attribute_array_get_float_at (GthreeAttributeArray *array,
                                      int                   index,
                                      int                   offset)
 {
-  return *gthree_attribute_array_peek_float_at (array, index, offset);
+  g_assert (array->type == GTHREE_ATTRIBUTE_TYPE_FLOAT);
+  return *(const float *)gthree_attribute_array_read_at (array, index, offset);
 }
 
 double *
 gthree_attribute_array_peek_double (GthreeAttributeArray *array)
 {
   g_assert (array->type == GTHREE_ATTRIBUTE_TYPE_DOUBLE);
-  return (double*)&array->data[0];
+  gthree_attribute_array_ensure_writable (array);
+  return (double*)array->data;
 }
 
 double *
@@ -456,7 +658,7 @@ gthree_attribute_array_get_xyz (GthreeAttributeArray *array,
                                 float                *y,
                                 float                *z)
 {
-  float *p = gthree_attribute_array_peek_float_at (array, index, offset);
+  const float *p = gthree_attribute_array_read_at (array, index, offset);
   *x = p[0];
   *y = p[1];
   *z = p[2];
@@ -487,7 +689,7 @@ gthree_attribute_array_get_xyzw (GthreeAttributeArray *array,
                                  float                *z,
                                  float                *w)
 {
-  float *p = gthree_attribute_array_peek_float_at (array, index, offset);
+  const float *p = gthree_attribute_array_read_at (array, index, offset);
   *x = p[0];
   *y = p[1];
   *z = p[2];
@@ -559,7 +761,7 @@ gthree_attribute_array_get_matrix (GthreeAttributeArray *array,
                                    guint                 offset,
                                    graphene_matrix_t    *matrix)
 {
-  float *p = gthree_attribute_array_peek_float_at (array, index, offset);
+  const float *p = gthree_attribute_array_read_at (array, index, offset);
   graphene_matrix_init_from_float (matrix, p);
 }
 
@@ -578,7 +780,7 @@ gthree_attribute_array_get_uint8 (GthreeAttributeArray *array,
                                   guint                 index,
                                   guint                 offset)
 {
-  guint8 *p = gthree_attribute_array_peek_uint8_at (array, index, offset);
+  const guint8 *p = gthree_attribute_array_read_at (array, index, offset);
   return *p;
 }
 
@@ -597,7 +799,7 @@ gthree_attribute_array_get_uint16 (GthreeAttributeArray *array,
                                    guint                 index,
                                    guint                 offset)
 {
-  guint16 *p = gthree_attribute_array_peek_uint16_at (array, index, offset);
+  const guint16 *p = gthree_attribute_array_read_at (array, index, offset);
   return *p;
 }
 
@@ -616,7 +818,7 @@ gthree_attribute_array_get_uint32 (GthreeAttributeArray *array,
                                   guint                 index,
                                   guint                 offset)
 {
-  guint32 *p = gthree_attribute_array_peek_uint32_at (array, index, offset);
+  const guint32 *p = gthree_attribute_array_read_at (array, index, offset);
   return *p;
 }
 
@@ -655,7 +857,7 @@ gthree_attribute_array_get_point3d (GthreeAttributeArray *array,
 {
   g_assert (array->type == GTHREE_ATTRIBUTE_TYPE_FLOAT);
 
-  *point = *(graphene_point3d_t *)gthree_attribute_array_peek_float_at (array, index, offset);
+  *point = *(const graphene_point3d_t *)gthree_attribute_array_read_at (array, index, offset);
 }
 
 void
@@ -671,56 +873,56 @@ gthree_attribute_array_get_elements_as_float (GthreeAttributeArray *array,
     {
     case GTHREE_ATTRIBUTE_TYPE_FLOAT:
       {
-        float *floats = gthree_attribute_array_peek_float_at (array, index, offset);
+        const float *floats = gthree_attribute_array_read_at (array, index, offset);
         for (i = 0; i < n_elements; i++)
           dest[i] = floats[i];
         break;
       }
     case GTHREE_ATTRIBUTE_TYPE_DOUBLE:
       {
-        double *values = gthree_attribute_array_peek_double_at (array, index, offset);
+        const double *values = gthree_attribute_array_read_at (array, index, offset);
         for (i = 0; i < n_elements; i++)
           dest[i] = (float)values[i];
         break;
       }
     case GTHREE_ATTRIBUTE_TYPE_UINT32:
       {
-        guint32 *values = gthree_attribute_array_peek_uint32_at (array, index, offset);
+        const guint32 *values = gthree_attribute_array_read_at (array, index, offset);
         for (i = 0; i < n_elements; i++)
           dest[i] = (float)values[i];
         break;
       }
     case GTHREE_ATTRIBUTE_TYPE_INT32:
       {
-        gint32 *values = gthree_attribute_array_peek_int32_at (array, index, offset);
+        const gint32 *values = gthree_attribute_array_read_at (array, index, offset);
         for (i = 0; i < n_elements; i++)
           dest[i] = (float)values[i];
         break;
       }
     case GTHREE_ATTRIBUTE_TYPE_UINT16:
       {
-        guint16 *values = gthree_attribute_array_peek_uint16_at (array, index, offset);
+        const guint16 *values = gthree_attribute_array_read_at (array, index, offset);
         for (i = 0; i < n_elements; i++)
           dest[i] = (float)values[i];
         break;
       }
     case GTHREE_ATTRIBUTE_TYPE_INT16:
       {
-        gint16 *values = gthree_attribute_array_peek_int16_at (array, index, offset);
+        const gint16 *values = gthree_attribute_array_read_at (array, index, offset);
         for (i = 0; i < n_elements; i++)
           dest[i] = (float)values[i];
         break;
       }
     case GTHREE_ATTRIBUTE_TYPE_UINT8:
       {
-        guint8 *values = gthree_attribute_array_peek_uint8_at (array, index, offset);
+        const guint8 *values = gthree_attribute_array_read_at (array, index, offset);
         for (i = 0; i < n_elements; i++)
           dest[i] = (float)values[i];
         break;
       }
     case GTHREE_ATTRIBUTE_TYPE_INT8:
       {
-        gint8 *values = gthree_attribute_array_peek_int8_at (array, index, offset);
+        const gint8 *values = gthree_attribute_array_read_at (array, index, offset);
         for (i = 0; i < n_elements; i++)
           dest[i] = (float)values[i];
         break;
@@ -817,7 +1019,8 @@ gthree_attribute_array_copy_raw (GthreeAttributeArray *array,
 
   source_stride_bytes = element_size * source_stride;
   dst_stride_bytes = element_size * array->stride;
-  dst = (guint8*)&array->data[0] + index * dst_stride_bytes + offset * element_size;
+  gthree_attribute_array_ensure_writable (array);
+  dst = array->data + index * dst_stride_bytes + offset * element_size;
 
   src = (guint8*)source;
 
@@ -851,7 +1054,7 @@ gthree_attribute_array_copy_at (GthreeAttributeArray *array,
 
   g_assert (attribute_type_size[array->type] == attribute_type_size[source->type]);
 
-  src = (guint8*)&source->data[0] +  attribute_type_size[source->type] * (source_index * source->stride + source_offset);
+  src = source->data + attribute_type_size[source->type] * (source_index * source->stride + source_offset);
   src_stride = source->stride;
   gthree_attribute_array_copy_raw (array, index, offset,
                                    src, src_stride,
@@ -920,6 +1123,7 @@ struct _GthreeAttribute {
   int item_size;    /* typically same as array->stride, but not of interleaved */
   int item_offset;  /* typically 0, but not if interleaved or stacked */
   int count;        /* May be smaller than the entire array if stacking */
+  int divisor;      /* 0 for per-vertex data, otherwise nr of instances per item */
   gboolean normalized;
 };
 
@@ -1004,6 +1208,7 @@ gthree_attribute_copy (const char           *name,
                                                            source->item_size,
                                                            source->item_offset,
                                                            source->count);
+  attribute->divisor = source->divisor;
 
   gthree_attribute_array_unref (array);
 
@@ -1126,7 +1331,34 @@ gthree_attribute_get_array (GthreeAttribute *attribute)
 void
 gthree_attribute_set_needs_update (GthreeAttribute *attribute)
 {
-  attribute->array->dirty = TRUE;
+  gthree_attribute_array_set_dirty (attribute->array);
+}
+
+/**
+ * gthree_attribute_set_needs_update_range:
+ * @attribute: a #GthreeAttribute
+ * @index: the first item that changed
+ * @count: the number of items that changed
+ *
+ * Like gthree_attribute_set_needs_update(), but only the given items
+ * are uploaded. Ranges from several calls are collected until the next
+ * upload, with overlapping and nearby ranges merged.
+ */
+void
+gthree_attribute_set_needs_update_range (GthreeAttribute *attribute,
+                                         int              index,
+                                         int              count)
+{
+  GthreeAttributeArray *array = attribute->array;
+
+  g_return_if_fail (index >= 0 && count >= 0 && index + count <= attribute->count);
+
+  if (count == 0)
+    return;
+
+  gthree_attribute_array_add_dirty_range (array,
+                                          index * array->stride + attribute->item_offset,
+                                          (index + count - 1) * array->stride + attribute->item_offset + attribute->item_size);
 }
 
 void
@@ -1138,6 +1370,7 @@ gthree_attribute_set_array (GthreeAttribute      *attribute,
   if (attribute->array)
     gthree_attribute_array_unref (attribute->array);
   attribute->array = array;
+  g_atomic_int_inc (&buffer_generation);
 }
 
 int
@@ -1190,6 +1423,34 @@ gthree_attribute_set_dynamic (GthreeAttribute *attribute,
   attribute->array->dynamic = !!dynamic;
 }
 
+gboolean
+gthree_attribute_get_streaming (GthreeAttribute *attribute)
+{
+  return attribute->array->streaming;
+}
+
+/* For data that is rewritten every frame. Each upload replaces the
+ * whole buffer storage instead of updating it in place. */
+void
+gthree_attribute_set_streaming (GthreeAttribute *attribute,
+                                gboolean         streaming)
+{
+  attribute->array->streaming = !!streaming;
+}
+
+int
+gthree_attribute_get_divisor (GthreeAttribute *attribute)
+{
+  return attribute->divisor;
+}
+
+void
+gthree_attribute_set_divisor (GthreeAttribute *attribute,
+                              int              divisor)
+{
+  attribute->divisor = divisor;
+}
+
 void
 gthree_attribute_copy_at (GthreeAttribute      *attribute,
                           guint                 index,
@@ -1212,6 +1473,7 @@ gthree_attribute_real_unrealize (GthreeResource *resource)
     {
       gthree_resource_lazy_delete (resource, GTHREE_RESOURCE_KIND_BUFFER, array->gl_buffer);
       array->gl_buffer = 0;
+      g_atomic_int_inc (&buffer_generation);
     }
 }
 
@@ -1325,6 +1587,37 @@ gthree_attribute_peek_float (GthreeAttribute *attribute)
   return NULL;
 }
 
+/* Like peek_float, but doesn't force a copy of borrowed data */
+const float *
+gthree_attribute_read_float (GthreeAttribute *attribute)
+{
+  if (attribute->array)
+    {
+      g_assert (attribute->array->type == GTHREE_ATTRIBUTE_TYPE_FLOAT);
+      return gthree_attribute_array_read_at (attribute->array, 0, attribute->item_offset);
+    }
+  return NULL;
+}
+
+/* Changes whenever the data of the attribute is marked as changed */
+guint
+gthree_attribute_get_version (GthreeAttribute *attribute)
+{
+  return attribute->array ? attribute->array->version : 0;
+}
+
+/* Like peek_uint32, but doesn't force a copy of borrowed data */
+const guint32 *
+gthree_attribute_read_uint32 (GthreeAttribute *attribute)
+{
+  if (attribute->array)
+    {
+      g_assert (attribute->array->type == GTHREE_ATTRIBUTE_TYPE_UINT32);
+      return gthree_attribute_array_read_at (attribute->array, 0, attribute->item_offset);
+    }
+  return NULL;
+}
+
 float *
 gthree_attribute_peek_float_at (GthreeAttribute *attribute,
                                 int              index)
@@ -33,6 +33,14 @@ GthreeAttributeArray *gthree_attribute_array_new_from_uint32    (guint32
                                                                  int                   count,
                                                                  int                   item_size);
 GTHREE_API
+GthreeAttributeArray *gthree_attribute_array_new_from_bytes     (GthreeAttributeType   type,
+                                                                 GBytes               *bytes,
+                                                                 gsize                 offset,
+                                                                 int                   count,
+                                                                 int                   stride);
+GTHREE_API
+gboolean              gthree_attribute_array_is_borrowed        (GthreeAttributeArray *array);
+GTHREE_API
 GthreeAttributeArray *gthree_attribute_array_reshape (GthreeAttributeArray *array,
                                                       guint                 index,
                                                       guint                 offset,
@@ -345,6 +353,10 @@ void                  gthree_attribute_set_array          (GthreeAttribute
 GTHREE_API
 void                  gthree_attribute_set_needs_update   (GthreeAttribute      *attribute);
 GTHREE_API
+void                  gthree_attribute_set_needs_update_range (GthreeAttribute  *attribute,
+                                                               int               index,
+                                                               int               count);
+GTHREE_API
 int                   gthree_attribute_get_count          (GthreeAttribute      *attribute);
 GTHREE_API
 GthreeAttributeType   gthree_attribute_get_attribute_type (GthreeAttribute      *attribute);
@@ -362,6 +374,16 @@ GTHREE_API
 void                  gthree_attribute_set_dynamic        (GthreeAttribute      *attribute,
                                                            gboolean              dynamic);
 GTHREE_API
+gboolean              gthree_attribute_get_streaming      (GthreeAttribute      *attribute);
+GTHREE_API
+void                  gthree_attribute_set_streaming      (GthreeAttribute      *attribute,
+                                                           gboolean              streaming);
+GTHREE_API
+int                   gthree_attribute_get_divisor        (GthreeAttribute      *attribute);
+GTHREE_API
+void                  gthree_attribute_set_divisor        (GthreeAttribute      *attribute,
+                                                           int                   divisor);
+GTHREE_API
 void                  gthree_attribute_copy_at            (GthreeAttribute      *attribute,
                                                            guint                 index,
                                                            GthreeAttribute      *source,
@@ -0,0 +1,588 @@
+#include <math.h>
+#include <string.h>
+
+#include "gthreegeometry.h"
+#include "gthreeattribute.h"
+#include "gthreeprivate.h"
+
+/* Bounding volume hierarchy over the triangles of a geometry. Nodes are
+ * stored depth first, so the left child of an interior node is always
+ * the next node, and right_or_first points at the right child. For
+ * leaves it is the index of the first face in the faces array. */
+
+#define BVH_LEAF_SIZE 4
+#define BVH_MAX_LEAF_SIZE 32
+#define BVH_MAX_DEPTH 64
+#define BVH_N_BINS 16
+#define BVH_TRAVERSAL_COST 1.0f
+
+typedef struct {
+  float min[3];
+  float max[3];
+  guint32 right_or_first;
+  guint32 count; /* 0 for interior nodes */
+} BvhNode;
+
+struct _GthreeBvh {
+  GArray *nodes;
+  guint32 *faces;
+  guint n_faces;
+};
+
+typedef struct {
+  float min[3];
+  float max[3];
+} Bounds;
+
+typedef struct {
+  GthreeBvh *bvh;
+  Bounds *face_bounds;
+  float *centroids;
+} BvhBuilder;
+
+static inline void
+bounds_init_empty (Bounds *b)
+{
+  b->min[0] = b->min[1] = b->min[2] = INFINITY;
+  b->max[0] = b->max[1] = b->max[2] = -INFINITY;
+}
+
+static inline void
+bounds_union (Bounds *b, const Bounds *other)
+{
+  for (int i = 0; i < 3; i++)
+    {
+      b->min[i] = fminf (b->min[i], other->min[i]);
+      b->max[i] = fmaxf (b->max[i], other->max[i]);
+    }
+}
+
+static inline void
+bounds_add_point (Bounds *b, const float *p)
+{
+  for (int i = 0; i < 3; i++)
+    {
+      b->min[i] = fminf (b->min[i], p[i]);
+      b->max[i] = fmaxf (b->max[i], p[i]);
+    }
+}
+
+static inline float
+bounds_half_area (const Bounds *b)
+{
+  float dx = b->max[0] - b->min[0];
+  float dy = b->max[1] - b->min[1];
+  float dz = b->max[2] - b->min[2];
+
+  if (dx < 0 || dy < 0 || dz < 0)
+    return 0;
+
+  return dx * dy + dy * dz + dz * dx;
+}
+
+static inline guint
+get_vertex_index (GthreeAttribute *index,
+                  guint            i)
+{
+  if (index)
+    return gthree_attribute_get_uint (index, i);
+  return i;
+}
+
+static guint
+get_n_faces (GthreeGeometry *geometry)
+{
+  GthreeAttribute *index = gthree_geometry_get_index (geometry);
+
+  if (index)
+    return gthree_attribute_get_count (index) / 3;
+
+  return gthree_geometry_get_position_count (geometry) / 3;
+}
+
+static void
+make_leaf (BvhNode *node, guint start, guint count)
+{
+  node->right_or_first = start;
+  node->count = count;
+}
+
+static void
+build_node (BvhBuilder *builder,
+            guint       node_index,
+            guint       start,
+            guint       count,
+            int         depth)
+{
+  GthreeBvh *bvh = builder->bvh;
+  guint32 *faces = bvh->faces + start;
+  Bounds bounds, centroid_bounds;
+  Bounds bin_bounds[BVH_N_BINS];
+  guint bin_count[BVH_N_BINS];
+  float left_area[BVH_N_BINS];
+  guint left_count[BVH_N_BINS];
+  float best_cost, leaf_cost;
+  int best_axis = -1, best_split = -1;
+  guint i, mid;
+  int axis, b;
+  BvhNode *node;
+
+  bounds_init_empty (&bounds);
+  bounds_init_empty (&centroid_bounds);
+  for (i = 0; i < count; i++)
+    {
+      bounds_union (&bounds, &builder->face_bounds[faces[i]]);
+      bounds_add_point (&centroid_bounds, &builder->centroids[faces[i] * 3]);
+    }
+
+  node = &g_array_index (bvh->nodes, BvhNode, node_index);
+  memcpy (node->min, bounds.min, sizeof (node->min));
+  memcpy (node->max, bounds.max, sizeof (node->max));
+
+  if (count <= BVH_LEAF_SIZE || depth >= BVH_MAX_DEPTH - 1)
+    {
+      make_leaf (node, start, count);
+      return;
+    }
+
+  /* Binned SAH, cost relative to the node surface area */
+  leaf_cost = count;
+  best_cost = INFINITY;
+
+  for (axis = 0; axis < 3; axis++)
+    {
+      float cmin = centroid_bounds.min[axis];
+      float extent = centroid_bounds.max[axis] - cmin;
+      float scale, node_area = bounds_half_area (&bounds);
+      Bounds acc;
+      guint acc_count;
+
+      if (extent <= 0 || node_area <= 0)
+        continue;
+
+      scale = BVH_N_BINS / extent;
+
+      for (b = 0; b < BVH_N_BINS; b++)
+        {
+          bounds_init_empty (&bin_bounds[b]);
+          bin_count[b] = 0;
+        }
+
+      for (i = 0; i < count; i++)
+        {
+          b = MIN ((int)((builder->centroids[faces[i] * 3 + axis] - cmin) * scale), BVH_N_BINS - 1);
+          bin_count[b]++;
+          bounds_union (&bin_bounds[b], &builder->face_bounds[faces[i]]);
+        }
+
+      bounds_init_empty (&acc);
+      acc_count = 0;
+      for (b = 0; b < BVH_N_BINS - 1; b++)
+        {
+          bounds_union (&acc, &bin_bounds[b]);
+          acc_count += bin_count[b];
+          left_area[b] = bounds_half_area (&acc);
+          left_count[b] = acc_count;
+        }
+
+      bounds_init_empty (&acc);
+      acc_count = 0;
+      for (b = BVH_N_BINS - 1; b > 0; b--)
+        {
+          float cost;
+
+          bounds_union (&acc, &bin_bounds[b]);
+          acc_count += bin_count[b];
+
+          if (left_count[b - 1] == 0 || acc_count == 0)
+            continue;
+
+          cost = BVH_TRAVERSAL_COST +
+            (left_area[b - 1] * left_count[b - 1] + bounds_half_area (&acc) * acc_count) / node_area;
+          if (cost < best_cost)
+            {
+              best_cost = cost;
+              best_axis = axis;
+              best_split = b;
+            }
+        }
+    }
+
+  if (best_axis < 0 ||
+      (best_cost >= leaf_cost && count <= BVH_MAX_LEAF_SIZE))
+    {
+      make_leaf (node, start, count);
+      return;
+    }
+
+  /* Partition the faces around the chosen bin boundary */
+  {
+    float cmin = centroid_bounds.min[best_axis];
+    float scale = BVH_N_BINS / (centroid_bounds.max[best_axis] - cmin);
+    guint lo = 0, hi = count;
+
+    while (lo < hi)
+      {
+        b = MIN ((int)((builder->centroids[faces[lo] * 3 + best_axis] - cmin) * scale), BVH_N_BINS - 1);
+        if (b < best_split)
+          lo++;
+        else
+          {
+            guint32 tmp = faces[lo];
+            faces[lo] = faces[--hi];
+            faces[hi] = tmp;
+          }
+      }
+    mid = lo;
+  }
+
+  g_array_set_size (bvh->nodes, bvh->nodes->len + 1);
+  build_node (builder, node_index + 1, start, mid, depth + 1);
+
+  g_array_set_size (bvh->nodes, bvh->nodes->len + 1);
+  /* The array may have been reallocated by the left subtree */
+  node = &g_array_index (bvh->nodes, BvhNode, node_index);
+  node->right_or_first = bvh->nodes->len - 1;
+  node->count = 0;
+  build_node (builder, node->right_or_first, start + mid, count - mid, depth + 1);
+}
+
+GthreeBvh *
+gthree_bvh_new (GthreeGeometry *geometry)
+{
+  GthreeAttribute *position = gthree_geometry_get_position (geometry);
+  GthreeAttribute *index = gthree_geometry_get_index (geometry);
+  BvhBuilder builder;
+  GthreeBvh *bvh;
+  const float *positions;
+  int stride;
+  guint f;
+
+  bvh = g_new0 (GthreeBvh, 1);
+  bvh->nodes = g_array_new (FALSE, FALSE, sizeof (BvhNode));
+
+  if (position == NULL ||
+      gthree_attribute_get_attribute_type (position) != GTHREE_ATTRIBUTE_TYPE_FLOAT)
+    return bvh;
+
+  bvh->n_faces = get_n_faces (geometry);
+  if (bvh->n_faces == 0)
+    return bvh;
+
+  positions = gthree_attribute_read_float (position);
+  stride = gthree_attribute_get_stride (position);
+
+  bvh->faces = g_new (guint32, bvh->n_faces);
+  builder.bvh = bvh;
+  builder.face_bounds = g_new (Bounds, bvh->n_faces);
+  builder.centroids = g_new (float, bvh->n_faces * 3);
+
+  for (f = 0; f < bvh->n_faces; f++)
+    {
+      Bounds *fb = &builder.face_bounds[f];
+      int k;
+
+      bounds_init_empty (fb);
+      for (k = 0; k < 3; k++)
+        bounds_add_point (fb, positions + get_vertex_index (index, f * 3 + k) * stride);
+
+      for (k = 0; k < 3; k++)
+        builder.centroids[f * 3 + k] = (fb->min[k] + fb->max[k]) * 0.5f;
+
+      bvh->faces[f] = f;
+    }
+
+  g_array_set_size (bvh->nodes, 1);
+  build_node (&builder, 0, 0, bvh->n_faces, 0);
+
+  g_free (builder.face_bounds);
+  g_free (builder.centroids);
+
+  return bvh;
+}
+
+void
+gthree_bvh_free (GthreeBvh *bvh)
+{
+  g_array_unref (bvh->nodes);
+  g_free (bvh->faces);
+  g_free (bvh);
+}
+
+static inline gboolean
+ray_hits_node (const BvhNode *node,
+               const float   *origin,
+               const float   *inv_dir)
+{
+  float tmin = 0, tmax = INFINITY;
+  int i;
+
+  for (i = 0; i < 3; i++)
+    {
+      float t1 = (node->min[i] - origin[i]) * inv_dir[i];
+      float t2 = (node->max[i] - origin[i]) * inv_dir[i];
+
+      tmin = fmaxf (tmin, fminf (t1, t2));
+      tmax = fminf (tmax, fmaxf (t1, t2));
+    }
+
+  return tmin <= tmax;
+}
+
+/* Möller–Trumbore, with the culling done the same way as three.js */
+static inline gboolean
+ray_hits_triangle (const float *origin,
+                   const float *dir,
+                   const float *a,
+                   const float *b,
+                   const float *c,
+                   GthreeSide   side,
+                   GthreeBvhHit *hit)
+{
+  float e1[3], e2[3], p[3], s[3], q[3];
+  float det, inv_det, u, v, t;
+
+  e1[0] = b[0] - a[0]; e1[1] = b[1] - a[1]; e1[2] = b[2] - a[2];
+  e2[0] = c[0] - a[0]; e2[1] = c[1] - a[1]; e2[2] = c[2] - a[2];
+
+  p[0] = dir[1] * e2[2] - dir[2] * e2[1];
+  p[1] = dir[2] * e2[0] - dir[0] * e2[2];
+  p[2] = dir[0] * e2[1] - dir[1] * e2[0];
+
+  /* det > 0 means we're looking at the front (counter-clockwise) side */
+  det = e1[0] * p[0] + e1[1] * p[1] + e1[2] * p[2];
+  if (side == GTHREE_SIDE_FRONT && det <= 0)
+    return FALSE;
+  if (side == GTHREE_SIDE_BACK && det >= 0)
+    return FALSE;
+  if (det == 0)
+    return FALSE;
+
+  inv_det = 1.0f / det;
+
+  s[0] = origin[0] - a[0]; s[1] = origin[1] - a[1]; s[2] = origin[2] - a[2];
+  u = (s[0] * p[0] + s[1] * p[1] + s[2] * p[2]) * inv_det;
+  if (u < 0 || u > 1)
+    return FALSE;
+
+  q[0] = s[1] * e1[2] - s[2] * e1[1];
+  q[1] = s[2] * e1[0] - s[0] * e1[2];
+  q[2] = s[0] * e1[1] - s[1] * e1[0];
+  v = (dir[0] * q[0] + dir[1] * q[1] + dir[2] * q[2]) * inv_det;
+  if (v < 0 || u + v > 1)
+    return FALSE;
+
+  t = (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]) * inv_det;
+  if (t < 0)
+    return FALSE;
+
+  hit->t = t;
+  hit->u = u;
+  hit->v = v;
+
+  return TRUE;
+}
+
+/* Appends a GthreeBvhHit for each triangle hit by the (object space)
+ * ray. Only faces inside [first_face, first_face + n_faces) count. */
+void
+gthree_bvh_raycast (GthreeBvh            *bvh,
+                    GthreeGeometry       *geometry,
+                    const graphene_ray_t *ray,
+                    GthreeSide            side,
+                    guint                 first_face,
+                    guint                 n_faces,
+                    GArray               *hits)
+{
+  GthreeAttribute *position = gthree_geometry_get_position (geometry);
+  GthreeAttribute *index = gthree_geometry_get_index (geometry);
+  guint stack[BVH_MAX_DEPTH + 1];
+  guint stack_len = 0;
+  graphene_vec3_t origin_v, dir_v;
+  float origin[3], dir[3], inv_dir[3];
+  const float *positions;
+  int stride, i;
+
+  if (bvh->nodes->len == 0)
+    return;
+
+  positions = gthree_attribute_read_float (position);
+  stride = gthree_attribute_get_stride (position);
+
+  graphene_ray_get_origin_vec3 (ray, &origin_v);
+  graphene_ray_get_direction (ray, &dir_v);
+  graphene_vec3_to_float (&origin_v, origin);
+  graphene_vec3_to_float (&dir_v, dir);
+  for (i = 0; i < 3; i++)
+    inv_dir[i] = 1.0f / dir[i];
+
+  stack[stack_len++] = 0;
+  while (stack_len > 0)
+    {
+      const BvhNode *node = &g_array_index (bvh->nodes, BvhNode, stack[--stack_len]);
+
+      if (!ray_hits_node (node, origin, inv_dir))
+        continue;
+
+      if (node->count == 0)
+        {
+          guint node_index = node - (BvhNode *)bvh->nodes->data;
+
+          stack[stack_len++] = node->right_or_first;
+          stack[stack_len++] = node_index + 1;
+          continue;
+        }
+
+      for (i = 0; i < node->count; i++)
+        {
+          guint32 f = bvh->faces[node->right_or_first + i];
+          GthreeBvhHit hit;
+
+          if (f < first_face || f - first_face >= n_faces)
+            continue;
+
+          if (ray_hits_triangle (origin, dir,
+                                 positions + get_vertex_index (index, f * 3 + 0) * stride,
+                                 positions + get_vertex_index (index, f * 3 + 1) * stride,
+                                 positions + get_vertex_index (index, f * 3 + 2) * stride,
+                                 side, &hit))
+            {
+              hit.face_index = f;
+              g_array_append_val (hits, hit);
+            }
+        }
+    }
+}
+
+static inline gboolean
+ray_enters_node (const BvhNode *node,
+                 const float   *origin,
+                 const float   *inv_dir,
+                 float          max_t,
+                 float         *entry_t)
+{
+  float tmin = 0, tmax = max_t;
+  int i;
+
+  for (i = 0; i < 3; i++)
+    {
+      float t1 = (node->min[i] - origin[i]) * inv_dir[i];
+      float t2 = (node->max[i] - origin[i]) * inv_dir[i];
+
+      tmin = fmaxf (tmin, fminf (t1, t2));
+      tmax = fminf (tmax, fmaxf (t1, t2));
+    }
+
+  *entry_t = tmin;
+  return tmin <= tmax;
+}
+
+/* Like gthree_bvh_raycast(), but only finds the closest hit with t in
+ * [min_t, max_t]. Children are visited front to back and the search
+ * interval shrinks with each hit, so most of the tree is skipped. This
+ * only reads from the bvh and geometry, so it is safe to call from
+ * several threads at once as long as nobody modifies them. */
+gboolean
+gthree_bvh_raycast_nearest (GthreeBvh            *bvh,
+                            GthreeGeometry       *geometry,
+                            const graphene_ray_t *ray,
+                            GthreeSide            side,
+                            guint                 first_face,
+                            guint                 n_faces,
+                            float                 min_t,
+                            float                 max_t,
+                            GthreeBvhHit         *nearest)
+{
+  GthreeAttribute *position = gthree_geometry_get_position (geometry);
+  GthreeAttribute *index = gthree_geometry_get_index (geometry);
+  guint stack[BVH_MAX_DEPTH + 1];
+  guint stack_len = 0;
+  graphene_vec3_t origin_v, dir_v;
+  float origin[3], dir[3], inv_dir[3];
+  const float *positions;
+  gboolean found = FALSE;
+  float entry_t;
+  int stride, i;
+
+  if (bvh->nodes->len == 0)
+    return FALSE;
+
+  positions = gthree_attribute_read_float (position);
+  stride = gthree_attribute_get_stride (position);
+
+  graphene_ray_get_origin_vec3 (ray, &origin_v);
+  graphene_ray_get_direction (ray, &dir_v);
+  graphene_vec3_to_float (&origin_v, origin);
+  graphene_vec3_to_float (&dir_v, dir);
+  for (i = 0; i < 3; i++)
+    inv_dir[i] = 1.0f / dir[i];
+
+  if (!ray_enters_node (&g_array_index (bvh->nodes, BvhNode, 0), origin, inv_dir, max_t, &entry_t))
+    return FALSE;
+
+  stack[stack_len++] = 0;
+  while (stack_len > 0)
+    {
+      const BvhNode *node = &g_array_index (bvh->nodes, BvhNode, stack[--stack_len]);
+
+      if (node->count == 0)
+        {
+          guint left = (node - (BvhNode *)bvh->nodes->data) + 1;
+          guint right = node->right_or_first;
+          float left_t, right_t;
+          gboolean hit_left, hit_right;
+
+          hit_left = ray_enters_node (&g_array_index (bvh->nodes, BvhNode, left), origin, inv_dir, max_t, &left_t);
+          hit_right = ray_enters_node (&g_array_index (bvh->nodes, BvhNode, right), origin, inv_dir, max_t, &right_t);
+
+          /* Push the far child first so the near one is popped next */
+          if (hit_left && hit_right)
+            {
+              if (left_t <= right_t)
+                {
+                  stack[stack_len++] = right;
+                  stack[stack_len++] = left;
+                }
+              else
+                {
+                  stack[stack_len++] = left;
+                  stack[stack_len++] = right;
+                }
+            }
+          else if (hit_left)
+            stack[stack_len++] = left;
+          else if (hit_right)
+            stack[stack_len++] = right;
+
+          continue;
+        }
+
+      /* Entry distance may be stale if a closer hit was found since the push */
+      if (!ray_enters_node (node, origin, inv_dir, max_t, &entry_t))
+        continue;
+
+      for (i = 0; i < node->count; i++)
+        {
+          guint32 f = bvh->faces[node->right_or_first + i];
+          GthreeBvhHit hit;
+
+          if (f < first_face || f - first_face >= n_faces)
+            continue;
+
+          if (ray_hits_triangle (origin, dir,
+                                 positions + get_vertex_index (index, f * 3 + 0) * stride,
+                                 positions + get_vertex_index (index, f * 3 + 1) * stride,
+                                 positions + get_vertex_index (index, f * 3 + 2) * stride,
+                                 side, &hit) &&
+              hit.t >= min_t && hit.t <= max_t)
+            {
+              hit.face_index = f;
+              *nearest = hit;
+              max_t = hit.t;
+              found = TRUE;
+            }
+        }
+    }
+
+  return found;
+}
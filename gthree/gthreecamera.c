@@ -1,11 +1,14 @@
 #include <math.h>
 
 #include "gthreecamera.h"
+#include "gthreeprivate.h"
+#include "gthreeobjectprivate.h"
 
 typedef struct {
   graphene_matrix_t projection_matrix;
   graphene_matrix_t projection_matrix_inverse;
   graphene_matrix_t world_matrix_inverse;
+  guint world_matrix_inverse_stamp;
 
   float near;
   float far;
@@ -107,9 +110,22 @@ void
 gthree_camera_update_matrix (GthreeCamera *camera)
 {
   GthreeCameraPrivate *priv = gthree_camera_get_instance_private (camera);
+  guint stamp = gthree_object_get_world_matrix_stamp (GTHREE_OBJECT (camera));
+
+  if (stamp != 0 && stamp == priv->world_matrix_inverse_stamp)
+    return;
 
   graphene_matrix_inverse (gthree_object_get_world_matrix (GTHREE_OBJECT (camera)),
                            &priv->world_matrix_inverse);
+  priv->world_matrix_inverse_stamp = stamp;
+}
+
+guint
+gthree_camera_get_world_inverse_stamp (GthreeCamera *camera)
+{
+  GthreeCameraPrivate *priv = gthree_camera_get_instance_private (camera);
+
+  return priv->world_matrix_inverse_stamp;
 }
 
 graphene_vec3_t *
@@ -155,6 +155,11 @@ typedef enum {
  GTHREE_SHADOW_MAP_TYPE_PCF_SOFT,
 } GthreeShadowMapType;
 
+typedef enum {
+ GTHREE_SORT_MODE_PAINTER,
+ GTHREE_SORT_MODE_STATE,
+} GthreeSortMode;
+
 G_END_DECLS
 
 #endif /* __GTHREE_ENUM_H__ */
@@ -1,4 +1,5 @@
 #include <math.h>
+#include <string.h>
 #include <epoxy/gl.h>
 
 #include "gthreegeometry.h"
@@ -10,6 +11,10 @@
 typedef struct {
   GthreeAttribute *index;
   GthreeAttribute *wireframe_index;
+  gboolean wireframe_merged;
+  guint update_epoch; /* Frame in which the buffers were last updated */
+  guint groups_stamp; /* Render lists point into groups */
+  guint layout_version; /* Bumped when attributes or the index are replaced */
   GHashTable *attributes; // intern string to GthreeAttribute
   GArray *groups;
 
@@ -23,8 +28,13 @@ typedef struct {
   guint bounding_box_set;
   guint bounding_sphere_set;
 
+  /* Built on first raycast, dropped with the bounds */
+  GthreeBvh *bvh;
+
   gint draw_range_start;
   gint draw_range_count;
+
+  guint id;
 } GthreeGeometryPrivate;
 
 G_DEFINE_TYPE_WITH_PRIVATE (GthreeGeometry, gthree_geometry, G_TYPE_OBJECT);
@@ -46,6 +56,8 @@ gthree_geometry_init (GthreeGeometry *geometry)
 
   priv->draw_range_start = 0;
   priv->draw_range_count = -1;
+
+  priv->id = gthree_allocate_id ();
 }
 
 static void
@@ -60,6 +72,7 @@ gthree_geometry_finalize (GObject *obj)
   if (priv->morph_attributes)
     g_hash_table_unref (priv->morph_attributes);
   g_array_unref (priv->groups);
+  g_clear_pointer (&priv->bvh, gthree_bvh_free);
 
   if (geometry->influences)
     g_array_unref (geometry->influences);
@@ -73,6 +86,30 @@ gthree_geometry_class_init (GthreeGeometryClass *klass)
   G_OBJECT_CLASS (klass)->finalize = gthree_geometry_finalize;
 }
 
+guint
+gthree_geometry_get_id (GthreeGeometry *geometry)
+{
+  GthreeGeometryPrivate *priv = gthree_geometry_get_instance_private (geometry);
+
+  return priv->id;
+}
+
+guint
+gthree_geometry_get_layout_version (GthreeGeometry *geometry)
+{
+  GthreeGeometryPrivate *priv = gthree_geometry_get_instance_private (geometry);
+
+  return priv->layout_version;
+}
+
+guint
+gthree_geometry_get_groups_stamp (GthreeGeometry *geometry)
+{
+  GthreeGeometryPrivate *priv = gthree_geometry_get_instance_private (geometry);
+
+  return priv->groups_stamp;
+}
+
 GthreeGeometry *
 gthree_geometry_new ()
 {
@@ -94,6 +131,8 @@ gthree_geometry_add_attribute (GthreeGeometry  *geometry,
   name = g_intern_string (name);
 
   g_hash_table_insert (priv->attributes, (char *)name, g_object_ref (attribute));
+  priv->update_epoch = 0;
+  priv->layout_version++;
 
   return attribute;
 }
@@ -105,6 +144,18 @@ gthree_geometry_invalidate_bounds (GthreeGeometry  *geometry)
 
   priv->bounding_box_set = FALSE;
   priv->bounding_sphere_set = FALSE;
+  g_clear_pointer (&priv->bvh, gthree_bvh_free);
+}
+
+GthreeBvh *
+gthree_geometry_get_bvh (GthreeGeometry *geometry)
+{
+  GthreeGeometryPrivate *priv = gthree_geometry_get_instance_private (geometry);
+
+  if (priv->bvh == NULL)
+    priv->bvh = gthree_bvh_new (geometry);
+
+  return priv->bvh;
 }
 
 void
@@ -113,7 +164,8 @@ gthree_geometry_remove_attribute (GthreeGeometry  *geometry,
 {
   GthreeGeometryPrivate *priv = gthree_geometry_get_instance_private (geometry);
 
-  g_hash_table_remove (priv->attributes, name);
+  if (g_hash_table_remove (priv->attributes, name))
+    priv->layout_version++;
 }
 
 GthreeAttribute *
@@ -143,43 +195,180 @@ gthree_geometry_get_index (GthreeGeometry  *geometry)
   return priv->index;
 }
 
+static gint
+compare_edges (gconstpointer a,
+               gconstpointer b)
+{
+  guint64 aa = *(const guint64 *)a;
+  guint64 bb = *(const guint64 *)b;
+
+  return aa < bb ? -1 : (aa > bb ? 1 : 0);
+}
+
+/* Each edge once, shared edges between triangles are only drawn once */
+static GthreeAttribute *
+create_merged_wireframe_index (GthreeAttribute *index,
+                               int              n_vertices)
+{
+  int orig_count = gthree_attribute_get_count (index);
+  g_autofree guint64 *edges = g_new (guint64, orig_count);
+  GthreeAttribute *wireframe_index;
+  int i, k, n_edges, n_unique;
+
+  n_edges = 0;
+  for (i = 0; i + 2 < orig_count; i += 3)
+    {
+      guint v[3];
+
+      for (k = 0; k < 3; k++)
+        v[k] = gthree_attribute_get_uint (index, i + k);
+
+      for (k = 0; k < 3; k++)
+        {
+          guint a = v[k], b = v[(k + 1) % 3];
+          edges[n_edges++] = ((guint64) MIN (a, b) << 32) | MAX (a, b);
+        }
+    }
+
+  qsort (edges, n_edges, sizeof (guint64), compare_edges);
+
+  n_unique = 0;
+  for (i = 0; i < n_edges; i++)
+    if (n_unique == 0 || edges[i] != edges[n_unique - 1])
+      edges[n_unique++] = edges[i];
+
+  wireframe_index = gthree_attribute_new ("wireframeIndex",
+                                          gthree_attribute_type_for_index (n_vertices),
+                                          n_unique * 2, 1, FALSE);
+  for (i = 0; i < n_unique; i++)
+    {
+      gthree_attribute_set_uint (wireframe_index, i * 2 + 0, edges[i] >> 32);
+      gthree_attribute_set_uint (wireframe_index, i * 2 + 1, edges[i] & 0xffffffff);
+    }
+
+  return wireframe_index;
+}
+
+/* Three lines per triangle, so index ranges map to twice the range in
+ * the wireframe index. Used when only parts of the geometry are drawn. */
+static GthreeAttribute *
+create_wireframe_index (GthreeAttribute *index,
+                        int              n_vertices)
+{
+  int orig_count = index ? gthree_attribute_get_count (index) : n_vertices;
+  GthreeAttribute *wireframe_index;
+  int i, k;
+
+  wireframe_index = gthree_attribute_new ("wireframeIndex",
+                                          gthree_attribute_type_for_index (n_vertices),
+                                          orig_count * 2, 1, FALSE);
+  for (i = 0; i + 2 < orig_count; i += 3)
+    {
+      guint v[3];
+
+      for (k = 0; k < 3; k++)
+        v[k] = index ? gthree_attribute_get_uint (index, i + k) : i + k;
+
+      for (k = 0; k < 3; k++)
+        {
+          gthree_attribute_set_uint (wireframe_index, i * 2 + k * 2 + 0, v[k]);
+          gthree_attribute_set_uint (wireframe_index, i * 2 + k * 2 + 1, v[(k + 1) % 3]);
+        }
+    }
+
+  return wireframe_index;
+}
+
 GthreeAttribute *
 gthree_geometry_get_wireframe_index (GthreeGeometry *geometry)
 {
   GthreeGeometryPrivate *priv = gthree_geometry_get_instance_private (geometry);
-  int i;
 
   if (priv->wireframe_index == NULL)
     {
-      if (priv->index != NULL)
-        {
-          int orig_count = gthree_attribute_get_count (priv->index);
-          priv->wireframe_index = gthree_attribute_new ("wireframeIndex",
-                                                        GTHREE_ATTRIBUTE_TYPE_UINT32,
-                                                        orig_count * 2, 1, FALSE);
-          for (i = 0; i < orig_count; i += 3)
-            {
-              int a = gthree_attribute_get_uint (priv->index, i + 0);
-              int b = gthree_attribute_get_uint (priv->index, i + 1);
-              int c = gthree_attribute_get_uint (priv->index, i + 2);
-
-              gthree_attribute_set_uint (priv->wireframe_index, i * 2 + 0, a);
-              gthree_attribute_set_uint (priv->wireframe_index, i * 2 + 1, b);
-              gthree_attribute_set_uint (priv->wireframe_index, i * 2 + 2, b);
-              gthree_attribute_set_uint (priv->wireframe_index, i * 2 + 3, c);
-              gthree_attribute_set_uint (priv->wireframe_index, i * 2 + 4, c);
-              gthree_attribute_set_uint (priv->wireframe_index, i * 2 + 5, a);
-            }
-        }
+      int n_vertices = gthree_geometry_get_position_count (geometry);
+
+      /* Merging edges loses the mapping from triangle ranges, so only
+       * do it when the whole geometry is drawn */
+      priv->wireframe_merged =
+        priv->index != NULL &&
+        priv->groups->len == 0 &&
+        priv->draw_range_start == 0 &&
+        priv->draw_range_count < 0;
+
+      if (priv->wireframe_merged)
+        priv->wireframe_index = create_merged_wireframe_index (priv->index, n_vertices);
       else
-        {
-          g_error ("TODO: Implement wgthree_geometry_get_wireframe_index for non-indexed geometries");
-        }
+        priv->wireframe_index = create_wireframe_index (priv->index, n_vertices);
     }
 
   return priv->wireframe_index;
 }
 
+/* Whether the wireframe index has shared edges merged, in which case
+ * it must be drawn in full rather than by (doubled) index ranges */
+gboolean
+gthree_geometry_get_wireframe_index_merged (GthreeGeometry *geometry)
+{
+  GthreeGeometryPrivate *priv = gthree_geometry_get_instance_private (geometry);
+
+  return priv->wireframe_index != NULL && priv->wireframe_merged;
+}
+
+static void
+gthree_geometry_invalidate_merged_wireframe (GthreeGeometry *geometry)
+{
+  GthreeGeometryPrivate *priv = gthree_geometry_get_instance_private (geometry);
+
+  if (priv->wireframe_merged)
+    g_clear_object (&priv->wireframe_index);
+}
+
+/* Uses the smallest index type that fits the largest index */
+void
+gthree_geometry_set_index_from_uint32 (GthreeGeometry *geometry,
+                                       const guint32  *indices,
+                                       int             count)
+{
+  g_autoptr(GthreeAttribute) index = NULL;
+  guint32 max_index = 0;
+  int i;
+
+  for (i = 0; i < count; i++)
+    max_index = MAX (max_index, indices[i]);
+
+  index = gthree_attribute_new ("index", gthree_attribute_type_for_index ((guint64) max_index + 1),
+                                count, 1, FALSE);
+  for (i = 0; i < count; i++)
+    gthree_attribute_set_uint (index, i, indices[i]);
+
+  gthree_geometry_set_index (geometry, index);
+}
+
+/* Replaces a 32bit index with a 16bit one if all indices fit */
+void
+gthree_geometry_compact_index (GthreeGeometry *geometry)
+{
+  GthreeGeometryPrivate *priv = gthree_geometry_get_instance_private (geometry);
+  g_autofree guint32 *indices = NULL;
+  int i, count;
+
+  if (priv->index == NULL ||
+      gthree_attribute_get_attribute_type (priv->index) != GTHREE_ATTRIBUTE_TYPE_UINT32)
+    return;
+
+  count = gthree_attribute_get_count (priv->index);
+  indices = g_new (guint32, count);
+  for (i = 0; i < count; i++)
+    {
+      indices[i] = gthree_attribute_get_uint (priv->index, i);
+      if (indices[i] >= 65535)
+        return;
+    }
+
+  gthree_geometry_set_index_from_uint32 (geometry, indices, count);
+}
+
 void
 gthree_geometry_set_index (GthreeGeometry  *geometry,
                            GthreeAttribute *index)
@@ -190,7 +379,10 @@ gthree_geometry_set_index (GthreeGeometry  *geometry,
 
   g_clear_object (&priv->index);
   g_clear_object (&priv->wireframe_index);
+  g_clear_pointer (&priv->bvh, gthree_bvh_free);
   priv->index = index;
+  priv->update_epoch = 0;
+  priv->layout_version++;
 }
 
 GthreeAttribute *
@@ -263,6 +455,7 @@ gthree_geometry_add_morph_attribute (GthreeGeometry *geometry,
     }
 
   g_ptr_array_add (attributes, g_object_ref (attribute));
+  priv->update_epoch = 0;
 }
 
 void
@@ -297,6 +490,14 @@ gthree_geometry_has_morph_attributes (GthreeGeometry          *geometry)
   return (priv->morph_attributes != NULL);
 }
 
+GList *
+gthree_geometry_get_attribute_names (GthreeGeometry  *geometry)
+{
+  GthreeGeometryPrivate *priv = gthree_geometry_get_instance_private (geometry);
+
+  return g_hash_table_get_keys (priv->attributes);
+}
+
 GList *
 gthree_geometry_get_morph_attributes_names (GthreeGeometry  *geometry)
 {
@@ -318,6 +519,8 @@ gthree_geometry_add_group (GthreeGeometry  *geometry,
   GthreeGeometryGroup group = { start, count, material_index };
 
   g_array_append_val (priv->groups, group);
+  gthree_geometry_invalidate_merged_wireframe (geometry);
+  priv->groups_stamp = gthree_allocate_matrix_stamp ();
 }
 
 void
@@ -325,7 +528,7 @@ gthree_geometry_clear_groups (GthreeGeometry  *geometry)
 {
   GthreeGeometryPrivate *priv = gthree_geometry_get_instance_private (geometry);
   g_array_set_size (priv->groups, 0);
-
+  priv->groups_stamp = gthree_allocate_matrix_stamp ();
 }
 
 int
@@ -375,63 +578,11 @@ gthree_geometry_set_draw_range (GthreeGeometry  *geometry,
   GthreeGeometryPrivate *priv = gthree_geometry_get_instance_private (geometry);
   priv->draw_range_start = start;
   priv->draw_range_count = count;
-}
-
-
-static float
-distance_sq (const graphene_vec3_t *p1,
-             const graphene_vec3_t *p2)
-{
-  graphene_vec3_t delta;
-
-  graphene_vec3_subtract (p1, p2, &delta);
-  return graphene_vec3_dot (&delta, &delta);
-}
 
-static void
-expand_box_from_points (graphene_box_t *box,
-                        GthreeAttribute *position)
-{
-  const float *floats, *f;
-  int n_points = gthree_attribute_get_count (position);
-  int stride = gthree_attribute_get_stride (position);
-  int i;
-
-  floats = gthree_attribute_peek_float (position);
-
-  for (f = floats, i = 0; i < n_points; i++, f += stride)
-    {
-      const graphene_point3d_t *point = (const graphene_point3d_t *)f;
-      graphene_vec3_t v;
-
-      graphene_point3d_to_vec3 (point, &v);
-      graphene_box_expand_vec3 (box, &v, box);
-    }
-}
-
-static float
-get_max_radius_sq_from_points (graphene_vec3_t *center,
-                               GthreeAttribute *position)
-{
-  const float *floats, *f;
-  int n_points = gthree_attribute_get_count (position);
-  int stride = gthree_attribute_get_stride (position);
-  int i;
-  float max_radius_sq = 0.f;
-
-  floats = gthree_attribute_peek_float (position);
-  for (f = floats, i = 0; i < n_points; i++, f += stride)
-    {
-      const graphene_point3d_t *point = (const graphene_point3d_t *)f;
-      graphene_vec3_t p;
-
-      graphene_point3d_to_vec3 (point, &p);
-      max_radius_sq = fmaxf (max_radius_sq, distance_sq (center, &p));
-    }
-  return max_radius_sq;
+  if (start != 0 || count >= 0)
+    gthree_geometry_invalidate_merged_wireframe (geometry);
 }
 
-
 const graphene_sphere_t *
 gthree_geometry_get_bounding_sphere  (GthreeGeometry *geometry)
 {
@@ -458,13 +609,13 @@ gthree_geometry_get_bounding_sphere  (GthreeGeometry *geometry)
           graphene_vec3_scale (&size, 0.5f, &center);
           graphene_vec3_add (&center, &min, &center);
 
-          max_radius_sq = get_max_radius_sq_from_points (&center, position);
+          max_radius_sq = gthree_compute_max_radius_sq (position, &center);
           if (morph_attributes)
             {
               for (int i = 0; i < morph_attributes->len; i++)
                 {
                   GthreeAttribute *attr = g_ptr_array_index (morph_attributes, i);
-                  max_radius_sq = fmaxf (max_radius_sq, get_max_radius_sq_from_points (&center, attr));
+                  max_radius_sq = fmaxf (max_radius_sq, gthree_compute_max_radius_sq (attr, &center));
                 }
             }
 
@@ -509,13 +660,13 @@ gthree_geometry_get_bounding_box  (GthreeGeometry *geometry)
 
       if (position)
         {
-          expand_box_from_points (&box, position);
+          gthree_compute_bounding_box (position, &box);
           if (morph_attributes)
             {
               for (int i = 0; i < morph_attributes->len; i++)
                 {
                   GthreeAttribute *attr = g_ptr_array_index (morph_attributes, i);
-                  expand_box_from_points (&box, attr);
+                  gthree_compute_bounding_box (attr, &box);
                 }
             }
 
@@ -542,8 +693,7 @@ gthree_geometry_normalize_normals (GthreeGeometry *geometry)
 {
   GthreeAttribute *normal;
   int i, vertex_count;
-  graphene_vec3_t n;
-  graphene_point3d_t *r;
+  float x, y, z, len;
 
   normal = gthree_geometry_get_normal (geometry);
   if (normal == NULL)
@@ -551,114 +701,701 @@ gthree_geometry_normalize_normals (GthreeGeometry *geometry)
 
   vertex_count = gthree_attribute_get_count (normal);
 
-  // non-indexed elements (unconnected triangle soup)
   for (i = 0; i < vertex_count; i ++)
     {
-      graphene_point3d_to_vec3 (gthree_attribute_peek_point3d_at (normal, i), &n);
-      graphene_vec3_normalize (&n, &n);
-      r = gthree_attribute_peek_point3d_at (normal, i);
-      r->x += graphene_vec3_get_x (&n);
-      r->y += graphene_vec3_get_y (&n);
-      r->z += graphene_vec3_get_z (&n);
+      gthree_attribute_get_xyz (normal, i, &x, &y, &z);
+      len = sqrtf (x * x + y * y + z * z);
+      if (len > 0)
+        gthree_attribute_set_xyz (normal, i, x / len, y / len, z / len);
     }
+
+  gthree_attribute_set_needs_update (normal);
 }
 
+/* Returns a float attribute with item_size components that we can
+ * write to directly, replacing any quantized one */
+static GthreeAttribute *
+ensure_float_attribute (GthreeGeometry *geometry,
+                        const char     *name,
+                        int             item_size,
+                        int             vertex_count)
+{
+  GthreeAttribute *attribute = gthree_geometry_get_attribute (geometry, name);
+
+  if (attribute == NULL ||
+      gthree_attribute_get_attribute_type (attribute) != GTHREE_ATTRIBUTE_TYPE_FLOAT ||
+      gthree_attribute_get_item_size (attribute) != item_size ||
+      gthree_attribute_get_count (attribute) != vertex_count)
+    {
+      attribute = gthree_attribute_new (name, GTHREE_ATTRIBUTE_TYPE_FLOAT, vertex_count, item_size, FALSE);
+      gthree_geometry_add_attribute (geometry, name, attribute);
+      g_object_unref (attribute); // Its owned by geometry anyway
+    }
+
+  return attribute;
+}
+
+/**
+ * gthree_geometry_compute_vertex_normals:
+ * @geometry: a #GthreeGeometry
+ *
+ * Computes smooth vertex normals by averaging the (area weighted) face
+ * normals of the triangles around each vertex. Large geometries are
+ * processed on several threads.
+ */
 void
 gthree_geometry_compute_vertex_normals (GthreeGeometry *geometry)
 {
   GthreeGeometryPrivate *priv = gthree_geometry_get_instance_private (geometry);
   GthreeAttribute *position;
   GthreeAttribute *normal;
-  int i, vertex_count;
-  int vA, vB, vC;
-  graphene_vec3_t pA, pB, pC, cb, ab;
-  graphene_point3d_t *nA, *nB, *nC;
 
   position = gthree_geometry_get_position (geometry);
   if (position == NULL)
     return;
 
-  vertex_count = gthree_attribute_get_count (position);
+  normal = ensure_float_attribute (geometry, "normal", 3, gthree_attribute_get_count (position));
+  gthree_compute_vertex_normals (position, priv->index, normal);
+  gthree_attribute_set_needs_update (normal);
+}
+
+/**
+ * gthree_geometry_compute_tangents:
+ * @geometry: a #GthreeGeometry
+ *
+ * Computes the "tangent" attribute from the positions, normals and uvs,
+ * for normal mapping. The tangents are orthogonalized against the
+ * normals, and the w component holds the handedness of the bitangent,
+ * following the same convention as MikkTSpace.
+ */
+void
+gthree_geometry_compute_tangents (GthreeGeometry *geometry)
+{
+  GthreeGeometryPrivate *priv = gthree_geometry_get_instance_private (geometry);
+  GthreeAttribute *position, *normal, *uv, *tangent;
 
+  position = gthree_geometry_get_position (geometry);
   normal = gthree_geometry_get_normal (geometry);
-  if (normal == NULL)
+  uv = gthree_geometry_get_uv (geometry);
+  if (position == NULL || normal == NULL || uv == NULL)
     {
-      normal = gthree_attribute_new ("normal", GTHREE_ATTRIBUTE_TYPE_FLOAT, vertex_count, 3, FALSE);
-      gthree_geometry_add_attribute (geometry, "normal", normal);
-      g_object_unref (normal); // Its owned by geometry anyway
+      g_warning ("gthree_geometry_compute_tangents() needs position, normal and uv attributes");
+      return;
+    }
+
+  if (gthree_attribute_get_count (normal) != gthree_attribute_get_count (position) ||
+      gthree_attribute_get_count (uv) != gthree_attribute_get_count (position))
+    {
+      g_warning ("gthree_geometry_compute_tangents() needs as many normals and uvs as positions");
+      return;
+    }
+
+  tangent = ensure_float_attribute (geometry, "tangent", 4, gthree_attribute_get_count (position));
+  gthree_compute_tangents (position, normal, uv, priv->index, tangent);
+  gthree_attribute_set_needs_update (tangent);
+}
+
+typedef struct {
+  const char *name;
+  GthreeAttribute *attribute;
+  int offset;
+} PackedAttribute;
+
+/* Position always goes first in the vertex, the rest by name */
+static gint
+compare_attribute_names (gconstpointer a,
+                         gconstpointer b)
+{
+  const char *aa = *(const char **)a;
+  const char *bb = *(const char **)b;
+
+  if (strcmp (aa, "position") == 0)
+    return -1;
+  if (strcmp (bb, "position") == 0)
+    return 1;
+  return strcmp (aa, bb);
+}
+
+/* Attributes that are fine with 15 bits of precision, as long as all
+ * values are in the range of a normalized short */
+static gboolean
+can_quantize (const char      *name,
+              GthreeAttribute *attribute)
+{
+  GthreeAttributeArray *array = gthree_attribute_get_array (attribute);
+  int item_size = gthree_attribute_get_item_size (attribute);
+  int item_offset = gthree_attribute_get_item_offset (attribute);
+  int count = gthree_attribute_get_count (attribute);
+  float v[4];
+  int i, k;
+
+  if (strcmp (name, "normal") != 0 &&
+      strcmp (name, "tangent") != 0 &&
+      strcmp (name, "uv") != 0 &&
+      strcmp (name, "uv2") != 0 &&
+      strcmp (name, "color") != 0)
+    return FALSE;
+
+  if (item_size > 4)
+    return FALSE;
+
+  for (i = 0; i < count; i++)
+    {
+      gthree_attribute_array_get_elements_as_float (array, i, item_offset, v, item_size);
+      for (k = 0; k < item_size; k++)
+        {
+          if (!(v[k] >= -1.0f && v[k] <= 1.0f))
+            return FALSE;
+        }
+    }
+
+  return TRUE;
+}
+
+static void
+pack_float_attributes (GthreeGeometry *geometry,
+                       GArray         *packed,
+                       int             stride,
+                       int             n_vertices)
+{
+  g_autoptr(GthreeAttributeArray) array = gthree_attribute_array_new (GTHREE_ATTRIBUTE_TYPE_FLOAT, n_vertices, stride);
+  int i;
+
+  for (i = 0; i < packed->len; i++)
+    {
+      PackedAttribute *p = &g_array_index (packed, PackedAttribute, i);
+      int item_size = gthree_attribute_get_item_size (p->attribute);
+      g_autoptr(GthreeAttribute) attribute = NULL;
+
+      gthree_attribute_array_copy_at (array, 0, p->offset,
+                                      gthree_attribute_get_array (p->attribute), 0,
+                                      gthree_attribute_get_item_offset (p->attribute),
+                                      item_size, n_vertices);
+
+      attribute = gthree_attribute_new_with_array_interleaved (p->name, array,
+                                                               gthree_attribute_get_normalized (p->attribute),
+                                                               item_size, p->offset, n_vertices);
+      gthree_geometry_add_attribute (geometry, p->name, attribute);
+    }
+}
+
+static void
+pack_quantized_attributes (GthreeGeometry *geometry,
+                           GArray         *packed,
+                           int             stride,
+                           int             n_vertices)
+{
+  g_autoptr(GthreeAttributeArray) array = gthree_attribute_array_new (GTHREE_ATTRIBUTE_TYPE_INT16, n_vertices, stride);
+  int i, j, k;
+
+  for (i = 0; i < packed->len; i++)
+    {
+      PackedAttribute *p = &g_array_index (packed, PackedAttribute, i);
+      GthreeAttributeArray *source = gthree_attribute_get_array (p->attribute);
+      int item_size = gthree_attribute_get_item_size (p->attribute);
+      int item_offset = gthree_attribute_get_item_offset (p->attribute);
+      g_autoptr(GthreeAttribute) attribute = NULL;
+
+      for (j = 0; j < n_vertices; j++)
+        {
+          gint16 *dest = gthree_attribute_array_peek_int16_at (array, j, p->offset);
+          float v[4];
+
+          gthree_attribute_array_get_elements_as_float (source, j, item_offset, v, item_size);
+          for (k = 0; k < item_size; k++)
+            dest[k] = (gint16) roundf (v[k] * 32767.0f);
+        }
+
+      attribute = gthree_attribute_new_with_array_interleaved (p->name, array, TRUE,
+                                                               item_size, p->offset, n_vertices);
+      gthree_geometry_add_attribute (geometry, p->name, attribute);
+    }
+}
+
+/* Repacks the static per-vertex float attributes into a single
+ * interleaved buffer, so drawing binds one buffer instead of one per
+ * attribute and the vertex data of each vertex is fetched together.
+ *
+ * With @quantize normals, tangents, uvs and colors that fit in [-1, 1]
+ * are moved to a second interleaved buffer of normalized shorts, which
+ * the GPU expands back for free. This halves their size, but they can
+ * then no longer be modified as floats, so do this last. Positions
+ * always stay float, since they feed bounds and raycasting and the
+ * shaders have no decode transform for them. */
+void
+gthree_geometry_optimize_layout (GthreeGeometry *geometry,
+                                 gboolean        quantize)
+{
+  GthreeGeometryPrivate *priv = gthree_geometry_get_instance_private (geometry);
+  g_autoptr(GPtrArray) names = g_ptr_array_new ();
+  g_autoptr(GArray) floats = g_array_new (FALSE, FALSE, sizeof (PackedAttribute));
+  g_autoptr(GArray) shorts = g_array_new (FALSE, FALSE, sizeof (PackedAttribute));
+  int float_stride = 0, short_stride = 0;
+  int n_vertices;
+  GHashTableIter iter;
+  gpointer key;
+  int i;
+
+  n_vertices = gthree_geometry_get_position_count (geometry);
+  if (n_vertices == 0)
+    return;
+
+  g_hash_table_iter_init (&iter, priv->attributes);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    g_ptr_array_add (names, key);
+  g_ptr_array_sort (names, compare_attribute_names);
+
+  for (i = 0; i < names->len; i++)
+    {
+      const char *name = g_ptr_array_index (names, i);
+      GthreeAttribute *attribute = g_hash_table_lookup (priv->attributes, name);
+      PackedAttribute p = { name, attribute, 0 };
+      int item_size = gthree_attribute_get_item_size (attribute);
+
+      if (gthree_attribute_get_attribute_type (attribute) != GTHREE_ATTRIBUTE_TYPE_FLOAT ||
+          gthree_attribute_get_divisor (attribute) != 0 ||
+          gthree_attribute_get_dynamic (attribute) ||
+          gthree_attribute_get_count (attribute) != n_vertices)
+        continue;
+
+      if (quantize && can_quantize (name, attribute))
+        {
+          p.offset = short_stride;
+          /* Keep each attribute 4-byte aligned */
+          short_stride += (item_size + 1) & ~1;
+          g_array_append_val (shorts, p);
+        }
+      else
+        {
+          p.offset = float_stride;
+          float_stride += item_size;
+          g_array_append_val (floats, p);
+        }
+    }
+
+  /* The attributes hold refs on their old arrays until they are replaced */
+  for (i = 0; i < floats->len; i++)
+    g_object_ref (g_array_index (floats, PackedAttribute, i).attribute);
+  for (i = 0; i < shorts->len; i++)
+    g_object_ref (g_array_index (shorts, PackedAttribute, i).attribute);
+
+  if (floats->len > 1)
+    pack_float_attributes (geometry, floats, float_stride, n_vertices);
+  if (shorts->len > 0)
+    pack_quantized_attributes (geometry, shorts, short_stride, n_vertices);
+
+  for (i = 0; i < floats->len; i++)
+    g_object_unref (g_array_index (floats, PackedAttribute, i).attribute);
+  for (i = 0; i < shorts->len; i++)
+    g_object_unref (g_array_index (shorts, PackedAttribute, i).attribute);
+}
+
+#define VERTEX_CACHE_SIZE 16
+
+static float
+simulate_fifo_cache (GthreeAttribute *index,
+                     int              n_vertices,
+                     int              cache_size)
+{
+  g_autofree guint *timestamps = g_new0 (guint, n_vertices);
+  int n_indices = gthree_attribute_get_count (index);
+  guint time = cache_size + 1;
+  int i, misses = 0;
+
+  if (n_indices < 3)
+    return 0;
+
+  for (i = 0; i < n_indices; i++)
+    {
+      guint v = gthree_attribute_get_uint (index, i);
+
+      if (v >= n_vertices)
+        continue;
+
+      /* A FIFO only moves on a miss, so entries younger than cache_size misses are hits */
+      if (time - timestamps[v] > cache_size)
+        {
+          timestamps[v] = time++;
+          misses++;
+        }
+    }
+
+  return (float) misses / (n_indices / 3);
+}
+
+/* Average cache miss ratio (transformed vertices per triangle) of the
+ * index, for a FIFO post-transform cache with cache_size entries.
+ * 0.5 is the best possible for a regular grid and 3 the worst. */
+float
+gthree_geometry_compute_acmr (GthreeGeometry *geometry,
+                              int             cache_size)
+{
+  GthreeGeometryPrivate *priv = gthree_geometry_get_instance_private (geometry);
+
+  if (priv->index == NULL)
+    return 0;
+
+  return simulate_fifo_cache (priv->index, gthree_geometry_get_position_count (geometry), cache_size);
+}
+
+typedef struct {
+  int n_vertices;
+  int cache_size;
+  int *live;
+  guint *timestamps;
+  int *dead_end;
+  int dead_end_len;
+  int cursor;
+  guint time;
+} Tipsify;
+
+static int
+tipsify_skip_dead_end (Tipsify *t)
+{
+  while (t->dead_end_len > 0)
+    {
+      int d = t->dead_end[--t->dead_end_len];
+      if (t->live[d] > 0)
+        return d;
+    }
+
+  while (t->cursor < t->n_vertices)
+    {
+      if (t->live[t->cursor] > 0)
+        return t->cursor++;
+      t->cursor++;
+    }
+
+  return -1;
+}
+
+/* Picks the candidate that is still in the cache when we get to it
+ * and has been there the longest, since it is closest to falling out */
+static int
+tipsify_next_vertex (Tipsify   *t,
+                     const int *candidates,
+                     int        n_candidates)
+{
+  int best = -1, best_priority = -1;
+  int i;
+
+  for (i = 0; i < n_candidates; i++)
+    {
+      int v = candidates[i];
+
+      if (t->live[v] > 0)
+        {
+          int priority = 0;
+
+          if (t->time - t->timestamps[v] + 2 * t->live[v] <= t->cache_size)
+            priority = t->time - t->timestamps[v];
+
+          if (priority > best_priority)
+            {
+              best_priority = priority;
+              best = v;
+            }
+        }
+    }
+
+  if (best == -1)
+    best = tipsify_skip_dead_end (t);
+
+  return best;
+}
+
+/* Reorders the triangles in indices (n_triangles * 3 vertex indices)
+ * with the Tipsify algorithm from Sander, Nehab and Barczak, "Fast
+ * Triangle Reordering for Vertex Locality and Reduced Overdraw". */
+static void
+tipsify (guint32 *indices,
+         int      n_triangles,
+         int      n_vertices,
+         int      cache_size)
+{
+  g_autofree int *adjacency_offsets = g_new0 (int, n_vertices + 1);
+  g_autofree int *adjacency = g_new (int, n_triangles * 3);
+  g_autofree int *live = g_new0 (int, n_vertices);
+  g_autofree guint *timestamps = g_new0 (guint, n_vertices);
+  g_autofree gboolean *emitted = g_new0 (gboolean, n_triangles);
+  g_autofree int *dead_end = g_new (int, n_triangles * 3);
+  g_autofree guint32 *output = g_new (guint32, n_triangles * 3);
+  g_autofree int *fill = g_new (int, n_vertices);
+  int candidates[3 * 64];
+  int n_output = 0;
+  Tipsify t = { 0, };
+  int i, f;
+
+  for (i = 0; i < n_triangles * 3; i++)
+    live[indices[i]]++;
+
+  for (i = 0; i < n_vertices; i++)
+    adjacency_offsets[i + 1] = adjacency_offsets[i] + live[i];
+
+  memcpy (fill, adjacency_offsets, sizeof (int) * n_vertices);
+  for (i = 0; i < n_triangles * 3; i++)
+    adjacency[fill[indices[i]]++] = i / 3;
+
+  t.n_vertices = n_vertices;
+  t.cache_size = cache_size;
+  t.live = live;
+  t.timestamps = timestamps;
+  t.dead_end = dead_end;
+  t.time = cache_size + 1;
+
+  f = tipsify_skip_dead_end (&t);
+  while (f >= 0)
+    {
+      int n_candidates = 0;
+
+      for (i = adjacency_offsets[f]; i < adjacency_offsets[f + 1]; i++)
+        {
+          int tri = adjacency[i];
+          int k;
+
+          if (emitted[tri])
+            continue;
+
+          for (k = 0; k < 3; k++)
+            {
+              guint32 v = indices[tri * 3 + k];
+
+              output[n_output++] = v;
+              dead_end[t.dead_end_len++] = v;
+              if (n_candidates < (int) G_N_ELEMENTS (candidates))
+                candidates[n_candidates++] = v;
+              live[v]--;
+
+              if (t.time - timestamps[v] > cache_size)
+                timestamps[v] = t.time++;
+            }
+
+          emitted[tri] = TRUE;
+        }
+
+      f = tipsify_next_vertex (&t, candidates, n_candidates);
+    }
+
+  memcpy (indices, output, sizeof (guint32) * n_triangles * 3);
+}
+
+static GthreeAttribute *
+remap_attribute (GthreeAttribute *attribute,
+                 GHashTable      *new_arrays,
+                 const guint32   *old_of_new,
+                 int              n_vertices)
+{
+  GthreeAttributeArray *array = gthree_attribute_get_array (attribute);
+  GthreeAttributeArray *new_array;
+  GthreeAttribute *new_attribute;
+  int stride = gthree_attribute_array_get_stride (array);
+  int item_size = gthree_attribute_get_item_size (attribute);
+  int item_offset = gthree_attribute_get_item_offset (attribute);
+  int i;
+
+  /* An array holding exactly these vertices, interleaved or not, is
+   * remapped whole and shared by all its attributes */
+  if (gthree_attribute_array_get_count (array) == n_vertices &&
+      item_offset + item_size <= stride)
+    {
+      new_array = g_hash_table_lookup (new_arrays, array);
+      if (new_array == NULL)
+        {
+          new_array = gthree_attribute_array_new (gthree_attribute_array_get_attribute_type (array),
+                                                  n_vertices, stride);
+          for (i = 0; i < n_vertices; i++)
+            gthree_attribute_array_copy_at (new_array, i, 0, array, old_of_new[i], 0, stride, 1);
+
+          g_hash_table_insert (new_arrays, array, new_array);
+        }
+
+      new_attribute = gthree_attribute_new_with_array_interleaved (gthree_attribute_get_name (attribute),
+                                                                   new_array,
+                                                                   gthree_attribute_get_normalized (attribute),
+                                                                   item_size,
+                                                                   item_offset,
+                                                                   n_vertices);
     }
   else
     {
-      // reset existing normals to zero
-      for (i = 0; i < vertex_count; i++)
-        gthree_attribute_set_xyz (normal, i, 0, 0, 0);
+      /* Otherwise it is a bigger shared view (like a glTF buffer view
+       * with several accessors), so only this attribute is copied out,
+       * tightly packed */
+      new_array = gthree_attribute_array_new (gthree_attribute_array_get_attribute_type (array),
+                                              n_vertices, item_size);
+      for (i = 0; i < n_vertices; i++)
+        gthree_attribute_array_copy_at (new_array, i, 0, array, old_of_new[i], item_offset, item_size, 1);
+
+      new_attribute = gthree_attribute_new_with_array_interleaved (gthree_attribute_get_name (attribute),
+                                                                   new_array,
+                                                                   gthree_attribute_get_normalized (attribute),
+                                                                   item_size,
+                                                                   0,
+                                                                   n_vertices);
+      gthree_attribute_array_unref (new_array);
     }
 
-  if (priv->index)
+  gthree_attribute_set_divisor (new_attribute, gthree_attribute_get_divisor (attribute));
+  gthree_attribute_set_dynamic (new_attribute, gthree_attribute_get_dynamic (attribute));
+
+  return new_attribute;
+}
+
+static gboolean
+is_remappable (GthreeAttribute *attribute,
+               int              n_vertices)
+{
+  return gthree_attribute_get_divisor (attribute) == 0 &&
+    gthree_attribute_get_count (attribute) == n_vertices;
+}
+
+/* Renumbers the vertices in the order the index first uses them, so
+ * vertex fetches walk memory mostly linearly. Unused vertices go last. */
+static void
+reorder_vertices (GthreeGeometry *geometry,
+                  guint32        *indices,
+                  int             n_indices,
+                  int             n_vertices)
+{
+  GthreeGeometryPrivate *priv = gthree_geometry_get_instance_private (geometry);
+  g_autoptr(GHashTable) new_arrays = g_hash_table_new_full (NULL, NULL, NULL, (GDestroyNotify)gthree_attribute_array_unref);
+  g_autofree guint32 *new_of_old = g_new (guint32, n_vertices);
+  g_autofree guint32 *old_of_new = g_new (guint32, n_vertices);
+  GHashTableIter iter;
+  gpointer key, value;
+  guint32 next = 0;
+  int i;
+
+  /* Bail if any per-vertex data can't be remapped along */
+  g_hash_table_iter_init (&iter, priv->attributes);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    if (gthree_attribute_get_divisor (value) == 0 && !is_remappable (value, n_vertices))
+      return;
+
+  if (priv->morph_attributes)
+    {
+      g_hash_table_iter_init (&iter, priv->morph_attributes);
+      while (g_hash_table_iter_next (&iter, NULL, &value))
+        {
+          GPtrArray *attributes = value;
+          for (i = 0; i < attributes->len; i++)
+            if (!is_remappable (g_ptr_array_index (attributes, i), n_vertices))
+              return;
+        }
+    }
+
+  memset (new_of_old, 0xff, sizeof (guint32) * n_vertices);
+  for (i = 0; i < n_indices; i++)
+    {
+      guint32 v = indices[i];
+      if (new_of_old[v] == G_MAXUINT32)
+        {
+          old_of_new[next] = v;
+          new_of_old[v] = next++;
+        }
+      indices[i] = new_of_old[v];
+    }
+  for (i = 0; i < n_vertices; i++)
+    {
+      if (new_of_old[i] == G_MAXUINT32)
+        {
+          old_of_new[next] = i;
+          new_of_old[i] = next++;
+        }
+    }
+
+  g_hash_table_iter_init (&iter, priv->attributes);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      if (gthree_attribute_get_divisor (value) != 0)
+        continue;
+      g_hash_table_iter_replace (&iter, remap_attribute (value, new_arrays, old_of_new, n_vertices));
+    }
+
+  if (priv->morph_attributes)
     {
-      int index_count = gthree_attribute_get_count (priv->index);
-      for (i = 0; i < index_count; i += 3 )
+      g_hash_table_iter_init (&iter, priv->morph_attributes);
+      while (g_hash_table_iter_next (&iter, NULL, &value))
         {
-          vA = gthree_attribute_get_uint (priv->index, i + 0);
-          vB = gthree_attribute_get_uint (priv->index, i + 1);
-          vC = gthree_attribute_get_uint (priv->index, i + 2);
-
-          graphene_point3d_to_vec3 (gthree_attribute_peek_point3d_at (position, vA), &pA);
-          graphene_point3d_to_vec3 (gthree_attribute_peek_point3d_at (position, vB), &pB);
-          graphene_point3d_to_vec3 (gthree_attribute_peek_point3d_at (position, vC), &pC);
-
-          graphene_vec3_subtract (&pC, &pB, &cb);
-          graphene_vec3_subtract (&pA, &pB, &ab);
-          graphene_vec3_cross (&cb, &ab, &cb);
-
-          nA = gthree_attribute_peek_point3d_at (normal, vA);
-          nA->x += graphene_vec3_get_x (&cb);
-          nA->y += graphene_vec3_get_y (&cb);
-          nA->z += graphene_vec3_get_z (&cb);
-
-          nB = gthree_attribute_peek_point3d_at (normal, vB);
-          nB->x += graphene_vec3_get_x (&cb);
-          nB->y += graphene_vec3_get_y (&cb);
-          nB->z += graphene_vec3_get_z (&cb);
-
-          nC = gthree_attribute_peek_point3d_at (normal, vC);
-          nC->x += graphene_vec3_get_x (&cb);
-          nC->y += graphene_vec3_get_y (&cb);
-          nC->z += graphene_vec3_get_z (&cb);
+          GPtrArray *attributes = value;
+          for (i = 0; i < attributes->len; i++)
+            {
+              GthreeAttribute *old = g_ptr_array_index (attributes, i);
+
+              g_ptr_array_index (attributes, i) = remap_attribute (old, new_arrays, old_of_new, n_vertices);
+              g_object_unref (old);
+            }
         }
     }
+}
+
+/* Reorders the triangles of an indexed triangle list for the GPU
+ * post-transform vertex cache, and then the vertices in the order they
+ * are used. Groups are reordered separately, so materials are kept.
+ * The cache miss ratios before and after (see
+ * gthree_geometry_compute_acmr()) are returned, if requested. */
+void
+gthree_geometry_optimize_vertex_cache (GthreeGeometry *geometry,
+                                       float          *acmr_before,
+                                       float          *acmr_after)
+{
+  GthreeGeometryPrivate *priv = gthree_geometry_get_instance_private (geometry);
+  g_autoptr(GthreeAttribute) new_index = NULL;
+  g_autofree guint32 *indices = NULL;
+  int n_indices, n_vertices;
+  int i;
+
+  if (acmr_before)
+    *acmr_before = gthree_geometry_compute_acmr (geometry, VERTEX_CACHE_SIZE);
+  if (acmr_after)
+    *acmr_after = acmr_before ? *acmr_before : gthree_geometry_compute_acmr (geometry, VERTEX_CACHE_SIZE);
+
+  n_vertices = gthree_geometry_get_position_count (geometry);
+  if (priv->index == NULL || n_vertices == 0)
+    return;
+
+  n_indices = gthree_attribute_get_count (priv->index);
+  indices = g_new (guint32, n_indices);
+  for (i = 0; i < n_indices; i++)
+    {
+      indices[i] = gthree_attribute_get_uint (priv->index, i);
+      if (indices[i] >= n_vertices)
+        return;
+    }
+
+  if (priv->groups->len == 0)
+    tipsify (indices, n_indices / 3, n_vertices, VERTEX_CACHE_SIZE);
   else
     {
-      // non-indexed elements (unconnected triangle soup)
-      for (i = 0; i < vertex_count; i += 3)
+      int end = 0;
+
+      /* Overlapping groups share triangles, so leave those alone */
+      for (i = 0; i < priv->groups->len; i++)
         {
-          graphene_point3d_to_vec3 (gthree_attribute_peek_point3d_at (position, i + 0), &pA);
-          graphene_point3d_to_vec3 (gthree_attribute_peek_point3d_at (position, i + 1), &pB);
-          graphene_point3d_to_vec3 (gthree_attribute_peek_point3d_at (position, i + 2), &pC);
-
-          graphene_vec3_subtract (&pC, &pB, &cb);
-          graphene_vec3_subtract (&pA, &pB, &ab);
-          graphene_vec3_cross (&cb, &ab, &cb);
-
-          nA = gthree_attribute_peek_point3d_at (normal, i + 0);
-          nA->x += graphene_vec3_get_x (&cb);
-          nA->y += graphene_vec3_get_y (&cb);
-          nA->z += graphene_vec3_get_z (&cb);
-
-          nB = gthree_attribute_peek_point3d_at (normal, i + 1);
-          nB->x += graphene_vec3_get_x (&cb);
-          nB->y += graphene_vec3_get_y (&cb);
-          nB->z += graphene_vec3_get_z (&cb);
-
-          nC = gthree_attribute_peek_point3d_at (normal, i + 2);
-          nC->x += graphene_vec3_get_x (&cb);
-          nC->y += graphene_vec3_get_y (&cb);
-          nC->z += graphene_vec3_get_z (&cb);
+          GthreeGeometryGroup *group = &g_array_index (priv->groups, GthreeGeometryGroup, i);
+          if (group->start < end || group->start % 3 != 0 ||
+              group->start + group->count > n_indices)
+            return;
+          end = group->start + group->count;
+        }
+
+      for (i = 0; i < priv->groups->len; i++)
+        {
+          GthreeGeometryGroup *group = &g_array_index (priv->groups, GthreeGeometryGroup, i);
+          tipsify (indices + group->start, group->count / 3, n_vertices, VERTEX_CACHE_SIZE);
         }
     }
 
-  gthree_geometry_normalize_normals (geometry);
-  gthree_attribute_set_needs_update (normal);
+  reorder_vertices (geometry, indices, n_indices, n_vertices);
+
+  new_index = gthree_attribute_new ("index", gthree_attribute_get_attribute_type (priv->index),
+                                    n_indices, 1, FALSE);
+  for (i = 0; i < n_indices; i++)
+    gthree_attribute_set_uint (new_index, i, indices[i]);
+  gthree_geometry_set_index (geometry, new_index);
+
+  if (acmr_after)
+    *acmr_after = gthree_geometry_compute_acmr (geometry, VERTEX_CACHE_SIZE);
 }
 
 void
@@ -667,6 +1404,12 @@ gthree_geometry_update (GthreeGeometry *geometry)
   GthreeGeometryPrivate *priv = gthree_geometry_get_instance_private (geometry);
   GthreeAttribute *attribute;
   GHashTableIter iter;
+  guint epoch = gthree_get_frame_epoch ();
+
+  /* Shared geometries only need to be checked once per frame */
+  if (epoch != 0 && priv->update_epoch == epoch)
+    return;
+  priv->update_epoch = epoch;
 
   if (priv->index)
     gthree_attribute_update (priv->index, GL_ELEMENT_ARRAY_BUFFER);
@@ -675,10 +1418,7 @@ gthree_geometry_update (GthreeGeometry *geometry)
 
   g_hash_table_iter_init (&iter, priv->attributes);
   while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&attribute))
-    {
-      // TODO: Only do this once per frame
-      gthree_attribute_update (attribute, GL_ARRAY_BUFFER);
-    }
+    gthree_attribute_update (attribute, GL_ARRAY_BUFFER);
 
   if (priv->morph_attributes != NULL)
     {
@@ -694,7 +1434,6 @@ gthree_geometry_update (GthreeGeometry *geometry)
             {
               GthreeAttribute *attribute = g_ptr_array_index (array, i);
 
-              // TODO: Only do this once per frame
               gthree_attribute_update (attribute, GL_ARRAY_BUFFER);
             }
         }
@@ -81,6 +81,12 @@ void                     gthree_geometry_set_index                  (GthreeGeome
 GTHREE_API
 GthreeAttribute *        gthree_geometry_get_index                  (GthreeGeometry          *geometry);
 GTHREE_API
+void                     gthree_geometry_set_index_from_uint32      (GthreeGeometry          *geometry,
+                                                                     const guint32           *indices,
+                                                                     int                      count);
+GTHREE_API
+void                     gthree_geometry_compact_index              (GthreeGeometry          *geometry);
+GTHREE_API
 GthreeAttribute *        gthree_geometry_get_wireframe_index        (GthreeGeometry          *geometry);
 GTHREE_API
 void                     gthree_geometry_add_morph_attribute        (GthreeGeometry          *geometry,
@@ -90,6 +96,8 @@ GTHREE_API
 void                     gthree_geometry_remove_morph_attributes    (GthreeGeometry          *geometry,
                                                                      const char              *name);
 GTHREE_API
+GList *                  gthree_geometry_get_attribute_names        (GthreeGeometry          *geometry);
+GTHREE_API
 GPtrArray *              gthree_geometry_get_morph_attributes       (GthreeGeometry          *geometry,
                                                                      const char              *name);
 GTHREE_API
@@ -133,6 +141,22 @@ void                     gthree_geometry_set_bounding_box           (GthreeGeome
 void                     gthree_geometry_compute_vertex_normals     (GthreeGeometry          *geometry);
 GTHREE_API
 void                     gthree_geometry_normalize_normals          (GthreeGeometry          *geometry);
+GTHREE_API
+void                     gthree_geometry_compute_tangents           (GthreeGeometry          *geometry);
+GTHREE_API
+void                     gthree_geometry_optimize_layout            (GthreeGeometry          *geometry,
+                                                                     gboolean                 quantize);
+GTHREE_API
+float                    gthree_geometry_compute_acmr               (GthreeGeometry          *geometry,
+                                                                     int                      cache_size);
+GTHREE_API
+void                     gthree_geometry_optimize_vertex_cache      (GthreeGeometry          *geometry,
+                                                                     float                   *acmr_before,
+                                                                     float                   *acmr_after);
+GTHREE_API
+GthreeGeometry *         gthree_geometry_simplify                   (GthreeGeometry          *geometry,
+                                                                     float                    ratio,
+                                                                     float                    max_error);
 
 
 G_END_DECLS
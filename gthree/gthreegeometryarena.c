@@ -0,0 +1,628 @@
+#include <string.h>
+#include <epoxy/gl.h>
+
+#include "gthreeprivate.h"
+
+/* Shared vertex and index buffers for multi drawing distinct geometries.
+ *
+ * Geometries with the same attribute layout (names, types and sizes)
+ * are copied into one arena, a geometry with large attributes and a
+ * 32bit index. Each geometry gets a range of vertices and of indices,
+ * its indices are kept relative to its own first vertex, so a draw of
+ * it uses the base vertex and first index of its ranges. All the
+ * geometries in an arena can then be drawn with a single vertex array
+ * object and one indirect multi draw call.
+ *
+ * Ranges are allocated at the end of the arena, which grows (keeping
+ * the offsets) when it is full. Ranges of geometries that are gone,
+ * changed size or weren't drawn for a while are reclaimed by
+ * compacting the arena between frames, which moves the other ranges.
+ */
+
+#define ARENA_MIN_VERTICES 65536
+#define ARENA_MIN_INDICES (3 * 65536)
+/* Larger geometries gain nothing from sharing buffers */
+#define ARENA_MAX_GEOMETRY_VERTICES (1 << 20)
+/* Geometries not drawn for this many frames are dropped */
+#define ARENA_MAX_AGE 300
+
+typedef struct {
+  const char *name; /* interned */
+  GthreeAttributeType type;
+  int item_size;
+  gboolean normalized;
+} ArenaAttribute;
+
+typedef struct {
+  GArray *attributes; /* ArenaAttribute */
+  GthreeGeometry *geometry;
+  int vertex_capacity;
+  int n_vertices;
+  int index_capacity;
+  int n_indices;
+  int wasted_vertices;
+  int wasted_indices;
+  int n_entries;
+} GthreeGeometryArena;
+
+typedef struct {
+  GthreeGeometryArena *arena;
+  GthreeGeometry *geometry; /* Not owned, weakly referenced */
+  int base_vertex;
+  int n_vertices;
+  int first_index;
+  int n_indices;
+  guint layout_version;
+  guint content_version;
+  guint last_used;
+} ArenaEntry;
+
+struct _GthreeGeometryArenas {
+  GHashTable *arenas;   /* layout string -> GthreeGeometryArena */
+  GHashTable *entries;  /* GthreeGeometry -> ArenaEntry */
+  GHashTable *rejected; /* GthreeGeometry -> layout version + 1 */
+};
+
+static void
+arena_free (gpointer data)
+{
+  GthreeGeometryArena *arena = data;
+
+  g_array_unref (arena->attributes);
+  g_object_unref (arena->geometry);
+  g_free (arena);
+}
+
+static void geometry_finalized (gpointer data,
+                                GObject *where_the_object_was);
+
+static void
+remove_entry (GthreeGeometryArenas *arenas,
+              ArenaEntry           *entry,
+              gboolean              finalized)
+{
+  GthreeGeometryArena *arena = entry->arena;
+
+  arena->wasted_vertices += entry->n_vertices;
+  arena->wasted_indices += entry->n_indices;
+  arena->n_entries--;
+
+  if (!finalized)
+    g_object_weak_unref (G_OBJECT (entry->geometry), geometry_finalized, arenas);
+
+  g_hash_table_remove (arenas->entries, entry->geometry);
+}
+
+static void
+geometry_finalized (gpointer data,
+                    GObject *where_the_object_was)
+{
+  GthreeGeometryArenas *arenas = data;
+  ArenaEntry *entry = g_hash_table_lookup (arenas->entries, where_the_object_was);
+
+  if (entry)
+    remove_entry (arenas, entry, TRUE);
+  g_hash_table_remove (arenas->rejected, where_the_object_was);
+}
+
+GthreeGeometryArenas *
+gthree_geometry_arenas_new (void)
+{
+  GthreeGeometryArenas *arenas = g_new0 (GthreeGeometryArenas, 1);
+
+  arenas->arenas = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, arena_free);
+  arenas->entries = g_hash_table_new_full (NULL, NULL, NULL, g_free);
+  arenas->rejected = g_hash_table_new (NULL, NULL);
+
+  return arenas;
+}
+
+void
+gthree_geometry_arenas_free (GthreeGeometryArenas *arenas)
+{
+  GHashTableIter iter;
+  gpointer key;
+
+  g_hash_table_iter_init (&iter, arenas->entries);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    g_object_weak_unref (G_OBJECT (key), geometry_finalized, arenas);
+
+  g_hash_table_iter_init (&iter, arenas->rejected);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    g_object_weak_unref (G_OBJECT (key), geometry_finalized, arenas);
+
+  g_hash_table_unref (arenas->entries);
+  g_hash_table_unref (arenas->rejected);
+  g_hash_table_unref (arenas->arenas);
+  g_free (arenas);
+}
+
+static gint
+compare_names (gconstpointer a,
+               gconstpointer b)
+{
+  return strcmp (*(const char **)a, *(const char **)b);
+}
+
+/* Returns the sorted attribute names of geometry, if all its attributes
+ * are per vertex */
+static GPtrArray *
+get_vertex_attribute_names (GthreeGeometry *geometry)
+{
+  GthreeAttribute *position = gthree_geometry_get_position (geometry);
+  GList *names, *l;
+  GPtrArray *sorted;
+  int n_vertices;
+
+  if (position == NULL || gthree_geometry_has_morph_attributes (geometry))
+    return NULL;
+
+  n_vertices = gthree_attribute_get_count (position);
+  if (n_vertices <= 0 || n_vertices > ARENA_MAX_GEOMETRY_VERTICES)
+    return NULL;
+
+  sorted = g_ptr_array_new ();
+  names = gthree_geometry_get_attribute_names (geometry);
+  for (l = names; l != NULL; l = l->next)
+    {
+      GthreeAttribute *attribute = gthree_geometry_get_attribute (geometry, l->data);
+
+      if (gthree_attribute_get_divisor (attribute) != 0 ||
+          gthree_attribute_get_count (attribute) != n_vertices)
+        {
+          g_list_free (names);
+          g_ptr_array_unref (sorted);
+          return NULL;
+        }
+
+      g_ptr_array_add (sorted, l->data);
+    }
+  g_list_free (names);
+  g_ptr_array_sort (sorted, compare_names);
+
+  return sorted;
+}
+
+static char *
+get_layout (GthreeGeometry *geometry,
+            GPtrArray      *names)
+{
+  GString *s = g_string_new ("");
+  guint i;
+
+  for (i = 0; i < names->len; i++)
+    {
+      const char *name = g_ptr_array_index (names, i);
+      GthreeAttribute *attribute = gthree_geometry_get_attribute (geometry, name);
+
+      g_string_append_printf (s, "%s:%d:%d:%d;", name,
+                              gthree_attribute_get_attribute_type (attribute),
+                              gthree_attribute_get_item_size (attribute),
+                              gthree_attribute_get_normalized (attribute));
+    }
+
+  return g_string_free (s, FALSE);
+}
+
+static guint
+get_content_version (GthreeGeometry      *geometry,
+                     GthreeGeometryArena *arena)
+{
+  GthreeAttribute *index = gthree_geometry_get_index (geometry);
+  guint version = 0;
+  guint i;
+
+  /* Versions only go up, so the sum changes when any of them does */
+  for (i = 0; i < arena->attributes->len; i++)
+    {
+      ArenaAttribute *a = &g_array_index (arena->attributes, ArenaAttribute, i);
+      version += gthree_attribute_get_version (gthree_geometry_get_attribute (geometry, a->name));
+    }
+
+  if (index)
+    version += gthree_attribute_get_version (index);
+
+  return version;
+}
+
+/* Replaces the buffers of the arena by ones with room for n_vertices
+ * and n_indices, copying the ranges in entries to the start of them */
+static void
+arena_resize (GthreeGeometryArena *arena,
+              int                  vertex_capacity,
+              int                  index_capacity,
+              GPtrArray           *entries)
+{
+  GthreeAttribute *old_index = gthree_geometry_get_index (arena->geometry);
+  g_autoptr(GthreeAttribute) index = NULL;
+  int n_vertices, n_indices;
+  guint i, e;
+
+  for (i = 0; i < arena->attributes->len; i++)
+    {
+      ArenaAttribute *a = &g_array_index (arena->attributes, ArenaAttribute, i);
+      GthreeAttribute *old = gthree_geometry_get_attribute (arena->geometry, a->name);
+      g_autoptr(GthreeAttribute) attribute = NULL;
+
+      attribute = gthree_attribute_new (a->name, a->type, vertex_capacity, a->item_size, a->normalized);
+
+      n_vertices = 0;
+      for (e = 0; old != NULL && e < entries->len; e++)
+        {
+          ArenaEntry *entry = g_ptr_array_index (entries, e);
+
+          gthree_attribute_array_copy_at (gthree_attribute_get_array (attribute), n_vertices, 0,
+                                          gthree_attribute_get_array (old), entry->base_vertex, 0,
+                                          a->item_size, entry->n_vertices);
+          n_vertices += entry->n_vertices;
+        }
+
+      gthree_geometry_add_attribute (arena->geometry, a->name, attribute);
+    }
+
+  index = gthree_attribute_new ("index", GTHREE_ATTRIBUTE_TYPE_UINT32, index_capacity, 1, FALSE);
+
+  n_vertices = 0;
+  n_indices = 0;
+  for (e = 0; e < entries->len; e++)
+    {
+      ArenaEntry *entry = g_ptr_array_index (entries, e);
+
+      if (old_index != NULL)
+        gthree_attribute_array_copy_at (gthree_attribute_get_array (index), n_indices, 0,
+                                        gthree_attribute_get_array (old_index), entry->first_index, 0,
+                                        1, entry->n_indices);
+
+      entry->base_vertex = n_vertices;
+      entry->first_index = n_indices;
+      n_vertices += entry->n_vertices;
+      n_indices += entry->n_indices;
+    }
+
+  gthree_geometry_set_index (arena->geometry, index);
+
+  arena->vertex_capacity = vertex_capacity;
+  arena->index_capacity = index_capacity;
+  arena->n_vertices = n_vertices;
+  arena->n_indices = n_indices;
+  arena->wasted_vertices = 0;
+  arena->wasted_indices = 0;
+}
+
+static GPtrArray *
+get_arena_entries (GthreeGeometryArenas *arenas,
+                   GthreeGeometryArena  *arena)
+{
+  GPtrArray *entries = g_ptr_array_new ();
+  GHashTableIter iter;
+  ArenaEntry *entry;
+
+  g_hash_table_iter_init (&iter, arenas->entries);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&entry))
+    {
+      if (entry->arena == arena)
+        g_ptr_array_add (entries, entry);
+    }
+
+  return entries;
+}
+
+static gint
+compare_entry_offsets (gconstpointer a,
+                       gconstpointer b)
+{
+  const ArenaEntry *aa = *(const ArenaEntry **)a;
+  const ArenaEntry *bb = *(const ArenaEntry **)b;
+
+  return aa->base_vertex - bb->base_vertex;
+}
+
+/* Makes room for n_vertices and n_indices more, keeping all offsets */
+static void
+arena_reserve (GthreeGeometryArena *arena,
+               int                  n_vertices,
+               int                  n_indices)
+{
+  g_autoptr(GPtrArray) entries = NULL;
+  int vertex_capacity = arena->vertex_capacity;
+  int index_capacity = arena->index_capacity;
+  ArenaEntry used = { NULL };
+  int wasted_vertices = arena->wasted_vertices;
+  int wasted_indices = arena->wasted_indices;
+
+  if (arena->n_vertices + n_vertices <= vertex_capacity &&
+      arena->n_indices + n_indices <= index_capacity)
+    return;
+
+  while (arena->n_vertices + n_vertices > vertex_capacity)
+    vertex_capacity = MAX (vertex_capacity * 2, ARENA_MIN_VERTICES);
+  while (arena->n_indices + n_indices > index_capacity)
+    index_capacity = MAX (index_capacity * 2, ARENA_MIN_INDICES);
+
+  /* Copy everything used so far as one range, so nothing moves */
+  used.n_vertices = arena->n_vertices;
+  used.n_indices = arena->n_indices;
+  entries = g_ptr_array_new ();
+  g_ptr_array_add (entries, &used);
+
+  arena_resize (arena, vertex_capacity, index_capacity, entries);
+  arena->wasted_vertices = wasted_vertices;
+  arena->wasted_indices = wasted_indices;
+}
+
+/* Copies the vertices and indices of geometry into the range of entry,
+ * returns FALSE if the indices are out of range */
+static gboolean
+arena_copy (GthreeGeometryArena *arena,
+            ArenaEntry          *entry,
+            GthreeGeometry      *geometry)
+{
+  GthreeAttribute *source_index = gthree_geometry_get_index (geometry);
+  GthreeAttribute *index = gthree_geometry_get_index (arena->geometry);
+  guint32 *indices;
+  int i;
+
+  if (entry->n_indices > 0)
+    {
+      indices = gthree_attribute_peek_uint32_at (index, entry->first_index);
+      for (i = 0; i < entry->n_indices; i++)
+        {
+          guint32 v = source_index ? gthree_attribute_get_uint (source_index, i) : (guint32)i;
+
+          if (v >= (guint32)entry->n_vertices)
+            return FALSE;
+          indices[i] = v;
+        }
+      gthree_attribute_set_needs_update_range (index, entry->first_index, entry->n_indices);
+    }
+
+  for (i = 0; i < arena->attributes->len; i++)
+    {
+      ArenaAttribute *a = &g_array_index (arena->attributes, ArenaAttribute, i);
+      GthreeAttribute *from = gthree_geometry_get_attribute (geometry, a->name);
+      GthreeAttribute *to = gthree_geometry_get_attribute (arena->geometry, a->name);
+
+      gthree_attribute_array_copy_at (gthree_attribute_get_array (to), entry->base_vertex, 0,
+                                      gthree_attribute_get_array (from), 0,
+                                      gthree_attribute_get_item_offset (from),
+                                      a->item_size, entry->n_vertices);
+      gthree_attribute_set_needs_update_range (to, entry->base_vertex, entry->n_vertices);
+    }
+
+  return TRUE;
+}
+
+static GthreeGeometryArena *
+get_arena (GthreeGeometryArenas *arenas,
+           GthreeGeometry       *geometry,
+           GPtrArray            *names)
+{
+  g_autofree char *layout = get_layout (geometry, names);
+  GthreeGeometryArena *arena;
+  guint i;
+
+  arena = g_hash_table_lookup (arenas->arenas, layout);
+  if (arena)
+    return arena;
+
+  arena = g_new0 (GthreeGeometryArena, 1);
+  arena->attributes = g_array_new (FALSE, FALSE, sizeof (ArenaAttribute));
+  arena->geometry = gthree_geometry_new ();
+
+  for (i = 0; i < names->len; i++)
+    {
+      GthreeAttribute *attribute = gthree_geometry_get_attribute (geometry, g_ptr_array_index (names, i));
+      ArenaAttribute a;
+
+      a.name = g_intern_string (g_ptr_array_index (names, i));
+      a.type = gthree_attribute_get_attribute_type (attribute);
+      a.item_size = gthree_attribute_get_item_size (attribute);
+      a.normalized = gthree_attribute_get_normalized (attribute);
+      g_array_append_val (arena->attributes, a);
+    }
+
+  g_hash_table_insert (arenas->arenas, g_steal_pointer (&layout), arena);
+
+  return arena;
+}
+
+static void
+reject (GthreeGeometryArenas *arenas,
+        GthreeGeometry       *geometry)
+{
+  if (!g_hash_table_contains (arenas->rejected, geometry))
+    g_object_weak_ref (G_OBJECT (geometry), geometry_finalized, arenas);
+
+  g_hash_table_insert (arenas->rejected, geometry,
+                       GUINT_TO_POINTER (gthree_geometry_get_layout_version (geometry) + 1));
+}
+
+static gboolean
+is_rejected (GthreeGeometryArenas *arenas,
+             GthreeGeometry       *geometry)
+{
+  gpointer version = g_hash_table_lookup (arenas->rejected, geometry);
+
+  return version != NULL &&
+    GPOINTER_TO_UINT (version) == gthree_geometry_get_layout_version (geometry) + 1;
+}
+
+/* Whether geometry can be drawn from an arena, without adding it */
+gboolean
+gthree_geometry_arenas_can_hold (GthreeGeometryArenas *arenas,
+                                 GthreeGeometry       *geometry)
+{
+  ArenaEntry *entry = g_hash_table_lookup (arenas->entries, geometry);
+  g_autoptr(GPtrArray) names = NULL;
+
+  if (entry != NULL && entry->layout_version == gthree_geometry_get_layout_version (geometry))
+    return TRUE;
+
+  if (is_rejected (arenas, geometry))
+    return FALSE;
+
+  names = get_vertex_attribute_names (geometry);
+  return names != NULL;
+}
+
+/* Makes sure geometry is in an arena, with its current content, and
+ * returns its place there. The places stay valid until the next
+ * gthree_geometry_arenas_begin_frame(). */
+gboolean
+gthree_geometry_arenas_lookup (GthreeGeometryArenas *arenas,
+                               GthreeGeometry       *geometry,
+                               guint                 frame,
+                               GthreeArenaSlot      *slot)
+{
+  ArenaEntry *entry = g_hash_table_lookup (arenas->entries, geometry);
+  GthreeGeometryArena *arena;
+  GthreeAttribute *index;
+  int n_vertices, n_indices;
+
+  if (entry != NULL && entry->layout_version != gthree_geometry_get_layout_version (geometry))
+    {
+      remove_entry (arenas, entry, FALSE);
+      entry = NULL;
+    }
+
+  if (entry == NULL)
+    {
+      g_autoptr(GPtrArray) names = NULL;
+
+      if (is_rejected (arenas, geometry))
+        return FALSE;
+
+      names = get_vertex_attribute_names (geometry);
+      if (names == NULL)
+        {
+          reject (arenas, geometry);
+          return FALSE;
+        }
+
+      arena = get_arena (arenas, geometry, names);
+
+      entry = g_new0 (ArenaEntry, 1);
+      entry->arena = arena;
+      entry->geometry = geometry;
+      entry->layout_version = gthree_geometry_get_layout_version (geometry);
+      entry->content_version = get_content_version (geometry, arena) - 1;
+      g_hash_table_insert (arenas->entries, geometry, entry);
+      g_hash_table_remove (arenas->rejected, geometry);
+      g_object_weak_ref (G_OBJECT (geometry), geometry_finalized, arenas);
+      arena->n_entries++;
+    }
+
+  arena = entry->arena;
+
+  if (entry->content_version != get_content_version (geometry, arena))
+    {
+      index = gthree_geometry_get_index (geometry);
+      n_vertices = gthree_geometry_get_position_count (geometry);
+      n_indices = index ? gthree_attribute_get_count (index) : n_vertices;
+
+      /* Changed size, so it needs a new range */
+      if (n_vertices != entry->n_vertices || n_indices != entry->n_indices)
+        {
+          arena->wasted_vertices += entry->n_vertices;
+          arena->wasted_indices += entry->n_indices;
+
+          arena_reserve (arena, n_vertices, n_indices);
+          entry->base_vertex = arena->n_vertices;
+          entry->first_index = arena->n_indices;
+          entry->n_vertices = n_vertices;
+          entry->n_indices = n_indices;
+          arena->n_vertices += n_vertices;
+          arena->n_indices += n_indices;
+        }
+
+      if (!arena_copy (arena, entry, geometry))
+        {
+          remove_entry (arenas, entry, FALSE);
+          reject (arenas, geometry);
+          return FALSE;
+        }
+
+      entry->content_version = get_content_version (geometry, arena);
+    }
+
+  entry->last_used = frame;
+
+  slot->geometry = arena->geometry;
+  slot->base_vertex = entry->base_vertex;
+  slot->first_index = entry->first_index;
+
+  return TRUE;
+}
+
+/* Drops geometries that weren't drawn for a while, and compacts (or
+ * frees) arenas that are mostly unused space */
+void
+gthree_geometry_arenas_begin_frame (GthreeGeometryArenas *arenas,
+                                    guint                 frame)
+{
+  GHashTableIter iter;
+  GthreeGeometryArena *arena;
+  ArenaEntry *entry;
+
+  g_hash_table_iter_init (&iter, arenas->entries);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&entry))
+    {
+      if (frame - entry->last_used > ARENA_MAX_AGE)
+        {
+          entry->arena->wasted_vertices += entry->n_vertices;
+          entry->arena->wasted_indices += entry->n_indices;
+          entry->arena->n_entries--;
+          g_object_weak_unref (G_OBJECT (entry->geometry), geometry_finalized, arenas);
+          g_hash_table_iter_remove (&iter);
+        }
+    }
+
+  g_hash_table_iter_init (&iter, arenas->arenas);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&arena))
+    {
+      g_autoptr(GPtrArray) entries = NULL;
+
+      if (arena->n_entries == 0)
+        {
+          g_hash_table_iter_remove (&iter);
+          continue;
+        }
+
+      if (arena->wasted_vertices * 2 <= arena->n_vertices &&
+          arena->wasted_indices * 2 <= arena->n_indices)
+        continue;
+
+      entries = get_arena_entries (arenas, arena);
+      g_ptr_array_sort (entries, compare_entry_offsets);
+      arena_resize (arena,
+                    MAX ((arena->n_vertices - arena->wasted_vertices) * 2, ARENA_MIN_VERTICES),
+                    MAX ((arena->n_indices - arena->wasted_indices) * 2, ARENA_MIN_INDICES),
+                    entries);
+    }
+}
+
+/* Uploads what changed in all the arenas */
+void
+gthree_geometry_arenas_upload (GthreeGeometryArenas *arenas)
+{
+  GHashTableIter iter;
+  GthreeGeometryArena *arena;
+
+  g_hash_table_iter_init (&iter, arenas->arenas);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&arena))
+    {
+      guint i;
+
+      for (i = 0; i < arena->attributes->len; i++)
+        {
+          ArenaAttribute *a = &g_array_index (arena->attributes, ArenaAttribute, i);
+          GthreeAttribute *attribute = gthree_geometry_get_attribute (arena->geometry, a->name);
+
+          if (attribute)
+            gthree_attribute_update (attribute, GL_ARRAY_BUFFER);
+        }
+
+      if (gthree_geometry_get_index (arena->geometry))
+        gthree_attribute_update (gthree_geometry_get_index (arena->geometry), GL_ELEMENT_ARRAY_BUFFER);
+    }
+}
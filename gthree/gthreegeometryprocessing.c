@@ -0,0 +1,595 @@
+#include <math.h>
+#include <string.h>
+
+#include "gthreeprivate.h"
+#include "gthreeattribute.h"
+
+/* Threaded per-vertex and per-triangle passes used by GthreeGeometry.
+ *
+ * Work is split into slices of consecutive items. Passes that scatter
+ * into vertices (normals, tangents) give every slice its own array of
+ * partial sums, which are then added up in a second pass over the
+ * vertices. The inner loops work on plain float arrays so that the
+ * compiler can vectorize them.
+ */
+
+/* Smaller inputs are processed on the calling thread */
+#define PROCESS_CHUNK 32768
+/* Limits the memory used for partial sums */
+#define PROCESS_MAX_ACCUMULATE_SLICES 8
+
+typedef void (*ProcessFunc) (gpointer data,
+                             int      slice,
+                             int      start,
+                             int      end);
+
+typedef struct {
+  ProcessFunc func;
+  gpointer data;
+  int n_items;
+  int n_slices;
+} ProcessJob;
+
+static void
+process_slice (gpointer data,
+               int      s)
+{
+  ProcessJob *job = data;
+  int start = (int)((gint64) job->n_items * s / job->n_slices);
+  int end = (int)((gint64) job->n_items * (s + 1) / job->n_slices);
+
+  job->func (job->data, s, start, end);
+}
+
+static int
+process_get_n_slices (int n_items,
+                      int max_slices)
+{
+  int n_slices;
+
+  n_slices = MIN ((n_items + PROCESS_CHUNK - 1) / PROCESS_CHUNK, gthree_parallel_get_n_threads ());
+  if (max_slices > 0)
+    n_slices = MIN (n_slices, max_slices);
+
+  return MAX (n_slices, 1);
+}
+
+/* Calls func for each slice, and returns when all are done */
+static void
+process_parallel (ProcessFunc func,
+                  gpointer    data,
+                  int         n_items,
+                  int         n_slices)
+{
+  ProcessJob job = { func, data, n_items, n_slices };
+
+  if (n_slices <= 1)
+    {
+      func (data, 0, 0, n_items);
+      return;
+    }
+
+  gthree_parallel_for (n_slices, process_slice, &job);
+}
+
+/* Returns the vertex data with item_size floats per vertex, either
+ * directly or as a converted copy in *copy */
+static const float *
+read_floats (GthreeAttribute *attribute,
+             int              item_size,
+             int             *stride,
+             float          **copy)
+{
+  GthreeAttributeArray *array = gthree_attribute_get_array (attribute);
+  int count = gthree_attribute_get_count (attribute);
+  int offset = gthree_attribute_get_item_offset (attribute);
+  gboolean snorm = FALSE;
+  float *f;
+  int i, k;
+
+  *copy = NULL;
+
+  if (gthree_attribute_array_get_attribute_type (array) == GTHREE_ATTRIBUTE_TYPE_FLOAT)
+    {
+      *stride = gthree_attribute_get_stride (attribute);
+      return gthree_attribute_read_float (attribute);
+    }
+
+  /* Quantized data, as made by gthree_geometry_optimize_layout() */
+  if (gthree_attribute_get_normalized (attribute) &&
+      gthree_attribute_array_get_attribute_type (array) == GTHREE_ATTRIBUTE_TYPE_INT16)
+    snorm = TRUE;
+
+  f = g_new (float, (gsize) count * item_size);
+  for (i = 0; i < count; i++)
+    {
+      gthree_attribute_array_get_elements_as_float (array, i, offset, f + i * item_size, item_size);
+      if (snorm)
+        for (k = 0; k < item_size; k++)
+          f[i * item_size + k] = MAX (f[i * item_size + k] / 32767.0f, -1.0f);
+    }
+
+  *stride = item_size;
+  *copy = f;
+  return f;
+}
+
+/* Returns the indices, either directly or as a converted copy in
+ * *copy, and the largest one in *max_index */
+static const guint32 *
+read_indices (GthreeAttribute *index,
+              guint32        **copy,
+              guint32         *max_index)
+{
+  int count = gthree_attribute_get_count (index);
+  const guint32 *indices;
+  guint32 max = 0;
+  int i;
+
+  *copy = NULL;
+
+  if (gthree_attribute_get_attribute_type (index) == GTHREE_ATTRIBUTE_TYPE_UINT32 &&
+      gthree_attribute_get_stride (index) == 1)
+    indices = gthree_attribute_read_uint32 (index);
+  else
+    {
+      *copy = g_new (guint32, count);
+      for (i = 0; i < count; i++)
+        (*copy)[i] = gthree_attribute_get_uint (index, i);
+      indices = *copy;
+    }
+
+  for (i = 0; i < count; i++)
+    max = MAX (max, indices[i]);
+
+  *max_index = max;
+  return indices;
+}
+
+typedef struct {
+  const float *position;
+  int position_stride;
+  const float *normal;
+  int normal_stride;
+  const float *uv;
+  int uv_stride;
+  const guint32 *index;
+  int n_vertices;
+
+  /* Per slice sums, n_components floats per vertex */
+  int n_components;
+  int n_slices;
+  float **sums;
+
+  float *out;
+  int out_stride;
+} AccumulateData;
+
+static inline void
+get_triangle (const AccumulateData *d,
+              int                   t,
+              guint32              *a,
+              guint32              *b,
+              guint32              *c)
+{
+  if (d->index)
+    {
+      *a = d->index[t * 3 + 0];
+      *b = d->index[t * 3 + 1];
+      *c = d->index[t * 3 + 2];
+    }
+  else
+    {
+      *a = t * 3 + 0;
+      *b = t * 3 + 1;
+      *c = t * 3 + 2;
+    }
+}
+
+static float *
+accumulate_get_sums (AccumulateData *d,
+                     int             slice)
+{
+  /* Allocated by the slice itself so that the clearing is spread out too */
+  d->sums[slice] = g_malloc0 (sizeof (float) * d->n_components * d->n_vertices);
+  return d->sums[slice];
+}
+
+static void
+accumulate_normals (gpointer data,
+                    int      slice,
+                    int      start,
+                    int      end)
+{
+  AccumulateData *d = data;
+  float *sums = accumulate_get_sums (d, slice);
+  const float *pos = d->position;
+  int ps = d->position_stride;
+  int t;
+
+  for (t = start; t < end; t++)
+    {
+      guint32 a, b, c;
+      const float *pa, *pb, *pc;
+      float cb[3], ab[3], n[3];
+      int k;
+
+      get_triangle (d, t, &a, &b, &c);
+      pa = pos + a * ps;
+      pb = pos + b * ps;
+      pc = pos + c * ps;
+
+      for (k = 0; k < 3; k++)
+        {
+          cb[k] = pc[k] - pb[k];
+          ab[k] = pa[k] - pb[k];
+        }
+
+      /* Area weighted, as the cross product is not normalized */
+      n[0] = cb[1] * ab[2] - cb[2] * ab[1];
+      n[1] = cb[2] * ab[0] - cb[0] * ab[2];
+      n[2] = cb[0] * ab[1] - cb[1] * ab[0];
+
+      for (k = 0; k < 3; k++)
+        {
+          sums[a * 3 + k] += n[k];
+          sums[b * 3 + k] += n[k];
+          sums[c * 3 + k] += n[k];
+        }
+    }
+}
+
+static void
+reduce_sums (AccumulateData *d,
+             float          *dest,
+             int             start,
+             int             end)
+{
+  int nc = d->n_components;
+  int s, i;
+
+  memcpy (dest, d->sums[0] + (gsize) start * nc, sizeof (float) * (end - start) * nc);
+  for (s = 1; s < d->n_slices; s++)
+    {
+      const float *src = d->sums[s] + (gsize) start * nc;
+
+      for (i = 0; i < (end - start) * nc; i++)
+        dest[i] += src[i];
+    }
+}
+
+#define REDUCE_BLOCK 1024
+
+static void
+reduce_normals (gpointer data,
+                int      slice,
+                int      start,
+                int      end)
+{
+  AccumulateData *d = data;
+  float block[REDUCE_BLOCK * 3];
+  int b, i;
+
+  for (b = start; b < end; b += REDUCE_BLOCK)
+    {
+      int block_end = MIN (b + REDUCE_BLOCK, end);
+
+      reduce_sums (d, block, b, block_end);
+
+      for (i = b; i < block_end; i++)
+        {
+          const float *n = block + (i - b) * 3;
+          float *out = d->out + (gsize) i * d->out_stride;
+          float len_sq = n[0] * n[0] + n[1] * n[1] + n[2] * n[2];
+          float scale = len_sq > 0 ? 1.0f / sqrtf (len_sq) : 0;
+
+          out[0] = n[0] * scale;
+          out[1] = n[1] * scale;
+          out[2] = n[2] * scale;
+        }
+    }
+}
+
+static void
+accumulate_tangents (gpointer data,
+                     int      slice,
+                     int      start,
+                     int      end)
+{
+  AccumulateData *d = data;
+  float *sums = accumulate_get_sums (d, slice);
+  int t;
+
+  for (t = start; t < end; t++)
+    {
+      guint32 a, b, c;
+      const float *pa, *pb, *pc, *ua, *ub, *uc;
+      float e1[3], e2[3], sdir[3], tdir[3];
+      float s1, s2, t1, t2, det, r;
+      int k;
+
+      get_triangle (d, t, &a, &b, &c);
+      pa = d->position + a * d->position_stride;
+      pb = d->position + b * d->position_stride;
+      pc = d->position + c * d->position_stride;
+      ua = d->uv + a * d->uv_stride;
+      ub = d->uv + b * d->uv_stride;
+      uc = d->uv + c * d->uv_stride;
+
+      for (k = 0; k < 3; k++)
+        {
+          e1[k] = pb[k] - pa[k];
+          e2[k] = pc[k] - pa[k];
+        }
+
+      s1 = ub[0] - ua[0];
+      s2 = uc[0] - ua[0];
+      t1 = ub[1] - ua[1];
+      t2 = uc[1] - ua[1];
+
+      /* Skip triangles with degenerate uv mapping */
+      det = s1 * t2 - s2 * t1;
+      if (fabsf (det) < 1e-20f)
+        continue;
+      r = 1.0f / det;
+
+      for (k = 0; k < 3; k++)
+        {
+          sdir[k] = (t2 * e1[k] - t1 * e2[k]) * r;
+          tdir[k] = (s1 * e2[k] - s2 * e1[k]) * r;
+        }
+
+      for (k = 0; k < 3; k++)
+        {
+          sums[a * 6 + k] += sdir[k];
+          sums[b * 6 + k] += sdir[k];
+          sums[c * 6 + k] += sdir[k];
+          sums[a * 6 + 3 + k] += tdir[k];
+          sums[b * 6 + 3 + k] += tdir[k];
+          sums[c * 6 + 3 + k] += tdir[k];
+        }
+    }
+}
+
+static void
+reduce_tangents (gpointer data,
+                 int      slice,
+                 int      start,
+                 int      end)
+{
+  AccumulateData *d = data;
+  float block[REDUCE_BLOCK * 6];
+  int b, i;
+
+  for (b = start; b < end; b += REDUCE_BLOCK)
+    {
+      int block_end = MIN (b + REDUCE_BLOCK, end);
+
+      reduce_sums (d, block, b, block_end);
+
+      for (i = b; i < block_end; i++)
+        {
+          const float *t = block + (i - b) * 6;
+          const float *t2 = t + 3;
+          const float *n = d->normal + (gsize) i * d->normal_stride;
+          float *out = d->out + (gsize) i * d->out_stride;
+          float nt, o[3], c[3], len_sq, scale;
+
+          /* Gram-Schmidt orthogonalize against the normal */
+          nt = n[0] * t[0] + n[1] * t[1] + n[2] * t[2];
+          o[0] = t[0] - n[0] * nt;
+          o[1] = t[1] - n[1] * nt;
+          o[2] = t[2] - n[2] * nt;
+          len_sq = o[0] * o[0] + o[1] * o[1] + o[2] * o[2];
+          scale = len_sq > 0 ? 1.0f / sqrtf (len_sq) : 0;
+
+          out[0] = o[0] * scale;
+          out[1] = o[1] * scale;
+          out[2] = o[2] * scale;
+
+          /* Handedness of the bitangent, as w */
+          c[0] = n[1] * t[2] - n[2] * t[1];
+          c[1] = n[2] * t[0] - n[0] * t[2];
+          c[2] = n[0] * t[1] - n[1] * t[0];
+          out[3] = (c[0] * t2[0] + c[1] * t2[1] + c[2] * t2[2]) < 0.0f ? -1.0f : 1.0f;
+        }
+    }
+}
+
+static void
+accumulate (AccumulateData  *d,
+            GthreeAttribute *index,
+            ProcessFunc      accumulate_func,
+            ProcessFunc      reduce_func)
+{
+  g_autofree guint32 *index_copy = NULL;
+  guint32 max_index;
+  int n_triangles, s;
+
+  if (index)
+    {
+      d->index = read_indices (index, &index_copy, &max_index);
+
+      /* The sums are only allocated for n_vertices */
+      if (gthree_attribute_get_count (index) > 0 && max_index >= (guint32) d->n_vertices)
+        {
+          g_warning ("Index %u out of range for %d vertices", max_index, d->n_vertices);
+          return;
+        }
+
+      n_triangles = gthree_attribute_get_count (index) / 3;
+    }
+  else
+    {
+      d->index = NULL;
+      n_triangles = d->n_vertices / 3;
+    }
+
+  d->n_slices = process_get_n_slices (n_triangles, PROCESS_MAX_ACCUMULATE_SLICES);
+  d->sums = g_new0 (float *, d->n_slices);
+
+  process_parallel (accumulate_func, d, n_triangles, d->n_slices);
+  process_parallel (reduce_func, d, d->n_vertices, process_get_n_slices (d->n_vertices, 0));
+
+  for (s = 0; s < d->n_slices; s++)
+    g_free (d->sums[s]);
+  g_free (d->sums);
+}
+
+/* normal must be a float attribute with the same count as position */
+void
+gthree_compute_vertex_normals (GthreeAttribute *position,
+                               GthreeAttribute *index,
+                               GthreeAttribute *normal)
+{
+  g_autofree float *position_copy = NULL;
+  AccumulateData d = { NULL };
+
+  d.position = read_floats (position, 3, &d.position_stride, &position_copy);
+  d.n_vertices = gthree_attribute_get_count (position);
+  d.n_components = 3;
+  d.out = gthree_attribute_peek_float (normal);
+  d.out_stride = gthree_attribute_get_stride (normal);
+
+  accumulate (&d, index, accumulate_normals, reduce_normals);
+}
+
+/* tangent must be a float attribute with item size 4 */
+void
+gthree_compute_tangents (GthreeAttribute *position,
+                         GthreeAttribute *normal,
+                         GthreeAttribute *uv,
+                         GthreeAttribute *index,
+                         GthreeAttribute *tangent)
+{
+  g_autofree float *position_copy = NULL;
+  g_autofree float *normal_copy = NULL;
+  g_autofree float *uv_copy = NULL;
+  AccumulateData d = { NULL };
+
+  d.position = read_floats (position, 3, &d.position_stride, &position_copy);
+  d.normal = read_floats (normal, 3, &d.normal_stride, &normal_copy);
+  d.uv = read_floats (uv, 2, &d.uv_stride, &uv_copy);
+  d.n_vertices = gthree_attribute_get_count (position);
+  d.n_components = 6;
+  d.out = gthree_attribute_peek_float (tangent);
+  d.out_stride = gthree_attribute_get_stride (tangent);
+
+  accumulate (&d, index, accumulate_tangents, reduce_tangents);
+}
+
+typedef struct {
+  const float *position;
+  int stride;
+  float center[3];
+  float *results; /* Per slice min/max, or max radius */
+} BoundsData;
+
+static void
+compute_slice_bounds (gpointer data,
+                      int      slice,
+                      int      start,
+                      int      end)
+{
+  BoundsData *d = data;
+  float mn[3] = { INFINITY, INFINITY, INFINITY };
+  float mx[3] = { -INFINITY, -INFINITY, -INFINITY };
+  int i, k;
+
+  for (i = start; i < end; i++)
+    {
+      const float *p = d->position + (gsize) i * d->stride;
+
+      for (k = 0; k < 3; k++)
+        {
+          mn[k] = fminf (mn[k], p[k]);
+          mx[k] = fmaxf (mx[k], p[k]);
+        }
+    }
+
+  memcpy (d->results + slice * 6, mn, sizeof (mn));
+  memcpy (d->results + slice * 6 + 3, mx, sizeof (mx));
+}
+
+/* Expands box to contain all the points in position */
+void
+gthree_compute_bounding_box (GthreeAttribute *position,
+                             graphene_box_t  *box)
+{
+  g_autofree float *position_copy = NULL;
+  int n_points = gthree_attribute_get_count (position);
+  BoundsData d = { NULL };
+  int n_slices, s;
+
+  if (n_points == 0)
+    return;
+
+  d.position = read_floats (position, 3, &d.stride, &position_copy);
+  n_slices = process_get_n_slices (n_points, 0);
+  d.results = g_new (float, n_slices * 6);
+
+  process_parallel (compute_slice_bounds, &d, n_points, n_slices);
+
+  for (s = 0; s < n_slices; s++)
+    {
+      graphene_vec3_t v;
+
+      graphene_vec3_init_from_float (&v, d.results + s * 6);
+      graphene_box_expand_vec3 (box, &v, box);
+      graphene_vec3_init_from_float (&v, d.results + s * 6 + 3);
+      graphene_box_expand_vec3 (box, &v, box);
+    }
+
+  g_free (d.results);
+}
+
+static void
+compute_slice_radius (gpointer data,
+                      int      slice,
+                      int      start,
+                      int      end)
+{
+  BoundsData *d = data;
+  float max_sq = 0;
+  int i;
+
+  for (i = start; i < end; i++)
+    {
+      const float *p = d->position + (gsize) i * d->stride;
+      float dx = p[0] - d->center[0];
+      float dy = p[1] - d->center[1];
+      float dz = p[2] - d->center[2];
+
+      max_sq = fmaxf (max_sq, dx * dx + dy * dy + dz * dz);
+    }
+
+  d->results[slice] = max_sq;
+}
+
+float
+gthree_compute_max_radius_sq (GthreeAttribute       *position,
+                              const graphene_vec3_t *center)
+{
+  g_autofree float *position_copy = NULL;
+  int n_points = gthree_attribute_get_count (position);
+  BoundsData d = { NULL };
+  float max_sq = 0;
+  int n_slices, s;
+
+  if (n_points == 0)
+    return 0;
+
+  d.position = read_floats (position, 3, &d.stride, &position_copy);
+  graphene_vec3_to_float (center, d.center);
+  n_slices = process_get_n_slices (n_points, 0);
+  d.results = g_new (float, n_slices);
+
+  process_parallel (compute_slice_radius, &d, n_points, n_slices);
+
+  for (s = 0; s < n_slices; s++)
+    max_sq = fmaxf (max_sq, d.results[s]);
+
+  g_free (d.results);
+
+  return max_sq;
+}
@@ -0,0 +1,406 @@
+#include <math.h>
+#include <epoxy/gl.h>
+
+#include "gthreeprivate.h"
+
+/* Culls the draws of a multi draw on the GPU, by zeroing the instance
+ * count of the indirect commands that are outside the frustum, or
+ * behind the depth of the previous frame.
+ *
+ * The occlusion test uses a depth pyramid, where each level holds the
+ * farthest depth of the texels it covers in the level below. A sphere
+ * is occluded if its nearest depth is behind the farthest depth of the
+ * (at most 3x3) texels of the level where its screen rect is about one
+ * texel big. */
+
+#define CULL_WORKGROUP_SIZE 64
+#define PYRAMID_WORKGROUP_SIZE 8
+
+struct _GthreeGpuCulling {
+  guint cull_program;
+  guint depth_init_program;
+  guint depth_reduce_program;
+
+  int n_draws_location;
+  int command_stride_location;
+  int planes_location;
+  int use_occlusion_location;
+  int occlusion_matrix_location;
+  int pyramid_location;
+  int pyramid_levels_location;
+  int depth_location;
+
+  guint depth_texture;
+  guint pyramid_texture;
+  int pyramid_width;
+  int pyramid_height;
+  int pyramid_levels;
+
+  /* What the pyramid was rendered with, it is only valid for that camera */
+  gconstpointer pyramid_camera;
+  graphene_matrix_t pyramid_view_projection;
+};
+
+static const char cull_source[] =
+  "#version 430\n"
+  "layout(local_size_x = 64) in;\n"
+  "layout(std430, binding = 0) buffer Commands { uint commands[]; };\n"
+  "layout(std430, binding = 1) readonly buffer Transforms { mat4 transforms[]; };\n"
+  "layout(std430, binding = 2) readonly buffer Spheres { vec4 spheres[]; };\n"
+  "uniform uint n_draws;\n"
+  "uniform uint command_stride;\n"
+  "uniform vec4 planes[6];\n"
+  "uniform bool use_occlusion;\n"
+  "uniform mat4 occlusion_matrix;\n"
+  "uniform sampler2D pyramid;\n"
+  "uniform int pyramid_levels;\n"
+  "\n"
+  "bool is_occluded (vec3 center, float radius)\n"
+  "{\n"
+  "  vec3 ndc_min = vec3 (1.0);\n"
+  "  vec3 ndc_max = vec3 (-1.0);\n"
+  "  for (int i = 0; i < 8; i++)\n"
+  "    {\n"
+  "      vec3 corner = center + radius * vec3 ((i & 1) != 0 ? 1.0 : -1.0,\n"
+  "                                            (i & 2) != 0 ? 1.0 : -1.0,\n"
+  "                                            (i & 4) != 0 ? 1.0 : -1.0);\n"
+  "      vec4 clip = occlusion_matrix * vec4 (corner, 1.0);\n"
+  "      if (clip.w <= 0.0)\n"
+  "        return false;\n"
+  "      ndc_min = min (ndc_min, clip.xyz / clip.w);\n"
+  "      ndc_max = max (ndc_max, clip.xyz / clip.w);\n"
+  "    }\n"
+  "\n"
+  "  vec2 uv_min = clamp (ndc_min.xy * 0.5 + 0.5, 0.0, 1.0);\n"
+  "  vec2 uv_max = clamp (ndc_max.xy * 0.5 + 0.5, 0.0, 1.0);\n"
+  "  vec2 extent = (uv_max - uv_min) * vec2 (textureSize (pyramid, 0));\n"
+  "  int level = clamp (int (ceil (log2 (max (max (extent.x, extent.y), 1.0)))), 0, pyramid_levels - 1);\n"
+  "  ivec2 size = textureSize (pyramid, level);\n"
+  "  ivec2 p_min = clamp (ivec2 (uv_min * vec2 (size)), ivec2 (0), size - 1);\n"
+  "  /* Odd sizes are folded into the last texel, which can shift texels by one */\n"
+  "  ivec2 p_max = clamp (ivec2 (uv_max * vec2 (size)) + 1, ivec2 (0), size - 1);\n"
+  "  float farthest = 0.0;\n"
+  "  for (int y = p_min.y; y <= p_max.y; y++)\n"
+  "    for (int x = p_min.x; x <= p_max.x; x++)\n"
+  "      farthest = max (farthest, texelFetch (pyramid, ivec2 (x, y), level).r);\n"
+  "\n"
+  "  return ndc_min.z * 0.5 + 0.5 > farthest;\n"
+  "}\n"
+  "\n"
+  "void main ()\n"
+  "{\n"
+  "  uint i = gl_GlobalInvocationID.x;\n"
+  "  if (i >= n_draws)\n"
+  "    return;\n"
+  "\n"
+  "  mat4 m = transforms[i];\n"
+  "  vec4 sphere = spheres[i];\n"
+  "  vec3 center = (m * vec4 (sphere.xyz, 1.0)).xyz;\n"
+  "  float scale = max (max (dot (m[0].xyz, m[0].xyz), dot (m[1].xyz, m[1].xyz)), dot (m[2].xyz, m[2].xyz));\n"
+  "  float radius = sphere.w * sqrt (scale);\n"
+  "  bool visible = true;\n"
+  "\n"
+  "  for (int p = 0; p < 6; p++)\n"
+  "    if (dot (planes[p].xyz, center) + planes[p].w < -radius)\n"
+  "      visible = false;\n"
+  "\n"
+  "  if (visible && use_occlusion)\n"
+  "    visible = !is_occluded (center, radius);\n"
+  "\n"
+  "  commands[i * command_stride + 1u] = visible ? 1u : 0u;\n"
+  "}\n";
+
+static const char depth_init_source[] =
+  "#version 430\n"
+  "layout(local_size_x = 8, local_size_y = 8) in;\n"
+  "uniform sampler2D depth;\n"
+  "layout(r32f, binding = 0) writeonly uniform image2D level0;\n"
+  "\n"
+  "void main ()\n"
+  "{\n"
+  "  ivec2 p = ivec2 (gl_GlobalInvocationID.xy);\n"
+  "  if (any (greaterThanEqual (p, imageSize (level0))))\n"
+  "    return;\n"
+  "  imageStore (level0, p, vec4 (texelFetch (depth, p, 0).r));\n"
+  "}\n";
+
+static const char depth_reduce_source[] =
+  "#version 430\n"
+  "layout(local_size_x = 8, local_size_y = 8) in;\n"
+  "layout(r32f, binding = 0) readonly uniform image2D src;\n"
+  "layout(r32f, binding = 1) writeonly uniform image2D dst;\n"
+  "\n"
+  "void main ()\n"
+  "{\n"
+  "  ivec2 p = ivec2 (gl_GlobalInvocationID.xy);\n"
+  "  ivec2 dst_size = imageSize (dst);\n"
+  "  ivec2 src_size = imageSize (src);\n"
+  "  if (any (greaterThanEqual (p, dst_size)))\n"
+  "    return;\n"
+  "\n"
+  "  /* The last texel also covers the odd row or column */\n"
+  "  ivec2 s = p * 2;\n"
+  "  ivec2 e = min (s + 1 + ivec2 (equal (p, dst_size - 1)) * (src_size & 1), src_size - 1);\n"
+  "  float farthest = 0.0;\n"
+  "  for (int y = s.y; y <= e.y; y++)\n"
+  "    for (int x = s.x; x <= e.x; x++)\n"
+  "      farthest = max (farthest, imageLoad (src, ivec2 (x, y)).r);\n"
+  "  imageStore (dst, p, vec4 (farthest));\n"
+  "}\n";
+
+static guint
+compile_compute_program (const char *source)
+{
+  GLuint shader, program;
+  GLint status;
+
+  shader = glCreateShader (GL_COMPUTE_SHADER);
+  glShaderSource (shader, 1, &source, NULL);
+  glCompileShader (shader);
+  glGetShaderiv (shader, GL_COMPILE_STATUS, &status);
+  if (!status)
+    {
+      char log[1024];
+
+      glGetShaderInfoLog (shader, sizeof (log), NULL, log);
+      g_warning ("Failed to compile culling shader: %s", log);
+      glDeleteShader (shader);
+      return 0;
+    }
+
+  program = glCreateProgram ();
+  glAttachShader (program, shader);
+  glLinkProgram (program);
+  glDetachShader (program, shader);
+  glDeleteShader (shader);
+
+  glGetProgramiv (program, GL_LINK_STATUS, &status);
+  if (!status)
+    {
+      char log[1024];
+
+      glGetProgramInfoLog (program, sizeof (log), NULL, log);
+      g_warning ("Failed to link culling shader: %s", log);
+      glDeleteProgram (program);
+      return 0;
+    }
+
+  return program;
+}
+
+/* Needs GL 4.3 for compute shaders and storage buffers, returns NULL
+ * if the programs can't be built */
+GthreeGpuCulling *
+gthree_gpu_culling_new (void)
+{
+  GthreeGpuCulling *culling;
+
+  if (epoxy_gl_version () < 43)
+    return NULL;
+
+  culling = g_new0 (GthreeGpuCulling, 1);
+  culling->cull_program = compile_compute_program (cull_source);
+  culling->depth_init_program = compile_compute_program (depth_init_source);
+  culling->depth_reduce_program = compile_compute_program (depth_reduce_source);
+
+  if (culling->cull_program == 0 ||
+      culling->depth_init_program == 0 ||
+      culling->depth_reduce_program == 0)
+    {
+      gthree_gpu_culling_free (culling);
+      return NULL;
+    }
+
+  culling->n_draws_location = glGetUniformLocation (culling->cull_program, "n_draws");
+  culling->command_stride_location = glGetUniformLocation (culling->cull_program, "command_stride");
+  culling->planes_location = glGetUniformLocation (culling->cull_program, "planes");
+  culling->use_occlusion_location = glGetUniformLocation (culling->cull_program, "use_occlusion");
+  culling->occlusion_matrix_location = glGetUniformLocation (culling->cull_program, "occlusion_matrix");
+  culling->pyramid_location = glGetUniformLocation (culling->cull_program, "pyramid");
+  culling->pyramid_levels_location = glGetUniformLocation (culling->cull_program, "pyramid_levels");
+  culling->depth_location = glGetUniformLocation (culling->depth_init_program, "depth");
+
+  return culling;
+}
+
+void
+gthree_gpu_culling_free (GthreeGpuCulling *culling)
+{
+  if (culling->cull_program)
+    glDeleteProgram (culling->cull_program);
+  if (culling->depth_init_program)
+    glDeleteProgram (culling->depth_init_program);
+  if (culling->depth_reduce_program)
+    glDeleteProgram (culling->depth_reduce_program);
+  if (culling->depth_texture)
+    glDeleteTextures (1, &culling->depth_texture);
+  if (culling->pyramid_texture)
+    glDeleteTextures (1, &culling->pyramid_texture);
+
+  g_free (culling);
+}
+
+static void
+ensure_pyramid (GthreeGpuCulling *culling,
+                int               width,
+                int               height)
+{
+  int levels;
+
+  if (culling->pyramid_texture != 0 &&
+      culling->pyramid_width == width &&
+      culling->pyramid_height == height)
+    return;
+
+  if (culling->depth_texture)
+    glDeleteTextures (1, &culling->depth_texture);
+  if (culling->pyramid_texture)
+    glDeleteTextures (1, &culling->pyramid_texture);
+
+  levels = 1;
+  while ((MAX (width, height) >> levels) > 0)
+    levels++;
+
+  glActiveTexture (GL_TEXTURE0);
+
+  glGenTextures (1, &culling->depth_texture);
+  glBindTexture (GL_TEXTURE_2D, culling->depth_texture);
+  glTexImage2D (GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, width, height, 0,
+                GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL);
+  glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+
+  glGenTextures (1, &culling->pyramid_texture);
+  glBindTexture (GL_TEXTURE_2D, culling->pyramid_texture);
+  glTexStorage2D (GL_TEXTURE_2D, levels, GL_R32F, width, height);
+  glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+  glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+  glBindTexture (GL_TEXTURE_2D, 0);
+
+  culling->pyramid_width = width;
+  culling->pyramid_height = height;
+  culling->pyramid_levels = levels;
+}
+
+/* Builds the depth pyramid from the depth buffer of the current
+ * framebuffer, to be used for culling the next frame rendered with
+ * camera. viewport is in framebuffer pixels. */
+void
+gthree_gpu_culling_update_depth_pyramid (GthreeGpuCulling        *culling,
+                                         gconstpointer            camera,
+                                         const graphene_matrix_t *view_projection,
+                                         const graphene_rect_t   *viewport)
+{
+  int x = graphene_rect_get_x (viewport);
+  int y = graphene_rect_get_y (viewport);
+  int width = graphene_rect_get_width (viewport);
+  int height = graphene_rect_get_height (viewport);
+  GLint sample_buffers = 0;
+  int level;
+
+  culling->pyramid_camera = NULL;
+
+  /* Multisampled depth can't be copied to a texture */
+  glGetIntegerv (GL_SAMPLE_BUFFERS, &sample_buffers);
+  if (width <= 0 || height <= 0 || sample_buffers > 0)
+    return;
+
+  ensure_pyramid (culling, width, height);
+
+  glActiveTexture (GL_TEXTURE0);
+  glBindTexture (GL_TEXTURE_2D, culling->depth_texture);
+  glCopyTexSubImage2D (GL_TEXTURE_2D, 0, 0, 0, x, y, width, height);
+
+  glUseProgram (culling->depth_init_program);
+  glUniform1i (culling->depth_location, 0);
+  glBindImageTexture (0, culling->pyramid_texture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+  glDispatchCompute ((width + PYRAMID_WORKGROUP_SIZE - 1) / PYRAMID_WORKGROUP_SIZE,
+                     (height + PYRAMID_WORKGROUP_SIZE - 1) / PYRAMID_WORKGROUP_SIZE, 1);
+
+  glUseProgram (culling->depth_reduce_program);
+  for (level = 1; level < culling->pyramid_levels; level++)
+    {
+      int level_width = MAX (width >> level, 1);
+      int level_height = MAX (height >> level, 1);
+
+      glMemoryBarrier (GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+      glBindImageTexture (0, culling->pyramid_texture, level - 1, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+      glBindImageTexture (1, culling->pyramid_texture, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+      glDispatchCompute ((level_width + PYRAMID_WORKGROUP_SIZE - 1) / PYRAMID_WORKGROUP_SIZE,
+                         (level_height + PYRAMID_WORKGROUP_SIZE - 1) / PYRAMID_WORKGROUP_SIZE, 1);
+    }
+
+  glMemoryBarrier (GL_TEXTURE_FETCH_BARRIER_BIT);
+  glBindTexture (GL_TEXTURE_2D, 0);
+
+  culling->pyramid_camera = camera;
+  culling->pyramid_view_projection = *view_projection;
+}
+
+/* Zeroes the instance count of the culled commands in command_buffer.
+ * Each draw has its local bounding sphere (center and radius) in
+ * sphere_buffer, transformed by its matrix in transform_buffer. The depth pyramid is only used if it was built
+ * for occlusion_camera. */
+void
+gthree_gpu_culling_cull (GthreeGpuCulling         *culling,
+                         gconstpointer             occlusion_camera,
+                         const graphene_frustum_t *frustum,
+                         guint                     sphere_buffer,
+                         guint                     transform_buffer,
+                         guint                     command_buffer,
+                         guint                     n_draws,
+                         guint                     command_stride)
+{
+  graphene_plane_t planes[6];
+  graphene_vec3_t normal;
+  float planes_v[6 * 4];
+  gboolean use_occlusion;
+  int i;
+
+  graphene_frustum_get_planes (frustum, planes);
+  for (i = 0; i < 6; i++)
+    {
+      graphene_plane_get_normal (&planes[i], &normal);
+      planes_v[i * 4 + 0] = graphene_vec3_get_x (&normal);
+      planes_v[i * 4 + 1] = graphene_vec3_get_y (&normal);
+      planes_v[i * 4 + 2] = graphene_vec3_get_z (&normal);
+      planes_v[i * 4 + 3] = graphene_plane_get_constant (&planes[i]);
+    }
+
+  use_occlusion = occlusion_camera != NULL && culling->pyramid_camera == occlusion_camera;
+
+  glUseProgram (culling->cull_program);
+  glUniform1ui (culling->n_draws_location, n_draws);
+  glUniform1ui (culling->command_stride_location, command_stride);
+  glUniform4fv (culling->planes_location, 6, planes_v);
+  glUniform1i (culling->use_occlusion_location, use_occlusion);
+
+  if (use_occlusion)
+    {
+      float matrix[16];
+
+      graphene_matrix_to_float (&culling->pyramid_view_projection, matrix);
+      glUniformMatrix4fv (culling->occlusion_matrix_location, 1, FALSE, matrix);
+      glUniform1i (culling->pyramid_levels_location, culling->pyramid_levels);
+      glUniform1i (culling->pyramid_location, 0);
+      glActiveTexture (GL_TEXTURE0);
+      glBindTexture (GL_TEXTURE_2D, culling->pyramid_texture);
+    }
+
+  glBindBufferBase (GL_SHADER_STORAGE_BUFFER, 0, command_buffer);
+  glBindBufferBase (GL_SHADER_STORAGE_BUFFER, 1, transform_buffer);
+  glBindBufferBase (GL_SHADER_STORAGE_BUFFER, 2, sphere_buffer);
+
+  glDispatchCompute ((n_draws + CULL_WORKGROUP_SIZE - 1) / CULL_WORKGROUP_SIZE, 1, 1);
+
+  /* The commands are read by the following indirect draw */
+  glMemoryBarrier (GL_COMMAND_BARRIER_BIT);
+
+  glBindBufferBase (GL_SHADER_STORAGE_BUFFER, 0, 0);
+  glBindBufferBase (GL_SHADER_STORAGE_BUFFER, 1, 0);
+  glBindBufferBase (GL_SHADER_STORAGE_BUFFER, 2, 0);
+  if (use_occlusion)
+    glBindTexture (GL_TEXTURE_2D, 0);
+}
@@ -0,0 +1,330 @@
+#include <math.h>
+#include <epoxy/gl.h>
+
+#include "gthreeinstancedmesh.h"
+#include "gthreeobjectprivate.h"
+#include "gthreeprivate.h"
+#include "gthreeattribute.h"
+
+typedef struct {
+  int count;
+  GthreeAttribute *instance_matrix;
+  GthreeAttribute *instance_color;
+
+  /* Union of the geometry bounds over all instances, in object space */
+  graphene_sphere_t bounding_sphere;
+  graphene_sphere_t bounding_sphere_source;
+  gboolean bounding_sphere_valid;
+} GthreeInstancedMeshPrivate;
+
+enum {
+  PROP_0,
+
+  PROP_COUNT,
+
+  N_PROPS
+};
+
+static GParamSpec *obj_props[N_PROPS] = { NULL, };
+
+G_DEFINE_TYPE_WITH_PRIVATE (GthreeInstancedMesh, gthree_instanced_mesh, GTHREE_TYPE_MESH)
+
+GthreeInstancedMesh *
+gthree_instanced_mesh_new (GthreeGeometry *geometry,
+                           GthreeMaterial *material,
+                           int             count)
+{
+  g_autoptr(GPtrArray) materials = g_ptr_array_new_with_free_func (g_object_unref);
+
+  if (material)
+    g_ptr_array_add (materials, g_object_ref (material));
+
+  return g_object_new (gthree_instanced_mesh_get_type (),
+                       "geometry", geometry,
+                       "materials", materials,
+                       "count", count,
+                       NULL);
+}
+
+static void
+gthree_instanced_mesh_init (GthreeInstancedMesh *mesh)
+{
+}
+
+static void
+gthree_instanced_mesh_finalize (GObject *obj)
+{
+  GthreeInstancedMesh *mesh = GTHREE_INSTANCED_MESH (obj);
+  GthreeInstancedMeshPrivate *priv = gthree_instanced_mesh_get_instance_private (mesh);
+
+  g_clear_object (&priv->instance_matrix);
+  g_clear_object (&priv->instance_color);
+
+  G_OBJECT_CLASS (gthree_instanced_mesh_parent_class)->finalize (obj);
+}
+
+static void
+gthree_instanced_mesh_allocate (GthreeInstancedMesh *mesh,
+                                int                  count)
+{
+  GthreeInstancedMeshPrivate *priv = gthree_instanced_mesh_get_instance_private (mesh);
+  graphene_matrix_t identity;
+  int i;
+
+  priv->count = count;
+  priv->instance_matrix = gthree_attribute_new ("instanceMatrix", GTHREE_ATTRIBUTE_TYPE_FLOAT,
+                                                count, 16, FALSE);
+  gthree_attribute_set_divisor (priv->instance_matrix, 1);
+  gthree_attribute_set_dynamic (priv->instance_matrix, TRUE);
+
+  graphene_matrix_init_identity (&identity);
+  for (i = 0; i < count; i++)
+    graphene_matrix_to_float (&identity, gthree_attribute_peek_float_at (priv->instance_matrix, i));
+
+  priv->bounding_sphere_valid = FALSE;
+}
+
+static void
+gthree_instanced_mesh_update (GthreeObject *object)
+{
+  GthreeInstancedMesh *mesh = GTHREE_INSTANCED_MESH (object);
+  GthreeInstancedMeshPrivate *priv = gthree_instanced_mesh_get_instance_private (mesh);
+
+  GTHREE_OBJECT_CLASS (gthree_instanced_mesh_parent_class)->update (object);
+
+  gthree_attribute_update (priv->instance_matrix, GL_ARRAY_BUFFER);
+  if (priv->instance_color)
+    gthree_attribute_update (priv->instance_color, GL_ARRAY_BUFFER);
+}
+
+static void
+gthree_instanced_mesh_update_bounding_sphere (GthreeInstancedMesh *mesh,
+                                              const graphene_sphere_t *geometry_sphere)
+{
+  GthreeInstancedMeshPrivate *priv = gthree_instanced_mesh_get_instance_private (mesh);
+  graphene_box_t box;
+  graphene_point3d_t center;
+  graphene_matrix_t m;
+  graphene_sphere_t sphere;
+  float max_radius = 0;
+  int i;
+
+  if (priv->count == 0)
+    {
+      graphene_sphere_init (&priv->bounding_sphere, NULL, 0);
+      return;
+    }
+
+  graphene_box_init_from_box (&box, graphene_box_empty ());
+  for (i = 0; i < priv->count; i++)
+    {
+      graphene_point3d_t c, min, max;
+      float r;
+
+      gthree_attribute_get_matrix (priv->instance_matrix, i, &m);
+      graphene_matrix_transform_sphere (&m, geometry_sphere, &sphere);
+
+      graphene_sphere_get_center (&sphere, &c);
+      r = graphene_sphere_get_radius (&sphere);
+
+      graphene_point3d_init (&min, c.x - r, c.y - r, c.z - r);
+      graphene_point3d_init (&max, c.x + r, c.y + r, c.z + r);
+      graphene_box_expand (&box, &min, &box);
+      graphene_box_expand (&box, &max, &box);
+    }
+
+  graphene_box_get_center (&box, &center);
+
+  for (i = 0; i < priv->count; i++)
+    {
+      graphene_point3d_t c;
+
+      gthree_attribute_get_matrix (priv->instance_matrix, i, &m);
+      graphene_matrix_transform_sphere (&m, geometry_sphere, &sphere);
+
+      graphene_sphere_get_center (&sphere, &c);
+      max_radius = MAX (max_radius, graphene_point3d_distance (&center, &c, NULL) + graphene_sphere_get_radius (&sphere));
+    }
+
+  graphene_sphere_init (&priv->bounding_sphere, &center, max_radius);
+}
+
+static gboolean
+gthree_instanced_mesh_in_frustum (GthreeObject *object,
+                                  const graphene_frustum_t *frustum)
+{
+  GthreeInstancedMesh *mesh = GTHREE_INSTANCED_MESH (object);
+  GthreeInstancedMeshPrivate *priv = gthree_instanced_mesh_get_instance_private (mesh);
+  GthreeGeometry *geometry = gthree_mesh_get_geometry (GTHREE_MESH (mesh));
+  const graphene_sphere_t *geometry_sphere;
+  graphene_sphere_t sphere;
+
+  if (!geometry || priv->count == 0)
+    return FALSE;
+
+  geometry_sphere = gthree_geometry_get_bounding_sphere (geometry);
+
+  /* The geometry bounds can change under us too */
+  if (!priv->bounding_sphere_valid ||
+      !graphene_sphere_equal (&priv->bounding_sphere_source, geometry_sphere))
+    {
+      gthree_instanced_mesh_update_bounding_sphere (mesh, geometry_sphere);
+      priv->bounding_sphere_source = *geometry_sphere;
+      priv->bounding_sphere_valid = TRUE;
+    }
+
+  graphene_matrix_transform_sphere (gthree_object_get_world_matrix (object),
+                                    &priv->bounding_sphere,
+                                    &sphere);
+
+  return graphene_frustum_intersects_sphere (frustum, &sphere);
+}
+
+static void
+gthree_instanced_mesh_set_property (GObject *obj,
+                                    guint prop_id,
+                                    const GValue *value,
+                                    GParamSpec *pspec)
+{
+  GthreeInstancedMesh *mesh = GTHREE_INSTANCED_MESH (obj);
+
+  switch (prop_id)
+    {
+    case PROP_COUNT:
+      gthree_instanced_mesh_allocate (mesh, g_value_get_int (value));
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
+    }
+}
+
+static void
+gthree_instanced_mesh_get_property (GObject *obj,
+                                    guint prop_id,
+                                    GValue *value,
+                                    GParamSpec *pspec)
+{
+  GthreeInstancedMesh *mesh = GTHREE_INSTANCED_MESH (obj);
+  GthreeInstancedMeshPrivate *priv = gthree_instanced_mesh_get_instance_private (mesh);
+
+  switch (prop_id)
+    {
+    case PROP_COUNT:
+      g_value_set_int (value, priv->count);
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
+    }
+}
+
+static void
+gthree_instanced_mesh_class_init (GthreeInstancedMeshClass *klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  GthreeObjectClass *object_class = GTHREE_OBJECT_CLASS (klass);
+
+  gobject_class->set_property = gthree_instanced_mesh_set_property;
+  gobject_class->get_property = gthree_instanced_mesh_get_property;
+  gobject_class->finalize = gthree_instanced_mesh_finalize;
+
+  object_class->in_frustum = gthree_instanced_mesh_in_frustum;
+  object_class->update = gthree_instanced_mesh_update;
+
+  obj_props[PROP_COUNT] =
+    g_param_spec_int ("count", "Count", "Number of instances",
+                      0, G_MAXINT, 0,
+                      G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS);
+
+  g_object_class_install_properties (gobject_class, N_PROPS, obj_props);
+}
+
+int
+gthree_instanced_mesh_get_count (GthreeInstancedMesh *mesh)
+{
+  GthreeInstancedMeshPrivate *priv = gthree_instanced_mesh_get_instance_private (mesh);
+
+  return priv->count;
+}
+
+/* Can only shrink (or regrow) within the count the mesh was created with */
+void
+gthree_instanced_mesh_set_count (GthreeInstancedMesh *mesh,
+                                 int                  count)
+{
+  GthreeInstancedMeshPrivate *priv = gthree_instanced_mesh_get_instance_private (mesh);
+
+  g_return_if_fail (count >= 0 && count <= gthree_attribute_get_count (priv->instance_matrix));
+
+  priv->count = count;
+  priv->bounding_sphere_valid = FALSE;
+  gthree_object_mark_changed (GTHREE_OBJECT (mesh));
+}
+
+void
+gthree_instanced_mesh_get_matrix_at (GthreeInstancedMesh *mesh,
+                                     int                  index,
+                                     graphene_matrix_t   *matrix)
+{
+  GthreeInstancedMeshPrivate *priv = gthree_instanced_mesh_get_instance_private (mesh);
+
+  gthree_attribute_get_matrix (priv->instance_matrix, index, matrix);
+}
+
+void
+gthree_instanced_mesh_set_matrix_at (GthreeInstancedMesh     *mesh,
+                                     int                      index,
+                                     const graphene_matrix_t *matrix)
+{
+  GthreeInstancedMeshPrivate *priv = gthree_instanced_mesh_get_instance_private (mesh);
+
+  graphene_matrix_to_float (matrix, gthree_attribute_peek_float_at (priv->instance_matrix, index));
+  gthree_attribute_set_needs_update_range (priv->instance_matrix, index, 1);
+
+  /* The bounds are recomputed when culling, so only the first change
+   * after that can make the culling result stale */
+  if (priv->bounding_sphere_valid)
+    gthree_object_mark_changed (GTHREE_OBJECT (mesh));
+  priv->bounding_sphere_valid = FALSE;
+}
+
+void
+gthree_instanced_mesh_set_color_at (GthreeInstancedMesh   *mesh,
+                                    int                    index,
+                                    const graphene_vec3_t *color)
+{
+  GthreeInstancedMeshPrivate *priv = gthree_instanced_mesh_get_instance_private (mesh);
+
+  if (priv->instance_color == NULL)
+    {
+      int i, n = gthree_attribute_get_count (priv->instance_matrix);
+
+      priv->instance_color = gthree_attribute_new ("instanceColor", GTHREE_ATTRIBUTE_TYPE_FLOAT,
+                                                   n, 3, FALSE);
+      gthree_attribute_set_divisor (priv->instance_color, 1);
+      gthree_attribute_set_dynamic (priv->instance_color, TRUE);
+
+      for (i = 0; i < n; i++)
+        gthree_attribute_set_xyz (priv->instance_color, i, 1, 1, 1);
+    }
+
+  gthree_attribute_set_vec3 (priv->instance_color, index, color);
+  gthree_attribute_set_needs_update_range (priv->instance_color, index, 1);
+}
+
+GthreeAttribute *
+gthree_instanced_mesh_get_instance_matrix (GthreeInstancedMesh *mesh)
+{
+  GthreeInstancedMeshPrivate *priv = gthree_instanced_mesh_get_instance_private (mesh);
+
+  return priv->instance_matrix;
+}
+
+GthreeAttribute *
+gthree_instanced_mesh_get_instance_color (GthreeInstancedMesh *mesh)
+{
+  GthreeInstancedMeshPrivate *priv = gthree_instanced_mesh_get_instance_private (mesh);
+
+  return priv->instance_color;
+}
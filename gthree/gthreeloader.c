@@ -52,8 +52,18 @@ typedef struct {
 
   GthreeMaterial *default_material;
   int scene;
+  gboolean optimize_geometry;
 } GthreeLoaderPrivate;
 
+enum {
+  NODE_READY,
+  MESH_READY,
+
+  LAST_SIGNAL
+};
+
+static guint loader_signals[LAST_SIGNAL] = { 0, };
+
 G_DEFINE_QUARK (gthree-loader-error-quark, gthree_loader_error)
 G_DEFINE_TYPE_WITH_PRIVATE (GthreeLoader, gthree_loader, G_TYPE_OBJECT)
 
@@ -350,6 +360,59 @@ static void
 gthree_loader_class_init (GthreeLoaderClass *klass)
 {
   G_OBJECT_CLASS (klass)->finalize = gthree_loader_finalize;
+
+  /* Emitted once a node has all its meshes and cameras. During
+   * gthree_loader_parse_gltf_async() the scenes are already set up
+   * at this point, so the node is drawn if they are rendered. */
+  loader_signals[NODE_READY] =
+    g_signal_new ("node-ready",
+                  G_TYPE_FROM_CLASS (klass),
+                  G_SIGNAL_RUN_LAST,
+                  0,
+                  NULL, NULL,
+                  NULL,
+                  G_TYPE_NONE, 2,
+                  GTHREE_TYPE_OBJECT,
+                  G_TYPE_INT);
+
+  /* Emitted for each mesh object created for a glTF mesh, with the
+   * index of that mesh */
+  loader_signals[MESH_READY] =
+    g_signal_new ("mesh-ready",
+                  G_TYPE_FROM_CLASS (klass),
+                  G_SIGNAL_RUN_LAST,
+                  0,
+                  NULL, NULL,
+                  NULL,
+                  G_TYPE_NONE, 2,
+                  GTHREE_TYPE_MESH,
+                  G_TYPE_INT);
+}
+
+GthreeLoader *
+gthree_loader_new (void)
+{
+  return g_object_new (gthree_loader_get_type (), NULL);
+}
+
+gboolean
+gthree_loader_get_optimize_geometry (GthreeLoader *loader)
+{
+  GthreeLoaderPrivate *priv = gthree_loader_get_instance_private (loader);
+
+  return priv->optimize_geometry;
+}
+
+/* If set, indexed triangle meshes are run through
+ * gthree_geometry_optimize_vertex_cache() while loading. This happens
+ * on the worker thread for gthree_loader_parse_gltf_async(). */
+void
+gthree_loader_set_optimize_geometry (GthreeLoader *loader,
+                                     gboolean      optimize)
+{
+  GthreeLoaderPrivate *priv = gthree_loader_get_instance_private (loader);
+
+  priv->optimize_geometry = !!optimize;
 }
 
 static gboolean
@@ -613,13 +676,25 @@ parse_buffers (GthreeLoader *loader, JsonObject *root, GBytes *bin_chunk, GFile
         {
           g_autoptr(GFile) file = NULL;
           g_autoptr(GBytes) file_bytes = NULL;
+          g_autofree char *path = NULL;
 
           if (base_path)
             file = g_file_resolve_relative_path (base_path, uri);
           else
             file = g_file_new_for_commandline_arg (uri);
 
-          file_bytes = g_file_load_bytes (file, NULL, NULL, error);
+          /* Map local files so the attribute arrays can point straight
+             into them instead of each holding a copy */
+          path = g_file_get_path (file);
+          if (path)
+            {
+              g_autoptr(GMappedFile) mapped = g_mapped_file_new (path, FALSE, NULL);
+              if (mapped)
+                file_bytes = g_mapped_file_get_bytes (mapped);
+            }
+
+          if (file_bytes == NULL)
+            file_bytes = g_file_load_bytes (file, NULL, NULL, error);
           if (file_bytes == NULL)
             return FALSE;
 
@@ -800,16 +875,25 @@ parse_accessors (GthreeLoader *loader, JsonObject *root, GError **error)
 
 
               /* Create an array for the entire bufferview now that we know the type, then store
-                 that for later use and use a subset of it here. */
-              accessor->array = gthree_attribute_array_new (attribute_type, count_shared_array, item_size_in_shared_array);
+                 that for later use and use a subset of it here. If the data is suitably aligned
+                 we wrap the buffer directly, and it is only copied if it gets modified. */
+              if (view->byte_stride % attribute_type_size == 0 &&
+                  GPOINTER_TO_SIZE (g_bytes_get_data (view->bytes, NULL)) % attribute_type_size == 0)
+                {
+                  accessor->array = gthree_attribute_array_new_from_bytes (attribute_type, view->bytes, 0,
+                                                                           count_shared_array, item_size_in_shared_array);
+                }
+              else
+                {
+                  accessor->array = gthree_attribute_array_new (attribute_type, count_shared_array, item_size_in_shared_array);
+                  memcpy (gthree_attribute_array_peek_uint8 (accessor->array),
+                          (char *)g_bytes_get_data (view->bytes, NULL),
+                          item_size_in_shared_array * count_shared_array * gthree_attribute_type_length (attribute_type));
+                }
               accessor->item_size = item_size;
               accessor->item_offset = byte_offset / attribute_type_size;
               accessor->count = count;
 
-              memcpy (gthree_attribute_array_peek_uint8 (accessor->array),
-                      (char *)g_bytes_get_data (view->bytes, NULL),
-                      item_size_in_shared_array * count_shared_array * gthree_attribute_type_length (attribute_type));
-
               if (view->array == NULL)
                 view->array = gthree_attribute_array_ref (accessor->array);
             }
@@ -895,11 +979,30 @@ parse_samplers (GthreeLoader *loader, JsonObject *root, GError **error)
 }
 
 
+typedef struct {
+  GBytes *bytes;
+  GdkPixbuf *pixbuf;
+  GError *error;
+} ImageDecode;
+
+static void
+decode_image (gpointer data,
+              gpointer user_data)
+{
+  ImageDecode *decode = data;
+  g_autoptr(GInputStream) in = g_memory_input_stream_new_from_bytes (decode->bytes);
+
+  decode->pixbuf = gdk_pixbuf_new_from_stream (in, NULL, &decode->error);
+}
+
 static gboolean
 parse_images (GthreeLoader *loader, JsonObject *root, GFile *base_path, GError **error)
 {
   GthreeLoaderPrivate *priv = gthree_loader_get_instance_private (loader);
   JsonArray *images_j = NULL;
+  g_autofree ImageDecode *decodes = NULL;
+  GThreadPool *pool = NULL;
+  gboolean res = TRUE;
   guint len;
   int i;
 
@@ -908,12 +1011,12 @@ parse_images (GthreeLoader *loader, JsonObject *root, GFile *base_path, GError *
 
   images_j = json_object_get_array_member (root, "images");
   len = json_array_get_length (images_j);
+  decodes = g_new0 (ImageDecode, len);
+
   for (i = 0; i < len; i++)
     {
       JsonObject *image_j = json_array_get_object_element (images_j, i);
-      g_autoptr(GdkPixbuf) pixbuf = NULL;
       g_autoptr(GBytes) bytes = NULL;
-      g_autoptr(GInputStream) in = NULL;
 
       if (json_object_has_member (image_j, "uri"))
         {
@@ -928,7 +1031,10 @@ parse_images (GthreeLoader *loader, JsonObject *root, GFile *base_path, GError *
 
           bytes = g_file_load_bytes (file, NULL, NULL, error);
           if (bytes == NULL)
-            return FALSE;
+            {
+              res = FALSE;
+              break;
+            }
         }
       else if (json_object_has_member (image_j, "bufferView"))
         {
@@ -938,7 +1044,8 @@ parse_images (GthreeLoader *loader, JsonObject *root, GFile *base_path, GError *
           if (v >= priv->buffer_views->len)
             {
               g_set_error (error, GTHREE_LOADER_ERROR, GTHREE_LOADER_ERROR_FAIL, "No buffer view %d in image %d", (int)v, (int)i);
-              return FALSE;
+              res = FALSE;
+              break;
             }
           view = g_ptr_array_index (priv->buffer_views, v);
           bytes = g_bytes_ref (view->bytes);
@@ -946,18 +1053,45 @@ parse_images (GthreeLoader *loader, JsonObject *root, GFile *base_path, GError *
       else
         {
           g_set_error (error, GTHREE_LOADER_ERROR, GTHREE_LOADER_ERROR_FAIL, "Missing url or bufferView from image buffer %d", i);
-          return FALSE;
+          res = FALSE;
+          break;
         }
 
-      in = g_memory_input_stream_new_from_bytes (bytes);
-      pixbuf = gdk_pixbuf_new_from_stream (in, NULL, error);
-      if (pixbuf == NULL)
-        return FALSE;
+      decodes[i].bytes = g_steal_pointer (&bytes);
 
-      g_ptr_array_add (priv->images, g_steal_pointer (&pixbuf));
+      /* Decoding is the slow part, so spread it over worker threads */
+      if (len > 1)
+        {
+          if (pool == NULL)
+            pool = g_thread_pool_new (decode_image, NULL, MIN (len, g_get_num_processors ()), FALSE, NULL);
+          g_thread_pool_push (pool, &decodes[i], NULL);
+        }
+      else
+        decode_image (&decodes[i], NULL);
     }
 
-  return TRUE;
+  if (pool)
+    g_thread_pool_free (pool, FALSE, TRUE);
+
+  for (i = 0; i < len; i++)
+    {
+      if (res && decodes[i].bytes != NULL)
+        {
+          if (decodes[i].pixbuf == NULL)
+            {
+              g_propagate_error (error, g_steal_pointer (&decodes[i].error));
+              res = FALSE;
+            }
+          else
+            g_ptr_array_add (priv->images, g_steal_pointer (&decodes[i].pixbuf));
+        }
+
+      g_clear_pointer (&decodes[i].bytes, g_bytes_unref);
+      g_clear_object (&decodes[i].pixbuf);
+      g_clear_error (&decodes[i].error);
+    }
+
+  return res;
 }
 
 static gboolean
@@ -1347,6 +1481,10 @@ parse_meshes (GthreeLoader *loader, JsonObject *root, GError **error)
           if (json_object_has_member (primitive_j, "targets"))
             add_morph_targets (loader, primitive_j, primitive->geometry);
 
+          /* The reordering only handles triangle lists */
+          if (priv->optimize_geometry && mode == 4)
+            gthree_geometry_optimize_vertex_cache (primitive->geometry, NULL, NULL);
+
           if (material != -1)
             primitive->material = g_object_ref (g_ptr_array_index (priv->materials, material));
           else
@@ -1494,8 +1632,18 @@ rad_to_deg (float rad)
   return rad * 180.0 / G_PI;
 }
 
-static gboolean
-parse_nodes (GthreeLoader *loader, JsonObject *root, GFile *base_path, GError **error)
+static guint
+get_n_nodes (JsonObject *root)
+{
+  if (!json_object_has_member (root, "nodes"))
+    return 0;
+
+  return json_array_get_length (json_object_get_array_member (root, "nodes"));
+}
+
+/* Creates all the (empty) nodes and links them together */
+static void
+create_nodes (GthreeLoader *loader, JsonObject *root)
 {
   GthreeLoaderPrivate *priv = gthree_loader_get_instance_private (loader);
   JsonArray *nodes_j = NULL;
@@ -1503,7 +1651,7 @@ parse_nodes (GthreeLoader *loader, JsonObject *root, GFile *base_path, GError **
   int i;
 
   if (!json_object_has_member (root, "nodes"))
-    return TRUE;
+    return;
 
   nodes_j = json_object_get_array_member (root, "nodes");
   len = json_array_get_length (nodes_j);
@@ -1585,184 +1733,202 @@ parse_nodes (GthreeLoader *loader, JsonObject *root, GFile *base_path, GError **
             }
         }
     }
+}
 
-  /* Then create extra objects like meshes and cameras */
-  for (i = 0; i < len; i++)
+/* Creates extra objects like meshes and cameras for one node */
+static void
+parse_node_extras (GthreeLoader *loader, JsonObject *root, int i)
+{
+  GthreeLoaderPrivate *priv = gthree_loader_get_instance_private (loader);
+  JsonArray *nodes_j = json_object_get_array_member (root, "nodes");
+  JsonObject *node_j = json_array_get_object_element (nodes_j, i);
+  GthreeObject *node = g_ptr_array_index (priv->nodes, i);
+
+  if (json_object_has_member (node_j, "mesh"))
     {
-      JsonObject *node_j = json_array_get_object_element (nodes_j, i);
-      GthreeObject *node = g_ptr_array_index (priv->nodes, i);
+      gint64 mesh_id = json_object_get_int_member (node_j, "mesh");
+      Mesh *mesh_info = g_ptr_array_index (priv->meshes, mesh_id);
+      Skin *skin = NULL;
+      GthreeGroup *group = NULL;
+      GthreeObject *toplevel = NULL;
+      GthreeObject *parent = node;
+      int j;
 
-      if (json_object_has_member (node_j, "mesh"))
+      if (json_object_has_member (node_j, "skin"))
         {
-          gint64 mesh_id = json_object_get_int_member (node_j, "mesh");
-          Mesh *mesh_info = g_ptr_array_index (priv->meshes, mesh_id);
-          Skin *skin = NULL;
-          GthreeGroup *group = NULL;
-          GthreeObject *toplevel = NULL;
-          GthreeObject *parent = node;
-          int j;
+          gint64 skin_id = json_object_get_int_member (node_j, "skin");
 
-          if (json_object_has_member (node_j, "skin"))
-            {
-              gint64 skin_id = json_object_get_int_member (node_j, "skin");
+          // This is used below for each primitive mesh
+          skin = g_ptr_array_index (priv->skins, skin_id);
+        }
 
-              // This is used below for each primitive mesh
-              skin = g_ptr_array_index (priv->skins, skin_id);
-            }
+      if (mesh_info->primitives->len > 1)
+        {
+          group = gthree_group_new ();
+          gthree_object_add_child (node, GTHREE_OBJECT (group));
+          parent = toplevel = GTHREE_OBJECT (group);
+        }
 
-          if (mesh_info->primitives->len > 1)
-            {
-              group = gthree_group_new ();
-              gthree_object_add_child (node, GTHREE_OBJECT (group));
-              parent = toplevel = GTHREE_OBJECT (group);
-            }
+      for (j = 0; j < mesh_info->primitives->len; j++)
+        {
+          Primitive *primitive = g_ptr_array_index (mesh_info->primitives, j);
+          GthreeMaterial *base_material = primitive->material;
+          GthreeMaterial *material;
+          MaterialCacheKey cache_key = { base_material };
+          GthreeMesh *mesh;
 
-          for (j = 0; j < mesh_info->primitives->len; j++)
-            {
-              Primitive *primitive = g_ptr_array_index (mesh_info->primitives, j);
-              GthreeMaterial *base_material = primitive->material;
-              GthreeMaterial *material;
-              MaterialCacheKey cache_key = { base_material };
-              GthreeMesh *mesh;
+          cache_key.use_skinning = skin != NULL;
 
-              cache_key.use_skinning = skin != NULL;
+          cache_key.use_vertex_tangents =
+            gthree_geometry_has_attribute (primitive->geometry, "tangent");
+          cache_key.use_vertex_colors =
+            gthree_geometry_has_attribute (primitive->geometry, "color");
 
-              cache_key.use_vertex_tangents =
-                gthree_geometry_has_attribute (primitive->geometry, "tangent");
-              cache_key.use_vertex_colors =
-                gthree_geometry_has_attribute (primitive->geometry, "color");
+          cache_key.use_morph_targets = gthree_geometry_has_morph_attributes (primitive->geometry);
+          cache_key.use_morph_normals = cache_key.use_morph_targets &&
+            (gthree_geometry_get_morph_attributes (primitive->geometry, "normal") != NULL);
 
-              cache_key.use_morph_targets = gthree_geometry_has_morph_attributes (primitive->geometry);
-              cache_key.use_morph_normals = cache_key.use_morph_targets &&
-                (gthree_geometry_get_morph_attributes (primitive->geometry, "normal") != NULL);
+          material = g_hash_table_lookup (priv->final_materials_hash, &cache_key);
+          if (material == NULL)
+            {
+              MaterialCacheKey *cache_key_copy = material_cache_key_clone (&cache_key);
 
-              material = g_hash_table_lookup (priv->final_materials_hash, &cache_key);
-              if (material == NULL)
-                {
-                  MaterialCacheKey *cache_key_copy = material_cache_key_clone (&cache_key);
+              material = gthree_material_clone (base_material);
+              if (cache_key.use_vertex_colors)
+                gthree_material_set_vertex_colors (material, TRUE);
+              if (cache_key.use_skinning)
+                gthree_mesh_material_set_skinning (GTHREE_MESH_MATERIAL (material), TRUE);
 
-                  material = gthree_material_clone (base_material);
-                  if (cache_key.use_vertex_colors)
-                    gthree_material_set_vertex_colors (material, TRUE);
-                  if (cache_key.use_skinning)
-                    gthree_mesh_material_set_skinning (GTHREE_MESH_MATERIAL (material), TRUE);
+              //TODO: if (cache_key.use_vertex_tangents)
 
-                  //TODO: if (cache_key.use_vertex_tangents)
+              if (cache_key.use_morph_targets)
+                gthree_mesh_material_set_morph_targets (GTHREE_MESH_MATERIAL (material), TRUE);
+              if (cache_key.use_morph_normals)
+                gthree_mesh_material_set_morph_normals (GTHREE_MESH_MATERIAL (material), TRUE);
 
-                  if (cache_key.use_morph_targets)
-                    gthree_mesh_material_set_morph_targets (GTHREE_MESH_MATERIAL (material), TRUE);
-                  if (cache_key.use_morph_normals)
-                    gthree_mesh_material_set_morph_normals (GTHREE_MESH_MATERIAL (material), TRUE);
+              g_hash_table_insert (priv->final_materials_hash, cache_key_copy, material);
+              g_ptr_array_add (priv->final_materials, material);
+            }
 
-                  g_hash_table_insert (priv->final_materials_hash, cache_key_copy, material);
-                  g_ptr_array_add (priv->final_materials, material);
-                }
 
+          /* TODO: more cache keys
+           * var useFlatShading = geometry.attributes.normal === undefined;
+           */
 
-              /* TODO: more cache keys
-               * var useFlatShading = geometry.attributes.normal === undefined;
-               */
+          if (skin != NULL)
+            {
+              GthreeSkeleton *skeleton;
+              g_autofree GthreeBone **bones = g_new0 (GthreeBone *, skin->joints->len);
+              g_autofree graphene_matrix_t *bone_inverses = g_new0 (graphene_matrix_t, skin->joints->len);
+              int b;
 
-              if (skin != NULL)
+              for (b = 0; b < skin->joints->len; b++)
                 {
-                  GthreeSkeleton *skeleton;
-                  g_autofree GthreeBone **bones = g_new0 (GthreeBone *, skin->joints->len);
-                  g_autofree graphene_matrix_t *bone_inverses = g_new0 (graphene_matrix_t, skin->joints->len);
-                  int b;
+                  bones[b] = g_ptr_array_index (priv->nodes, g_array_index (skin->joints, int, b));
+                  graphene_matrix_init_identity (&bone_inverses[b]);
+                }
 
-                  for (b = 0; b < skin->joints->len; b++)
-                    {
-                      bones[b] = g_ptr_array_index (priv->nodes, g_array_index (skin->joints, int, b));
-                      graphene_matrix_init_identity (&bone_inverses[b]);
-                    }
+              mesh = (GthreeMesh *)gthree_skinned_mesh_new (primitive->geometry, g_object_ref (material));
 
-                  mesh = (GthreeMesh *)gthree_skinned_mesh_new (primitive->geometry, g_object_ref (material));
+              if (skin->inverse_bind_matrices >= 0)
+                {
+                  Accessor *accessor = g_ptr_array_index (priv->accessors, skin->inverse_bind_matrices);
 
-                  if (skin->inverse_bind_matrices >= 0)
+                  if (accessor->count != skin->joints->len)
+                    g_warning ("Wrong inverse bind matrices size");
+                  else
                     {
-                      Accessor *accessor = g_ptr_array_index (priv->accessors, skin->inverse_bind_matrices);
-
-                      if (accessor->count != skin->joints->len)
-                        g_warning ("Wrong inverse bind matrices size");
-                      else
-                        {
-                          for (b = 0; b < skin->joints->len; b++)
-                            gthree_attribute_array_get_matrix (accessor->array, b, 0, &bone_inverses[b]);
-                        }
+                      for (b = 0; b < skin->joints->len; b++)
+                        gthree_attribute_array_get_matrix (accessor->array, b, 0, &bone_inverses[b]);
                     }
-
-                  // From three.js, see #15319
-                  gthree_skinned_mesh_normalize_skin_weights (GTHREE_SKINNED_MESH (mesh));
-
-                  skeleton = gthree_skeleton_new (bones, skin->joints->len, bone_inverses);
-                  gthree_skinned_mesh_bind (GTHREE_SKINNED_MESH (mesh), skeleton,
-                                            gthree_object_get_world_matrix (GTHREE_OBJECT (mesh)));
                 }
-              else
-                mesh = gthree_mesh_new (primitive->geometry, g_object_ref (material));
 
-              switch (primitive->mode)
-                {
-                case 4:
-                  gthree_mesh_set_draw_mode (mesh, GTHREE_DRAW_MODE_TRIANGLES);
-                  break;
-                case 5:
-                  gthree_mesh_set_draw_mode (mesh, GTHREE_DRAW_MODE_TRIANGLE_STRIP);
-                  break;
-                case 6:
-                  gthree_mesh_set_draw_mode (mesh, GTHREE_DRAW_MODE_TRIANGLE_FAN);
-                  break;
-                default:
-                  g_warning ("Unsupported primitive mode %d", primitive->mode);
-                  break;
-                }
+              // From three.js, see #15319
+              gthree_skinned_mesh_normalize_skin_weights (GTHREE_SKINNED_MESH (mesh));
 
+              skeleton = gthree_skeleton_new (bones, skin->joints->len, bone_inverses);
+              gthree_skinned_mesh_bind (GTHREE_SKINNED_MESH (mesh), skeleton,
+                                        gthree_object_get_world_matrix (GTHREE_OBJECT (mesh)));
+            }
+          else
+            mesh = gthree_mesh_new (primitive->geometry, g_object_ref (material));
 
-              if (mesh_info->weights)
-                {
-                  GArray *morph_targets = gthree_mesh_get_morph_targets (mesh);
-                  for (int j = 0; j < mesh_info->weights->len; j++)
-                    g_array_index (morph_targets, float, j) = g_array_index (mesh_info->weights, float, j);
-                }
+          switch (primitive->mode)
+            {
+            case 4:
+              gthree_mesh_set_draw_mode (mesh, GTHREE_DRAW_MODE_TRIANGLES);
+              break;
+            case 5:
+              gthree_mesh_set_draw_mode (mesh, GTHREE_DRAW_MODE_TRIANGLE_STRIP);
+              break;
+            case 6:
+              gthree_mesh_set_draw_mode (mesh, GTHREE_DRAW_MODE_TRIANGLE_FAN);
+              break;
+            default:
+              g_warning ("Unsupported primitive mode %d", primitive->mode);
+              break;
+            }
 
 
-              gthree_object_add_child (parent, GTHREE_OBJECT (mesh));
-              if (toplevel == NULL)
-                toplevel = GTHREE_OBJECT (mesh);
+          if (mesh_info->weights)
+            {
+              GArray *morph_targets = gthree_mesh_get_morph_targets (mesh);
+              for (int j = 0; j < mesh_info->weights->len; j++)
+                g_array_index (morph_targets, float, j) = g_array_index (mesh_info->weights, float, j);
             }
 
-          if (mesh_info->name && toplevel)
-            gthree_object_set_name (GTHREE_OBJECT (toplevel), mesh_info->name);
+
+          gthree_object_add_child (parent, GTHREE_OBJECT (mesh));
+          if (toplevel == NULL)
+            toplevel = GTHREE_OBJECT (mesh);
+
+          g_signal_emit (loader, loader_signals[MESH_READY], 0, mesh, (int)mesh_id);
         }
 
-      if (json_object_has_member (node_j, "camera"))
-        {
-          gint64 camera_id = json_object_get_int_member (node_j, "camera");
-          Camera *camera = g_ptr_array_index (priv->cameras, camera_id);
-          GthreeCamera *camera_node = NULL;
+      if (mesh_info->name && toplevel)
+        gthree_object_set_name (GTHREE_OBJECT (toplevel), mesh_info->name);
+    }
 
-          if (camera->perspective)
-            camera_node = (GthreeCamera *)gthree_perspective_camera_new (rad_to_deg (camera->yfov), camera->aspect_ratio,
-                                                                         camera->znear, camera->zfar);
-          else
-            camera_node = (GthreeCamera *)gthree_orthographic_camera_new (camera->xmag / -2.0,
-                                                                          camera->xmag / 2.0,
-                                                                          camera->ymag / 2.0,
-                                                                          camera->ymag / -2.0,
-                                                                          camera->znear,
-                                                                          camera->zfar);
-
-          if (camera_node)
-            {
-              if (camera->name)
-                gthree_object_set_name (GTHREE_OBJECT (camera_node), camera->name);
+  if (json_object_has_member (node_j, "camera"))
+    {
+      gint64 camera_id = json_object_get_int_member (node_j, "camera");
+      Camera *camera = g_ptr_array_index (priv->cameras, camera_id);
+      GthreeCamera *camera_node = NULL;
 
-              gthree_object_add_child (node, GTHREE_OBJECT (camera_node));
-            }
-        }
+      if (camera->perspective)
+        camera_node = (GthreeCamera *)gthree_perspective_camera_new (rad_to_deg (camera->yfov), camera->aspect_ratio,
+                                                                     camera->znear, camera->zfar);
+      else
+        camera_node = (GthreeCamera *)gthree_orthographic_camera_new (camera->xmag / -2.0,
+                                                                      camera->xmag / 2.0,
+                                                                      camera->ymag / 2.0,
+                                                                      camera->ymag / -2.0,
+                                                                      camera->znear,
+                                                                      camera->zfar);
+
+      if (camera_node)
+        {
+          if (camera->name)
+            gthree_object_set_name (GTHREE_OBJECT (camera_node), camera->name);
 
+          gthree_object_add_child (node, GTHREE_OBJECT (camera_node));
+        }
     }
 
+  g_signal_emit (loader, loader_signals[NODE_READY], 0, node, i);
+}
+
+static gboolean
+parse_nodes (GthreeLoader *loader, JsonObject *root, GFile *base_path, GError **error)
+{
+  guint len = get_n_nodes (root);
+  int i;
+
+  create_nodes (loader, root);
+
+  for (i = 0; i < len; i++)
+    parse_node_extras (loader, root, i);
+
   return TRUE;
 }
 
@@ -1991,13 +2157,10 @@ parse_animations (GthreeLoader *loader, JsonObject *root, GError **error)
   return TRUE;
 }
 
-GthreeLoader *
-gthree_loader_parse_gltf (GBytes *data, GFile *base_path, GError **error)
+static JsonNode *
+parse_gltf_container (GBytes *data, GBytes **bin_out, GError **error)
 {
   g_autoptr(JsonParser) parser = NULL;
-  g_autoptr(JsonNode) root_node = NULL;
-  JsonObject *root;
-  g_autoptr(GthreeLoader) loader = NULL;
   guint32 glb_version;
   guint32 json_length;
   g_autoptr(GBytes) json = NULL;
@@ -2025,44 +2188,70 @@ gthree_loader_parse_gltf (GBytes *data, GFile *base_path, GError **error)
   if (!json_parser_load_from_data (parser, g_bytes_get_data (json, NULL), g_bytes_get_size (json), error))
     return NULL;
 
-  root_node = json_parser_steal_root (parser);
-  root = json_node_get_object (root_node);
+  *bin_out = g_steal_pointer (&bin);
 
-  loader = g_object_new (gthree_loader_get_type (), NULL);
+  return json_parser_steal_root (parser);
+}
 
+/* Everything up to the nodes, this doesn't touch anything outside the loader */
+static gboolean
+parse_resources (GthreeLoader *loader, JsonObject *root, GBytes *bin, GFile *base_path, GError **error)
+{
   init_node_info (loader, root);
 
   if (!parse_asset (loader, root, error))
-    return NULL;
+    return FALSE;
 
   if (!parse_buffers (loader, root, bin, base_path, error))
-    return NULL;
+    return FALSE;
 
   if (!parse_buffer_views (loader, root, error))
-    return NULL;
+    return FALSE;
 
   if (!parse_accessors (loader, root, error))
-    return NULL;
+    return FALSE;
 
   if (!parse_samplers (loader, root, error))
-    return NULL;
+    return FALSE;
 
   if (!parse_images (loader, root, base_path, error))
-    return NULL;
+    return FALSE;
 
   if (!parse_textures (loader, root, error))
-    return NULL;
+    return FALSE;
 
   if (!parse_materials (loader, root, error))
-    return NULL;
+    return FALSE;
 
   if (!parse_meshes (loader, root, error))
-    return NULL;
+    return FALSE;
 
   if (!parse_cameras (loader, root, error))
-    return NULL;
+    return FALSE;
 
   if (!parse_skins (loader, root, error))
+    return FALSE;
+
+  return TRUE;
+}
+
+GthreeLoader *
+gthree_loader_parse_gltf (GBytes *data, GFile *base_path, GError **error)
+{
+  g_autoptr(JsonNode) root_node = NULL;
+  JsonObject *root;
+  g_autoptr(GthreeLoader) loader = NULL;
+  g_autoptr(GBytes) bin = NULL;
+
+  root_node = parse_gltf_container (data, &bin, error);
+  if (root_node == NULL)
+    return NULL;
+
+  root = json_node_get_object (root_node);
+
+  loader = gthree_loader_new ();
+
+  if (!parse_resources (loader, root, bin, base_path, error))
     return NULL;
 
   if (!parse_nodes (loader, root, base_path, error))
@@ -2077,6 +2266,163 @@ gthree_loader_parse_gltf (GBytes *data, GFile *base_path, GError **error)
   return g_steal_pointer (&loader);
 }
 
+typedef struct {
+  GBytes *data;
+  GFile *base_path;
+  JsonNode *root_node;
+  GBytes *bin;
+  guint n_nodes;
+  guint next_node;
+  GSource *idle_source;
+} ParseAsyncData;
+
+static void
+parse_async_data_free (ParseAsyncData *async_data)
+{
+  g_bytes_unref (async_data->data);
+  g_clear_object (&async_data->base_path);
+  g_clear_pointer (&async_data->root_node, json_node_unref);
+  g_clear_pointer (&async_data->bin, g_bytes_unref);
+  if (async_data->idle_source)
+    {
+      g_source_destroy (async_data->idle_source);
+      g_source_unref (async_data->idle_source);
+    }
+  g_free (async_data);
+}
+
+/* Time to spend building nodes per main loop iteration, so frames can
+   be drawn in between */
+#define PARSE_NODES_BUDGET_USEC 4000
+
+static gboolean
+parse_nodes_idle (gpointer user_data)
+{
+  GTask *task = user_data;
+  GthreeLoader *loader = g_task_get_source_object (task);
+  ParseAsyncData *async_data = g_task_get_task_data (task);
+  JsonObject *root = json_node_get_object (async_data->root_node);
+  gint64 deadline = g_get_monotonic_time () + PARSE_NODES_BUDGET_USEC;
+  GError *error = NULL;
+
+  if (g_task_return_error_if_cancelled (task))
+    goto out;
+
+  while (async_data->next_node < async_data->n_nodes &&
+         g_get_monotonic_time () < deadline)
+    parse_node_extras (loader, root, async_data->next_node++);
+
+  if (async_data->next_node < async_data->n_nodes)
+    return G_SOURCE_CONTINUE;
+
+  if (parse_animations (loader, root, &error))
+    g_task_return_boolean (task, TRUE);
+  else
+    g_task_return_error (task, error);
+
+ out:
+  g_clear_pointer (&async_data->idle_source, g_source_unref);
+  return G_SOURCE_REMOVE;
+}
+
+static void
+parse_resources_thread (GTask        *task,
+                        gpointer      source_object,
+                        gpointer      task_data,
+                        GCancellable *cancellable)
+{
+  GthreeLoader *loader = source_object;
+  ParseAsyncData *async_data = task_data;
+  GError *error = NULL;
+
+  async_data->root_node = parse_gltf_container (async_data->data, &async_data->bin, &error);
+  if (async_data->root_node == NULL ||
+      !parse_resources (loader, json_node_get_object (async_data->root_node),
+                        async_data->bin, async_data->base_path, &error))
+    {
+      g_task_return_error (task, error);
+      return;
+    }
+
+  g_task_return_boolean (task, TRUE);
+}
+
+static void
+parse_resources_done (GObject      *source_object,
+                      GAsyncResult *result,
+                      gpointer      user_data)
+{
+  g_autoptr(GTask) task = user_data;
+  GthreeLoader *loader = GTHREE_LOADER (source_object);
+  ParseAsyncData *async_data = g_task_get_task_data (task);
+  JsonObject *root;
+  GError *error = NULL;
+
+  if (!g_task_propagate_boolean (G_TASK (result), &error))
+    {
+      g_task_return_error (task, error);
+      return;
+    }
+
+  /* The scenes are linked up right away (they are cheap), and the
+     meshes are then added to them over several main loop iterations */
+  root = json_node_get_object (async_data->root_node);
+  create_nodes (loader, root);
+  if (!parse_scenes (loader, root, &error))
+    {
+      g_task_return_error (task, error);
+      return;
+    }
+
+  async_data->n_nodes = get_n_nodes (root);
+  async_data->idle_source = g_idle_source_new ();
+  g_source_set_callback (async_data->idle_source, parse_nodes_idle,
+                         g_object_ref (task), g_object_unref);
+  g_source_attach (async_data->idle_source, g_task_get_context (task));
+}
+
+/* Like gthree_loader_parse_gltf(), but decodes buffers and images on
+ * other threads, and then builds the nodes a few at a time from the
+ * main loop, emitting GthreeLoader::node-ready and
+ * GthreeLoader::mesh-ready as they are done. */
+void
+gthree_loader_parse_gltf_async (GthreeLoader        *loader,
+                                GBytes              *data,
+                                GFile               *base_path,
+                                GCancellable        *cancellable,
+                                GAsyncReadyCallback  callback,
+                                gpointer             user_data)
+{
+  g_autoptr(GTask) task = NULL;
+  g_autoptr(GTask) thread_task = NULL;
+  ParseAsyncData *async_data;
+
+  g_return_if_fail (GTHREE_IS_LOADER (loader));
+
+  async_data = g_new0 (ParseAsyncData, 1);
+  async_data->data = g_bytes_ref (data);
+  if (base_path)
+    async_data->base_path = g_object_ref (base_path);
+
+  task = g_task_new (loader, cancellable, callback, user_data);
+  g_task_set_source_tag (task, gthree_loader_parse_gltf_async);
+  g_task_set_task_data (task, async_data, (GDestroyNotify)parse_async_data_free);
+
+  thread_task = g_task_new (loader, cancellable, parse_resources_done, g_object_ref (task));
+  g_task_set_task_data (thread_task, async_data, NULL);
+  g_task_run_in_thread (thread_task, parse_resources_thread);
+}
+
+gboolean
+gthree_loader_parse_gltf_finish (GthreeLoader  *loader,
+                                 GAsyncResult  *result,
+                                 GError       **error)
+{
+  g_return_val_if_fail (g_task_is_valid (result, loader), FALSE);
+
+  return g_task_propagate_boolean (G_TASK (result), error);
+}
+
 int
 gthree_loader_get_n_scenes (GthreeLoader *loader)
 {
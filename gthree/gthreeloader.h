@@ -61,7 +61,28 @@ GthreeAnimationClip *gthree_loader_get_animation    (GthreeLoader *loader,
                                                      int           index);
 
 GTHREE_API
-GthreeLoader *gthree_loader_parse_gltf (GBytes *data, GFile *base_path, GError **error);
+GthreeLoader *gthree_loader_new (void);
+GTHREE_API
+gboolean      gthree_loader_get_optimize_geometry (GthreeLoader *loader);
+GTHREE_API
+void          gthree_loader_set_optimize_geometry (GthreeLoader *loader,
+                                                   gboolean      optimize);
+
+GTHREE_API
+GthreeLoader *gthree_loader_parse_gltf        (GBytes               *data,
+                                               GFile                *base_path,
+                                               GError              **error);
+GTHREE_API
+void          gthree_loader_parse_gltf_async  (GthreeLoader         *loader,
+                                               GBytes               *data,
+                                               GFile                *base_path,
+                                               GCancellable         *cancellable,
+                                               GAsyncReadyCallback   callback,
+                                               gpointer              user_data);
+GTHREE_API
+gboolean      gthree_loader_parse_gltf_finish (GthreeLoader         *loader,
+                                               GAsyncResult         *result,
+                                               GError              **error);
 
 GTHREE_API
 GthreeGeometry *gthree_load_geometry_from_json (const char *data, GError **error);
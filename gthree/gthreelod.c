@@ -0,0 +1,476 @@
+#include <math.h>
+
+#include "gthreelod.h"
+#include "gthreemesh.h"
+#include "gthreeprivate.h"
+
+typedef struct {
+  GthreeObject *object;
+  float threshold;
+  float hysteresis;
+} LodLevel;
+
+typedef struct {
+  GArray *levels;
+  int current_level;
+  gboolean auto_update;
+  gboolean screen_space;
+} GthreeLODPrivate;
+
+enum {
+  PROP_0,
+
+  PROP_AUTO_UPDATE,
+  PROP_SCREEN_SPACE,
+
+  N_PROPS
+};
+
+static GParamSpec *obj_props[N_PROPS] = { NULL, };
+
+G_DEFINE_TYPE_WITH_PRIVATE (GthreeLOD, gthree_lod, GTHREE_TYPE_OBJECT)
+
+/**
+ * gthree_lod_new:
+ *
+ * Creates an object that shows one of its levels at a time, picked by
+ * how far away from the camera it is. By default the levels are chosen
+ * by the camera distance, see gthree_lod_set_screen_space() for picking
+ * them by projected size instead.
+ *
+ * Returns: (transfer full): a new #GthreeLOD
+ */
+GthreeLOD *
+gthree_lod_new (void)
+{
+  return g_object_new (gthree_lod_get_type (), NULL);
+}
+
+static void
+lod_level_clear (gpointer data)
+{
+  LodLevel *level = data;
+
+  g_object_unref (level->object);
+}
+
+static void
+gthree_lod_init (GthreeLOD *lod)
+{
+  GthreeLODPrivate *priv = gthree_lod_get_instance_private (lod);
+
+  priv->levels = g_array_new (FALSE, FALSE, sizeof (LodLevel));
+  g_array_set_clear_func (priv->levels, lod_level_clear);
+  priv->auto_update = TRUE;
+}
+
+static void
+gthree_lod_finalize (GObject *obj)
+{
+  GthreeLOD *lod = GTHREE_LOD (obj);
+  GthreeLODPrivate *priv = gthree_lod_get_instance_private (lod);
+
+  g_array_unref (priv->levels);
+
+  G_OBJECT_CLASS (gthree_lod_parent_class)->finalize (obj);
+}
+
+static void
+gthree_lod_set_property (GObject *obj,
+                         guint prop_id,
+                         const GValue *value,
+                         GParamSpec *pspec)
+{
+  GthreeLOD *lod = GTHREE_LOD (obj);
+
+  switch (prop_id)
+    {
+    case PROP_AUTO_UPDATE:
+      gthree_lod_set_auto_update (lod, g_value_get_boolean (value));
+      break;
+
+    case PROP_SCREEN_SPACE:
+      gthree_lod_set_screen_space (lod, g_value_get_boolean (value));
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
+    }
+}
+
+static void
+gthree_lod_get_property (GObject *obj,
+                         guint prop_id,
+                         GValue *value,
+                         GParamSpec *pspec)
+{
+  GthreeLOD *lod = GTHREE_LOD (obj);
+  GthreeLODPrivate *priv = gthree_lod_get_instance_private (lod);
+
+  switch (prop_id)
+    {
+    case PROP_AUTO_UPDATE:
+      g_value_set_boolean (value, priv->auto_update);
+      break;
+
+    case PROP_SCREEN_SPACE:
+      g_value_set_boolean (value, priv->screen_space);
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
+    }
+}
+
+static void
+gthree_lod_class_init (GthreeLODClass *klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+
+  gobject_class->set_property = gthree_lod_set_property;
+  gobject_class->get_property = gthree_lod_get_property;
+  gobject_class->finalize = gthree_lod_finalize;
+
+  obj_props[PROP_AUTO_UPDATE] =
+    g_param_spec_boolean ("auto-update", "Auto update", "Pick the level when rendering",
+                          TRUE,
+                          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  obj_props[PROP_SCREEN_SPACE] =
+    g_param_spec_boolean ("screen-space", "Screen space", "Level thresholds are projected sizes in pixels",
+                          FALSE,
+                          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  g_object_class_install_properties (gobject_class, N_PROPS, obj_props);
+}
+
+/* Levels are ordered by this, from the most to the least detailed.
+ * Distances increase towards coarser levels, sizes decrease. */
+static float
+get_level_key (GthreeLOD *lod,
+               LodLevel  *level)
+{
+  GthreeLODPrivate *priv = gthree_lod_get_instance_private (lod);
+
+  return priv->screen_space ? -level->threshold : level->threshold;
+}
+
+static void
+sort_levels (GthreeLOD *lod)
+{
+  GthreeLODPrivate *priv = gthree_lod_get_instance_private (lod);
+  guint i, j;
+
+  /* Few levels, insertion sort keeps equal thresholds in order */
+  for (i = 1; i < priv->levels->len; i++)
+    {
+      LodLevel level = g_array_index (priv->levels, LodLevel, i);
+      float key = get_level_key (lod, &level);
+
+      for (j = i; j > 0 && get_level_key (lod, &g_array_index (priv->levels, LodLevel, j - 1)) > key; j--)
+        g_array_index (priv->levels, LodLevel, j) = g_array_index (priv->levels, LodLevel, j - 1);
+      g_array_index (priv->levels, LodLevel, j) = level;
+    }
+}
+
+/**
+ * gthree_lod_add_level:
+ * @lod: a #GthreeLOD
+ * @object: the object to show for this level
+ * @threshold: the camera distance from which on this level is used, or
+ *   with #GthreeLOD:screen-space, the projected diameter in pixels below
+ *   which it is used
+ * @hysteresis: fraction of @threshold by which the object has to move
+ *   back before the level is left again, to avoid flickering when the
+ *   object is right at the threshold
+ *
+ * Adds @object as a child of @lod, and as one of its levels.
+ */
+void
+gthree_lod_add_level (GthreeLOD    *lod,
+                      GthreeObject *object,
+                      float         threshold,
+                      float         hysteresis)
+{
+  GthreeLODPrivate *priv = gthree_lod_get_instance_private (lod);
+  LodLevel level = { g_object_ref (object), fabsf (threshold), CLAMP (hysteresis, 0, 1) };
+  guint i;
+
+  g_array_append_val (priv->levels, level);
+  sort_levels (lod);
+
+  /* Until the next update, show the most detailed level */
+  for (i = 0; i < priv->levels->len; i++)
+    gthree_object_set_visible (g_array_index (priv->levels, LodLevel, i).object, i == 0);
+  priv->current_level = 0;
+
+  gthree_object_add_child (GTHREE_OBJECT (lod), object);
+}
+
+/**
+ * gthree_lod_add_simplified_level:
+ * @lod: a #GthreeLOD
+ * @threshold: see gthree_lod_add_level()
+ * @hysteresis: see gthree_lod_add_level()
+ * @ratio: the fraction of the triangles to keep
+ *
+ * Adds a level made by simplifying the geometry of the first level
+ * with gthree_geometry_simplify(). The first level has to be a
+ * #GthreeMesh, the new level shares its materials and vertex data.
+ *
+ * Returns: (transfer none) (nullable): the new level
+ */
+GthreeObject *
+gthree_lod_add_simplified_level (GthreeLOD *lod,
+                                 float      threshold,
+                                 float      hysteresis,
+                                 float      ratio)
+{
+  GthreeLODPrivate *priv = gthree_lod_get_instance_private (lod);
+  g_autoptr(GPtrArray) materials = NULL;
+  g_autoptr(GthreeGeometry) geometry = NULL;
+  g_autoptr(GthreeMesh) mesh = NULL;
+  GthreeMesh *source;
+  int i;
+
+  if (priv->levels->len == 0 ||
+      !GTHREE_IS_MESH (g_array_index (priv->levels, LodLevel, 0).object))
+    {
+      g_warning ("The first level must be a mesh to simplify");
+      return NULL;
+    }
+
+  source = GTHREE_MESH (g_array_index (priv->levels, LodLevel, 0).object);
+  if (gthree_mesh_get_draw_mode (source) != GTHREE_DRAW_MODE_TRIANGLES)
+    {
+      g_warning ("Only triangle meshes can be simplified");
+      return NULL;
+    }
+
+  geometry = gthree_geometry_simplify (gthree_mesh_get_geometry (source), ratio, 1.0);
+  if (geometry == NULL)
+    return NULL;
+
+  materials = g_ptr_array_new ();
+  for (i = 0; i < gthree_mesh_get_n_materials (source); i++)
+    g_ptr_array_add (materials, gthree_mesh_get_material (source, i));
+
+  mesh = gthree_mesh_new (geometry, NULL);
+  gthree_mesh_set_materials (mesh, materials);
+  gthree_object_set_cast_shadow (GTHREE_OBJECT (mesh), gthree_object_get_cast_shadow (GTHREE_OBJECT (source)));
+  gthree_object_set_receive_shadow (GTHREE_OBJECT (mesh), gthree_object_get_receive_shadow (GTHREE_OBJECT (source)));
+
+  gthree_lod_add_level (lod, GTHREE_OBJECT (mesh), threshold, hysteresis);
+
+  return GTHREE_OBJECT (mesh);
+}
+
+int
+gthree_lod_get_n_levels (GthreeLOD *lod)
+{
+  GthreeLODPrivate *priv = gthree_lod_get_instance_private (lod);
+
+  return priv->levels->len;
+}
+
+/**
+ * gthree_lod_get_level:
+ * @lod: a #GthreeLOD
+ * @index: the level, 0 being the most detailed
+ *
+ * Returns: (transfer none): the object of the level
+ */
+GthreeObject *
+gthree_lod_get_level (GthreeLOD *lod,
+                      int        index)
+{
+  GthreeLODPrivate *priv = gthree_lod_get_instance_private (lod);
+
+  g_return_val_if_fail (index >= 0 && index < priv->levels->len, NULL);
+
+  return g_array_index (priv->levels, LodLevel, index).object;
+}
+
+int
+gthree_lod_get_current_level (GthreeLOD *lod)
+{
+  GthreeLODPrivate *priv = gthree_lod_get_instance_private (lod);
+
+  return priv->current_level;
+}
+
+gboolean
+gthree_lod_get_auto_update (GthreeLOD *lod)
+{
+  GthreeLODPrivate *priv = gthree_lod_get_instance_private (lod);
+
+  return priv->auto_update;
+}
+
+void
+gthree_lod_set_auto_update (GthreeLOD *lod,
+                            gboolean   auto_update)
+{
+  GthreeLODPrivate *priv = gthree_lod_get_instance_private (lod);
+
+  auto_update = !!auto_update;
+  if (priv->auto_update == auto_update)
+    return;
+
+  priv->auto_update = auto_update;
+  g_object_notify_by_pspec (G_OBJECT (lod), obj_props[PROP_AUTO_UPDATE]);
+}
+
+gboolean
+gthree_lod_get_screen_space (GthreeLOD *lod)
+{
+  GthreeLODPrivate *priv = gthree_lod_get_instance_private (lod);
+
+  return priv->screen_space;
+}
+
+void
+gthree_lod_set_screen_space (GthreeLOD *lod,
+                             gboolean   screen_space)
+{
+  GthreeLODPrivate *priv = gthree_lod_get_instance_private (lod);
+
+  screen_space = !!screen_space;
+  if (priv->screen_space == screen_space)
+    return;
+
+  priv->screen_space = screen_space;
+  sort_levels (lod);
+  g_object_notify_by_pspec (G_OBJECT (lod), obj_props[PROP_SCREEN_SPACE]);
+}
+
+/* The world space bounds of the most detailed level that has some */
+static gboolean
+get_level_bounding_sphere (GthreeLOD         *lod,
+                           graphene_sphere_t *sphere)
+{
+  GthreeLODPrivate *priv = gthree_lod_get_instance_private (lod);
+  guint i;
+
+  for (i = 0; i < priv->levels->len; i++)
+    {
+      GthreeObject *object = g_array_index (priv->levels, LodLevel, i).object;
+      GthreeGeometry *geometry;
+
+      if (!GTHREE_IS_MESH (object))
+        continue;
+
+      geometry = gthree_mesh_get_geometry (GTHREE_MESH (object));
+      if (geometry == NULL)
+        continue;
+
+      graphene_matrix_transform_sphere (gthree_object_get_world_matrix (object),
+                                        gthree_geometry_get_bounding_sphere (geometry),
+                                        sphere);
+      return TRUE;
+    }
+
+  return FALSE;
+}
+
+/* Larger is less detailed, in the same units as get_level_key() */
+static float
+get_lod_metric (GthreeLOD    *lod,
+                GthreeCamera *camera,
+                float         viewport_height)
+{
+  GthreeLODPrivate *priv = gthree_lod_get_instance_private (lod);
+  const graphene_matrix_t *camera_matrix = gthree_object_get_world_matrix (GTHREE_OBJECT (camera));
+  const graphene_matrix_t *lod_matrix = gthree_object_get_world_matrix (GTHREE_OBJECT (lod));
+  graphene_sphere_t sphere;
+
+  if (priv->screen_space && get_level_bounding_sphere (lod, &sphere))
+    {
+      graphene_matrix_t proj_screen;
+      graphene_point3d_t center;
+      graphene_vec4_t clip;
+      float scale, w;
+
+      gthree_camera_get_proj_screen_matrix (camera, &proj_screen);
+      graphene_sphere_get_center (&sphere, &center);
+      graphene_vec4_init (&clip, center.x, center.y, center.z, 1);
+      graphene_matrix_transform_vec4 (&proj_screen, &clip, &clip);
+
+      /* w is the view depth for perspective, and 1 for orthographic
+       * projections. Around or behind the camera, it is as big as it gets. */
+      w = graphene_vec4_get_w (&clip);
+      if (w <= 0.0001f)
+        return -G_MAXFLOAT;
+
+      scale = graphene_matrix_get_value (gthree_camera_get_projection_matrix (camera), 1, 1);
+      return -(2 * graphene_sphere_get_radius (&sphere) * scale / w * viewport_height / 2);
+    }
+  else
+    {
+      graphene_point3d_t camera_position, lod_position;
+
+      graphene_point3d_init (&camera_position,
+                             graphene_matrix_get_x_translation (camera_matrix),
+                             graphene_matrix_get_y_translation (camera_matrix),
+                             graphene_matrix_get_z_translation (camera_matrix));
+      graphene_point3d_init (&lod_position,
+                             graphene_matrix_get_x_translation (lod_matrix),
+                             graphene_matrix_get_y_translation (lod_matrix),
+                             graphene_matrix_get_z_translation (lod_matrix));
+
+      /* Screen space thresholds but no bounds, can't use them */
+      if (priv->screen_space)
+        return -G_MAXFLOAT;
+
+      return graphene_point3d_distance (&camera_position, &lod_position, NULL);
+    }
+}
+
+/**
+ * gthree_lod_update:
+ * @lod: a #GthreeLOD
+ * @camera: the camera the scene is rendered with
+ * @viewport_height: the height of the viewport in pixels, only used
+ *   with #GthreeLOD:screen-space
+ *
+ * Shows the level that matches the current view and hides the others.
+ * The renderer calls this for all visible lods when they have
+ * #GthreeLOD:auto-update set, after updating the world matrices.
+ */
+void
+gthree_lod_update (GthreeLOD    *lod,
+                   GthreeCamera *camera,
+                   float         viewport_height)
+{
+  GthreeLODPrivate *priv = gthree_lod_get_instance_private (lod);
+  float metric;
+  guint i, selected;
+
+  if (priv->levels->len <= 1)
+    return;
+
+  metric = get_lod_metric (lod, camera, viewport_height);
+
+  for (i = 1; i < priv->levels->len; i++)
+    {
+      LodLevel *level = &g_array_index (priv->levels, LodLevel, i);
+      float key = get_level_key (lod, level);
+
+      /* Stay at the current level until clearly past its threshold */
+      if (i == priv->current_level)
+        key -= fabsf (key) * level->hysteresis;
+
+      if (metric < key)
+        break;
+    }
+
+  selected = i - 1;
+  if (selected == priv->current_level &&
+      gthree_object_get_visible (g_array_index (priv->levels, LodLevel, selected).object))
+    return;
+
+  for (i = 0; i < priv->levels->len; i++)
+    gthree_object_set_visible (g_array_index (priv->levels, LodLevel, i).object, i == selected);
+
+  priv->current_level = selected;
+}
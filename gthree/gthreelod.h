@@ -0,0 +1,71 @@
+#ifndef __GTHREE_LOD_H__
+#define __GTHREE_LOD_H__
+
+#if !defined (__GTHREE_H_INSIDE__) && !defined (GTHREE_COMPILATION)
+#error "Only <gthree/gthree.h> can be included directly."
+#endif
+
+#include <gthree/gthreeobject.h>
+#include <gthree/gthreecamera.h>
+
+G_BEGIN_DECLS
+
+#define GTHREE_TYPE_LOD      (gthree_lod_get_type ())
+#define GTHREE_LOD(inst)     (G_TYPE_CHECK_INSTANCE_CAST ((inst), \
+                                                          GTHREE_TYPE_LOD, \
+                                                          GthreeLOD))
+#define GTHREE_IS_LOD(inst)  (G_TYPE_CHECK_INSTANCE_TYPE ((inst), \
+                                                          GTHREE_TYPE_LOD))
+
+typedef struct {
+  GthreeObject parent;
+} GthreeLOD;
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (GthreeLOD, g_object_unref)
+
+typedef struct {
+  GthreeObjectClass parent_class;
+
+} GthreeLODClass;
+
+GTHREE_API
+GType gthree_lod_get_type (void) G_GNUC_CONST;
+
+GTHREE_API
+GthreeLOD *   gthree_lod_new                   (void);
+
+GTHREE_API
+void          gthree_lod_add_level             (GthreeLOD    *lod,
+                                                GthreeObject *object,
+                                                float         threshold,
+                                                float         hysteresis);
+GTHREE_API
+GthreeObject *gthree_lod_add_simplified_level  (GthreeLOD    *lod,
+                                                float         threshold,
+                                                float         hysteresis,
+                                                float         ratio);
+GTHREE_API
+int           gthree_lod_get_n_levels          (GthreeLOD    *lod);
+GTHREE_API
+GthreeObject *gthree_lod_get_level             (GthreeLOD    *lod,
+                                                int           index);
+GTHREE_API
+int           gthree_lod_get_current_level     (GthreeLOD    *lod);
+GTHREE_API
+gboolean      gthree_lod_get_auto_update       (GthreeLOD    *lod);
+GTHREE_API
+void          gthree_lod_set_auto_update       (GthreeLOD    *lod,
+                                                gboolean      auto_update);
+GTHREE_API
+gboolean      gthree_lod_get_screen_space      (GthreeLOD    *lod);
+GTHREE_API
+void          gthree_lod_set_screen_space      (GthreeLOD    *lod,
+                                                gboolean      screen_space);
+GTHREE_API
+void          gthree_lod_update                (GthreeLOD    *lod,
+                                                GthreeCamera *camera,
+                                                float         viewport_height);
+
+G_END_DECLS
+
+#endif /* __GTHREE_LOD_H__ */
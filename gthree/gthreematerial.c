@@ -24,6 +24,7 @@ typedef struct {
 
   GthreeShader *shader;
   gboolean needs_update;
+  guint id;
 
   /* modified by the renderer to track state */
   GthreeMaterialProperties properties;
@@ -97,6 +98,8 @@ gthree_material_init (GthreeMaterial *material)
   priv->side = GTHREE_SIDE_FRONT;
 
   priv->properties.light_hash.num_point = -1; // Ensure we fill it once
+
+  priv->id = gthree_allocate_id ();
 }
 
 static void
@@ -104,8 +107,10 @@ gthree_material_finalize (GObject *obj)
 {
   GthreeMaterial *material = GTHREE_MATERIAL (obj);
   GthreeMaterialPrivate *priv = gthree_material_get_instance_private (material);
+  int i;
 
-  g_clear_object (&priv->properties.program);
+  for (i = 0; i < GTHREE_N_PROGRAM_VARIANTS; i++)
+    g_clear_object (&priv->properties.programs[i]);
 
   G_OBJECT_CLASS (gthree_material_parent_class)->finalize (obj);
 }
@@ -568,6 +573,14 @@ gthree_material_load_default_attribute (GthreeMaterial       *material,
     class->load_default_attribute (material, attribute_location, attribute);
 }
 
+guint
+gthree_material_get_id (GthreeMaterial *material)
+{
+  GthreeMaterialPrivate *priv = gthree_material_get_instance_private (material);
+
+  return priv->id;
+}
+
 GthreeMaterialProperties *
 gthree_material_get_properties (GthreeMaterial  *material)
 {
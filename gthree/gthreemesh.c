@@ -3,6 +3,7 @@
 
 #include "gthreemesh.h"
 #include "gthreemeshbasicmaterial.h"
+#include "gthreeraycaster.h"
 #include "gthreeobjectprivate.h"
 #include "gthreeprivate.h"
 
@@ -267,6 +268,8 @@ gthree_mesh_set_materials (GthreeMesh *mesh,
       if (src)
         g_ptr_array_index (priv->materials, i) = g_object_ref (src);
     }
+
+  gthree_object_mark_changed (GTHREE_OBJECT (mesh));
 }
 
 void
@@ -275,6 +278,7 @@ gthree_mesh_add_material (GthreeMesh *mesh,
 {
   GthreeMeshPrivate *priv = gthree_mesh_get_instance_private (mesh);
   g_ptr_array_add (priv->materials, g_object_ref (material));
+  gthree_object_mark_changed (GTHREE_OBJECT (mesh));
 }
 
 void
@@ -290,6 +294,7 @@ gthree_mesh_set_material (GthreeMesh *mesh,
 
   old_material = g_ptr_array_index (priv->materials, index);
   g_ptr_array_index (priv->materials, index) = g_object_ref (material);
+  gthree_object_mark_changed (GTHREE_OBJECT (mesh));
 }
 
 GthreeGeometry *
@@ -300,6 +305,260 @@ gthree_mesh_get_geometry (GthreeMesh *mesh)
   return priv->geometry;
 }
 
+static gboolean
+ray_hits_sphere (const graphene_ray_t    *ray,
+                 const graphene_sphere_t *sphere)
+{
+  graphene_point3d_t center;
+  graphene_vec3_t origin, direction, v;
+  float radius = graphene_sphere_get_radius (sphere);
+  float tca, d2;
+
+  graphene_ray_get_origin_vec3 (ray, &origin);
+  graphene_ray_get_direction (ray, &direction);
+  graphene_sphere_get_center (sphere, &center);
+
+  graphene_point3d_to_vec3 (&center, &v);
+  graphene_vec3_subtract (&v, &origin, &v);
+
+  tca = graphene_vec3_dot (&v, &direction);
+  d2 = graphene_vec3_dot (&v, &v) - tca * tca;
+  if (d2 > radius * radius)
+    return FALSE;
+
+  /* Sphere entirely behind the ray origin */
+  if (tca < 0 && graphene_vec3_dot (&v, &v) > radius * radius)
+    return FALSE;
+
+  return TRUE;
+}
+
+static void
+get_uv_at (GthreeAttribute       *uv,
+           const GthreeBvhHit    *hit,
+           GthreeAttribute       *index,
+           graphene_vec2_t       *res)
+{
+  const float *floats = gthree_attribute_read_float (uv);
+  int stride = gthree_attribute_get_stride (uv);
+  float w = 1.0f - hit->u - hit->v;
+  const float *a, *b, *c;
+  guint ia = hit->face_index * 3, ib = ia + 1, ic = ia + 2;
+
+  if (index)
+    {
+      ia = gthree_attribute_get_uint (index, ia);
+      ib = gthree_attribute_get_uint (index, ib);
+      ic = gthree_attribute_get_uint (index, ic);
+    }
+
+  a = floats + ia * stride;
+  b = floats + ib * stride;
+  c = floats + ic * stride;
+
+  graphene_vec2_init (res,
+                      a[0] * w + b[0] * hit->u + c[0] * hit->v,
+                      a[1] * w + b[1] * hit->u + c[1] * hit->v);
+}
+
+/* Gathers what is needed to raycast the mesh. This may build the
+ * geometry bounds and bvh, so it has to be called on the main thread,
+ * but the target can then be used from any thread. */
+gboolean
+gthree_mesh_init_raycast_target (GthreeMesh             *mesh,
+                                 GthreeMeshRaycastTarget *target)
+{
+  GthreeMeshPrivate *priv = gthree_mesh_get_instance_private (mesh);
+  GthreeGeometry *geometry = priv->geometry;
+  GthreeObject *object = GTHREE_OBJECT (mesh);
+  GthreeAttribute *position, *index;
+  int draw_start, draw_count, n_indices;
+
+  if (geometry == NULL || priv->draw_mode != GTHREE_DRAW_MODE_TRIANGLES)
+    return FALSE;
+
+  position = gthree_geometry_get_position (geometry);
+  if (position == NULL ||
+      gthree_attribute_get_attribute_type (position) != GTHREE_ATTRIBUTE_TYPE_FLOAT)
+    return FALSE;
+
+  index = gthree_geometry_get_index (geometry);
+  n_indices = index ? gthree_attribute_get_count (index) : gthree_attribute_get_count (position);
+  draw_start = MAX (gthree_geometry_get_draw_range_start (geometry), 0);
+  draw_count = gthree_geometry_get_draw_range_count (geometry);
+  if (draw_count < 0 || draw_start + draw_count > n_indices)
+    draw_count = n_indices - draw_start;
+  if (draw_count <= 0)
+    return FALSE;
+
+  target->object = object;
+  target->geometry = geometry;
+  target->world_matrix = *gthree_object_get_world_matrix (object);
+  if (!graphene_matrix_inverse (&target->world_matrix, &target->inverse))
+    return FALSE;
+
+  graphene_matrix_transform_sphere (&target->world_matrix,
+                                    gthree_geometry_get_bounding_sphere (geometry),
+                                    &target->sphere);
+
+  target->side = GTHREE_SIDE_DOUBLE;
+  if (priv->materials->len > 0 && g_ptr_array_index (priv->materials, 0) != NULL)
+    target->side = gthree_material_get_side (g_ptr_array_index (priv->materials, 0));
+
+  target->first_face = draw_start / 3;
+  target->n_faces = draw_count / 3;
+  target->bvh = gthree_geometry_get_bvh (geometry);
+
+  return TRUE;
+}
+
+/* Returns FALSE if the ray misses the bounding sphere, otherwise the
+ * object space ray and the world distance of a unit step along it */
+static gboolean
+raycast_target_get_local_ray (const GthreeMeshRaycastTarget *target,
+                              const graphene_ray_t          *ray,
+                              graphene_ray_t                *local_ray,
+                              float                         *world_scale)
+{
+  graphene_point3d_t origin;
+  graphene_vec3_t direction;
+
+  /* Cheap rejection against the world space bounding sphere first */
+  if (!ray_hits_sphere (ray, &target->sphere))
+    return FALSE;
+
+  graphene_ray_get_origin (ray, &origin);
+  graphene_ray_get_direction (ray, &direction);
+  graphene_matrix_transform_point3d (&target->inverse, &origin, &origin);
+  graphene_matrix_transform_vec3 (&target->inverse, &direction, &direction);
+  graphene_ray_init (local_ray, &origin, &direction);
+
+  if (world_scale)
+    {
+      graphene_ray_get_direction (local_ray, &direction);
+      graphene_matrix_transform_vec3 (&target->world_matrix, &direction, &direction);
+      *world_scale = graphene_vec3_length (&direction);
+    }
+
+  return TRUE;
+}
+
+/* Closest hit within [near, far] (world distances) of a world space ray */
+gboolean
+gthree_mesh_raycast_target_nearest (const GthreeMeshRaycastTarget *target,
+                                    const graphene_ray_t          *ray,
+                                    float                          near,
+                                    float                          far,
+                                    GthreeBvhHit                  *hit,
+                                    float                         *distance)
+{
+  graphene_ray_t local_ray;
+  float scale;
+
+  if (!raycast_target_get_local_ray (target, ray, &local_ray, &scale) || scale == 0)
+    return FALSE;
+
+  if (!gthree_bvh_raycast_nearest (target->bvh, target->geometry, &local_ray, target->side,
+                                   target->first_face, target->n_faces,
+                                   near / scale, far / scale, hit))
+    return FALSE;
+
+  *distance = hit->t * scale;
+  return TRUE;
+}
+
+static void
+gthree_mesh_raycast (GthreeObject    *object,
+                     GthreeRaycaster *raycaster,
+                     GPtrArray       *intersections)
+{
+  GthreeMesh *mesh = GTHREE_MESH (object);
+  const graphene_ray_t *ray = gthree_raycaster_get_ray (raycaster);
+  float near = gthree_raycaster_get_near (raycaster);
+  float far = gthree_raycaster_get_far (raycaster);
+  GthreeMeshRaycastTarget target;
+  GthreeGeometry *geometry;
+  const graphene_matrix_t *world_matrix;
+  GthreeAttribute *position, *index, *uv, *uv2;
+  graphene_vec3_t world_origin, local_origin, direction;
+  graphene_ray_t local_ray;
+  g_autoptr(GArray) hits = NULL;
+  int i, k;
+
+  if (!gthree_mesh_init_raycast_target (mesh, &target))
+    return;
+
+  if (!raycast_target_get_local_ray (&target, ray, &local_ray, NULL))
+    return;
+
+  geometry = target.geometry;
+  world_matrix = &target.world_matrix;
+  position = gthree_geometry_get_position (geometry);
+  index = gthree_geometry_get_index (geometry);
+
+  hits = g_array_new (FALSE, FALSE, sizeof (GthreeBvhHit));
+  gthree_bvh_raycast (target.bvh, geometry, &local_ray, target.side,
+                      target.first_face, target.n_faces, hits);
+
+  if (hits->len == 0)
+    return;
+
+  uv = gthree_geometry_get_attribute (geometry, "uv");
+  if (uv && gthree_attribute_get_attribute_type (uv) != GTHREE_ATTRIBUTE_TYPE_FLOAT)
+    uv = NULL;
+  uv2 = gthree_geometry_get_attribute (geometry, "uv2");
+  if (uv2 && gthree_attribute_get_attribute_type (uv2) != GTHREE_ATTRIBUTE_TYPE_FLOAT)
+    uv2 = NULL;
+
+  graphene_ray_get_origin_vec3 (ray, &world_origin);
+  graphene_ray_get_origin_vec3 (&local_ray, &local_origin);
+  graphene_ray_get_direction (&local_ray, &direction);
+
+  for (i = 0; i < hits->len; i++)
+    {
+      const GthreeBvhHit *hit = &g_array_index (hits, GthreeBvhHit, i);
+      GthreeRayIntersection *intersection;
+      graphene_point3d_t p;
+      graphene_vec3_t point, delta;
+      float distance;
+
+      graphene_vec3_scale (&direction, hit->t, &point);
+      graphene_vec3_add (&local_origin, &point, &point);
+      graphene_point3d_init_from_vec3 (&p, &point);
+      graphene_matrix_transform_point3d (world_matrix, &p, &p);
+      graphene_point3d_to_vec3 (&p, &point);
+
+      graphene_vec3_subtract (&point, &world_origin, &delta);
+      distance = graphene_vec3_length (&delta);
+      if (distance < near || distance > far)
+        continue;
+
+      intersection = gthree_ray_intersection_new ();
+      intersection->object = g_object_ref (object);
+      intersection->distance = distance;
+      intersection->point = point;
+      intersection->face_index = hit->face_index;
+
+      for (k = 0; k < 3; k++)
+        {
+          graphene_point3d_t p;
+
+          gthree_attribute_get_point3d (position,
+                                        index ? gthree_attribute_get_uint (index, hit->face_index * 3 + k) : hit->face_index * 3 + k,
+                                        &p);
+          graphene_matrix_transform_point3d (world_matrix, &p, &p);
+          graphene_point3d_to_vec3 (&p, &intersection->face[k]);
+        }
+
+      if (uv)
+        get_uv_at (uv, hit, index, &intersection->uv);
+      if (uv2)
+        get_uv_at (uv2, hit, index, &intersection->uv2);
+
+      g_ptr_array_add (intersections, intersection);
+    }
+}
+
 static void
 gthree_mesh_class_init (GthreeMeshClass *klass)
 {
@@ -313,6 +572,7 @@ gthree_mesh_class_init (GthreeMeshClass *klass)
   object_class->in_frustum = gthree_mesh_in_frustum;
   object_class->update = gthree_mesh_update;
   object_class->fill_render_list = gthree_mesh_fill_render_list;
+  object_class->raycast = gthree_mesh_raycast;
 
   obj_props[PROP_GEOMETRY] =
     g_param_spec_object ("geometry", "Geometry", "Geometry",
@@ -2,6 +2,7 @@
 #include <epoxy/gl.h>
 
 #include "gthreeobjectprivate.h"
+#include "gthreeprivate.h"
 #include "gthreemesh.h"
 
 #include <graphene.h>
@@ -18,6 +19,14 @@ static GQuark q_modelMatrix;
 static GQuark q_modelViewMatrix;
 static GQuark q_normalMatrix;
 
+static volatile gint matrix_stamp_counter;
+
+/* Bumped on every change to the object graph */
+static volatile gint tree_generation;
+
+typedef struct _FlatTree FlatTree;
+static void flat_tree_free (FlatTree *tree);
+
 
 static guint object_signals[LAST_SIGNAL] = { 0, };
 
@@ -35,7 +44,16 @@ typedef struct {
   graphene_matrix_t world_matrix;
 
   graphene_matrix_t model_view_matrix;
-  graphene_matrix_t normal_matrix;
+  float normal_matrix[9];
+
+  /* Stamps of the world and camera matrices the model view matrix was
+     computed from, 0 if unknown */
+  guint world_matrix_stamp;
+  guint model_view_world_stamp;
+  guint model_view_camera_stamp;
+
+  /* Stamp of the last change to what this subtree renders */
+  guint subtree_stamp;
 
   gboolean visible;
   gboolean cast_shadow;
@@ -54,6 +72,9 @@ typedef struct {
   gint n_children;
   gint age;
 
+  /* The subtree, flattened for the parallel matrix update */
+  FlatTree *flat_tree;
+
   guint realized : 1;
   guint in_destruction : 1;
   guint euler_valid : 1;
@@ -62,6 +83,7 @@ typedef struct {
   guint matrix_need_update : 1;
 
   guint frustum_culled : 1;
+  guint normal_matrix_valid : 1;
 } GthreeObjectPrivate;
 
 enum
@@ -181,6 +203,7 @@ gthree_object_finalize (GObject *obj)
 
   g_free (priv->uuid);
   g_free (priv->name);
+  g_clear_pointer (&priv->flat_tree, flat_tree_free);
 
   G_OBJECT_CLASS (gthree_object_parent_class)->finalize (obj);
 }
@@ -321,6 +344,14 @@ gthree_object_set_matrix_auto_update (GthreeObject *object,
   priv->matrix_auto_update = !! auto_update;
 }
 
+gboolean
+gthree_object_get_matrix_auto_update (GthreeObject *object)
+{
+  GthreeObjectPrivate *priv = gthree_object_get_instance_private (object);
+
+  return priv->matrix_auto_update;
+}
+
 const char *
 gthree_object_get_name (GthreeObject *object)
 {
@@ -375,6 +406,7 @@ gthree_object_set_visible (GthreeObject *object,
     return;
 
   priv->visible = visible;
+  gthree_object_mark_changed (object);
 
   g_object_notify_by_pspec (G_OBJECT (object), obj_props[PROP_VISIBLE]);
 }
@@ -397,6 +429,7 @@ gthree_object_set_cast_shadow (GthreeObject *object,
     return;
 
   priv->cast_shadow = cast_shadow;
+  gthree_object_mark_changed (object);
 }
 
 gboolean
@@ -446,6 +479,7 @@ gthree_object_set_layer (GthreeObject *object,
   GthreeObjectPrivate *priv = gthree_object_get_instance_private (object);
 
   priv->layer_mask = 1 << layer;
+  gthree_object_mark_changed (object);
 }
 
 void
@@ -455,6 +489,7 @@ gthree_object_enable_layer (GthreeObject *object,
   GthreeObjectPrivate *priv = gthree_object_get_instance_private (object);
 
   priv->layer_mask |= 1 << layer;
+  gthree_object_mark_changed (object);
 }
 
 void
@@ -464,6 +499,7 @@ gthree_object_disable_layer (GthreeObject *object,
   GthreeObjectPrivate *priv = gthree_object_get_instance_private (object);
 
   priv->layer_mask &= ~ (1 << layer);
+  gthree_object_mark_changed (object);
 }
 
 void
@@ -473,6 +509,7 @@ gthree_object_toggle_layer (GthreeObject *object,
   GthreeObjectPrivate *priv = gthree_object_get_instance_private (object);
 
   priv->layer_mask ^= ~ 1 << layer;
+  gthree_object_mark_changed (object);
 }
 
 gboolean
@@ -783,6 +820,8 @@ gthree_object_set_world_matrix (GthreeObject *object, const graphene_matrix_t *m
 
   priv->world_matrix = *matrix;
   priv->world_matrix_need_update = FALSE;
+  priv->world_matrix_stamp = gthree_allocate_matrix_stamp ();
+  gthree_object_mark_changed (object);
 
   // TODO: decompose matrix into position, quat, scale
 }
@@ -798,6 +837,10 @@ gthree_object_real_update_matrix_world (GthreeObject *object,
 
   if (priv->world_matrix_need_update || force)
     {
+      /* When forced, the parent changed and already marked the ancestors */
+      if (priv->world_matrix_need_update)
+        gthree_object_mark_changed (object);
+
       if (priv->parent == NULL)
         priv->world_matrix = priv->matrix;
       else
@@ -806,6 +849,7 @@ gthree_object_real_update_matrix_world (GthreeObject *object,
                                   &priv->world_matrix);
 
       priv->world_matrix_need_update = FALSE;
+      priv->world_matrix_stamp = gthree_allocate_matrix_stamp ();
       force = TRUE;
     }
 
@@ -828,6 +872,281 @@ gthree_object_update_matrix_world (GthreeObject *object,
     gthree_object_update_matrix_world (child, force);
 }
 
+/* Parallel matrix world update
+ *
+ * Each node only reads its own state and the world matrix of its
+ * parent, so disjoint subtrees can be updated concurrently as long as
+ * parents are done before children. The top of the tree is updated
+ * serially, breadth first, until there are enough independent
+ * subtrees. Each of these is flattened into a parent-ordered range of
+ * a shared array, and the ranges are handed out to the worker pool
+ * (and the calling thread) one at a time until none are left.
+ *
+ * The flattened tree is kept on the root until the object graph
+ * changes anywhere, so static hierarchies are only walked once.
+ */
+
+#define PARALLEL_MIN_NODES 256
+#define PARALLEL_TASKS_PER_THREAD 4
+
+typedef struct {
+  GthreeObject *object;
+  int parent; /* Index in the same array, or -1 for the root of a task */
+  gboolean force;
+} FlatNode;
+
+typedef struct {
+  int start;
+  int end;
+  int parent; /* Index in top, or -1 for the root */
+} FlatTask;
+
+struct _FlatTree {
+  guint generation;
+  GArray *top;   /* FlatNode, updated serially */
+  GArray *nodes; /* FlatNode, ranges updated in parallel */
+  GArray *tasks;
+};
+
+typedef struct {
+  FlatTree *tree;
+  gboolean force;
+} MatrixUpdateJob;
+
+static void
+flat_tree_free (FlatTree *tree)
+{
+  g_array_unref (tree->top);
+  g_array_unref (tree->nodes);
+  g_array_unref (tree->tasks);
+  g_free (tree);
+}
+
+static void
+matrix_update_task (gpointer data,
+                    int      t)
+{
+  MatrixUpdateJob *job = data;
+  FlatNode *top = (FlatNode *)job->tree->top->data;
+  FlatNode *nodes = (FlatNode *)job->tree->nodes->data;
+  FlatTask *task = &g_array_index (job->tree->tasks, FlatTask, t);
+  gboolean task_force = task->parent < 0 ? job->force : top[task->parent].force;
+  int i;
+
+  for (i = task->start; i < task->end; i++)
+    {
+      FlatNode *node = &nodes[i];
+      gboolean force = node->parent < 0 ? task_force : nodes[node->parent].force;
+
+      node->force = GTHREE_OBJECT_GET_CLASS (node->object)->update_matrix_world (node->object, force);
+    }
+}
+
+/* Appends the subtree in depth first order, using stack as scratch space */
+static void
+flatten_subtree (GArray       *nodes,
+                 GArray       *stack,
+                 GthreeObject *object)
+{
+  FlatNode root = { object, -1, FALSE };
+
+  g_array_set_size (stack, 0);
+  g_array_append_val (stack, root);
+
+  while (stack->len > 0)
+    {
+      FlatNode node = g_array_index (stack, FlatNode, stack->len - 1);
+      GthreeObject *child;
+      int index;
+
+      g_array_set_size (stack, stack->len - 1);
+
+      index = nodes->len;
+      g_array_append_val (nodes, node);
+
+      /* Pushed in reverse, so they are popped in order */
+      for (child = PRIV (node.object)->last_child;
+           child != NULL;
+           child = PRIV (child)->prev_sibling)
+        {
+          FlatNode child_node = { child, index, FALSE };
+          g_array_append_val (stack, child_node);
+        }
+    }
+}
+
+static FlatTree *
+flat_tree_new (GthreeObject *object,
+               guint         generation)
+{
+  g_autoptr(GArray) frontier = NULL;
+  g_autoptr(GArray) next = NULL;
+  g_autoptr(GArray) stack = NULL;
+  FlatTree *tree;
+  FlatNode root = { object, -1, FALSE };
+  int target, i;
+
+  target = gthree_parallel_get_n_threads () * PARALLEL_TASKS_PER_THREAD;
+
+  tree = g_new0 (FlatTree, 1);
+  tree->generation = generation;
+  tree->top = g_array_new (FALSE, FALSE, sizeof (FlatNode));
+  tree->nodes = g_array_new (FALSE, FALSE, sizeof (FlatNode));
+
+  /* Take the top levels until there are enough subtrees */
+  frontier = g_array_new (FALSE, FALSE, sizeof (FlatNode));
+  next = g_array_new (FALSE, FALSE, sizeof (FlatNode));
+  g_array_append_val (frontier, root);
+
+  while (frontier->len > 0 && frontier->len < target)
+    {
+      GArray *tmp;
+
+      g_array_set_size (next, 0);
+      for (i = 0; i < frontier->len; i++)
+        {
+          FlatNode *node = &g_array_index (frontier, FlatNode, i);
+          GthreeObject *child;
+          int index = tree->top->len;
+
+          g_array_append_val (tree->top, *node);
+
+          for (child = PRIV (node->object)->first_child;
+               child != NULL;
+               child = PRIV (child)->next_sibling)
+            {
+              FlatNode child_node = { child, index, FALSE };
+              g_array_append_val (next, child_node);
+            }
+        }
+
+      tmp = frontier;
+      frontier = next;
+      next = tmp;
+    }
+
+  tree->tasks = g_array_sized_new (FALSE, FALSE, sizeof (FlatTask), frontier->len);
+  stack = g_array_new (FALSE, FALSE, sizeof (FlatNode));
+
+  for (i = 0; i < frontier->len; i++)
+    {
+      FlatNode *node = &g_array_index (frontier, FlatNode, i);
+      FlatTask task;
+
+      task.start = tree->nodes->len;
+      flatten_subtree (tree->nodes, stack, node->object);
+      task.end = tree->nodes->len;
+      task.parent = node->parent;
+      g_array_append_val (tree->tasks, task);
+    }
+
+  return tree;
+}
+
+void
+gthree_object_update_matrix_world_parallel (GthreeObject *object,
+                                            gboolean force)
+{
+  GthreeObjectPrivate *priv = gthree_object_get_instance_private (object);
+  guint generation = (guint) g_atomic_int_get (&tree_generation);
+  MatrixUpdateJob job;
+  FlatNode *top;
+  int i;
+
+  if (priv->flat_tree == NULL || priv->flat_tree->generation != generation)
+    {
+      g_clear_pointer (&priv->flat_tree, flat_tree_free);
+      priv->flat_tree = flat_tree_new (object, generation);
+    }
+
+  job.tree = priv->flat_tree;
+  job.force = force;
+
+  /* Serially update the top levels, parents come before children */
+  top = (FlatNode *)job.tree->top->data;
+  for (i = 0; i < job.tree->top->len; i++)
+    {
+      FlatNode *node = &top[i];
+      gboolean parent_force = node->parent < 0 ? force : top[node->parent].force;
+
+      node->force = GTHREE_OBJECT_GET_CLASS (node->object)->update_matrix_world (node->object, parent_force);
+    }
+
+  if (job.tree->nodes->len >= PARALLEL_MIN_NODES)
+    gthree_parallel_for (job.tree->tasks->len, matrix_update_task, &job);
+  else
+    {
+      for (i = 0; i < job.tree->tasks->len; i++)
+        matrix_update_task (&job, i);
+    }
+}
+
+
+/* Stamps are unique across all objects, so a camera stamp identifies
+   both the camera and the version of its matrix */
+guint
+gthree_allocate_matrix_stamp (void)
+{
+  guint stamp;
+
+  do
+    stamp = (guint) g_atomic_int_add (&matrix_stamp_counter, 1) + 1;
+  while (G_UNLIKELY (stamp == 0));
+
+  return stamp;
+}
+
+guint
+gthree_object_get_world_matrix_stamp (GthreeObject *object)
+{
+  GthreeObjectPrivate *priv = gthree_object_get_instance_private (object);
+
+  return priv->world_matrix_stamp;
+}
+
+/* The newest stamp a render list was saved with, see below */
+static volatile guint changes_seen_stamp;
+
+/* Records a change to the visibility, transform, children or rendered
+ * content of object. The new stamp is set on the ancestors, so a
+ * changed scene can be found without traversing it. An ancestor
+ * already stamped after the last saved render list has had all of its
+ * own ancestors stamped too, so the walk stops there. That keeps
+ * marking many nodes, like in the parallel matrix update, from
+ * hammering the root. This can race with the parallel matrix update,
+ * but all racing stores are new. */
+void
+gthree_object_mark_changed (GthreeObject *object)
+{
+  guint seen = (guint) g_atomic_int_get ((gint *)&changes_seen_stamp);
+  guint stamp = gthree_allocate_matrix_stamp ();
+
+  for (; object != NULL; object = PRIV (object)->parent)
+    {
+      guint old = (guint) g_atomic_int_get ((gint *)&PRIV (object)->subtree_stamp);
+
+      if (old != 0 && (gint) (old - seen) > 0)
+        break;
+
+      g_atomic_int_set ((gint *)&PRIV (object)->subtree_stamp, (gint) stamp);
+    }
+}
+
+/* Called with a fresh stamp when a renderer saved the subtree stamp of
+ * a scene, so later changes are stamped all the way up again */
+void
+gthree_object_set_changes_seen (guint stamp)
+{
+  g_atomic_int_set ((gint *)&changes_seen_stamp, (gint) stamp);
+}
+
+guint
+gthree_object_get_subtree_stamp (GthreeObject *object)
+{
+  GthreeObjectPrivate *priv = gthree_object_get_instance_private (object);
+
+  return (guint) g_atomic_int_get ((gint *)&priv->subtree_stamp);
+}
 
 void
 gthree_object_update_matrix_view (GthreeObject *object,
@@ -837,8 +1156,30 @@ gthree_object_update_matrix_view (GthreeObject *object,
 
   graphene_matrix_multiply (&priv->world_matrix, camera_matrix, &priv->model_view_matrix);
 
-  graphene_matrix_inverse (&priv->model_view_matrix, &priv->normal_matrix);
-  graphene_matrix_transpose (&priv->normal_matrix, &priv->normal_matrix);
+  priv->model_view_world_stamp = 0;
+  priv->model_view_camera_stamp = 0;
+  priv->normal_matrix_valid = FALSE;
+}
+
+void
+gthree_object_update_matrix_view_for_camera (GthreeObject *object,
+                                             GthreeCamera *camera)
+{
+  GthreeObjectPrivate *priv = gthree_object_get_instance_private (object);
+  guint camera_stamp = gthree_camera_get_world_inverse_stamp (camera);
+
+  if (priv->world_matrix_stamp != 0 && camera_stamp != 0 &&
+      priv->model_view_world_stamp == priv->world_matrix_stamp &&
+      priv->model_view_camera_stamp == camera_stamp)
+    return;
+
+  graphene_matrix_multiply (&priv->world_matrix,
+                            gthree_camera_get_world_inverse_matrix (camera),
+                            &priv->model_view_matrix);
+
+  priv->model_view_world_stamp = priv->world_matrix_stamp;
+  priv->model_view_camera_stamp = camera_stamp;
+  priv->normal_matrix_valid = FALSE;
 }
 
 void
@@ -855,13 +1196,40 @@ gthree_object_get_normal_matrix3_floats (GthreeObject *object,
                                          float *dest)
 {
   GthreeObjectPrivate *priv = gthree_object_get_instance_private (object);
-  float dest4[16];
 
-  graphene_matrix_to_float (&priv->normal_matrix, dest4);
+  /* Inverse transpose of the upper 3x3 of the model view matrix,
+     which is the cofactor matrix divided by the determinant */
+  if (!priv->normal_matrix_valid)
+    {
+      float m[16], det;
+      float *n = priv->normal_matrix;
+      int i;
+
+      graphene_matrix_to_float (&priv->model_view_matrix, m);
+
+      n[0] = m[5] * m[10] - m[6] * m[9];
+      n[1] = m[6] * m[8] - m[4] * m[10];
+      n[2] = m[4] * m[9] - m[5] * m[8];
+      n[3] = m[2] * m[9] - m[1] * m[10];
+      n[4] = m[0] * m[10] - m[2] * m[8];
+      n[5] = m[1] * m[8] - m[0] * m[9];
+      n[6] = m[1] * m[6] - m[2] * m[5];
+      n[7] = m[2] * m[4] - m[0] * m[6];
+      n[8] = m[0] * m[5] - m[1] * m[4];
+
+      det = m[0] * n[0] + m[1] * n[1] + m[2] * n[2];
+      if (det != 0)
+        {
+          for (i = 0; i < 9; i++)
+            n[i] /= det;
+        }
+      else
+        memset (n, 0, sizeof (priv->normal_matrix));
 
-  dest[0] = dest4[0];  dest[1] = dest4[1]; dest[2] = dest4[2];
-  dest[3] = dest4[4];  dest[4] = dest4[5]; dest[5] = dest4[6];
-  dest[6] = dest4[8];  dest[7] = dest4[9]; dest[8] = dest4[10];
+      priv->normal_matrix_valid = TRUE;
+    }
+
+  memcpy (dest, priv->normal_matrix, sizeof (priv->normal_matrix));
 }
 
 void
@@ -930,6 +1298,8 @@ gthree_object_add_child (GthreeObject              *object,
   priv->n_children += 1;
 
   priv->age += 1;
+  g_atomic_int_inc (&tree_generation);
+  gthree_object_mark_changed (object);
 
   g_signal_emit (child, object_signals[PARENT_SET], 0, NULL);
 
@@ -976,6 +1346,8 @@ gthree_object_remove_child (GthreeObject                 *object,
   priv->n_children -= 1;
 
   priv->age += 1;
+  g_atomic_int_inc (&tree_generation);
+  gthree_object_mark_changed (object);
 
   g_signal_emit (child, object_signals[PARENT_SET], 0, object);
 
@@ -1107,6 +1479,7 @@ gthree_object_real_set_direct_uniforms  (GthreeObject *object,
   gthree_object_get_model_view_matrix_floats (object, matrix);
   glUniformMatrix4fv (mvm_location, 1, FALSE, matrix);
 
+  /* The normal matrix is computed lazily, so this skips it entirely */
   if (nm_location >= 0)
     {
       gthree_object_get_normal_matrix3_floats (object, matrix);
@@ -1140,6 +1513,14 @@ gthree_object_set_before_render_callback (GthreeObject                *object,
   priv->before_render_cb = callback;
 }
 
+gboolean
+gthree_object_has_before_render_callback (GthreeObject *object)
+{
+  GthreeObjectPrivate *priv = gthree_object_get_instance_private (object);
+
+  return priv->before_render_cb != NULL;
+}
+
 void
 gthree_object_call_before_render_callback  (GthreeObject                *object,
                                             GthreeScene                 *scene,
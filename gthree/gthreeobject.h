@@ -85,6 +85,8 @@ GTHREE_API
 void                         gthree_object_set_matrix_auto_update       (GthreeObject                *object,
                                                                          gboolean                     auto_update);
 GTHREE_API
+gboolean                     gthree_object_get_matrix_auto_update       (GthreeObject                *object);
+GTHREE_API
 void                         gthree_object_update_matrix_world          (GthreeObject                *object,
                                                                          gboolean                     force);
 GTHREE_API
@@ -14,6 +14,16 @@ void       gthree_object_fill_render_list (GthreeObject   *object,
 void       gthree_object_call_before_render_callback (GthreeObject   *object,
                                                       GthreeScene    *scene,
                                                       GthreeCamera   *camera);
+gboolean   gthree_object_has_before_render_callback (GthreeObject   *object);
+void       gthree_object_update_matrix_world_parallel (GthreeObject *object,
+                                                       gboolean      force);
+guint      gthree_allocate_matrix_stamp        (void);
+guint      gthree_object_get_world_matrix_stamp (GthreeObject *object);
+void       gthree_object_mark_changed          (GthreeObject *object);
+void       gthree_object_set_changes_seen      (guint         stamp);
+guint      gthree_object_get_subtree_stamp     (GthreeObject *object);
+void       gthree_object_update_matrix_view_for_camera (GthreeObject *object,
+                                                        GthreeCamera *camera);
 
 G_END_DECLS
 
@@ -0,0 +1,121 @@
+#include "gthreeprivate.h"
+
+/* One thread pool shared by all the threaded passes (matrix updates,
+ * batched raycasts, geometry processing).
+ *
+ * The calling thread works on the tasks too, so a parallel for runs to
+ * completion even if all the pool threads are busy, and can be used
+ * from inside another one. */
+
+typedef struct {
+  gint ref_count;
+  GthreeParallelFunc func;
+  gpointer data;
+  int n_tasks;
+  gint next_task;
+  gint tasks_done;
+  GMutex mutex;
+  GCond cond;
+} ParallelJob;
+
+static GThreadPool *parallel_pool;
+static int parallel_n_threads;
+
+static void
+parallel_job_unref (ParallelJob *job)
+{
+  if (g_atomic_int_dec_and_test (&job->ref_count))
+    {
+      g_mutex_clear (&job->mutex);
+      g_cond_clear (&job->cond);
+      g_free (job);
+    }
+}
+
+static void
+parallel_job_run (ParallelJob *job)
+{
+  int t;
+
+  while ((t = g_atomic_int_add (&job->next_task, 1)) < job->n_tasks)
+    {
+      job->func (job->data, t);
+
+      if (g_atomic_int_add (&job->tasks_done, 1) == job->n_tasks - 1)
+        {
+          g_mutex_lock (&job->mutex);
+          g_cond_signal (&job->cond);
+          g_mutex_unlock (&job->mutex);
+        }
+    }
+}
+
+static void
+parallel_worker (gpointer data,
+                 gpointer user_data)
+{
+  ParallelJob *job = data;
+
+  parallel_job_run (job);
+  parallel_job_unref (job);
+}
+
+/* The number of threads a parallel for can use, including the caller */
+int
+gthree_parallel_get_n_threads (void)
+{
+  if (g_once_init_enter (&parallel_pool))
+    {
+      GThreadPool *pool;
+
+      parallel_n_threads = MAX (g_get_num_processors () - 1, 1);
+      pool = g_thread_pool_new (parallel_worker, NULL,
+                                parallel_n_threads, FALSE, NULL);
+      g_once_init_leave (&parallel_pool, pool);
+    }
+
+  return parallel_n_threads + 1;
+}
+
+/* Calls func for each task in 0..n_tasks-1, spread over the pool and
+ * the calling thread, and returns when all are done */
+void
+gthree_parallel_for (int                n_tasks,
+                     GthreeParallelFunc func,
+                     gpointer           data)
+{
+  ParallelJob *job;
+  int n_workers, i;
+
+  if (n_tasks <= 1)
+    {
+      if (n_tasks == 1)
+        func (data, 0);
+      return;
+    }
+
+  n_workers = MIN (gthree_parallel_get_n_threads () - 1, n_tasks - 1);
+
+  job = g_new0 (ParallelJob, 1);
+  job->ref_count = 1;
+  job->func = func;
+  job->data = data;
+  job->n_tasks = n_tasks;
+  g_mutex_init (&job->mutex);
+  g_cond_init (&job->cond);
+
+  for (i = 0; i < n_workers; i++)
+    {
+      g_atomic_int_inc (&job->ref_count);
+      g_thread_pool_push (parallel_pool, job, NULL);
+    }
+
+  parallel_job_run (job);
+
+  g_mutex_lock (&job->mutex);
+  while (g_atomic_int_get (&job->tasks_done) < job->n_tasks)
+    g_cond_wait (&job->cond, &job->mutex);
+  g_mutex_unlock (&job->mutex);
+
+  parallel_job_unref (job);
+}
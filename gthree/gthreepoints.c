@@ -169,7 +169,8 @@ gthree_points_set_material (GthreePoints *points,
 {
   GthreePointsPrivate *priv = gthree_points_get_instance_private (points);
 
-  g_set_object (&priv->material, material);
+  if (g_set_object (&priv->material, material))
+    gthree_object_mark_changed (GTHREE_OBJECT (points));
 }
 
 
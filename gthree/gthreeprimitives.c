@@ -3,6 +3,7 @@
 
 #include "gthreeprimitives.h"
 #include "gthreeattribute.h"
+#include "gthreeprivate.h"
 
 enum {
   AXIS_X,
@@ -11,7 +12,7 @@ enum {
 };
 
 static void
-push3i (GArray *array, guint16 a, guint16 b, guint16 c)
+push3i (GArray *array, guint32 a, guint32 b, guint32 c)
 {
   g_array_append_val (array, a);
   g_array_append_val (array, b);
@@ -123,12 +124,12 @@ gthree_geometry_new_box (float width, float height, float depth,
   float height_half = height / 2;
   float depth_half = depth / 2;
   GArray *vertices, *normals, *uvs, *index;
-  GthreeAttribute *a_position, *a_normal, *a_uv, *a_index;
+  GthreeAttribute *a_position, *a_normal, *a_uv;
 
   vertices = g_array_new (FALSE, FALSE, sizeof (float));
   normals = g_array_new (FALSE, FALSE, sizeof (float));
   uvs = g_array_new (FALSE, FALSE, sizeof (float));
-  index = g_array_new (FALSE, FALSE, sizeof (guint16));
+  index = g_array_new (FALSE, FALSE, sizeof (guint32));
 
   geometry = gthree_geometry_new ();
 
@@ -139,9 +140,7 @@ gthree_geometry_new_box (float width, float height, float depth,
   build_plane (geometry, vertices, normals, uvs, index, AXIS_X, AXIS_Y,  1, -1, width, height, depth_half, 4, widthSegments, heightSegments, depthSegments ); // pz
   build_plane (geometry, vertices, normals, uvs, index, AXIS_X, AXIS_Y, -1, -1, width, height, - depth_half, 5, widthSegments, heightSegments, depthSegments ); // nz
 
-  a_index = gthree_attribute_new_from_uint16 ("index", (guint16 *)index->data, index->len, 1);
-  gthree_geometry_set_index (geometry, a_index);
-  g_object_unref (a_index);
+  gthree_geometry_set_index_from_uint32 (geometry, (guint32 *)index->data, index->len);
 
   a_position = gthree_attribute_new_from_float ("position", (float *)vertices->data, vertices->len / 3, 3);
   gthree_geometry_add_attribute (geometry, "position", a_position);
@@ -169,20 +168,18 @@ gthree_geometry_new_plane (float width, float height,
 {
   GthreeGeometry *geometry;
   GArray *vertices, *normals, *uvs, *index;
-  GthreeAttribute *a_position, *a_normal, *a_uv, *a_index;
+  GthreeAttribute *a_position, *a_normal, *a_uv;
 
   vertices = g_array_new (FALSE, FALSE, sizeof (float));
   normals = g_array_new (FALSE, FALSE, sizeof (float));
   uvs = g_array_new (FALSE, FALSE, sizeof (float));
-  index = g_array_new (FALSE, FALSE, sizeof (guint16));
+  index = g_array_new (FALSE, FALSE, sizeof (guint32));
 
   geometry = gthree_geometry_new ();
 
   build_plane (geometry, vertices, normals, uvs, index, AXIS_X, AXIS_Y,  1, -1, width, height, 0, 0, widthSegments, heightSegments, 1); // pz
 
-  a_index = gthree_attribute_new_from_uint16 ("index", (guint16 *)index->data, index->len, 1);
-  gthree_geometry_set_index (geometry, a_index);
-  g_object_unref (a_index);
+  gthree_geometry_set_index_from_uint32 (geometry, (guint32 *)index->data, index->len);
 
   a_position = gthree_attribute_new_from_float ("position", (float *)vertices->data, vertices->len / 3, 3);
   gthree_geometry_add_attribute (geometry, "position", a_position);
@@ -216,10 +213,10 @@ gthree_geometry_new_sphere_full (float radius,
   float *position;
   float *normal;
   float *uvs;
-  guint16 *index;
+  guint32 *index;
   graphene_sphere_t bound;
   graphene_point3d_t center;
-  GthreeAttribute *a_position, *a_normal, *a_uv, *a_index;
+  GthreeAttribute *a_position, *a_normal, *a_uv;
   float thetaEnd;
 
   geometry = gthree_geometry_new ();
@@ -235,7 +232,7 @@ gthree_geometry_new_sphere_full (float radius,
   position = g_new (float, 3 * vertices_w * vertices_h);
   normal = g_new (float, 3 * vertices_w * vertices_h);
   uvs = g_new (float, 2 * vertices_w * vertices_h);
-  index = g_new (guint16, 2 * 3 *widthSegments * heightSegments);
+  index = g_new (guint32, 2 * 3 *widthSegments * heightSegments);
 
   vertex_count = 0;
   for (y = 0; y <= heightSegments; y++)
@@ -306,9 +303,7 @@ gthree_geometry_new_sphere_full (float radius,
         }
     }
 
-  a_index = gthree_attribute_new_from_uint16 ("index", (guint16 *)index, index_count, 1);
-  gthree_geometry_set_index (geometry, a_index);
-  g_object_unref (a_index);
+  gthree_geometry_set_index_from_uint32 (geometry, index, index_count);
 
   a_position = gthree_attribute_new_from_float ("position", (float *)position, vertices_w * vertices_h, 3);
   gthree_geometry_add_attribute (geometry, "position", a_position);
@@ -392,7 +387,7 @@ gthree_geometry_new_cylinder_full (float    radiusTop,
   a_uv = gthree_attribute_new ("uv", GTHREE_ATTRIBUTE_TYPE_FLOAT, vertex_count, 2, FALSE);
   gthree_geometry_add_attribute (geometry, "uv", a_uv);
 
-  a_index = gthree_attribute_new ("index", GTHREE_ATTRIBUTE_TYPE_UINT16, index_count, 1, FALSE);
+  a_index = gthree_attribute_new ("index", gthree_attribute_type_for_index (vertex_count), index_count, 1, FALSE);
   gthree_geometry_set_index (geometry, a_index);
 
   normals = g_newa (graphene_vec3_t, radialSegments + 1);
@@ -534,7 +529,7 @@ gthree_geometry_new_torus_full (float radius,
   a_uv = gthree_attribute_new ("uv", GTHREE_ATTRIBUTE_TYPE_FLOAT, vertex_count, 2, FALSE);
   gthree_geometry_add_attribute (geometry, "uv", a_uv);
 
-  a_index = gthree_attribute_new ("index", GTHREE_ATTRIBUTE_TYPE_UINT16, index_count, 1, FALSE);
+  a_index = gthree_attribute_new ("index", gthree_attribute_type_for_index (vertex_count), index_count, 1, FALSE);
   gthree_geometry_set_index (geometry, a_index);
 
   for (j = 0; j <= radialSegments; j++)
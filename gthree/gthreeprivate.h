@@ -45,10 +45,24 @@ struct _GthreeLightSetup
 };
 
 /* Keep track of what state the material is wired up for */
+typedef enum {
+  GTHREE_PROGRAM_VARIANT_PLAIN,
+  GTHREE_PROGRAM_VARIANT_INSTANCING,
+  GTHREE_PROGRAM_VARIANT_INSTANCING_COLOR,
+
+  GTHREE_N_PROGRAM_VARIANTS
+} GthreeProgramVariant;
+
 struct _GthreeMaterialProperties
 {
+  /* The variant last used */
   GthreeProgram *program;
+  /* Objects sharing the material may need instancing or not, so each
+   * gets its own program, all made for the same material state */
+  GthreeProgram *programs[GTHREE_N_PROGRAM_VARIANTS];
   GthreeLightSetupHash light_hash;
+  /* The program the shader uniform locations were looked up for */
+  GthreeProgram *locations_program;
 };
 
 struct  _GthreeProgramParameters {
@@ -85,6 +99,8 @@ struct  _GthreeProgramParameters {
   guint size_attenuation : 1;
   guint logarithmic_depth_buffer : 1;
   guint skinning : 1;
+  guint instancing : 1;
+  guint instancing_color : 1;
   guint use_vertex_texture : 1;
   guint morph_targets : 1;
   guint morph_normals : 1;
@@ -97,6 +113,7 @@ struct  _GthreeProgramParameters {
   guint flip_sided : 1;
   guint depth_packing : 2;
   guint dithering : 1;
+  guint uniform_buffers : 1;
 
   guint8 alpha_test;
   guint16 max_bones;
@@ -115,6 +132,22 @@ struct  _GthreeProgramParameters {
 
 gboolean gthree_uniform_is_array (GthreeUniform *uniform);
 GthreeUniform *gthree_uniform_newq (GQuark name, GthreeUniformType type);
+void gthree_uniforms_append_std140 (GthreeUniforms    *uniforms,
+                                    const char *const *members,
+                                    GByteArray        *buffer);
+
+gboolean    gthree_program_is_ready (GthreeProgram *program);
+gboolean    gthree_program_poll     (GthreeProgram *program,
+                                     gboolean       parallel_compile);
+
+const char *gthree_renderer_get_driver_id                (GthreeRenderer *renderer);
+gboolean    gthree_renderer_get_supports_program_binary (GthreeRenderer *renderer);
+void        gthree_renderer_count_program_binary        (GthreeRenderer *renderer,
+                                                         gboolean        hit);
+
+/* Binding points of the uniform blocks shared by all programs */
+#define GTHREE_UBO_BINDING_CAMERA 0
+#define GTHREE_UBO_BINDING_LIGHTS 1
 
 GthreeRenderList *gthree_render_list_new ();
 void gthree_render_list_free (GthreeRenderList *list);
@@ -124,8 +157,175 @@ void gthree_render_list_push (GthreeRenderList *list,
                               GthreeGeometry *geometry,
                               GthreeMaterial *material,
                               GthreeGeometryGroup *group);
-void gthree_render_list_sort (GthreeRenderList *list);
+void gthree_render_list_sort (GthreeRenderList *list,
+                              GthreeSortMode    mode);
+
+/* Small per-instance ids used to build render list sort keys */
+guint gthree_allocate_id      (void);
+guint gthree_get_frame_epoch  (void);
+guint gthree_program_get_id   (GthreeProgram  *program);
+guint gthree_material_get_id  (GthreeMaterial *material);
+guint gthree_geometry_get_id  (GthreeGeometry *geometry);
+
+const float *gthree_attribute_read_float (GthreeAttribute *attribute);
+const guint32 *gthree_attribute_read_uint32 (GthreeAttribute *attribute);
+guint gthree_attribute_get_version (GthreeAttribute *attribute);
+GthreeAttributeType gthree_attribute_type_for_index (guint64 n_vertices);
+guint gthree_attribute_get_buffer_generation (void);
+
+gboolean gthree_geometry_get_wireframe_index_merged (GthreeGeometry *geometry);
+guint    gthree_geometry_get_layout_version        (GthreeGeometry *geometry);
+guint    gthree_geometry_get_groups_stamp          (GthreeGeometry *geometry);
+
+/* Runs tasks on a thread pool shared by all threaded passes */
+typedef void (*GthreeParallelFunc) (gpointer data,
+                                    int      task);
+
+int   gthree_parallel_get_n_threads (void);
+void  gthree_parallel_for           (int                    n_tasks,
+                                     GthreeParallelFunc     func,
+                                     gpointer               data);
+
+/* Threaded geometry processing, for large meshes */
+void  gthree_compute_vertex_normals (GthreeAttribute       *position,
+                                     GthreeAttribute       *index,
+                                     GthreeAttribute       *normal);
+void  gthree_compute_tangents       (GthreeAttribute       *position,
+                                     GthreeAttribute       *normal,
+                                     GthreeAttribute       *uv,
+                                     GthreeAttribute       *index,
+                                     GthreeAttribute       *tangent);
+void  gthree_compute_bounding_box   (GthreeAttribute       *position,
+                                     graphene_box_t        *box);
+float gthree_compute_max_radius_sq  (GthreeAttribute       *position,
+                                     const graphene_vec3_t *center);
+
+/* Per-geometry triangle hierarchy used for raycasting */
+typedef struct _GthreeBvh GthreeBvh;
 
+typedef struct {
+  int face_index;
+  float t;    /* Along the (normalized) object space ray */
+  float u, v; /* Barycentric weights of the second and third vertex */
+} GthreeBvhHit;
+
+GthreeBvh *gthree_bvh_new          (GthreeGeometry       *geometry);
+void       gthree_bvh_free         (GthreeBvh            *bvh);
+void       gthree_bvh_raycast      (GthreeBvh            *bvh,
+                                    GthreeGeometry       *geometry,
+                                    const graphene_ray_t *ray,
+                                    GthreeSide            side,
+                                    guint                 first_face,
+                                    guint                 n_faces,
+                                    GArray               *hits);
+gboolean   gthree_bvh_raycast_nearest (GthreeBvh            *bvh,
+                                       GthreeGeometry       *geometry,
+                                       const graphene_ray_t *ray,
+                                       GthreeSide            side,
+                                       guint                 first_face,
+                                       guint                 n_faces,
+                                       float                 min_t,
+                                       float                 max_t,
+                                       GthreeBvhHit         *nearest);
+GthreeBvh *gthree_geometry_get_bvh (GthreeGeometry       *geometry);
+
+typedef struct {
+  GthreeObject *object;
+  GthreeGeometry *geometry;
+  GthreeBvh *bvh;
+  graphene_matrix_t world_matrix;
+  graphene_matrix_t inverse;
+  graphene_sphere_t sphere; /* World space bounds */
+  GthreeSide side;
+  guint first_face;
+  guint n_faces;
+} GthreeMeshRaycastTarget;
+
+gboolean gthree_mesh_init_raycast_target    (GthreeMesh                    *mesh,
+                                             GthreeMeshRaycastTarget       *target);
+gboolean gthree_mesh_raycast_target_nearest (const GthreeMeshRaycastTarget *target,
+                                             const graphene_ray_t          *ray,
+                                             float                          near,
+                                             float                          far,
+                                             GthreeBvhHit                  *hit,
+                                             float                         *distance);
+
+/* Dynamic world space AABB tree used as scene spatial index */
+typedef struct _GthreeAabbTree GthreeAabbTree;
+typedef void (*GthreeAabbTreeFunc) (gpointer data,
+                                    gpointer user_data);
+
+GthreeAabbTree *gthree_aabb_tree_new            (void);
+void            gthree_aabb_tree_free           (GthreeAabbTree           *tree);
+int             gthree_aabb_tree_get_n_leaves   (GthreeAabbTree           *tree);
+int             gthree_aabb_tree_insert         (GthreeAabbTree           *tree,
+                                                 const graphene_box_t     *box,
+                                                 gpointer                  data);
+void            gthree_aabb_tree_remove         (GthreeAabbTree           *tree,
+                                                 int                       proxy);
+gboolean        gthree_aabb_tree_move           (GthreeAabbTree           *tree,
+                                                 int                       proxy,
+                                                 const graphene_box_t     *box);
+void            gthree_aabb_tree_query_frustum  (GthreeAabbTree           *tree,
+                                                 const graphene_frustum_t *frustum,
+                                                 GthreeAabbTreeFunc        func,
+                                                 gpointer                  user_data);
+void            gthree_aabb_tree_query_ray      (GthreeAabbTree           *tree,
+                                                 const graphene_ray_t     *ray,
+                                                 GthreeAabbTreeFunc        func,
+                                                 gpointer                  user_data);
+
+/* Shared vertex and index buffers for multi drawing distinct geometries */
+typedef struct _GthreeGeometryArenas GthreeGeometryArenas;
+
+typedef struct {
+  GthreeGeometry *geometry; /* The arena, holding many geometries */
+  int base_vertex;
+  int first_index;
+} GthreeArenaSlot;
+
+GthreeGeometryArenas *gthree_geometry_arenas_new         (void);
+void                  gthree_geometry_arenas_free        (GthreeGeometryArenas *arenas);
+gboolean              gthree_geometry_arenas_can_hold    (GthreeGeometryArenas *arenas,
+                                                          GthreeGeometry       *geometry);
+gboolean              gthree_geometry_arenas_lookup      (GthreeGeometryArenas *arenas,
+                                                          GthreeGeometry       *geometry,
+                                                          guint                 frame,
+                                                          GthreeArenaSlot      *slot);
+void                  gthree_geometry_arenas_begin_frame (GthreeGeometryArenas *arenas,
+                                                          guint                 frame);
+void                  gthree_geometry_arenas_upload      (GthreeGeometryArenas *arenas);
+
+/* Compute shader culling of multi draw commands */
+typedef struct _GthreeGpuCulling GthreeGpuCulling;
+
+GthreeGpuCulling *gthree_gpu_culling_new                  (void);
+void              gthree_gpu_culling_free                 (GthreeGpuCulling         *culling);
+void              gthree_gpu_culling_update_depth_pyramid (GthreeGpuCulling         *culling,
+                                                           gconstpointer             camera,
+                                                           const graphene_matrix_t  *view_projection,
+                                                           const graphene_rect_t    *viewport);
+void              gthree_gpu_culling_cull                 (GthreeGpuCulling         *culling,
+                                                           gconstpointer             occlusion_camera,
+                                                           const graphene_frustum_t *frustum,
+                                                           guint                     sphere_buffer,
+                                                           guint                     transform_buffer,
+                                                           guint                     command_buffer,
+                                                           guint                     n_draws,
+                                                           guint                     command_stride);
+
+void       gthree_scene_update_spatial_index (GthreeScene              *scene,
+                                              GthreeCamera             *camera,
+                                              float                     viewport_height);
+GPtrArray *gthree_scene_get_index_lights     (GthreeScene              *scene);
+void       gthree_scene_query_frustum        (GthreeScene              *scene,
+                                              const graphene_frustum_t *frustum,
+                                              GthreeAabbTreeFunc        func,
+                                              gpointer                  user_data);
+void       gthree_scene_query_ray            (GthreeScene              *scene,
+                                              const graphene_ray_t     *ray,
+                                              GthreeAabbTreeFunc        func,
+                                              gpointer                  user_data);
 
 guint gthree_renderer_allocate_texture_unit (GthreeRenderer *renderer);
 
@@ -198,6 +398,7 @@ void gthree_spot_light_shadow_update (GthreeSpotLightShadow *shadow,
 GthreeMaterialProperties *gthree_material_get_properties (GthreeMaterial  *material);
 
 graphene_matrix_t *gthree_camera_get_projection_matrix_for_write (GthreeCamera *camera);
+guint gthree_camera_get_world_inverse_stamp (GthreeCamera *camera);
 
 void gthree_object_print_tree (GthreeObject *object, int depth);
 
@@ -12,6 +12,13 @@ typedef struct {
   GHashTable *attribute_locations;
 
   GLuint gl_program;
+  guint id;
+
+  /* Set while the link may still be running in the driver */
+  gboolean ready;
+  GLuint pending_vertex_shader;
+  GLuint pending_fragment_shader;
+  char *binary_path;
 
   /* Cache keys: */
   GthreeProgramCache *cache;
@@ -57,11 +64,20 @@ GLuint
 create_shader (int type, const char *code)
 {
   GLuint shader = glCreateShader (type);
-  GLint status;
 
   glShaderSource (shader, 1, &code, NULL);
   glCompileShader (shader);
 
+  return shader;
+}
+
+/* Querying the status waits for the compile, so this is only done
+   once the program is finished */
+static void
+check_shader (GLuint shader, int type)
+{
+  GLint status;
+
   glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
   if (status == GL_FALSE)
     {
@@ -78,8 +94,6 @@ create_shader (int type, const char *code)
 
       g_free (buffer);
     }
-
-  return shader;
 }
 
 static void
@@ -99,6 +113,123 @@ generate_defines (GString *out, GPtrArray *defines)
     }
 }
 
+static const char camera_uniforms[] =
+  "uniform mat4 projectionMatrix;\n"
+  "uniform mat4 viewMatrix;\n"
+  "uniform vec3 cameraPosition;\n";
+
+static const char camera_uniform_block[] =
+  "layout(std140) uniform GthreeCameraBlock {\n"
+  "	mat4 projectionMatrix;\n"
+  "	mat4 viewMatrix;\n"
+  "	vec3 cameraPosition;\n"
+  "};\n";
+
+static void
+append_version (GString *str,
+                GthreeProgramParameters *parameters)
+{
+  g_string_append (str, "#version 130\n");
+  if (parameters->uniform_buffers)
+    g_string_append (str,
+                     "#extension GL_ARB_uniform_buffer_object : enable\n"
+                     "#define USE_UNIFORM_BUFFERS\n");
+}
+
+static void
+bind_uniform_block (GLuint      gl_program,
+                    const char *name,
+                    GLuint      binding)
+{
+  GLuint index = glGetUniformBlockIndex (gl_program, name);
+
+  if (index != GL_INVALID_INDEX)
+    glUniformBlockBinding (gl_program, index, binding);
+}
+
+/* Program binary cache file: magic, binary format, then the blob */
+#define PROGRAM_BINARY_MAGIC "GTPB"
+
+static char *
+program_binary_path (GthreeRenderer *renderer,
+                     const char *vertex,
+                     const char *fragment,
+                     GthreeProgramParameters *parameters,
+                     const char *index0_attribute_name)
+{
+  g_autoptr(GChecksum) checksum = g_checksum_new (G_CHECKSUM_SHA256);
+  g_autofree char *filename = NULL;
+  const char *driver_id = gthree_renderer_get_driver_id (renderer);
+
+  /* Include the terminating nuls so the fields can't run together */
+  g_checksum_update (checksum, (const guchar *)vertex, strlen (vertex) + 1);
+  g_checksum_update (checksum, (const guchar *)fragment, strlen (fragment) + 1);
+  g_checksum_update (checksum, (const guchar *)parameters, sizeof (GthreeProgramParameters));
+  g_checksum_update (checksum, (const guchar *)driver_id, strlen (driver_id) + 1);
+  if (index0_attribute_name)
+    g_checksum_update (checksum, (const guchar *)index0_attribute_name, strlen (index0_attribute_name));
+
+  filename = g_strconcat (g_checksum_get_string (checksum), ".bin", NULL);
+
+  return g_build_filename (gthree_renderer_get_program_cache_dir (renderer), filename, NULL);
+}
+
+static gboolean
+load_program_binary (GLuint gl_program,
+                     const char *path)
+{
+  g_autofree char *contents = NULL;
+  gsize len;
+  guint32 format;
+  GLint status;
+
+  if (!g_file_get_contents (path, &contents, &len, NULL))
+    return FALSE;
+
+  if (len <= 8 || memcmp (contents, PROGRAM_BINARY_MAGIC, 4) != 0)
+    return FALSE;
+
+  memcpy (&format, contents + 4, 4);
+
+  /* The driver may reject a blob, e.g. after an update, then we just recompile */
+  glProgramBinary (gl_program, format, contents + 8, len - 8);
+  glGetProgramiv (gl_program, GL_LINK_STATUS, &status);
+
+  return status == GL_TRUE;
+}
+
+static void
+save_program_binary (GLuint gl_program,
+                     const char *path)
+{
+  g_autofree char *dir = NULL;
+  g_autofree char *contents = NULL;
+  g_autoptr(GError) error = NULL;
+  GLint len = 0;
+  GLenum format;
+
+  glGetProgramiv (gl_program, GL_PROGRAM_BINARY_LENGTH, &len);
+  if (len <= 0)
+    return;
+
+  contents = g_malloc (len + 8);
+  glGetProgramBinary (gl_program, len, &len, &format, contents + 8);
+  memcpy (contents, PROGRAM_BINARY_MAGIC, 4);
+  memcpy (contents + 4, &format, 4);
+
+  dir = g_path_get_dirname (path);
+  g_mkdir_with_parents (dir, 0755);
+
+  if (!g_file_set_contents (path, contents, len + 8, &error))
+    g_warning ("Failed to save program binary: %s", error->message);
+}
+
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+static void gthree_program_finish (GthreeProgram *program);
+
 static void
 get_uniform_locations (GthreeProgram *program)
 {
@@ -368,8 +499,8 @@ gthree_program_new (GthreeShader *shader, GthreeProgramParameters *parameters, G
   g_autofree char *fragment_expanded = NULL;
   const char *shader_name;
   GLuint glVertexShader, glFragmentShader;
-  GLint status;
   char formatd_buffer[G_ASCII_DTOSTR_BUF_SIZE];
+  g_autofree char *binary_path = NULL;
 
   program = g_object_new (gthree_program_get_type (),
                           NULL);
@@ -457,7 +588,7 @@ gthree_program_new (GthreeShader *shader, GthreeProgramParameters *parameters, G
 
   if (TRUE /*! material instanceof THREE.RawShaderMaterial */)
     {
-      g_string_append (vertex, "#version 130\n");
+      append_version (vertex, parameters);
       g_string_append_printf (vertex, "precision %s float;\n", precision_to_string (parameters->precision));
       g_string_append_printf (vertex, "precision %s int;\n", precision_to_string (parameters->precision));
 
@@ -518,6 +649,11 @@ gthree_program_new (GthreeShader *shader, GthreeProgramParameters *parameters, G
       if (parameters->flat_shading)
         g_string_append (vertex, "#define FLAT_SHADED\n");
 
+      if (parameters->instancing)
+        g_string_append (vertex, "#define USE_INSTANCING\n");
+      if (parameters->instancing_color)
+        g_string_append (vertex, "#define USE_INSTANCING_COLOR\n");
+
       if (parameters->skinning)
         g_string_append (vertex, "#define USE_SKINNING\n");
       if (parameters->use_vertex_texture)
@@ -548,18 +684,26 @@ gthree_program_new (GthreeShader *shader, GthreeProgramParameters *parameters, G
       // parameters.logarithmicDepthBuffer && ( capabilities.isWebGL2 || extensions.get( 'EXT_frag_depth' ) ) ? '#define USE_LOGDEPTHBUF_EXT' : '',
 #endif
 
+        g_string_append (vertex,
+                         parameters->uniform_buffers ? camera_uniform_block : camera_uniforms);
+
         g_string_append (vertex,
                          "uniform mat4 modelMatrix;\n"
                          "uniform mat4 modelViewMatrix;\n"
-                         "uniform mat4 projectionMatrix;\n"
-                         "uniform mat4 viewMatrix;\n"
                          "uniform mat3 normalMatrix;\n"
-                         "uniform vec3 cameraPosition;\n"
 
                          "attribute vec3 position;\n"
                          "attribute vec3 normal;\n"
                          "attribute vec2 uv;\n"
 
+                         "#ifdef USE_INSTANCING\n"
+                         "	attribute mat4 instanceMatrix;\n"
+                         "#endif\n"
+
+                         "#ifdef USE_INSTANCING_COLOR\n"
+                         "	attribute vec3 instanceColor;\n"
+                         "#endif\n"
+
                          "#ifdef USE_TANGENT\n"
                          "	attribute vec4 tangent;\n"
                          "#endif\n"
@@ -594,7 +738,7 @@ gthree_program_new (GthreeShader *shader, GthreeProgramParameters *parameters, G
 
       /* fragment shader prefix */
 
-      g_string_append (fragment, "#version 130\n");
+      append_version (fragment, parameters);
       g_string_append_printf (fragment, "precision %s float;\n", precision_to_string (parameters->precision));
       g_string_append_printf (fragment, "precision %s int;\n", precision_to_string (parameters->precision));
 
@@ -653,6 +797,8 @@ gthree_program_new (GthreeShader *shader, GthreeProgramParameters *parameters, G
         g_string_append (fragment, "#define USE_TANGENT\n");
       if (parameters->vertex_colors)
         g_string_append (fragment, "#define USE_COLOR\n");
+      if (parameters->instancing_color)
+        g_string_append (fragment, "#define USE_INSTANCING_COLOR\n");
 
       if (parameters->gradient_map)
         g_string_append (fragment, "#define USE_GRADIENTMAP\n");
@@ -686,8 +832,7 @@ gthree_program_new (GthreeShader *shader, GthreeProgramParameters *parameters, G
 #endif
 
         g_string_append (fragment,
-                         "uniform mat4 viewMatrix;\n"
-                         "uniform vec3 cameraPosition;\n");
+                         parameters->uniform_buffers ? camera_uniform_block : camera_uniforms);
 #if TODO
       // ( parameters.toneMapping !== NoToneMapping ) ? '#define TONE_MAPPING' : '',
       // ( parameters.toneMapping !== NoToneMapping ) ? ShaderChunk[ 'tonemapping_pars_fragment' ] : '', // this code is required here because it is used by the toneMapping() function defined below
@@ -738,12 +883,26 @@ gthree_program_new (GthreeShader *shader, GthreeProgramParameters *parameters, G
                fragment_expanded);
     }
 
-  glVertexShader = create_shader (GL_VERTEX_SHADER, vertex_expanded);
-  glFragmentShader = create_shader (GL_FRAGMENT_SHADER, fragment_expanded);
-
   g_string_free (vertex, TRUE);
   g_string_free (fragment, TRUE);
 
+  if (gthree_renderer_get_program_cache_dir (renderer) != NULL &&
+      gthree_renderer_get_supports_program_binary (renderer))
+    {
+      binary_path = program_binary_path (renderer, vertex_expanded, fragment_expanded,
+                                         parameters, index0AttributeName);
+      if (load_program_binary (gl_program, binary_path))
+        {
+          gthree_renderer_count_program_binary (renderer, TRUE);
+          goto linked;
+        }
+
+      gthree_renderer_count_program_binary (renderer, FALSE);
+    }
+
+  glVertexShader = create_shader (GL_VERTEX_SHADER, vertex_expanded);
+  glFragmentShader = create_shader (GL_FRAGMENT_SHADER, fragment_expanded);
+
   glAttachShader (gl_program, glVertexShader);
   glAttachShader (gl_program, glFragmentShader);
 
@@ -767,36 +926,122 @@ gthree_program_new (GthreeShader *shader, GthreeProgramParameters *parameters, G
     glBindAttribLocation (gl_program, 0, index0AttributeName);
   }
 
+  if (binary_path)
+    glProgramParameteri (gl_program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+
   glLinkProgram (gl_program);
 
-  glGetProgramiv (gl_program, GL_LINK_STATUS, &status);
-  if (status == GL_FALSE)
+  priv->gl_program = gl_program;
+  priv->pending_vertex_shader = glVertexShader;
+  priv->pending_fragment_shader = glFragmentShader;
+  priv->binary_path = g_steal_pointer (&binary_path);
+
+  /* In async mode the link status is only queried once the renderer
+     polls the program, so we don't wait for the driver here */
+  if (!gthree_renderer_get_async_compile (renderer))
+    gthree_program_finish (program);
+
+  return program;
+
+ linked:
+  priv->gl_program = gl_program;
+  gthree_program_finish (program);
+
+  return program;
+}
+
+static void
+gthree_program_finish (GthreeProgram *program)
+{
+  GthreeProgramPrivate *priv = gthree_program_get_instance_private (program);
+  GLuint gl_program = priv->gl_program;
+
+  if (priv->ready)
+    return;
+
+  if (priv->pending_vertex_shader)
     {
-      GLint log_len;
-      char *buffer;
+      GLint status;
 
-      glGetProgramiv (gl_program, GL_INFO_LOG_LENGTH, &log_len);
+      glGetProgramiv (gl_program, GL_LINK_STATUS, &status);
+      if (status == GL_FALSE)
+        {
+          GLint log_len;
+          char *buffer;
 
-      buffer = g_malloc (log_len + 1);
-      glGetProgramInfoLog (gl_program, log_len, NULL, buffer);
-      g_warning ("Linker failure: %s\n", buffer);
-      g_free (buffer);
+          check_shader (priv->pending_vertex_shader, GL_VERTEX_SHADER);
+          check_shader (priv->pending_fragment_shader, GL_FRAGMENT_SHADER);
+
+          glGetProgramiv (gl_program, GL_INFO_LOG_LENGTH, &log_len);
+
+          buffer = g_malloc (log_len + 1);
+          glGetProgramInfoLog (gl_program, log_len, NULL, buffer);
+          g_warning ("Linker failure: %s\n", buffer);
+          g_free (buffer);
+        }
+      else if (priv->binary_path)
+        save_program_binary (gl_program, priv->binary_path);
+
+      // clean up
+
+      glDeleteShader (priv->pending_vertex_shader);
+      glDeleteShader (priv->pending_fragment_shader);
+      priv->pending_vertex_shader = 0;
+      priv->pending_fragment_shader = 0;
     }
 
-  // clean up
+  g_clear_pointer (&priv->binary_path, g_free);
 
-  glDeleteShader (glVertexShader);
-  glDeleteShader (glFragmentShader);
+  /* Block bindings are not part of the program binary */
+  if (priv->params.uniform_buffers)
+    {
+      bind_uniform_block (gl_program, "GthreeCameraBlock", GTHREE_UBO_BINDING_CAMERA);
+      bind_uniform_block (gl_program, "GthreeLightsBlock", GTHREE_UBO_BINDING_LIGHTS);
+    }
 
-  priv->gl_program = gl_program;
+  priv->ready = TRUE;
+}
 
-  return program;
+gboolean
+gthree_program_is_ready (GthreeProgram *program)
+{
+  GthreeProgramPrivate *priv = gthree_program_get_instance_private (program);
+
+  return priv->ready;
+}
+
+/* Finishes the program if the driver is done linking it. Without
+ * parallel compile support we can't ask, so this just finishes it,
+ * which the renderer only does a frame after the link was started. */
+gboolean
+gthree_program_poll (GthreeProgram *program,
+                     gboolean       parallel_compile)
+{
+  GthreeProgramPrivate *priv = gthree_program_get_instance_private (program);
+
+  if (priv->ready)
+    return TRUE;
+
+  if (parallel_compile)
+    {
+      GLint done = GL_FALSE;
+
+      glGetProgramiv (priv->gl_program, GL_COMPLETION_STATUS_KHR, &done);
+      if (!done)
+        return FALSE;
+    }
+
+  gthree_program_finish (program);
+
+  return TRUE;
 }
 
 static void
 gthree_program_init (GthreeProgram *program)
 {
+  GthreeProgramPrivate *priv = gthree_program_get_instance_private (program);
 
+  priv->id = gthree_allocate_id ();
 }
 
 static void
@@ -805,6 +1050,13 @@ gthree_program_finalize (GObject *obj)
   GthreeProgram *program = GTHREE_PROGRAM (obj);
   GthreeProgramPrivate *priv = gthree_program_get_instance_private (program);
 
+  if (priv->pending_vertex_shader)
+    {
+      glDeleteShader (priv->pending_vertex_shader);
+      glDeleteShader (priv->pending_fragment_shader);
+    }
+  g_free (priv->binary_path);
+
   if (priv->gl_program)
     {
       glDeleteProgram (priv->gl_program);
@@ -836,6 +1088,14 @@ gthree_program_use (GthreeProgram *program)
   glUseProgram (priv->gl_program);
 }
 
+guint
+gthree_program_get_id (GthreeProgram *program)
+{
+  GthreeProgramPrivate *priv = gthree_program_get_instance_private (program);
+
+  return priv->id;
+}
+
 gint
 gthree_program_lookup_uniform_location (GthreeProgram *program,
                                         GQuark uniform)
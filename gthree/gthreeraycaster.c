@@ -1,6 +1,10 @@
+#include <string.h>
+
 #include "gthreeraycaster.h"
 #include "gthreeperspectivecamera.h"
 #include "gthreeorthographiccamera.h"
+#include "gthreescene.h"
+#include "gthreeprivate.h"
 
 typedef struct {
   graphene_ray_t ray;
@@ -31,17 +35,21 @@ gthree_ray_intersection_copy (GthreeRayIntersection *intersection)
 GthreeRayIntersection *
 gthree_ray_intersection_new (void)
 {
-  return g_new0 (GthreeRayIntersection, 0);
+  return g_new0 (GthreeRayIntersection, 1);
 }
 
 static gint
 compare_intersection (gconstpointer  a,
                       gconstpointer  b)
 {
-  const GthreeRayIntersection *aa = a;
-  const GthreeRayIntersection *bb = b;
-
-  return aa->distance - bb->distance;
+  const GthreeRayIntersection *aa = *(const GthreeRayIntersection **)a;
+  const GthreeRayIntersection *bb = *(const GthreeRayIntersection **)b;
+
+  if (aa->distance < bb->distance)
+    return -1;
+  if (aa->distance > bb->distance)
+    return 1;
+  return 0;
 }
 
 G_DEFINE_BOXED_TYPE (GthreeRayIntersection, gthree_ray_intersection,
@@ -167,6 +175,20 @@ gthree_raycaster_get_far (GthreeRaycaster *raycaster)
   return priv->far;
 }
 
+typedef struct {
+  GthreeRaycaster *raycaster;
+  GPtrArray *intersections;
+} IntersectIndexedData;
+
+static void
+intersect_indexed_object (gpointer data,
+                          gpointer user_data)
+{
+  IntersectIndexedData *idata = user_data;
+
+  gthree_object_raycast (data, idata->raycaster, idata->intersections);
+}
+
 void
 intersect_object (GthreeRaycaster *raycaster,
                   GthreeObject *object,
@@ -176,6 +198,18 @@ intersect_object (GthreeRaycaster *raycaster,
   if (!gthree_object_get_visible (object))
     return;
 
+  /* Only renderables can be hit, and the index has all the visible ones */
+  if (recurse && GTHREE_IS_SCENE (object) &&
+      gthree_scene_get_spatial_index (GTHREE_SCENE (object)))
+    {
+      GthreeRaycasterPrivate *priv = gthree_raycaster_get_instance_private (raycaster);
+      IntersectIndexedData data = { raycaster, intersections };
+
+      gthree_scene_update_spatial_index (GTHREE_SCENE (object), NULL, 0);
+      gthree_scene_query_ray (GTHREE_SCENE (object), &priv->ray, intersect_indexed_object, &data);
+      return;
+    }
+
   gthree_object_raycast (object, raycaster, intersections);
 
   if (recurse)
@@ -224,3 +258,198 @@ gthree_raycaster_intersect_object (GthreeRaycaster *raycaster,
                                              recurse,
                                              optional_target);
 }
+
+#define RAYCAST_BATCH_CHUNK 64
+
+typedef struct {
+  GArray *targets;          /* GthreeMeshRaycastTarget */
+  GHashTable *target_index; /* GthreeObject -> index + 1, when using a scene index */
+  GthreeScene *scene;
+  const graphene_ray_t *rays;
+  GthreeRayHit *hits;
+  int n_rays;
+  int n_chunks;
+  float near;
+  float far;
+} RaycastBatch;
+
+typedef struct {
+  RaycastBatch *batch;
+  const graphene_ray_t *ray;
+  GthreeRayHit *hit;
+} RaycastBatchRay;
+
+static void
+raycast_batch_test_target (RaycastBatch                  *batch,
+                           const GthreeMeshRaycastTarget *target,
+                           const graphene_ray_t          *ray,
+                           GthreeRayHit                  *result)
+{
+  GthreeBvhHit hit;
+  float distance;
+
+  /* Anything further than the current best can't win */
+  if (gthree_mesh_raycast_target_nearest (target, ray, batch->near,
+                                          result->object ? result->distance : batch->far,
+                                          &hit, &distance) &&
+      (result->object == NULL || distance < result->distance))
+    {
+      result->object = target->object;
+      result->distance = distance;
+      result->face_index = hit.face_index;
+    }
+}
+
+static void
+raycast_batch_test_candidate (gpointer data,
+                              gpointer user_data)
+{
+  RaycastBatchRay *bray = user_data;
+  guint index = GPOINTER_TO_UINT (g_hash_table_lookup (bray->batch->target_index, data));
+
+  if (index != 0)
+    raycast_batch_test_target (bray->batch,
+                               &g_array_index (bray->batch->targets, GthreeMeshRaycastTarget, index - 1),
+                               bray->ray, bray->hit);
+}
+
+static void
+raycast_batch_run_chunk (gpointer data,
+                         int      c)
+{
+  RaycastBatch *batch = data;
+  int start = c * RAYCAST_BATCH_CHUNK;
+  int end = MIN (start + RAYCAST_BATCH_CHUNK, batch->n_rays);
+  int r;
+  guint i;
+
+  for (r = start; r < end; r++)
+    {
+      const graphene_ray_t *ray = &batch->rays[r];
+      GthreeRayHit *hit = &batch->hits[r];
+
+      memset (hit, 0, sizeof (GthreeRayHit));
+      hit->face_index = -1;
+
+      if (batch->scene)
+        {
+          RaycastBatchRay bray = { batch, ray, hit };
+
+          gthree_scene_query_ray (batch->scene, ray, raycast_batch_test_candidate, &bray);
+        }
+      else
+        {
+          for (i = 0; i < batch->targets->len; i++)
+            raycast_batch_test_target (batch,
+                                       &g_array_index (batch->targets, GthreeMeshRaycastTarget, i),
+                                       ray, hit);
+        }
+
+      if (hit->object)
+        {
+          graphene_vec3_t origin, direction;
+
+          graphene_ray_get_origin_vec3 (ray, &origin);
+          graphene_ray_get_direction (ray, &direction);
+          graphene_vec3_scale (&direction, hit->distance, &hit->point);
+          graphene_vec3_add (&origin, &hit->point, &hit->point);
+        }
+    }
+}
+
+static void
+collect_raycast_targets (GthreeObject *object,
+                         gboolean      recurse,
+                         GArray       *targets)
+{
+  if (!gthree_object_get_visible (object))
+    return;
+
+  if (GTHREE_IS_MESH (object))
+    {
+      GthreeMeshRaycastTarget target;
+
+      if (gthree_mesh_init_raycast_target (GTHREE_MESH (object), &target))
+        g_array_append_val (targets, target);
+    }
+
+  if (recurse)
+    {
+      GthreeObjectIter iter;
+      GthreeObject *child;
+
+      gthree_object_iter_init (&iter, object);
+      while (gthree_object_iter_next (&iter, &child))
+        collect_raycast_targets (child, TRUE, targets);
+    }
+}
+
+/**
+ * gthree_raycaster_intersect_rays:
+ * @raycaster: a #GthreeRaycaster
+ * @objects: (array length=n_objects): the objects to test
+ * @n_objects: the number of objects
+ * @recurse: whether to also test the descendants of @objects
+ * @rays: (array length=n_rays): world space rays
+ * @n_rays: the number of rays
+ * @hits: (array length=n_rays) (out caller-allocates): return location for the results
+ *
+ * Finds the closest mesh hit by each of @rays, within the near and far
+ * distances of @raycaster (the ray set on it is not used). This
+ * prepares the objects once for all the rays and spreads the rays over
+ * several threads, so it is much cheaper than calling
+ * gthree_raycaster_intersect_objects() once per ray.
+ *
+ * Rays that don't hit anything get a %NULL object in their result.
+ * The objects in @hits are not referenced.
+ */
+void
+gthree_raycaster_intersect_rays (GthreeRaycaster      *raycaster,
+                                 GthreeObject        **objects,
+                                 int                   n_objects,
+                                 gboolean              recurse,
+                                 const graphene_ray_t *rays,
+                                 int                   n_rays,
+                                 GthreeRayHit         *hits)
+{
+  GthreeRaycasterPrivate *priv = gthree_raycaster_get_instance_private (raycaster);
+  RaycastBatch *batch;
+  int i;
+
+  if (n_rays <= 0)
+    return;
+
+  batch = g_new0 (RaycastBatch, 1);
+  batch->targets = g_array_new (FALSE, FALSE, sizeof (GthreeMeshRaycastTarget));
+  batch->rays = rays;
+  batch->hits = hits;
+  batch->n_rays = n_rays;
+  batch->n_chunks = (n_rays + RAYCAST_BATCH_CHUNK - 1) / RAYCAST_BATCH_CHUNK;
+  batch->near = priv->near;
+  batch->far = priv->far;
+
+  for (i = 0; i < n_objects; i++)
+    collect_raycast_targets (objects[i], recurse, batch->targets);
+
+  /* With a single indexed scene each ray only visits the candidates from the index */
+  if (n_objects == 1 && recurse && GTHREE_IS_SCENE (objects[0]) &&
+      gthree_object_get_visible (objects[0]) &&
+      gthree_scene_get_spatial_index (GTHREE_SCENE (objects[0])))
+    {
+      batch->scene = GTHREE_SCENE (objects[0]);
+      gthree_scene_update_spatial_index (batch->scene, NULL, 0);
+
+      batch->target_index = g_hash_table_new (NULL, NULL);
+      for (i = 0; i < batch->targets->len; i++)
+        g_hash_table_insert (batch->target_index,
+                             g_array_index (batch->targets, GthreeMeshRaycastTarget, i).object,
+                             GUINT_TO_POINTER (i + 1));
+    }
+
+  gthree_parallel_for (batch->n_chunks, raycast_batch_run_chunk, batch);
+
+  g_array_unref (batch->targets);
+  if (batch->target_index)
+    g_hash_table_unref (batch->target_index);
+  g_free (batch);
+}
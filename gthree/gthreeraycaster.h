@@ -28,6 +28,14 @@ typedef struct {
   graphene_vec2_t uv2;
 } GthreeRayIntersection;
 
+/* Nearest hit of one ray, see gthree_raycaster_intersect_rays() */
+typedef struct {
+  GthreeObject *object; /* Not referenced, NULL if nothing was hit */
+  float distance;
+  int face_index;
+  graphene_vec3_t point;
+} GthreeRayHit;
+
 GTHREE_API
 GType gthree_ray_intersection_get_type (void) G_GNUC_CONST;
 
@@ -85,7 +93,14 @@ GPtrArray           *gthree_raycaster_intersect_objects (GthreeRaycaster *raycas
                                                          int n_objects,
                                                          gboolean recurse,
                                                          GPtrArray *optional_target);
-
+GTHREE_API
+void                 gthree_raycaster_intersect_rays   (GthreeRaycaster      *raycaster,
+                                                        GthreeObject        **objects,
+                                                        int                   n_objects,
+                                                        gboolean              recurse,
+                                                        const graphene_ray_t *rays,
+                                                        int                   n_rays,
+                                                        GthreeRayHit         *hits);
 
 
 G_END_DECLS
@@ -5,6 +5,7 @@
 #include "gthreeobjectprivate.h"
 #include "gthreemesh.h"
 #include "gthreeskinnedmesh.h"
+#include "gthreeinstancedmesh.h"
 #include "gthreelinesegments.h"
 #include "gthreeshader.h"
 #include "gthreematerial.h"
@@ -18,11 +19,13 @@
 #include "gthreelinebasicmaterial.h"
 #include "gthreeprimitives.h"
 #include "gthreegroup.h"
+#include "gthreelod.h"
 #include "gthreeattribute.h"
 #include "gthreesprite.h"
 #include "gthreepoints.h"
 #include "gthreespotlight.h"
 #include "gthreepointlight.h"
+#include "gthreetypebuiltins.h"
 
 #define MAX_MORPH_TARGETS 8
 #define MAX_MORPH_NORMALS 4
@@ -36,8 +39,58 @@ typedef struct {
   GthreeMaterial *material;
   GthreeGeometryGroup *group;
   float z;
+  guint64 sort_key;
 } GthreeRenderListItem;
 
+/* What we enabled in a vertex array object, to avoid redundant calls */
+typedef struct {
+  guint8 enabled_attributes[16];
+  guint8 attribute_divisors[16];
+} VertexArrayState;
+
+typedef struct {
+  GthreeGeometry *geometry;
+  GthreeProgram *program;
+  GthreeObject *instances;
+  gboolean wireframe;
+  gboolean multi_draw;
+} VaoKey;
+
+typedef struct {
+  int location;
+  GQuark name;
+} VaoDefaultAttribute;
+
+typedef struct {
+  VaoKey key;
+  guint vao;
+
+  /* The key pointers may be reused by new objects, so also check the ids */
+  guint geometry_id;
+  guint program_id;
+  guint layout_version;
+  guint buffer_generation;
+  GthreeAttribute *instance_color;
+
+  guint last_used_frame;
+  /* Program attributes the geometry lacks, these are not part of the vao state */
+  GArray *default_attributes;
+} VaoEntry;
+
+/* Vertex array objects unused for this many frames are deleted */
+#define VAO_CACHE_MAX_AGE 300
+
+/* Items [first, last) of list, drawn by commands
+ * [first_command, first_command + n_draws) of the frame */
+typedef struct {
+  GArray *list;
+  int first;
+  int last;
+  guint first_command;
+  guint n_draws;
+  GthreeGeometry *arena;
+} MultiDrawRun;
+
 struct _GthreeRenderList {
   float current_z;
   gboolean use_background;
@@ -61,6 +114,7 @@ typedef struct {
   gboolean auto_clear_stencil;
   graphene_vec3_t clear_color;
   gboolean sort_objects;
+  GthreeSortMode sort_mode;
   float gamma_factor;
   gboolean physically_correct_lights;
   gboolean shadowmap_enabled;
@@ -114,11 +168,12 @@ typedef struct {
   GthreeGeometry *current_geometry_program_geometry;
   GthreeProgram *current_geometry_program_program;
   gboolean current_geometry_program_wireframe;
+  GthreeObject *current_geometry_program_instances;
 
   GthreeRenderList *current_render_list;
 
-  guint8 new_attributes[8];
-  guint8 enabled_attributes[8];
+  guint8 new_attributes[16];
+  VertexArrayState *vao_state;
 
   float morph_influences[8];
 
@@ -130,8 +185,73 @@ typedef struct {
 
   gboolean supports_vertex_textures;
   gboolean supports_bone_textures;
+  gboolean supports_uniform_buffers;
+  gboolean supports_program_binary;
+
+  /* On-disk program binary cache */
+  char *driver_id;
+  char *program_cache_dir;
+  guint program_cache_hits;
+  guint program_cache_misses;
 
+  /* Programs whose link was started but not yet checked */
+  gboolean async_compile;
+  gboolean supports_parallel_compile;
+  GPtrArray *pending_programs;
+
+  /* Used for draws that can't be cached, like morph targets */
   guint vertex_array_object;
+  VertexArrayState vertex_array_object_state;
+  guint bound_vertex_array_object;
+  GHashTable *vao_cache;
+  /* Frames rendered by this renderer, the global epoch also counts
+   * the frames of other renderers */
+  guint frame_counter;
+
+  /* Runs of meshes sharing a material are drawn with one
+   * glMultiDrawElementsIndirect call. Their geometries are copied into
+   * shared arenas, and each draw reads its world matrix as instance
+   * matrix through its base instance. The commands, transforms and
+   * bounds of all the runs of a frame are uploaded (and culled)
+   * together, each run draws a range of them. */
+  gboolean multi_draw;
+  gboolean supports_multi_draw;
+  gboolean multi_draw_active;
+  GthreeGeometryArenas *arenas;
+  guint multi_draw_transform_buffer;
+  guint multi_draw_sphere_buffer;
+  guint multi_draw_command_buffer;
+  guint multi_draw_capacity; /* In draws, for all three buffers */
+  GArray *multi_draw_transforms;
+  GArray *multi_draw_spheres;
+  GArray *multi_draw_commands;
+  GArray *multi_draw_runs;
+  guint multi_draw_next_run;
+
+  /* Compute shader culling of the multi draws, created on first use */
+  gboolean gpu_culling;
+  gboolean gpu_culling_failed;
+  GthreeGpuCulling *culling;
+
+  /* What the render list was built for, it is kept while none of it
+   * changes. Objects mark their ancestors when they change, so a
+   * static scene is detected without traversing it. */
+  gboolean reuse_render_list;
+  gboolean render_list_valid;
+  GthreeScene *render_list_scene;
+  GthreeCamera *render_list_camera;
+  guint render_list_scene_stamp;
+  guint render_list_stamp;
+  guint32 render_list_layer_mask;
+  gboolean render_list_indexed;
+  float render_list_viewport_height;
+  graphene_matrix_t render_list_proj_screen_matrix;
+  guint render_list_n_items;
+
+  /* Uniform buffers shared by all programs */
+  guint camera_ubo;
+  guint lights_ubo;
+  GByteArray *ubo_data;
 
   /* Background */
   GthreeMesh *bg_box_mesh;
@@ -161,9 +281,26 @@ static GQuark q_spotLights;
 static GQuark q_bindMatrix;
 static GQuark q_bindMatrixInverse;
 static GQuark q_boneMatrices;
+static GQuark q_instanceMatrix;
+static GQuark q_instanceColor;
 
 G_DEFINE_TYPE_WITH_PRIVATE (GthreeRenderer, gthree_renderer, G_TYPE_OBJECT);
 
+enum {
+  PROP_0,
+
+  PROP_SORT_MODE,
+  PROP_PROGRAM_CACHE_DIR,
+  PROP_ASYNC_COMPILE,
+  PROP_MULTI_DRAW,
+  PROP_GPU_CULLING,
+  PROP_REUSE_RENDER_LIST,
+
+  N_PROPS
+};
+
+static GParamSpec *obj_props[N_PROPS] = { NULL, };
+
 static void clear (gboolean color, gboolean depth, gboolean stencil);
 static void set_clear_color (GthreeRenderer *renderer,
                              const graphene_vec3_t *color,
@@ -174,6 +311,9 @@ static void render_item (GthreeRenderer *renderer,
                          gpointer fog,
                          GthreeMaterial *material,
                          GthreeRenderListItem *item);
+static gboolean can_multi_draw (GthreeRenderer *renderer,
+                                GthreeObject   *object,
+                                GthreeMaterial *material);
 
 static void
 push_debug_group (const char   *format, ...)
@@ -221,6 +361,43 @@ gthree_renderer_new ()
   return renderer;
 }
 
+static guint
+vao_key_hash (gconstpointer data)
+{
+  const VaoKey *key = data;
+
+  return g_direct_hash (key->geometry) ^
+    (g_direct_hash (key->program) * 31) ^
+    (g_direct_hash (key->instances) * 17) ^
+    key->wireframe ^
+    (key->multi_draw << 1);
+}
+
+static gboolean
+vao_key_equal (gconstpointer a,
+               gconstpointer b)
+{
+  const VaoKey *aa = a;
+  const VaoKey *bb = b;
+
+  return
+    aa->geometry == bb->geometry &&
+    aa->program == bb->program &&
+    aa->instances == bb->instances &&
+    aa->wireframe == bb->wireframe &&
+    aa->multi_draw == bb->multi_draw;
+}
+
+static void
+vao_entry_free (gpointer data)
+{
+  VaoEntry *entry = data;
+
+  glDeleteVertexArrays (1, &entry->vao);
+  g_array_unref (entry->default_attributes);
+  g_free (entry);
+}
+
 static void
 gthree_renderer_init (GthreeRenderer *renderer)
 {
@@ -240,6 +417,7 @@ gthree_renderer_init (GthreeRenderer *renderer)
   priv->auto_clear_depth = TRUE;
   priv->auto_clear_stencil = TRUE;
   priv->sort_objects = TRUE;
+  priv->sort_mode = GTHREE_SORT_MODE_PAINTER;
   priv->width = 1;
   priv->height = 1;
   priv->pixel_ratio = 1;
@@ -277,9 +455,11 @@ gthree_renderer_init (GthreeRenderer *renderer)
 
   gthree_set_default_gl_state (renderer);
 
-  /* We only use one vao, so bind it here */
   glGenVertexArrays (1, &priv->vertex_array_object);
   glBindVertexArray (priv->vertex_array_object);
+  priv->bound_vertex_array_object = priv->vertex_array_object;
+  priv->vao_state = &priv->vertex_array_object_state;
+  priv->vao_cache = g_hash_table_new_full (vao_key_hash, vao_key_equal, NULL, vao_entry_free);
 
   // GPU capabilities
   glGetIntegerv (GL_MAX_TEXTURE_IMAGE_UNITS, &priv->max_textures);
@@ -296,6 +476,58 @@ gthree_renderer_init (GthreeRenderer *renderer)
     priv->supports_vertex_textures &&
     epoxy_has_gl_extension("GL_ARB_texture_float");
 
+  priv->supports_uniform_buffers =
+    epoxy_gl_version () >= 31 ||
+    epoxy_has_gl_extension("GL_ARB_uniform_buffer_object");
+
+  if (epoxy_gl_version () >= 41 ||
+      epoxy_has_gl_extension("GL_ARB_get_program_binary"))
+    {
+      GLint n_formats = 0;
+
+      glGetIntegerv (GL_NUM_PROGRAM_BINARY_FORMATS, &n_formats);
+      priv->supports_program_binary = n_formats > 0;
+    }
+
+  priv->driver_id = g_strdup_printf ("%s\n%s\n%s",
+                                     (const char *)glGetString (GL_VENDOR),
+                                     (const char *)glGetString (GL_RENDERER),
+                                     (const char *)glGetString (GL_VERSION));
+
+  priv->pending_programs = g_ptr_array_new_with_free_func (g_object_unref);
+#ifdef GL_KHR_parallel_shader_compile
+  if (epoxy_has_gl_extension ("GL_KHR_parallel_shader_compile"))
+    {
+      glMaxShaderCompilerThreadsKHR (0xffffffff);
+      priv->supports_parallel_compile = TRUE;
+    }
+#endif
+
+  /* Base instances are needed for the per draw transforms */
+  priv->supports_multi_draw =
+    epoxy_gl_version () >= 43 ||
+    (epoxy_has_gl_extension ("GL_ARB_multi_draw_indirect") &&
+     epoxy_has_gl_extension ("GL_ARB_base_instance"));
+
+  if (priv->supports_multi_draw)
+    {
+      priv->arenas = gthree_geometry_arenas_new ();
+      glGenBuffers (1, &priv->multi_draw_transform_buffer);
+      glGenBuffers (1, &priv->multi_draw_sphere_buffer);
+      glGenBuffers (1, &priv->multi_draw_command_buffer);
+      priv->multi_draw_transforms = g_array_new (FALSE, FALSE, sizeof (float));
+      priv->multi_draw_spheres = g_array_new (FALSE, FALSE, sizeof (float));
+      priv->multi_draw_commands = g_array_new (FALSE, FALSE, sizeof (guint32));
+      priv->multi_draw_runs = g_array_new (FALSE, FALSE, sizeof (MultiDrawRun));
+    }
+
+  if (priv->supports_uniform_buffers)
+    {
+      glGenBuffers (1, &priv->camera_ubo);
+      glGenBuffers (1, &priv->lights_ubo);
+      priv->ubo_data = g_byte_array_new ();
+    }
+
   //priv->compressed_texture_formats = _glExtensionCompressedTextureS3TC ? glGetParameter( _gl.COMPRESSED_TEXTURE_FORMATS ) : [];
 
 }
@@ -315,6 +547,7 @@ gthree_renderer_finalize (GObject *obj)
   if (priv->shadowmap_distance_materials)
     g_ptr_array_unref (priv->shadowmap_distance_materials);
 
+  g_ptr_array_unref (priv->pending_programs);
   gthree_program_cache_free (priv->program_cache);
 
   g_array_free (priv->clipping_planes, TRUE);
@@ -334,19 +567,163 @@ gthree_renderer_finalize (GObject *obj)
 
   gthree_render_list_free (priv->current_render_list);
 
+  g_hash_table_unref (priv->vao_cache);
+  glDeleteVertexArrays (1, &priv->vertex_array_object);
+
+  if (priv->culling)
+    gthree_gpu_culling_free (priv->culling);
+
+  if (priv->supports_multi_draw)
+    {
+      gthree_geometry_arenas_free (priv->arenas);
+      glDeleteBuffers (1, &priv->multi_draw_transform_buffer);
+      glDeleteBuffers (1, &priv->multi_draw_sphere_buffer);
+      glDeleteBuffers (1, &priv->multi_draw_command_buffer);
+      g_array_unref (priv->multi_draw_transforms);
+      g_array_unref (priv->multi_draw_spheres);
+      g_array_unref (priv->multi_draw_commands);
+      g_array_unref (priv->multi_draw_runs);
+    }
+
+  if (priv->supports_uniform_buffers)
+    {
+      glDeleteBuffers (1, &priv->camera_ubo);
+      glDeleteBuffers (1, &priv->lights_ubo);
+      g_byte_array_unref (priv->ubo_data);
+    }
+
   g_clear_object (&priv->bg_box_mesh);
   g_clear_object (&priv->bg_plane_mesh);
   g_clear_object (&priv->current_bg_texture);
 
   g_clear_object (&priv->gl_context);
 
+  g_free (priv->driver_id);
+  g_free (priv->program_cache_dir);
+
   G_OBJECT_CLASS (gthree_renderer_parent_class)->finalize (obj);
 }
 
+static void
+gthree_renderer_set_property (GObject *obj,
+                              guint prop_id,
+                              const GValue *value,
+                              GParamSpec *pspec)
+{
+  GthreeRenderer *renderer = GTHREE_RENDERER (obj);
+
+  switch (prop_id)
+    {
+    case PROP_SORT_MODE:
+      gthree_renderer_set_sort_mode (renderer, g_value_get_enum (value));
+      break;
+
+    case PROP_PROGRAM_CACHE_DIR:
+      gthree_renderer_set_program_cache_dir (renderer, g_value_get_string (value));
+      break;
+
+    case PROP_ASYNC_COMPILE:
+      gthree_renderer_set_async_compile (renderer, g_value_get_boolean (value));
+      break;
+
+    case PROP_MULTI_DRAW:
+      gthree_renderer_set_multi_draw (renderer, g_value_get_boolean (value));
+      break;
+
+    case PROP_GPU_CULLING:
+      gthree_renderer_set_gpu_culling (renderer, g_value_get_boolean (value));
+      break;
+
+    case PROP_REUSE_RENDER_LIST:
+      gthree_renderer_set_reuse_render_list (renderer, g_value_get_boolean (value));
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
+    }
+}
+
+static void
+gthree_renderer_get_property (GObject *obj,
+                              guint prop_id,
+                              GValue *value,
+                              GParamSpec *pspec)
+{
+  GthreeRenderer *renderer = GTHREE_RENDERER (obj);
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+
+  switch (prop_id)
+    {
+    case PROP_SORT_MODE:
+      g_value_set_enum (value, priv->sort_mode);
+      break;
+
+    case PROP_PROGRAM_CACHE_DIR:
+      g_value_set_string (value, priv->program_cache_dir);
+      break;
+
+    case PROP_ASYNC_COMPILE:
+      g_value_set_boolean (value, priv->async_compile);
+      break;
+
+    case PROP_MULTI_DRAW:
+      g_value_set_boolean (value, priv->multi_draw);
+      break;
+
+    case PROP_GPU_CULLING:
+      g_value_set_boolean (value, priv->gpu_culling);
+      break;
+
+    case PROP_REUSE_RENDER_LIST:
+      g_value_set_boolean (value, priv->reuse_render_list);
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
+    }
+}
+
 static void
 gthree_renderer_class_init (GthreeRendererClass *klass)
 {
-  G_OBJECT_CLASS (klass)->finalize = gthree_renderer_finalize;
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+
+  gobject_class->set_property = gthree_renderer_set_property;
+  gobject_class->get_property = gthree_renderer_get_property;
+  gobject_class->finalize = gthree_renderer_finalize;
+
+  obj_props[PROP_SORT_MODE] =
+    g_param_spec_enum ("sort-mode", "Sort mode", "How the opaque render list is ordered",
+                       GTHREE_TYPE_SORT_MODE,
+                       GTHREE_SORT_MODE_PAINTER,
+                       G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  obj_props[PROP_PROGRAM_CACHE_DIR] =
+    g_param_spec_string ("program-cache-dir", "Program cache dir", "Where linked program binaries are cached, or NULL",
+                         NULL,
+                         G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  obj_props[PROP_ASYNC_COMPILE] =
+    g_param_spec_boolean ("async-compile", "Async compile", "Skip objects until their programs are linked instead of waiting",
+                          FALSE,
+                          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  obj_props[PROP_MULTI_DRAW] =
+    g_param_spec_boolean ("multi-draw", "Multi draw", "Draw runs of meshes sharing geometry and material with one indirect call",
+                          FALSE,
+                          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  obj_props[PROP_GPU_CULLING] =
+    g_param_spec_boolean ("gpu-culling", "GPU culling", "Cull multi drawn meshes with compute shaders instead of on the CPU",
+                          FALSE,
+                          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  obj_props[PROP_REUSE_RENDER_LIST] =
+    g_param_spec_boolean ("reuse-render-list", "Reuse render list", "Keep the render list between frames while the scene and camera don't change",
+                          FALSE,
+                          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  g_object_class_install_properties (gobject_class, N_PROPS, obj_props);
 
 #define INIT_QUARK(name) q_##name = g_quark_from_static_string (#name)
   INIT_QUARK(position);
@@ -368,6 +745,8 @@ gthree_renderer_class_init (GthreeRendererClass *klass)
   INIT_QUARK(bindMatrix);
   INIT_QUARK(bindMatrixInverse);
   INIT_QUARK(boneMatrices);
+  INIT_QUARK(instanceMatrix);
+  INIT_QUARK(instanceColor);
 
   graphene_vec3_init (&cube_directions[0],  1,  0,  0);
   graphene_vec3_init (&cube_directions[1], -1,  0,  0);
@@ -562,6 +941,276 @@ gthree_renderer_set_gamma_factor (GthreeRenderer *renderer,
   priv->gamma_factor = factor;
 }
 
+void
+gthree_renderer_set_sort_mode (GthreeRenderer *renderer,
+                               GthreeSortMode  mode)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+
+  if (priv->sort_mode == mode)
+    return;
+
+  priv->sort_mode = mode;
+  priv->render_list_valid = FALSE;
+
+  g_object_notify_by_pspec (G_OBJECT (renderer), obj_props[PROP_SORT_MODE]);
+}
+
+GthreeSortMode
+gthree_renderer_get_sort_mode (GthreeRenderer *renderer)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+
+  return priv->sort_mode;
+}
+
+/* Linked programs are stored here, keyed by their final source, the
+ * program parameters and the driver, and reused on later runs. The
+ * cache is off (NULL) until a directory is set, as the application
+ * knows best where its files belong, typically a directory under
+ * g_get_user_cache_dir(). Set to NULL to disable it again. */
+void
+gthree_renderer_set_program_cache_dir (GthreeRenderer *renderer,
+                                       const char     *path)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+
+  if (g_strcmp0 (priv->program_cache_dir, path) == 0)
+    return;
+
+  g_free (priv->program_cache_dir);
+  priv->program_cache_dir = g_strdup (path);
+
+  g_object_notify_by_pspec (G_OBJECT (renderer), obj_props[PROP_PROGRAM_CACHE_DIR]);
+}
+
+const char *
+gthree_renderer_get_program_cache_dir (GthreeRenderer *renderer)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+
+  return priv->program_cache_dir;
+}
+
+guint
+gthree_renderer_get_program_cache_hits (GthreeRenderer *renderer)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+
+  return priv->program_cache_hits;
+}
+
+guint
+gthree_renderer_get_program_cache_misses (GthreeRenderer *renderer)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+
+  return priv->program_cache_misses;
+}
+
+/* In async mode new programs are linked in the background (in parallel
+ * if the driver supports GL_KHR_parallel_shader_compile), and objects
+ * using them are skipped until they are ready. */
+void
+gthree_renderer_set_async_compile (GthreeRenderer *renderer,
+                                   gboolean        async_compile)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+
+  async_compile = !!async_compile;
+  if (priv->async_compile == async_compile)
+    return;
+
+  priv->async_compile = async_compile;
+  g_object_notify_by_pspec (G_OBJECT (renderer), obj_props[PROP_ASYNC_COMPILE]);
+}
+
+gboolean
+gthree_renderer_get_async_compile (GthreeRenderer *renderer)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+
+  return priv->async_compile;
+}
+
+/* Only has an effect with GL 4.3, or GL_ARB_multi_draw_indirect and
+ * GL_ARB_base_instance. Plain meshes (not skinned, instanced or morphed)
+ * that are drawn consecutively with the same material are then
+ * submitted together, even with different geometries: these are copied
+ * into shared buffers, one per attribute layout, and the world matrices
+ * are uploaded to a buffer instead of set as uniforms. Works best with
+ * GTHREE_SORT_MODE_STATE, which keeps such meshes together. */
+void
+gthree_renderer_set_multi_draw (GthreeRenderer *renderer,
+                                gboolean        multi_draw)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+
+  multi_draw = !!multi_draw;
+  if (priv->multi_draw == multi_draw)
+    return;
+
+  priv->multi_draw = multi_draw;
+  priv->render_list_valid = FALSE;
+  g_object_notify_by_pspec (G_OBJECT (renderer), obj_props[PROP_MULTI_DRAW]);
+}
+
+gboolean
+gthree_renderer_get_multi_draw (GthreeRenderer *renderer)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+
+  return priv->multi_draw;
+}
+
+/* Needs GL 4.3 and the multi-draw property. Meshes that are multi drawn
+ * are then not culled on the CPU, instead their draws are culled by a
+ * compute shader, against the frustum and against the depth of the
+ * previous frame rendered to the window with the same camera. Objects
+ * that were hidden in the previous frame may appear a frame late. */
+void
+gthree_renderer_set_gpu_culling (GthreeRenderer *renderer,
+                                 gboolean        gpu_culling)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+
+  gpu_culling = !!gpu_culling;
+  if (priv->gpu_culling == gpu_culling)
+    return;
+
+  priv->gpu_culling = gpu_culling;
+  priv->render_list_valid = FALSE;
+  g_object_notify_by_pspec (G_OBJECT (renderer), obj_props[PROP_GPU_CULLING]);
+}
+
+gboolean
+gthree_renderer_get_gpu_culling (GthreeRenderer *renderer)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+
+  return priv->gpu_culling;
+}
+
+/* Static scenes, where neither the objects nor the camera change, can
+ * keep the render list of the previous frame instead of traversing,
+ * culling and sorting the scene again. A change to the visibility,
+ * transform, layers, children or materials of any object in the scene
+ * rebuilds the whole list. Changes that don't go through the object
+ * API, like editing the instance matrix attribute of a
+ * #GthreeInstancedMesh directly, are not noticed. Neither are edits to
+ * the vertices of a geometry that change its bounds, so the frustum
+ * culling results kept in the list can be stale until something else
+ * changes. */
+void
+gthree_renderer_set_reuse_render_list (GthreeRenderer *renderer,
+                                       gboolean        reuse_render_list)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+
+  reuse_render_list = !!reuse_render_list;
+  if (priv->reuse_render_list == reuse_render_list)
+    return;
+
+  priv->reuse_render_list = reuse_render_list;
+  priv->render_list_valid = FALSE;
+  g_object_notify_by_pspec (G_OBJECT (renderer), obj_props[PROP_REUSE_RENDER_LIST]);
+}
+
+gboolean
+gthree_renderer_get_reuse_render_list (GthreeRenderer *renderer)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+
+  return priv->reuse_render_list;
+}
+
+static GthreeGpuCulling *
+get_gpu_culling (GthreeRenderer *renderer)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+
+  if (!priv->gpu_culling || !priv->multi_draw || !priv->supports_multi_draw)
+    return NULL;
+
+  if (priv->culling == NULL && !priv->gpu_culling_failed)
+    {
+      priv->culling = gthree_gpu_culling_new ();
+      priv->gpu_culling_failed = priv->culling == NULL;
+      /* Projection skipped the CPU culling of what is now drawn normally */
+      if (priv->gpu_culling_failed)
+        priv->render_list_valid = FALSE;
+    }
+
+  return priv->culling;
+}
+
+guint
+gthree_renderer_get_programs_pending (GthreeRenderer *renderer)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+
+  return priv->pending_programs->len;
+}
+
+static void
+add_pending_program (GthreeRenderer *renderer,
+                     GthreeProgram  *program)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+  int i;
+
+  for (i = 0; i < priv->pending_programs->len; i++)
+    {
+      if (g_ptr_array_index (priv->pending_programs, i) == program)
+        return;
+    }
+
+  g_ptr_array_add (priv->pending_programs, g_object_ref (program));
+}
+
+static void
+poll_pending_programs (GthreeRenderer *renderer)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+  int i;
+
+  for (i = priv->pending_programs->len - 1; i >= 0; i--)
+    {
+      GthreeProgram *program = g_ptr_array_index (priv->pending_programs, i);
+
+      if (gthree_program_poll (program, priv->supports_parallel_compile))
+        g_ptr_array_remove_index_fast (priv->pending_programs, i);
+    }
+}
+
+const char *
+gthree_renderer_get_driver_id (GthreeRenderer *renderer)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+
+  return priv->driver_id;
+}
+
+gboolean
+gthree_renderer_get_supports_program_binary (GthreeRenderer *renderer)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+
+  return priv->supports_program_binary;
+}
+
+void
+gthree_renderer_count_program_binary (GthreeRenderer *renderer,
+                                      gboolean        hit)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+
+  if (hit)
+    priv->program_cache_hits++;
+  else
+    priv->program_cache_misses++;
+}
+
 float
 gthree_renderer_get_gamma_factor (GthreeRenderer *renderer)
 {
@@ -1068,21 +1717,92 @@ set_blending (GthreeRenderer *renderer,
     }
 }
 
-static void
-project_object (GthreeRenderer *renderer,
-                GthreeScene    *scene,
-                GthreeObject   *object,
-                GthreeCamera   *camera)
+/* Meshes that can be multi drawn with all their materials are culled
+ * by the GPU, even if they end up alone in their run, as all the draws
+ * of a frame are culled by one dispatch */
+static gboolean
+is_gpu_culled (GthreeRenderer *renderer,
+               GthreeObject   *object)
 {
   GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
-  GthreeObject *child;
-  GthreeObjectIter iter;
-  float z = 0;
+  int i, n_materials;
 
-  if (!gthree_object_get_visible (object))
-    return;
+  if (!priv->gpu_culling || priv->gpu_culling_failed || G_OBJECT_TYPE (object) != GTHREE_TYPE_MESH)
+    return FALSE;
 
-  if (gthree_object_check_layer (object, gthree_object_get_layer_mask (GTHREE_OBJECT (camera))))
+  n_materials = gthree_mesh_get_n_materials (GTHREE_MESH (object));
+  for (i = 0; i < n_materials; i++)
+    {
+      GthreeMaterial *material = gthree_mesh_get_material (GTHREE_MESH (object), i);
+
+      if (material == NULL || !can_multi_draw (renderer, object, material))
+        return FALSE;
+    }
+
+  return n_materials > 0;
+}
+
+static void
+project_renderable (GthreeRenderer *renderer,
+                    GthreeObject   *object)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+  float z = 0;
+
+  if (GTHREE_IS_SKINNED_MESH (object))
+    {
+      GthreeSkeleton *skeleton = gthree_skinned_mesh_get_skeleton (GTHREE_SKINNED_MESH (object));
+      if (skeleton)
+        gthree_skeleton_update (skeleton);
+    }
+
+  if (!gthree_object_get_is_frustum_culled (object) ||
+      is_gpu_culled (renderer, object) ||
+      gthree_object_is_in_frustum (object, &priv->frustum))
+    {
+      gthree_object_update (object);
+
+      if (priv->sort_objects)
+        {
+          graphene_vec4_t vector;
+
+          /* Get position */
+          graphene_matrix_get_row (gthree_object_get_world_matrix (object), 3, &vector);
+
+          /* project object position to screen */
+          graphene_matrix_transform_vec4 (&priv->proj_screen_matrix, &vector, &vector);
+
+          z = graphene_vec4_get_z (&vector) / graphene_vec4_get_w (&vector);
+        }
+
+      priv->current_render_list->current_z = z;
+
+      gthree_object_fill_render_list (object, priv->current_render_list);
+    }
+}
+
+static float
+get_viewport_pixel_height (GthreeRenderer *renderer)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+
+  return graphene_rect_get_height (&priv->current_viewport) * priv->pixel_ratio;
+}
+
+static void
+project_object (GthreeRenderer *renderer,
+                GthreeScene    *scene,
+                GthreeObject   *object,
+                GthreeCamera   *camera)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+  GthreeObject *child;
+  GthreeObjectIter iter;
+
+  if (!gthree_object_get_visible (object))
+    return;
+
+  if (gthree_object_check_layer (object, gthree_object_get_layer_mask (GTHREE_OBJECT (camera))))
     {
       if (GTHREE_IS_GROUP (object))
         {
@@ -1090,6 +1810,11 @@ project_object (GthreeRenderer *renderer,
           groupOrder = object.renderOrder;
 #endif
         }
+      else if (GTHREE_IS_LOD (object))
+        {
+          if (gthree_lod_get_auto_update (GTHREE_LOD (object)))
+            gthree_lod_update (GTHREE_LOD (object), camera, get_viewport_pixel_height (renderer));
+        }
       else if (GTHREE_IS_LIGHT (object))
         {
           priv->lights = g_list_append (priv->lights, object);
@@ -1097,53 +1822,178 @@ project_object (GthreeRenderer *renderer,
             priv->shadows = g_list_append (priv->shadows, object);
         }
       else if (GTHREE_IS_MESH (object) || GTHREE_IS_LINE_SEGMENTS (object) || GTHREE_IS_SPRITE (object) || GTHREE_IS_POINTS (object))
-        {
-          if (GTHREE_IS_SKINNED_MESH (object))
-            {
-              GthreeSkeleton *skeleton = gthree_skinned_mesh_get_skeleton (GTHREE_SKINNED_MESH (object));
-              if (skeleton)
-                gthree_skeleton_update (skeleton);
-            }
+        project_renderable (renderer, object);
+    }
 
-          if (!gthree_object_get_is_frustum_culled (object) || gthree_object_is_in_frustum (object, &priv->frustum))
-            {
-              gthree_object_update (object);
+  gthree_object_iter_init (&iter, object);
+  while (gthree_object_iter_next (&iter, &child))
+    project_object (renderer, scene, child, camera);
+}
 
-              if (priv->sort_objects)
-                {
-                  graphene_vec4_t vector;
+typedef struct {
+  GthreeRenderer *renderer;
+  guint32 layer_mask;
+} ProjectIndexedData;
+
+static void
+project_indexed_object (gpointer data,
+                        gpointer user_data)
+{
+  ProjectIndexedData *pdata = user_data;
+  GthreeObject *object = data;
 
-                  /* Get position */
-                  graphene_matrix_get_row (gthree_object_get_world_matrix (object), 3, &vector);
+  if (gthree_object_check_layer (object, pdata->layer_mask))
+    project_renderable (pdata->renderer, object);
+}
 
-                  /* project object position to screen */
-                  graphene_matrix_transform_vec4 (&priv->proj_screen_matrix, &vector, &vector);
+/* Same result as project_object(), but gets the renderables from the
+ * scene spatial index, so whole culled subtrees are skipped */
+static void
+project_scene_indexed (GthreeRenderer *renderer,
+                       GthreeScene    *scene,
+                       GthreeCamera   *camera)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+  ProjectIndexedData data = { renderer, gthree_object_get_layer_mask (GTHREE_OBJECT (camera)) };
+  GPtrArray *lights;
+  guint i;
 
-                  z = graphene_vec4_get_z (&vector) / graphene_vec4_get_w (&vector);
-                }
+  gthree_scene_update_spatial_index (scene, camera, get_viewport_pixel_height (renderer));
 
-              priv->current_render_list->current_z = z;
+  lights = gthree_scene_get_index_lights (scene);
+  for (i = 0; i < lights->len; i++)
+    {
+      GthreeObject *light = g_ptr_array_index (lights, i);
 
-              gthree_object_fill_render_list (object, priv->current_render_list);
-            }
+      if (!gthree_object_check_layer (light, data.layer_mask))
+        continue;
+
+      priv->lights = g_list_append (priv->lights, light);
+      if (gthree_object_get_cast_shadow (light))
+        priv->shadows = g_list_append (priv->shadows, light);
+    }
+
+  gthree_scene_query_frustum (scene, &priv->frustum, project_indexed_object, &data);
+}
+
+static gboolean
+can_reuse_render_list (GthreeRenderer *renderer,
+                       GthreeScene    *scene,
+                       GthreeCamera   *camera)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+  GthreeRenderList *list = priv->current_render_list;
+  guint i;
+
+  if (!priv->reuse_render_list || !priv->render_list_valid ||
+      priv->render_list_scene != scene ||
+      priv->render_list_camera != camera ||
+      priv->render_list_scene_stamp != gthree_object_get_subtree_stamp (GTHREE_OBJECT (scene)) ||
+      priv->render_list_layer_mask != gthree_object_get_layer_mask (GTHREE_OBJECT (camera)) ||
+      priv->render_list_indexed != gthree_scene_get_spatial_index (scene) ||
+      priv->render_list_viewport_height != get_viewport_pixel_height (renderer) ||
+      !graphene_matrix_equal_fast (&priv->render_list_proj_screen_matrix, &priv->proj_screen_matrix))
+    return FALSE;
+
+  /* Geometries and materials are shared, so they can't mark the
+   * objects using them. Check what the list depends on directly. */
+  for (i = 0; i < priv->render_list_n_items; i++)
+    {
+      GthreeRenderListItem *item = &g_array_index (list->items, GthreeRenderListItem, i);
+      guint groups_stamp = gthree_geometry_get_groups_stamp (item->geometry);
+
+      /* Stamps are allocated in order, so this changed after the list was built */
+      if (groups_stamp != 0 && (gint) (groups_stamp - priv->render_list_stamp) > 0)
+        return FALSE;
+    }
+
+  for (i = 0; i < list->opaque->len; i++)
+    {
+      int index = g_array_index (list->opaque, int, i);
+      if (gthree_material_get_is_transparent (g_array_index (list->items, GthreeRenderListItem, index).material))
+        return FALSE;
+    }
+
+  for (i = 0; i < list->transparent->len; i++)
+    {
+      int index = g_array_index (list->transparent, int, i);
+      if (!gthree_material_get_is_transparent (g_array_index (list->items, GthreeRenderListItem, index).material))
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+/* Does the per frame part of project_renderable() for the kept list */
+static void
+reuse_render_list (GthreeRenderer *renderer)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+  GthreeRenderList *list = priv->current_render_list;
+  GthreeObject *last_object = NULL;
+  guint i;
+
+  /* The background is added again after projecting */
+  g_array_set_size (list->items, priv->render_list_n_items);
+  g_array_set_size (list->background, 0);
+
+  for (i = 0; i < list->items->len; i++)
+    {
+      GthreeObject *object = g_array_index (list->items, GthreeRenderListItem, i).object;
+
+      /* The items of an object are consecutive */
+      if (object == last_object)
+        continue;
+      last_object = object;
+
+      if (GTHREE_IS_SKINNED_MESH (object))
+        {
+          GthreeSkeleton *skeleton = gthree_skinned_mesh_get_skeleton (GTHREE_SKINNED_MESH (object));
+          if (skeleton)
+            gthree_skeleton_update (skeleton);
         }
+
+      gthree_object_update (object);
     }
+}
 
-  gthree_object_iter_init (&iter, object);
-  while (gthree_object_iter_next (&iter, &child))
-    project_object (renderer, scene, child, camera);
+static void
+save_render_list_state (GthreeRenderer *renderer,
+                        GthreeScene    *scene,
+                        GthreeCamera   *camera)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+
+  /* After projecting, so lods switching levels don't count as a change */
+  priv->render_list_valid = TRUE;
+  priv->render_list_scene = scene;
+  priv->render_list_camera = camera;
+  priv->render_list_scene_stamp = gthree_object_get_subtree_stamp (GTHREE_OBJECT (scene));
+  priv->render_list_stamp = gthree_allocate_matrix_stamp ();
+  gthree_object_set_changes_seen (priv->render_list_stamp);
+  priv->render_list_layer_mask = gthree_object_get_layer_mask (GTHREE_OBJECT (camera));
+  priv->render_list_indexed = gthree_scene_get_spatial_index (scene);
+  priv->render_list_viewport_height = get_viewport_pixel_height (renderer);
+  priv->render_list_proj_screen_matrix = priv->proj_screen_matrix;
+  priv->render_list_n_items = priv->current_render_list->items->len;
 }
 
 static void
 material_apply_light_setup (GthreeUniforms *m_uniforms,
                             GthreeLightSetup *light_setup,
-                            gboolean update_only)
+                            gboolean update_only,
+                            gboolean uniform_buffers)
 {
-  gthree_uniforms_set_vec3 (m_uniforms, "ambientLightColor", &light_setup->ambient);
+  /* With uniform buffers the light values come from the shared lights
+     block, so there is nothing to sync once the uniforms exist */
+  if (!update_only || !uniform_buffers)
+    {
+      gthree_uniforms_set_vec3 (m_uniforms, "ambientLightColor", &light_setup->ambient);
 
-  gthree_uniforms_set_uarray (m_uniforms, "directionalLights", light_setup->directional, update_only);
-  gthree_uniforms_set_uarray (m_uniforms, "pointLights", light_setup->point, update_only);
-  gthree_uniforms_set_uarray (m_uniforms, "spotLights", light_setup->spot, update_only);
+      gthree_uniforms_set_uarray (m_uniforms, "directionalLights", light_setup->directional, update_only);
+      gthree_uniforms_set_uarray (m_uniforms, "pointLights", light_setup->point, update_only);
+      gthree_uniforms_set_uarray (m_uniforms, "spotLights", light_setup->spot, update_only);
+    }
 
   gthree_uniforms_set_texture_array (m_uniforms, "directionalShadowMap", light_setup->directional_shadow_map);
   gthree_uniforms_set_matrix4_array (m_uniforms, "directionalShadowMatrix", light_setup->directional_shadow_map_matrix);
@@ -1155,11 +2005,29 @@ material_apply_light_setup (GthreeUniforms *m_uniforms,
   gthree_uniforms_set_matrix4_array (m_uniforms, "pointShadowMatrix", light_setup->point_shadow_map_matrix);
 }
 
+/* Multi draws pass the world matrices as instance matrices */
+static GthreeProgramVariant
+get_program_variant (GthreeRenderer *renderer,
+                     GthreeObject   *object)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+
+  if (GTHREE_IS_INSTANCED_MESH (object) &&
+      gthree_instanced_mesh_get_instance_color (GTHREE_INSTANCED_MESH (object)) != NULL)
+    return GTHREE_PROGRAM_VARIANT_INSTANCING_COLOR;
+
+  if (GTHREE_IS_INSTANCED_MESH (object) || priv->multi_draw_active)
+    return GTHREE_PROGRAM_VARIANT_INSTANCING;
+
+  return GTHREE_PROGRAM_VARIANT_PLAIN;
+}
+
 static GthreeProgram *
 init_material (GthreeRenderer *renderer,
                GthreeMaterial *material,
                gpointer fog,
-               GthreeObject *object)
+               GthreeObject *object,
+               GthreeProgramVariant variant)
 {
   GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
   GthreeProgram *program;
@@ -1180,6 +2048,7 @@ init_material (GthreeRenderer *renderer,
   // TODO: Get encoding from currentRenderTarget if set
   parameters.output_encoding = GTHREE_ENCODING_FORMAT_GAMMA;
   parameters.physically_correct_lights = priv->physically_correct_lights;
+  parameters.uniform_buffers = priv->supports_uniform_buffers;
 
   gthree_material_set_params (material, &parameters);
   parameters.num_dir_lights = priv->light_setup.directional->len;
@@ -1198,6 +2067,9 @@ init_material (GthreeRenderer *renderer,
   parameters.max_bones = max_bones;
   parameters.skinning = GTHREE_IS_MESH_MATERIAL (material) && gthree_mesh_material_get_skinning (GTHREE_MESH_MATERIAL (material));
 
+  parameters.instancing = variant != GTHREE_PROGRAM_VARIANT_PLAIN;
+  parameters.instancing_color = variant == GTHREE_PROGRAM_VARIANT_INSTANCING_COLOR;
+
   parameters.morph_targets = GTHREE_IS_MESH_MATERIAL (material) && gthree_mesh_material_get_morph_targets (GTHREE_MESH_MATERIAL (material));
   parameters.morph_normals = GTHREE_IS_MESH_MATERIAL (material) && gthree_mesh_material_get_morph_normals (GTHREE_MESH_MATERIAL (material));
 
@@ -1226,8 +2098,8 @@ init_material (GthreeRenderer *renderer,
 #endif
 
   program = gthree_program_cache_get (priv->program_cache, shader, &parameters, renderer);
-  g_clear_object (&material_properties->program);
-  material_properties->program = program;
+  g_clear_object (&material_properties->programs[variant]);
+  material_properties->programs[variant] = program;
 
   // TODO: thee.js uses the lightstate current_hash and other stuff to avoid some stuff here?
   // I think it caches the material uniforms we calculate here and avoid reloading if switching to a new program?
@@ -1287,9 +2159,11 @@ init_material (GthreeRenderer *renderer,
     }
 
   if (priv->lights)
-    material_apply_light_setup (m_uniforms, &priv->light_setup, FALSE);
+    material_apply_light_setup (m_uniforms, &priv->light_setup, FALSE, priv->supports_uniform_buffers);
 
-  gthree_shader_update_uniform_locations_for_program (shader, program);
+  /* The uniform locations are looked up in set_program() once it is ready */
+  if (!gthree_program_is_ready (program))
+    add_pending_program (renderer, program);
 
   return NULL;
 }
@@ -1622,7 +2496,7 @@ shadow_map_render_object (GthreeRenderer *renderer,
           GthreeMaterial *material = NULL;
           gboolean uses_groups = FALSE;
 
-          gthree_object_update_matrix_view (object, gthree_camera_get_world_inverse_matrix (shadow_camera));
+          gthree_object_update_matrix_view_for_camera (object, shadow_camera);
           gthree_object_update (object);
 
           // TODO: Abstract this out into vfuncs
@@ -1660,7 +2534,7 @@ shadow_map_render_object (GthreeRenderer *renderer,
             {
               GthreeMaterial *depthMaterial = getDepthMaterial (renderer, object, geometry, material, is_point_light, _lightPositionWorld,
                                                                 gthree_camera_get_near (shadow_camera), gthree_camera_get_far (shadow_camera));
-              GthreeRenderListItem item = { object, geometry, depthMaterial, NULL, 0.0 };
+              GthreeRenderListItem item = { object, geometry, depthMaterial, NULL, 0.0, 0 };
               render_item (renderer, shadow_camera, FALSE, depthMaterial, &item);
             }
         }
@@ -1928,6 +2802,102 @@ mark_uniforms_lights_needs_update (GthreeUniforms *uniforms, gboolean needs_upda
 
 }
 
+static void
+upload_camera_uniform_buffer (GthreeRenderer *renderer,
+                              GthreeCamera *camera)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+  const graphene_matrix_t *camera_matrix_world = gthree_object_get_world_matrix (GTHREE_OBJECT (camera));
+  graphene_vec4_t pos;
+  /* std140: mat4 projectionMatrix, mat4 viewMatrix, vec3 cameraPosition */
+  float data[16 + 16 + 4];
+
+  graphene_matrix_to_float (gthree_camera_get_projection_matrix (camera), &data[0]);
+  graphene_matrix_to_float (gthree_camera_get_world_inverse_matrix (camera), &data[16]);
+  graphene_matrix_get_row (camera_matrix_world, 3, &pos);
+  graphene_vec4_to_float (&pos, &data[32]);
+
+  glBindBuffer (GL_UNIFORM_BUFFER, priv->camera_ubo);
+  glBufferData (GL_UNIFORM_BUFFER, sizeof (data), data, GL_DYNAMIC_DRAW);
+  glBindBufferBase (GL_UNIFORM_BUFFER, GTHREE_UBO_BINDING_CAMERA, priv->camera_ubo);
+}
+
+static const char *const directional_light_members[] = {
+  "direction", "color", "shadow", "shadowBias", "shadowRadius", "shadowMapSize", NULL
+};
+
+static const char *const point_light_members[] = {
+  "position", "color", "distance", "decay",
+  "shadow", "shadowBias", "shadowRadius", "shadowMapSize", "shadowCameraNear", "shadowCameraFar", NULL
+};
+
+static const char *const spot_light_members[] = {
+  "position", "direction", "color", "distance", "decay", "coneCos", "penumbraCos",
+  "shadow", "shadowBias", "shadowRadius", "shadowMapSize", NULL
+};
+
+/* Must match the GthreeLightsBlock layout in lights_pars_begin.glsl */
+static void
+upload_lights_uniform_buffer (GthreeRenderer *renderer)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+  GthreeLightSetup *setup = &priv->light_setup;
+  float ambient[4];
+  int i;
+
+  g_byte_array_set_size (priv->ubo_data, 0);
+
+  graphene_vec3_to_float (&setup->ambient, ambient);
+  ambient[3] = 0;
+  g_byte_array_append (priv->ubo_data, (guint8 *)ambient, sizeof (ambient));
+
+  for (i = 0; i < setup->directional->len; i++)
+    gthree_uniforms_append_std140 (g_ptr_array_index (setup->directional, i), directional_light_members, priv->ubo_data);
+  for (i = 0; i < setup->point->len; i++)
+    gthree_uniforms_append_std140 (g_ptr_array_index (setup->point, i), point_light_members, priv->ubo_data);
+  for (i = 0; i < setup->spot->len; i++)
+    gthree_uniforms_append_std140 (g_ptr_array_index (setup->spot, i), spot_light_members, priv->ubo_data);
+
+  glBindBuffer (GL_UNIFORM_BUFFER, priv->lights_ubo);
+  glBufferData (GL_UNIFORM_BUFFER, priv->ubo_data->len, priv->ubo_data->data, GL_DYNAMIC_DRAW);
+  glBindBufferBase (GL_UNIFORM_BUFFER, GTHREE_UBO_BINDING_LIGHTS, priv->lights_ubo);
+}
+
+static void
+prepare_material (GthreeRenderer *renderer,
+                  gpointer fog,
+                  GthreeMaterial *material,
+                  GthreeObject *object)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+  GthreeMaterialProperties *material_properties = gthree_material_get_properties (material);
+  GthreeProgramVariant variant = get_program_variant (renderer, object);
+
+  /* Maybe the light state (e.g. nr of lights, or if this is a shaded
+     object) changed since we last initialized the material, even if
+     the material itself didn't change */
+  priv->light_setup.hash.obj_receive_shadow = gthree_object_get_receive_shadow (object) && priv->shadowmap_enabled;
+  if (!gthree_material_get_needs_update (material) &&
+      !gthree_light_setup_hash_equal (&material_properties->light_hash, &priv->light_setup.hash))
+    gthree_material_set_needs_update (material, TRUE);
+
+  /* All variants are made for the old state */
+  if (gthree_material_get_needs_update (material))
+    {
+      int i;
+
+      for (i = 0; i < GTHREE_N_PROGRAM_VARIANTS; i++)
+        g_clear_object (&material_properties->programs[i]);
+      material_properties->locations_program = NULL;
+      gthree_material_set_needs_update (material, FALSE);
+    }
+
+  if (material_properties->programs[variant] == NULL)
+    init_material (renderer, material, fog, object, variant);
+
+  material_properties->program = material_properties->programs[variant];
+}
+
 static GthreeProgram *
 set_program (GthreeRenderer *renderer,
              GthreeCamera *camera,
@@ -1955,26 +2925,24 @@ set_program (GthreeRenderer *renderer,
 
   priv->used_texture_units = 0;
 
-  /* Maybe the light state (e.g. nr of lights, or if this is a shaded
-     object) changed since we last initialized the material, even if
-     the material itself didn't change */
-  priv->light_setup.hash.obj_receive_shadow = gthree_object_get_receive_shadow (object) && priv->shadowmap_enabled;
-  if (!gthree_material_get_needs_update (material))
-    {
-      if (!gthree_light_setup_hash_equal (&material_properties->light_hash, &priv->light_setup.hash))
-        gthree_material_set_needs_update (material, TRUE);
-    }
-
-  if (gthree_material_get_needs_update (material))
-    {
-      init_material (renderer, material, fog, object);
-      gthree_material_set_needs_update (material, FALSE);
-    }
+  prepare_material (renderer, fog, material, object);
 
   program = material_properties->program;
   shader = gthree_material_get_shader (material);
   m_uniforms = gthree_shader_get_uniforms (shader);
 
+  /* Still linking, skip the object for now */
+  if (!gthree_program_is_ready (program))
+    return NULL;
+
+  /* Switching between the variants of a material only needs the
+   * locations looked up again */
+  if (material_properties->locations_program != program)
+    {
+      gthree_shader_update_uniform_locations_for_program (shader, program);
+      material_properties->locations_program = program;
+    }
+
   if (program != priv->current_program )
     {
       gthree_program_use (program);
@@ -1991,7 +2959,17 @@ set_program (GthreeRenderer *renderer,
       refreshMaterial = TRUE;
     }
 
-  if (refreshProgram || camera != priv->current_camera)
+  if (priv->supports_uniform_buffers)
+    {
+      if (camera != priv->current_camera)
+        {
+          upload_camera_uniform_buffer (renderer, camera);
+          priv->current_camera = camera;
+          refreshMaterial = TRUE;
+          refreshLights = TRUE;
+        }
+    }
+  else if (refreshProgram || camera != priv->current_camera)
     {
       const graphene_matrix_t *projection_matrix = gthree_camera_get_projection_matrix (camera);
       float projection_matrixv[16];
@@ -2131,7 +3109,7 @@ set_program (GthreeRenderer *renderer,
                * the actual values from the light uniforms into the material uniforms
                * (these are note the same because the location differs for each instance)
                */
-              material_apply_light_setup (m_uniforms, &priv->light_setup, TRUE);
+              material_apply_light_setup (m_uniforms, &priv->light_setup, TRUE, priv->supports_uniform_buffers);
             }
         }
 
@@ -2195,31 +3173,49 @@ init_attributes (GthreeRenderer *renderer)
 }
 
 static void
-enable_attribute (GthreeRenderer *renderer,
-                  guint attribute)
+enable_attribute_and_divisor (GthreeRenderer *renderer,
+                              guint attribute,
+                              guint divisor)
 {
   GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
 
+  VertexArrayState *state = priv->vao_state;
+
   priv->new_attributes[attribute] = 1;
-  if (priv->enabled_attributes[attribute] == 0)
+  if (state->enabled_attributes[attribute] == 0)
     {
       glEnableVertexAttribArray(attribute);
-      priv->enabled_attributes[attribute] = 1;
+      state->enabled_attributes[attribute] = 1;
+    }
+
+  if (state->attribute_divisors[attribute] != divisor)
+    {
+      glVertexAttribDivisor (attribute, divisor);
+      state->attribute_divisors[attribute] = divisor;
     }
 }
 
+static void
+enable_attribute (GthreeRenderer *renderer,
+                  guint attribute)
+{
+  enable_attribute_and_divisor (renderer, attribute, 0);
+}
+
 static void
 disable_unused_attributes (GthreeRenderer *renderer)
 {
   GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
   int i;
 
+  VertexArrayState *state = priv->vao_state;
+
   for (i = 0; i < G_N_ELEMENTS(priv->new_attributes); i++)
     {
-      if (priv->enabled_attributes[i] != priv->new_attributes[i])
+      if (state->enabled_attributes[i] != priv->new_attributes[i])
         {
           glDisableVertexAttribArray(i);
-          priv->enabled_attributes[i] = 0;
+          state->enabled_attributes[i] = 0;
         }
     }
 }
@@ -2228,11 +3224,15 @@ static void
 setup_vertex_attributes (GthreeRenderer *renderer,
                          GthreeMaterial *material,
                          GthreeProgram *program,
-                         GthreeGeometry *geometry)
+                         GthreeGeometry *geometry,
+                         GthreeObject *object,
+                         GArray *default_attributes)
 {
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
   GHashTable *program_attributes;
   GHashTableIter iter;
   gpointer key, value;
+  int bound_buffer = -1;
 
   init_attributes (renderer);
 
@@ -2247,79 +3247,238 @@ setup_vertex_attributes (GthreeRenderer *renderer,
 
       if (program_attribute >= 0)
         {
-          GthreeAttribute *geometry_attribute = gthree_geometry_get_attribute (geometry, name);
+          GthreeAttribute *geometry_attribute = NULL;
+
+          if (priv->multi_draw_active && nameq == q_instanceMatrix)
+            {
+              int i;
+
+              glBindBuffer (GL_ARRAY_BUFFER, priv->multi_draw_transform_buffer);
+              bound_buffer = priv->multi_draw_transform_buffer;
+              for (i = 0; i < 4; i++)
+                {
+                  enable_attribute_and_divisor (renderer, program_attribute + i, 1);
+                  glVertexAttribPointer (program_attribute + i, 4, GL_FLOAT, FALSE,
+                                         16 * sizeof (float), GINT_TO_POINTER (i * 4 * sizeof (float)));
+                }
+              continue;
+            }
+
+          if (GTHREE_IS_INSTANCED_MESH (object))
+            {
+              if (nameq == q_instanceMatrix)
+                geometry_attribute = gthree_instanced_mesh_get_instance_matrix (GTHREE_INSTANCED_MESH (object));
+              else if (nameq == q_instanceColor)
+                geometry_attribute = gthree_instanced_mesh_get_instance_color (GTHREE_INSTANCED_MESH (object));
+            }
+
+          if (geometry_attribute == NULL)
+            geometry_attribute = gthree_geometry_get_attribute (geometry, name);
+
           if (geometry_attribute != NULL)
             {
               gboolean normalized = gthree_attribute_get_normalized (geometry_attribute);
               int size = gthree_attribute_get_item_size (geometry_attribute);
               int offset = gthree_attribute_get_item_offset (geometry_attribute);
               int stride = gthree_attribute_get_stride (geometry_attribute);
+              int divisor = gthree_attribute_get_divisor (geometry_attribute);
 
               int buffer = gthree_attribute_get_gl_buffer (geometry_attribute);
               int type = gthree_attribute_get_gl_type (geometry_attribute);
               int bytes_per_element = gthree_attribute_get_gl_bytes_per_element (geometry_attribute);
+              int i, n_slots;
 
-              /*
-                if ( geometryAttribute.isInstancedBufferAttribute )
+              /* Interleaved attributes share a buffer */
+              if (buffer != bound_buffer)
                 {
-                state.enableAttributeAndDivisor( programAttribute, geometryAttribute.meshPerAttribute );
-                if ( geometry.maxInstancedCount === undefined )
-                {
-                geometry.maxInstancedCount = geometryAttribute.meshPerAttribute * geometryAttribute.count;
+                  glBindBuffer (GL_ARRAY_BUFFER, buffer);
+                  bound_buffer = buffer;
                 }
+
+              /* Matrix attributes take one location per column */
+              n_slots = (size + 3) / 4;
+              for (i = 0; i < n_slots; i++)
+                {
+                  enable_attribute_and_divisor (renderer, program_attribute + i, divisor);
+                  glVertexAttribPointer (program_attribute + i, MIN (size - i * 4, 4), type, normalized,
+                                         stride * bytes_per_element,
+                                         GINT_TO_POINTER ((offset + i * 4) * bytes_per_element));
                 }
-                else
-              */
-              {
-                enable_attribute (renderer, program_attribute);
-              }
-              glBindBuffer (GL_ARRAY_BUFFER, buffer);
-              glVertexAttribPointer (program_attribute, size, type, normalized, stride * bytes_per_element, GINT_TO_POINTER (offset * bytes_per_element));
             }
           else
             {
               gthree_material_load_default_attribute (material, program_attribute, nameq);
+              if (default_attributes)
+                {
+                  VaoDefaultAttribute def = { program_attribute, nameq };
+                  g_array_append_val (default_attributes, def);
+                }
             }
         }
     }
 
-
-
   disable_unused_attributes (renderer);
 }
 
-//	var influencesList = {};
-//	var morphInfluences = new Float32Array( 8 );
-
-typedef struct {
-  int index;
-  float value;
-} InfluenceInfo;
-
-static int
-influence_info_cmp (InfluenceInfo *a, InfluenceInfo *b)
+static void
+bind_vertex_array_object (GthreeRenderer *renderer,
+                          guint           vao)
 {
-  float aa = fabs (a->value);
-  float bb = fabs (b->value);
-
-  if (aa == bb)
-    return 0;
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
 
-  if (bb > aa)
-    return -1;
+  if (priv->bound_vertex_array_object != vao)
+    {
+      glBindVertexArray (vao);
+      priv->bound_vertex_array_object = vao;
+    }
+}
 
-  return 1;
+static gboolean
+vao_entry_is_valid (VaoEntry *entry,
+                    GthreeObject *instances)
+{
+  return
+    entry->geometry_id == gthree_geometry_get_id (entry->key.geometry) &&
+    entry->program_id == gthree_program_get_id (entry->key.program) &&
+    entry->layout_version == gthree_geometry_get_layout_version (entry->key.geometry) &&
+    entry->buffer_generation == gthree_attribute_get_buffer_generation () &&
+    entry->instance_color == (instances ? gthree_instanced_mesh_get_instance_color (GTHREE_INSTANCED_MESH (instances)) : NULL);
 }
 
+/* Binds a vertex array object with the attributes of geometry (and any
+ * per instance attributes of object) set up for program, reusing a
+ * cached one if possible */
 static void
-update_morphtargets (GthreeRenderer *renderer,
-                     GthreeMesh *mesh,
-                     GthreeGeometry *geometry,
-                     GthreeMeshMaterial *material,
-                     GthreeProgram *program)
+setup_vertex_array (GthreeRenderer *renderer,
+                    GthreeMaterial *material,
+                    GthreeProgram *program,
+                    GthreeGeometry *geometry,
+                    GthreeObject *object,
+                    GthreeAttribute *index,
+                    gboolean wireframe,
+                    gboolean cacheable)
 {
   GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
-  GArray *object_influences = gthree_mesh_get_morph_targets (mesh);
+  VertexArrayState state = { { 0 } };
+  VaoKey key;
+  VaoEntry *entry;
+  guint i;
+
+  if (!cacheable)
+    {
+      bind_vertex_array_object (renderer, priv->vertex_array_object);
+      setup_vertex_attributes (renderer, material, program, geometry, object, NULL);
+      if (index != NULL)
+        glBindBuffer (GL_ELEMENT_ARRAY_BUFFER, gthree_attribute_get_gl_buffer (index));
+      return;
+    }
+
+  key.geometry = geometry;
+  key.program = program;
+  key.instances = GTHREE_IS_INSTANCED_MESH (object) ? object : NULL;
+  key.wireframe = wireframe;
+  key.multi_draw = priv->multi_draw_active;
+
+  entry = g_hash_table_lookup (priv->vao_cache, &key);
+  if (entry != NULL && !vao_entry_is_valid (entry, key.instances))
+    {
+      if (priv->bound_vertex_array_object == entry->vao)
+        bind_vertex_array_object (renderer, priv->vertex_array_object);
+      g_hash_table_remove (priv->vao_cache, &key);
+      entry = NULL;
+    }
+
+  if (entry != NULL)
+    {
+      bind_vertex_array_object (renderer, entry->vao);
+
+      /* Current vertex attribute values are context state, not vao state */
+      for (i = 0; i < entry->default_attributes->len; i++)
+        {
+          VaoDefaultAttribute *def = &g_array_index (entry->default_attributes, VaoDefaultAttribute, i);
+          gthree_material_load_default_attribute (material, def->location, def->name);
+        }
+    }
+  else
+    {
+      entry = g_new0 (VaoEntry, 1);
+      entry->key = key;
+      entry->geometry_id = gthree_geometry_get_id (geometry);
+      entry->program_id = gthree_program_get_id (program);
+      entry->layout_version = gthree_geometry_get_layout_version (geometry);
+      entry->buffer_generation = gthree_attribute_get_buffer_generation ();
+      if (key.instances)
+        entry->instance_color = gthree_instanced_mesh_get_instance_color (GTHREE_INSTANCED_MESH (object));
+      entry->default_attributes = g_array_new (FALSE, FALSE, sizeof (VaoDefaultAttribute));
+
+      glGenVertexArrays (1, &entry->vao);
+      bind_vertex_array_object (renderer, entry->vao);
+
+      /* A new vao has everything disabled */
+      priv->vao_state = &state;
+      setup_vertex_attributes (renderer, material, program, geometry, object, entry->default_attributes);
+      priv->vao_state = &priv->vertex_array_object_state;
+
+      if (index != NULL)
+        glBindBuffer (GL_ELEMENT_ARRAY_BUFFER, gthree_attribute_get_gl_buffer (index));
+
+      g_hash_table_insert (priv->vao_cache, &entry->key, entry);
+    }
+
+  entry->last_used_frame = priv->frame_counter;
+}
+
+static void
+expire_vertex_array_objects (GthreeRenderer *renderer)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+  GHashTableIter iter;
+  VaoEntry *entry;
+
+  g_hash_table_iter_init (&iter, priv->vao_cache);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&entry))
+    {
+      if (priv->frame_counter - entry->last_used_frame > VAO_CACHE_MAX_AGE)
+        {
+          if (priv->bound_vertex_array_object == entry->vao)
+            bind_vertex_array_object (renderer, priv->vertex_array_object);
+          g_hash_table_iter_remove (&iter);
+        }
+    }
+}
+
+//	var influencesList = {};
+//	var morphInfluences = new Float32Array( 8 );
+
+typedef struct {
+  int index;
+  float value;
+} InfluenceInfo;
+
+static int
+influence_info_cmp (InfluenceInfo *a, InfluenceInfo *b)
+{
+  float aa = fabs (a->value);
+  float bb = fabs (b->value);
+
+  if (aa == bb)
+    return 0;
+
+  if (bb > aa)
+    return -1;
+
+  return 1;
+}
+
+static void
+update_morphtargets (GthreeRenderer *renderer,
+                     GthreeMesh *mesh,
+                     GthreeGeometry *geometry,
+                     GthreeMeshMaterial *material,
+                     GthreeProgram *program)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+  GArray *object_influences = gthree_mesh_get_morph_targets (mesh);
   int length = object_influences->len;
   GArray *influences;
   int i;
@@ -2415,6 +3574,54 @@ update_morphtargets (GthreeRenderer *renderer,
     g_warning ("No morphTargetInfluences uniform");
 }
 
+/* Returns the number of elements of index (or of the vertices, if
+ * there is no index) to draw for group, and the first one in start */
+static int
+get_draw_range (GthreeGeometry      *geometry,
+                GthreeGeometryGroup *group,
+                GthreeAttribute     *index,
+                int                  range_factor,
+                gboolean             wireframe,
+                int                 *start)
+{
+  GthreeAttribute *position = gthree_geometry_get_position (geometry);
+  int data_count;
+  int range_start, range_count, group_start, group_count, draw_start, draw_end;
+
+  data_count = -1;
+
+  if (index != NULL)
+    data_count = gthree_attribute_get_count (index);
+  else if (position != NULL)
+    data_count = gthree_attribute_get_count (position);
+
+  range_start = gthree_geometry_get_draw_range_start (geometry) * range_factor;
+  range_count = gthree_geometry_get_draw_range_count (geometry) * range_factor;
+
+  group_start = group != NULL ? group->start * range_factor : 0;
+  group_count = group != NULL ? group->count * range_factor : -1;
+
+  /* Handle unlimited ranges (-1 * maybe range_factor) */
+  if (group_count < 0)
+    group_count = data_count;
+  if (range_count < 0)
+    range_count = data_count;
+
+  draw_start = MAX (range_start, group_start);
+  draw_end = MIN (data_count, MIN (range_start + range_count, group_start + group_count)) - 1;
+
+  /* Merged wireframe edges don't map to triangle ranges, but are only
+   * built for geometries that are drawn in full anyway */
+  if (wireframe && gthree_geometry_get_wireframe_index_merged (geometry))
+    {
+      *start = 0;
+      return MAX (0, data_count);
+    }
+
+  *start = draw_start;
+  return MAX (0, draw_end - draw_start + 1);
+}
+
 static void
 render_item (GthreeRenderer *renderer,
              GthreeCamera *camera,
@@ -2427,11 +3634,13 @@ render_item (GthreeRenderer *renderer,
   GthreeGeometryGroup *group = item->group;
   GthreeObject *object = item->object;
   GthreeProgram *program;
-  GthreeAttribute *position, *index;
+  GthreeAttribute *index;
+  GthreeInstancedMesh *instances = NULL;
+  int instance_count = 1;
   gboolean update_buffers = FALSE;
+  gboolean cacheable = TRUE;
   gboolean wireframe = FALSE;
-  int data_count;
-  int range_factor, range_start, range_count, group_start, group_count, draw_start, draw_end, draw_count;
+  int range_factor, draw_start, draw_count;
   int draw_mode = GL_TRIANGLES;
 
   if (!gthree_material_get_is_visible (material))
@@ -2442,27 +3651,40 @@ render_item (GthreeRenderer *renderer,
     wireframe = TRUE;
 
   program = set_program (renderer, camera, fog, material, object);
+  if (program == NULL)
+    return;
+
+  if (GTHREE_IS_INSTANCED_MESH (object))
+    {
+      instances = GTHREE_INSTANCED_MESH (object);
+      instance_count = gthree_instanced_mesh_get_count (instances);
+      if (instance_count == 0)
+        return;
+    }
 
   if (geometry != priv->current_geometry_program_geometry ||
       program != priv->current_geometry_program_program ||
-      wireframe != priv->current_geometry_program_wireframe)
+      wireframe != priv->current_geometry_program_wireframe ||
+      (GthreeObject *)instances != priv->current_geometry_program_instances)
     {
       priv->current_geometry_program_geometry = geometry;
       priv->current_geometry_program_program = program;
       priv->current_geometry_program_wireframe = wireframe;
+      priv->current_geometry_program_instances = (GthreeObject *)instances;
       update_buffers = true;
     }
 
+  /* Morph targets swap the geometry attributes for every draw */
   if (GTHREE_IS_MESH (object) &&
       gthree_mesh_has_morph_targets (GTHREE_MESH (object)) &&
       GTHREE_IS_MESH_MATERIAL (material))
     {
       update_morphtargets (renderer, GTHREE_MESH (object), geometry, GTHREE_MESH_MATERIAL (material), program);
       update_buffers = TRUE;
+      cacheable = FALSE;
     }
 
   index = gthree_geometry_get_index (geometry);
-  position = gthree_geometry_get_position (geometry);
   range_factor = 1;
 
   if (wireframe)
@@ -2473,35 +3695,9 @@ render_item (GthreeRenderer *renderer,
     }
 
   if (update_buffers)
-    {
-      setup_vertex_attributes (renderer, material, program, geometry);
-      if (index != NULL)
-        glBindBuffer (GL_ELEMENT_ARRAY_BUFFER, gthree_attribute_get_gl_buffer (index));
-    }
-
-  data_count = -1;
-
-  if (index != NULL)
-    data_count = gthree_attribute_get_count (index);
-  else if (position != NULL)
-    data_count = gthree_attribute_get_count (position);
-
-  range_start = gthree_geometry_get_draw_range_start (geometry) * range_factor;
-  range_count = gthree_geometry_get_draw_range_count (geometry) * range_factor;
-
-  group_start = group != NULL ? group->start * range_factor : 0;
-  group_count = group != NULL ? group->count * range_factor : -1;
-
-  /* Handle unlimited ranges (-1 * maybe range_factor) */
-  if (group_count < 0)
-    group_count = data_count;
-  if (range_count < 0)
-    range_count = data_count;
-
-  draw_start = MAX (range_start, group_start);
-  draw_end = MIN (data_count, MIN (range_start + range_count, group_start + group_count)) - 1;
-  draw_count = MAX( 0, draw_end - draw_start + 1);
+    setup_vertex_array (renderer, material, program, geometry, object, index, wireframe, cacheable);
 
+  draw_count = get_draw_range (geometry, group, index, range_factor, wireframe, &draw_start);
   if ( draw_count == 0 )
     return;
 
@@ -2554,14 +3750,337 @@ render_item (GthreeRenderer *renderer,
       int index_bytes_per_element = gthree_attribute_get_gl_bytes_per_element (index);
       int index_offset = gthree_attribute_get_item_offset (index);
 
-      glDrawElements (draw_mode, draw_count, index_type, GINT_TO_POINTER ((index_offset + draw_start) * index_bytes_per_element));
+      if (instances)
+        glDrawElementsInstanced (draw_mode, draw_count, index_type, GINT_TO_POINTER ((index_offset + draw_start) * index_bytes_per_element), instance_count);
+      else
+        glDrawElements (draw_mode, draw_count, index_type, GINT_TO_POINTER ((index_offset + draw_start) * index_bytes_per_element));
     }
   else
     {
-      glDrawArrays (draw_mode, draw_start, draw_count);
+      if (instances)
+        glDrawArraysInstanced (draw_mode, draw_start, draw_count, instance_count);
+      else
+        glDrawArrays (draw_mode, draw_start, draw_count);
+    }
+}
+
+static gboolean
+can_multi_draw (GthreeRenderer *renderer,
+                GthreeObject   *object,
+                GthreeMaterial *material)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+  GthreeGeometry *geometry;
+
+  if (!priv->multi_draw || !priv->supports_multi_draw)
+    return FALSE;
+
+  /* The instance matrix is taken by the world matrix, so no instanced
+   * (or skinned, or sprite, etc) objects */
+  if (G_OBJECT_TYPE (object) != GTHREE_TYPE_MESH ||
+      gthree_mesh_get_draw_mode (GTHREE_MESH (object)) != GTHREE_DRAW_MODE_TRIANGLES ||
+      gthree_mesh_has_morph_targets (GTHREE_MESH (object)))
+    return FALSE;
+
+  /* Custom shaders may not apply the instance matrix */
+  if (GTHREE_IS_SHADER_MATERIAL (material))
+    return FALSE;
+
+  /* The transforms are uploaded before anything is drawn, so they
+   * can't be changed by the callback */
+  if (gthree_object_has_before_render_callback (object))
+    return FALSE;
+
+  if (GTHREE_IS_MESH_MATERIAL (material) &&
+      (gthree_mesh_material_get_is_wireframe (GTHREE_MESH_MATERIAL (material)) ||
+       gthree_mesh_material_get_skinning (GTHREE_MESH_MATERIAL (material))))
+    return FALSE;
+
+  /* The geometry has to fit in an arena */
+  geometry = gthree_mesh_get_geometry (GTHREE_MESH (object));
+  return geometry != NULL && gthree_geometry_arenas_can_hold (priv->arenas, geometry);
+}
+
+/* Per object state that ends up in the program has to match for all
+ * the draws, and they have to come from the same arena */
+static gboolean
+can_multi_draw_together (GthreeRenderListItem  *first,
+                         const GthreeArenaSlot *first_slot,
+                         GthreeRenderListItem  *item,
+                         const GthreeArenaSlot *slot)
+{
+  return
+    slot->geometry == first_slot->geometry &&
+    gthree_object_get_receive_shadow (item->object) == gthree_object_get_receive_shadow (first->object);
+}
+
+static void
+set_multi_draw_uniforms (GthreeProgram *program,
+                         GthreeCamera  *camera)
+{
+  const graphene_matrix_t *camera_matrix = gthree_object_get_world_matrix (GTHREE_OBJECT (camera));
+  int mvm_location = gthree_program_lookup_uniform_location (program, q_modelViewMatrix);
+  int nm_location = gthree_program_lookup_uniform_location (program, q_normalMatrix);
+  int mm_location = gthree_program_lookup_uniform_location (program, q_modelMatrix);
+  float matrix[16];
+
+  /* The world matrix is in the instance matrix, so the model matrix is identity */
+  graphene_matrix_to_float (gthree_camera_get_world_inverse_matrix (camera), matrix);
+  glUniformMatrix4fv (mvm_location, 1, FALSE, matrix);
+
+  /* Inverse transpose of the view matrix is the transposed camera matrix */
+  if (nm_location >= 0)
+    {
+      float normal[9];
+      int i, j;
+
+      graphene_matrix_to_float (camera_matrix, matrix);
+      for (i = 0; i < 3; i++)
+        for (j = 0; j < 3; j++)
+          normal[i * 3 + j] = matrix[j * 4 + i];
+      glUniformMatrix3fv (nm_location, 1, FALSE, normal);
+    }
+
+  if (mm_location >= 0)
+    {
+      graphene_matrix_t identity;
+
+      graphene_matrix_init_identity (&identity);
+      graphene_matrix_to_float (&identity, matrix);
+      glUniformMatrix4fv (mm_location, 1, FALSE, matrix);
+    }
+}
+
+/* Adds the indirect command, transform and bounds of drawing item
+ * from its place in the arena */
+static void
+add_multi_draw (GthreeRenderer        *renderer,
+                GthreeRenderListItem  *item,
+                const GthreeArenaSlot *slot)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+  const graphene_sphere_t *bounds;
+  graphene_point3d_t center;
+  guint32 command[5];
+  float matrix[16];
+  float sphere[4];
+  int draw_start, draw_count;
+
+  draw_count = get_draw_range (item->geometry, item->group, gthree_geometry_get_index (item->geometry),
+                               1, FALSE, &draw_start);
+  if (draw_count == 0)
+    return;
+
+  /* The arena index is relative to the first vertex of each geometry,
+   * and the base instance picks the transform */
+  command[0] = draw_count;
+  command[1] = 1;
+  command[2] = slot->first_index + draw_start;
+  command[3] = slot->base_vertex;
+  command[4] = priv->multi_draw_commands->len / 5;
+  g_array_append_vals (priv->multi_draw_commands, command, 5);
+
+  gthree_object_get_world_matrix_floats (item->object, matrix);
+  g_array_append_vals (priv->multi_draw_transforms, matrix, 16);
+
+  bounds = gthree_geometry_get_bounding_sphere (item->geometry);
+  graphene_sphere_get_center (bounds, &center);
+  sphere[0] = center.x;
+  sphere[1] = center.y;
+  sphere[2] = center.z;
+  sphere[3] = graphene_sphere_get_radius (bounds);
+  g_array_append_vals (priv->multi_draw_spheres, sphere, 4);
+}
+
+static void
+truncate_multi_draws (GthreeRenderer *renderer,
+                      guint           n_draws)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+
+  g_array_set_size (priv->multi_draw_commands, n_draws * 5);
+  g_array_set_size (priv->multi_draw_transforms, n_draws * 16);
+  g_array_set_size (priv->multi_draw_spheres, n_draws * 4);
+}
+
+/* Finds the runs of the render lists that are multi drawn, and uploads
+ * the draws of all of them at once. With GPU culling all the draws are
+ * then culled by a single dispatch, using the depth pyramid of the
+ * previous frame. */
+static void
+prepare_multi_draws (GthreeRenderer *renderer,
+                     GthreeCamera   *camera,
+                     GthreeMaterial *override_material)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+  GthreeRenderList *render_list = priv->current_render_list;
+  GArray *lists[3] = { render_list->background, render_list->opaque, render_list->transparent };
+  GthreeGpuCulling *culling;
+  guint n_draws;
+  int l, i;
+
+  if (!priv->supports_multi_draw)
+    return;
+
+  g_array_set_size (priv->multi_draw_runs, 0);
+  priv->multi_draw_next_run = 0;
+  truncate_multi_draws (renderer, 0);
+
+  if (!priv->multi_draw)
+    return;
+
+  culling = get_gpu_culling (renderer);
+
+  /* In the order render_objects() draws them */
+  for (l = 0; l < G_N_ELEMENTS (lists); l++)
+    {
+      GArray *render_list_indexes = lists[l];
+
+      for (i = 0; i < render_list_indexes->len; i++)
+        {
+          GthreeRenderListItem *item =
+            &g_array_index (render_list->items, GthreeRenderListItem,
+                            g_array_index (render_list_indexes, int, i));
+          GthreeMaterial *material = override_material ? override_material : item->material;
+          guint first_command = priv->multi_draw_commands->len / 5;
+          GthreeArenaSlot slot;
+          MultiDrawRun run;
+          int last;
+
+          if (material == NULL ||
+              !can_multi_draw (renderer, item->object, material) ||
+              !gthree_geometry_arenas_lookup (priv->arenas, item->geometry, priv->frame_counter, &slot))
+            continue;
+
+          add_multi_draw (renderer, item, &slot);
+
+          for (last = i + 1; last < render_list_indexes->len; last++)
+            {
+              GthreeRenderListItem *next =
+                &g_array_index (render_list->items, GthreeRenderListItem,
+                                g_array_index (render_list_indexes, int, last));
+              GthreeArenaSlot next_slot;
+
+              if ((override_material == NULL && next->material != material) ||
+                  !can_multi_draw (renderer, next->object, material) ||
+                  !gthree_geometry_arenas_lookup (priv->arenas, next->geometry, priv->frame_counter, &next_slot) ||
+                  !can_multi_draw_together (item, &slot, next, &next_slot))
+                break;
+
+              add_multi_draw (renderer, next, &next_slot);
+            }
+
+          /* A lone mesh is cheaper to draw normally, and keeps using the
+           * plain program. GPU culled ones were skipped by the CPU culling
+           * though, so they must go through the culling. */
+          if (last == i + 1 && culling == NULL)
+            {
+              truncate_multi_draws (renderer, first_command);
+              continue;
+            }
+
+          if (!gthree_material_get_is_visible (material))
+            truncate_multi_draws (renderer, first_command);
+
+          run.list = render_list_indexes;
+          run.first = i;
+          run.last = last;
+          run.first_command = first_command;
+          run.n_draws = priv->multi_draw_commands->len / 5 - first_command;
+          run.arena = slot.geometry;
+          g_array_append_val (priv->multi_draw_runs, run);
+
+          i = last - 1;
+        }
+    }
+
+  n_draws = priv->multi_draw_commands->len / 5;
+  if (n_draws == 0)
+    return;
+
+  gthree_geometry_arenas_upload (priv->arenas);
+
+  /* The buffers are kept, and only reallocated when they grow */
+  if (n_draws > priv->multi_draw_capacity)
+    {
+      priv->multi_draw_capacity = MAX (n_draws * 2, 64);
+
+      glBindBuffer (GL_ARRAY_BUFFER, priv->multi_draw_transform_buffer);
+      glBufferData (GL_ARRAY_BUFFER, priv->multi_draw_capacity * 16 * sizeof (float), NULL, GL_DYNAMIC_DRAW);
+      glBindBuffer (GL_ARRAY_BUFFER, priv->multi_draw_sphere_buffer);
+      glBufferData (GL_ARRAY_BUFFER, priv->multi_draw_capacity * 4 * sizeof (float), NULL, GL_DYNAMIC_DRAW);
+      glBindBuffer (GL_ARRAY_BUFFER, priv->multi_draw_command_buffer);
+      glBufferData (GL_ARRAY_BUFFER, priv->multi_draw_capacity * 5 * sizeof (guint32), NULL, GL_DYNAMIC_DRAW);
+    }
+
+  glBindBuffer (GL_ARRAY_BUFFER, priv->multi_draw_transform_buffer);
+  glBufferSubData (GL_ARRAY_BUFFER, 0, priv->multi_draw_transforms->len * sizeof (float),
+                   priv->multi_draw_transforms->data);
+  glBindBuffer (GL_ARRAY_BUFFER, priv->multi_draw_command_buffer);
+  glBufferSubData (GL_ARRAY_BUFFER, 0, priv->multi_draw_commands->len * sizeof (guint32),
+                   priv->multi_draw_commands->data);
+
+  if (culling)
+    {
+      glBindBuffer (GL_ARRAY_BUFFER, priv->multi_draw_sphere_buffer);
+      glBufferSubData (GL_ARRAY_BUFFER, 0, priv->multi_draw_spheres->len * sizeof (float),
+                       priv->multi_draw_spheres->data);
+
+      gthree_gpu_culling_cull (culling,
+                               priv->current_render_target == NULL ? camera : NULL,
+                               &priv->frustum,
+                               priv->multi_draw_sphere_buffer,
+                               priv->multi_draw_transform_buffer,
+                               priv->multi_draw_command_buffer,
+                               n_draws, 5);
+
+      /* The culling changed the program and texture bindings */
+      priv->current_program = NULL;
     }
 }
 
+/* Draws the items of run with a single indirect draw call, of its
+ * range of the commands prepared for the frame */
+static void
+render_multi_draw (GthreeRenderer     *renderer,
+                   GthreeCamera       *camera,
+                   gpointer            fog,
+                   GthreeMaterial     *material,
+                   const MultiDrawRun *run)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+  GthreeRenderListItem *first_item;
+  GthreeProgram *program;
+
+  if (run->n_draws == 0)
+    return;
+
+  first_item = &g_array_index (priv->current_render_list->items, GthreeRenderListItem,
+                               g_array_index (run->list, int, run->first));
+
+  priv->multi_draw_active = TRUE;
+  program = set_program (renderer, camera, fog, material, first_item->object);
+  priv->multi_draw_active = FALSE;
+  if (program == NULL)
+    return;
+
+  set_multi_draw_uniforms (program, camera);
+
+  priv->multi_draw_active = TRUE;
+  setup_vertex_array (renderer, material, program, run->arena, first_item->object,
+                      gthree_geometry_get_index (run->arena), FALSE, TRUE);
+  priv->multi_draw_active = FALSE;
+
+  /* Make the next render_item() set up its own vertex array */
+  priv->current_geometry_program_geometry = NULL;
+
+  glBindBuffer (GL_DRAW_INDIRECT_BUFFER, priv->multi_draw_command_buffer);
+  glMultiDrawElementsIndirect (GL_TRIANGLES, GL_UNSIGNED_INT,
+                               GSIZE_TO_POINTER (run->first_command * 5 * sizeof (guint32)),
+                               run->n_draws, 0);
+  glBindBuffer (GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
 static void
 render_objects (GthreeRenderer *renderer,
                 GthreeScene    *scene,
@@ -2582,7 +4101,7 @@ render_objects (GthreeRenderer *renderer,
 
       gthree_object_call_before_render_callback (item->object, scene, camera);
 
-      gthree_object_update_matrix_view (item->object, gthree_camera_get_world_inverse_matrix (camera));
+      gthree_object_update_matrix_view_for_camera (item->object, camera);
 
       if (override_material)
         material = override_material;
@@ -2612,10 +4131,44 @@ render_objects (GthreeRenderer *renderer,
       }
       set_material_faces (renderer, material);
 
+      if (priv->multi_draw_next_run < priv->multi_draw_runs->len)
+        {
+          MultiDrawRun *run = &g_array_index (priv->multi_draw_runs, MultiDrawRun,
+                                              priv->multi_draw_next_run);
+
+          /* The meshes of a run have no before render callbacks */
+          if (run->list == render_list_indexes && run->first == i)
+            {
+              render_multi_draw (renderer, camera, fog, material, run);
+              priv->multi_draw_next_run++;
+              i = run->last - 1;
+              continue;
+            }
+        }
+
       render_item (renderer, camera, fog, material, item);
     }
 }
 
+/* Keep the opaque depth of window frames for occlusion culling the next one */
+static void
+update_depth_pyramid (GthreeRenderer *renderer,
+                      GthreeCamera   *camera)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+  GthreeGpuCulling *culling = get_gpu_culling (renderer);
+  graphene_rect_t viewport;
+
+  if (culling == NULL || priv->current_render_target != NULL)
+    return;
+
+  graphene_rect_scale (&priv->current_viewport, priv->pixel_ratio, priv->pixel_ratio, &viewport);
+  gthree_gpu_culling_update_depth_pyramid (culling, camera, &priv->proj_screen_matrix, &viewport);
+
+  /* The pyramid build changed the program and texture bindings */
+  priv->current_program = NULL;
+}
+
 static void
 clear (gboolean color, gboolean depth, gboolean stencil)
 {
@@ -2775,6 +4328,25 @@ gthree_renderer_render_background (GthreeRenderer *renderer,
     }
 }
 
+static gint frame_epoch = 0;
+
+/* Bumped at the start of each render, so that per-frame work like
+ * uploading shared geometries is only done once. Never zero once
+ * something has been rendered. */
+guint
+gthree_get_frame_epoch (void)
+{
+  return (guint) g_atomic_int_get (&frame_epoch);
+}
+
+static void
+gthree_advance_frame_epoch (void)
+{
+  /* Skip 0 on wraparound */
+  if (g_atomic_int_add (&frame_epoch, 1) == -1)
+    g_atomic_int_add (&frame_epoch, 1);
+}
+
 void
 gthree_renderer_render (GthreeRenderer *renderer,
                         GthreeScene    *scene,
@@ -2788,11 +4360,16 @@ gthree_renderer_render (GthreeRenderer *renderer,
 
   g_assert (gdk_gl_context_get_current () == priv->gl_context);
 
-  g_list_free (priv->lights);
-  priv->lights = NULL;
+  gthree_advance_frame_epoch ();
 
-  g_list_free (priv->shadows);
-  priv->shadows = NULL;
+  /* Someone else may have bound a vao since the last frame */
+  priv->bound_vertex_array_object = 0;
+  if (++priv->frame_counter % 64 == 0)
+    expire_vertex_array_objects (renderer);
+
+  /* Only between frames, as compacting moves the arena ranges */
+  if (priv->arenas)
+    gthree_geometry_arenas_begin_frame (priv->arenas, priv->frame_counter);
 
   fog = NULL;
 
@@ -2801,10 +4378,14 @@ gthree_renderer_render (GthreeRenderer *renderer,
   priv->current_geometry_program_geometry = NULL;
   priv->current_geometry_program_program = NULL;
   priv->current_geometry_program_wireframe = FALSE;
+  priv->current_geometry_program_instances = NULL;
 
   /* update scene graph */
 
-  gthree_object_update_matrix_world (GTHREE_OBJECT (scene), FALSE);
+  if (gthree_scene_get_parallel_matrix_update (scene))
+    gthree_object_update_matrix_world_parallel (GTHREE_OBJECT (scene), FALSE);
+  else
+    gthree_object_update_matrix_world (GTHREE_OBJECT (scene), FALSE);
 
   /* update camera matrices and frustum */
 
@@ -2821,12 +4402,31 @@ gthree_renderer_render (GthreeRenderer *renderer,
   /* Flush lazily deleted resources to avoid leaking until widget unrealize */
   gthree_resources_flush_deletes (priv->gl_context);
 
-  gthree_render_list_init (priv->current_render_list);
+  poll_pending_programs (renderer);
 
-  project_object (renderer, scene, GTHREE_OBJECT (scene), camera);
+  if (can_reuse_render_list (renderer, scene, camera))
+    reuse_render_list (renderer);
+  else
+    {
+      g_list_free (priv->lights);
+      priv->lights = NULL;
+
+      g_list_free (priv->shadows);
+      priv->shadows = NULL;
+
+      gthree_render_list_init (priv->current_render_list);
+
+      if (gthree_scene_get_spatial_index (scene))
+        project_scene_indexed (renderer, scene, camera);
+      else
+        project_object (renderer, scene, GTHREE_OBJECT (scene), camera);
+
+      if (priv->sort_objects)
+        gthree_render_list_sort (priv->current_render_list, priv->sort_mode);
 
-  if (priv->sort_objects)
-    gthree_render_list_sort (priv->current_render_list);
+      if (priv->reuse_render_list)
+        save_render_list_state (renderer, scene, camera);
+    }
 
   if (priv->clipping_enabled )
     clipping_begin_shadows (renderer);
@@ -2835,6 +4435,9 @@ gthree_renderer_render (GthreeRenderer *renderer,
 
   setup_lights (renderer, camera);
 
+  if (priv->supports_uniform_buffers)
+    upload_lights_uniform_buffer (renderer);
+
   if (priv->clipping_enabled)
     clipping_end_shadows (renderer);
 
@@ -2845,6 +4448,8 @@ gthree_renderer_render (GthreeRenderer *renderer,
   /* set matrices for regular objects (frustum culled) */
 
   override_material = gthree_scene_get_override_material (scene);
+  prepare_multi_draws (renderer, camera, override_material);
+
   if (override_material)
     {
       gboolean polygon_offset;
@@ -2861,6 +4466,7 @@ gthree_renderer_render (GthreeRenderer *renderer,
 
       render_objects (renderer, scene, priv->current_render_list->background, camera, fog, TRUE, override_material );
       render_objects (renderer, scene, priv->current_render_list->opaque, camera, fog, TRUE, override_material );
+      update_depth_pyramid (renderer, camera);
       render_objects (renderer, scene, priv->current_render_list->transparent, camera, fog, TRUE, override_material );
     }
   else
@@ -2872,6 +4478,8 @@ gthree_renderer_render (GthreeRenderer *renderer,
       // opaque pass (front-to-back order)
       render_objects (renderer, scene, priv->current_render_list->opaque, camera, fog, FALSE, NULL);
 
+      update_depth_pyramid (renderer, camera);
+
       // transparent pass (back-to-front order)
       render_objects (renderer, scene, priv->current_render_list->transparent, camera, fog, TRUE, NULL);
     }
@@ -2887,6 +4495,95 @@ gthree_renderer_render (GthreeRenderer *renderer,
   pop_debug_group ();
 }
 
+/* Like project_object, but ignores the frustum since we want programs
+ * for everything that may become visible */
+static void
+compile_project_object (GthreeRenderer   *renderer,
+                        GthreeObject     *object,
+                        GthreeCamera     *camera,
+                        GthreeRenderList *list)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+  GthreeObject *child;
+  GthreeObjectIter iter;
+
+  if (!gthree_object_get_visible (object))
+    return;
+
+  if (gthree_object_check_layer (object, gthree_object_get_layer_mask (GTHREE_OBJECT (camera))))
+    {
+      if (GTHREE_IS_LIGHT (object))
+        {
+          priv->lights = g_list_append (priv->lights, object);
+          if (gthree_object_get_cast_shadow (object))
+            priv->shadows = g_list_append (priv->shadows, object);
+        }
+      else if (GTHREE_IS_MESH (object) || GTHREE_IS_LINE_SEGMENTS (object) || GTHREE_IS_SPRITE (object) || GTHREE_IS_POINTS (object))
+        {
+          gthree_object_fill_render_list (object, list);
+        }
+    }
+
+  gthree_object_iter_init (&iter, object);
+  while (gthree_object_iter_next (&iter, &child))
+    compile_project_object (renderer, child, camera, list);
+}
+
+/* Creates the programs needed to render @scene from @camera, without
+ * drawing anything. This is meant to be called behind a loading screen
+ * so the first real frame doesn't stall on shader compilation. In async
+ * compile mode this returns immediately and
+ * gthree_renderer_get_programs_pending() can be used to report progress. */
+void
+gthree_renderer_compile (GthreeRenderer *renderer,
+                         GthreeScene    *scene,
+                         GthreeCamera   *camera)
+{
+  GthreeRendererPrivate *priv = gthree_renderer_get_instance_private (renderer);
+  GthreeRenderList *list;
+  GthreeMaterial *override_material;
+  int i;
+
+  g_assert (gdk_gl_context_get_current () == priv->gl_context);
+
+  /* This replaces the lights of the kept render list */
+  priv->render_list_valid = FALSE;
+
+  g_list_free (priv->lights);
+  priv->lights = NULL;
+
+  g_list_free (priv->shadows);
+  priv->shadows = NULL;
+
+  gthree_object_update_matrix_world (GTHREE_OBJECT (scene), FALSE);
+  if (gthree_object_get_parent (GTHREE_OBJECT (camera)) == NULL)
+    gthree_object_update_matrix_world (GTHREE_OBJECT (camera), FALSE);
+  gthree_camera_update_matrix (camera);
+
+  list = gthree_render_list_new ();
+  gthree_render_list_init (list);
+
+  compile_project_object (renderer, GTHREE_OBJECT (scene), camera, list);
+
+  /* The light counts and shadow hash are part of the program parameters */
+  setup_lights (renderer, camera);
+
+  override_material = gthree_scene_get_override_material (scene);
+
+  for (i = 0; i < list->items->len; i++)
+    {
+      GthreeRenderListItem *item = &g_array_index (list->items, GthreeRenderListItem, i);
+      GthreeMaterial *material = override_material ? override_material : item->material;
+
+      if (material == NULL)
+        continue;
+
+      prepare_material (renderer, NULL, material, item->object);
+    }
+
+  gthree_render_list_free (list);
+}
+
 guint
 gthree_renderer_allocate_texture_unit (GthreeRenderer *renderer)
 {
@@ -2902,6 +4599,14 @@ gthree_renderer_allocate_texture_unit (GthreeRenderer *renderer)
 }
 
 
+guint
+gthree_allocate_id (void)
+{
+  static gint next_id = 1;
+
+  return (guint) g_atomic_int_add (&next_id, 1);
+}
+
 GthreeRenderList *
 gthree_render_list_new ()
 {
@@ -2990,10 +4695,83 @@ render_list_reverse_painter_sort_stable (gconstpointer _a, gconstpointer _b, gpo
   return 0;
 }
 
+/* Opaque items can be drawn in any order, so group them by the state
+ * that is expensive to switch: program, then material, then geometry,
+ * and only then front-to-back. Each field gets 16 bits of the key, ids
+ * wrapping around only costs us some grouping, not correctness. */
+static guint64
+render_list_item_state_key (GthreeRenderListItem *item)
+{
+  GthreeMaterialProperties *material_properties = gthree_material_get_properties (item->material);
+  guint64 program_id = 0, material_id, geometry_id, depth;
+  float z;
+
+  /* Not known until the first time the material is drawn */
+  if (material_properties->program)
+    program_id = gthree_program_get_id (material_properties->program);
+
+  material_id = gthree_material_get_id (item->material);
+  geometry_id = gthree_geometry_get_id (item->geometry);
+
+  /* z is in normalized device coordinates */
+  z = CLAMP ((item->z + 1.0f) * 0.5f, 0.0f, 1.0f);
+  depth = (guint64) (z * 0xffff);
+
+  return
+    ((program_id & 0xffff) << 48) |
+    ((material_id & 0xffff) << 32) |
+    ((geometry_id & 0xffff) << 16) |
+    depth;
+}
+
+static gint
+render_list_state_sort_stable (gconstpointer _a, gconstpointer _b, gpointer user_data)
+{
+  GthreeRenderList *list = user_data;
+  int ai = *(int *)_a;
+  int bi = *(int *)_b;
+  GthreeRenderListItem *a = &g_array_index (list->items, GthreeRenderListItem, ai);
+  GthreeRenderListItem *b = &g_array_index (list->items, GthreeRenderListItem, bi);
+
+  if (a->sort_key != b->sort_key)
+    {
+      if (a->sort_key > b->sort_key)
+        return 1;
+      else
+        return -1;
+    }
+  else if (a->object != b->object)
+    {
+      if ((gsize)a->object > (gsize)b->object)
+        return 1;
+      else
+        return -1;
+    }
+
+  return 0;
+}
+
 void
-gthree_render_list_sort (GthreeRenderList *list)
+gthree_render_list_sort (GthreeRenderList *list,
+                         GthreeSortMode    mode)
 {
-  g_array_sort_with_data (list->opaque, render_list_painter_sort_stable, list);
+  int i;
+
+  if (mode == GTHREE_SORT_MODE_STATE)
+    {
+      for (i = 0; i < list->opaque->len; i++)
+        {
+          int index = g_array_index (list->opaque, int, i);
+          GthreeRenderListItem *item = &g_array_index (list->items, GthreeRenderListItem, index);
+
+          item->sort_key = render_list_item_state_key (item);
+        }
+
+      g_array_sort_with_data (list->opaque, render_list_state_sort_stable, list);
+    }
+  else
+    g_array_sort_with_data (list->opaque, render_list_painter_sort_stable, list);
+
   g_array_sort_with_data (list->transparent, render_list_reverse_painter_sort_stable, list);
 }
 
@@ -3004,7 +4782,7 @@ gthree_render_list_push (GthreeRenderList *list,
                          GthreeMaterial *material,
                          GthreeGeometryGroup *group)
 {
-  GthreeRenderListItem item = { object, geometry, material, group, list->current_z };
+  GthreeRenderListItem item = { object, geometry, material, group, list->current_z, 0 };
   int index = list->items->len;
 
   g_array_append_val (list->items, item);
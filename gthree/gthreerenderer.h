@@ -82,6 +82,46 @@ void                gthree_renderer_set_gamma_factor          (GthreeRenderer
 GTHREE_API
 float               gthree_renderer_get_gamma_factor          (GthreeRenderer     *renderer);
 GTHREE_API
+void                gthree_renderer_set_sort_mode             (GthreeRenderer     *renderer,
+                                                               GthreeSortMode      mode);
+GTHREE_API
+GthreeSortMode      gthree_renderer_get_sort_mode             (GthreeRenderer     *renderer);
+GTHREE_API
+void                gthree_renderer_set_program_cache_dir     (GthreeRenderer     *renderer,
+                                                               const char         *path);
+GTHREE_API
+const char *        gthree_renderer_get_program_cache_dir     (GthreeRenderer     *renderer);
+GTHREE_API
+guint               gthree_renderer_get_program_cache_hits    (GthreeRenderer     *renderer);
+GTHREE_API
+guint               gthree_renderer_get_program_cache_misses  (GthreeRenderer     *renderer);
+GTHREE_API
+void                gthree_renderer_set_async_compile         (GthreeRenderer     *renderer,
+                                                               gboolean            async_compile);
+GTHREE_API
+gboolean            gthree_renderer_get_async_compile         (GthreeRenderer     *renderer);
+GTHREE_API
+void                gthree_renderer_set_multi_draw            (GthreeRenderer     *renderer,
+                                                               gboolean            multi_draw);
+GTHREE_API
+gboolean            gthree_renderer_get_multi_draw            (GthreeRenderer     *renderer);
+GTHREE_API
+void                gthree_renderer_set_gpu_culling           (GthreeRenderer     *renderer,
+                                                               gboolean            gpu_culling);
+GTHREE_API
+gboolean            gthree_renderer_get_gpu_culling           (GthreeRenderer     *renderer);
+GTHREE_API
+void                gthree_renderer_set_reuse_render_list     (GthreeRenderer     *renderer,
+                                                               gboolean            reuse_render_list);
+GTHREE_API
+gboolean            gthree_renderer_get_reuse_render_list     (GthreeRenderer     *renderer);
+GTHREE_API
+guint               gthree_renderer_get_programs_pending      (GthreeRenderer     *renderer);
+GTHREE_API
+void                gthree_renderer_compile                   (GthreeRenderer     *renderer,
+                                                               GthreeScene        *scene,
+                                                               GthreeCamera       *camera);
+GTHREE_API
 gboolean            gthree_renderer_get_shadow_map_enabled    (GthreeRenderer     *renderer);
 GTHREE_API
 void                gthree_renderer_set_shadow_map_enabled    (GthreeRenderer     *renderer,
@@ -3,16 +3,48 @@
 
 #include "gthreescene.h"
 #include "gthreelight.h"
+#include "gthreepoints.h"
+#include "gthreelinesegments.h"
+#include "gthreeinstancedmesh.h"
+#include "gthreeskinnedmesh.h"
+#include "gthreelod.h"
 
 #include "gthreeobjectprivate.h"
+#include "gthreeprivate.h"
+
+typedef struct {
+  GthreeObject *object;
+  int proxy;
+  guint world_matrix_stamp;
+  graphene_sphere_t geometry_sphere;
+  guint generation;
+} IndexEntry;
 
 typedef struct {
   graphene_vec3_t bg_color;
   gboolean bg_color_is_set;
   GthreeTexture *bg_texture;
   GthreeMaterial *override_material;
+  gboolean parallel_matrix_update;
+
+  /* Spatial index, only allocated when enabled */
+  GthreeAabbTree *index;
+  GHashTable *index_entries; /* GthreeObject -> IndexEntry */
+  GPtrArray *unindexed;      /* Renderables we can't bound cheaply */
+  GPtrArray *lights;
+  guint index_generation;
 } GthreeScenePrivate;
 
+enum {
+  PROP_0,
+
+  PROP_PARALLEL_MATRIX_UPDATE,
+  PROP_SPATIAL_INDEX,
+
+  N_PROPS
+};
+
+static GParamSpec *obj_props[N_PROPS] = { NULL, };
 
 G_DEFINE_TYPE_WITH_PRIVATE (GthreeScene, gthree_scene, GTHREE_TYPE_OBJECT);
 
@@ -43,6 +75,11 @@ gthree_scene_finalize (GObject *obj)
 
   g_clear_object (&priv->override_material);
 
+  g_clear_pointer (&priv->index, gthree_aabb_tree_free);
+  g_clear_pointer (&priv->index_entries, g_hash_table_unref);
+  g_clear_pointer (&priv->unindexed, g_ptr_array_unref);
+  g_clear_pointer (&priv->lights, g_ptr_array_unref);
+
   G_OBJECT_CLASS (gthree_scene_parent_class)->finalize (obj);
 }
 
@@ -108,8 +145,310 @@ gthree_scene_set_override_material (GthreeScene *scene,
   priv->override_material = material;
 }
 
+gboolean
+gthree_scene_get_parallel_matrix_update (GthreeScene *scene)
+{
+  GthreeScenePrivate *priv = gthree_scene_get_instance_private (scene);
+
+  return priv->parallel_matrix_update;
+}
+
+/* When enabled, the renderer updates the world matrices of independent
+ * subtrees on worker threads. Any update_matrix_world overrides in the
+ * scene must then be safe to call concurrently for different objects. */
+void
+gthree_scene_set_parallel_matrix_update (GthreeScene *scene,
+                                         gboolean     parallel)
+{
+  GthreeScenePrivate *priv = gthree_scene_get_instance_private (scene);
+
+  parallel = !!parallel;
+  if (priv->parallel_matrix_update == parallel)
+    return;
+
+  priv->parallel_matrix_update = parallel;
+  g_object_notify_by_pspec (G_OBJECT (scene), obj_props[PROP_PARALLEL_MATRIX_UPDATE]);
+}
+
+static void
+index_entry_free (IndexEntry *entry)
+{
+  g_object_unref (entry->object);
+  g_free (entry);
+}
+
+gboolean
+gthree_scene_get_spatial_index (GthreeScene *scene)
+{
+  GthreeScenePrivate *priv = gthree_scene_get_instance_private (scene);
+
+  return priv->index != NULL;
+}
+
+/* When enabled, the scene keeps a dynamic AABB tree of the world space
+ * bounds of its renderable objects, which the renderer uses for frustum
+ * culling and the raycaster for finding candidate objects. This pays
+ * off for scenes with very many objects, most of them not moving. */
+void
+gthree_scene_set_spatial_index (GthreeScene *scene,
+                                gboolean     spatial_index)
+{
+  GthreeScenePrivate *priv = gthree_scene_get_instance_private (scene);
+
+  spatial_index = !!spatial_index;
+  if ((priv->index != NULL) == spatial_index)
+    return;
+
+  if (spatial_index)
+    {
+      priv->index = gthree_aabb_tree_new ();
+      priv->index_entries = g_hash_table_new_full (NULL, NULL, NULL, (GDestroyNotify)index_entry_free);
+      priv->unindexed = g_ptr_array_new ();
+      priv->lights = g_ptr_array_new ();
+    }
+  else
+    {
+      g_clear_pointer (&priv->index, gthree_aabb_tree_free);
+      g_clear_pointer (&priv->index_entries, g_hash_table_unref);
+      g_clear_pointer (&priv->unindexed, g_ptr_array_unref);
+      g_clear_pointer (&priv->lights, g_ptr_array_unref);
+    }
+
+  g_object_notify_by_pspec (G_OBJECT (scene), obj_props[PROP_SPATIAL_INDEX]);
+}
+
+/* Only objects whose culling volume is the transformed geometry bounds
+ * go in the tree. Skinned meshes are left out because their skeletons
+ * need updating even when culled. */
+static GthreeGeometry *
+get_indexable_geometry (GthreeObject *object)
+{
+  if (!gthree_object_get_is_frustum_culled (object))
+    return NULL;
+
+  if (GTHREE_IS_INSTANCED_MESH (object) || GTHREE_IS_SKINNED_MESH (object))
+    return NULL;
+
+  if (GTHREE_IS_MESH (object))
+    return gthree_mesh_get_geometry (GTHREE_MESH (object));
+
+  if (GTHREE_IS_POINTS (object))
+    return gthree_points_get_geometry (GTHREE_POINTS (object));
+
+  return NULL;
+}
+
+static void
+update_index_entry (GthreeScene    *scene,
+                    GthreeObject   *object,
+                    GthreeGeometry *geometry)
+{
+  GthreeScenePrivate *priv = gthree_scene_get_instance_private (scene);
+  const graphene_sphere_t *geometry_sphere = gthree_geometry_get_bounding_sphere (geometry);
+  guint stamp = gthree_object_get_world_matrix_stamp (object);
+  IndexEntry *entry;
+  graphene_sphere_t sphere;
+  graphene_box_t box;
+
+  entry = g_hash_table_lookup (priv->index_entries, object);
+  if (entry)
+    {
+      entry->generation = priv->index_generation;
+      if (entry->world_matrix_stamp == stamp &&
+          graphene_sphere_equal (&entry->geometry_sphere, geometry_sphere))
+        return;
+    }
+
+  graphene_matrix_transform_sphere (gthree_object_get_world_matrix (object),
+                                    geometry_sphere, &sphere);
+  graphene_sphere_get_bounding_box (&sphere, &box);
+
+  if (entry == NULL)
+    {
+      entry = g_new0 (IndexEntry, 1);
+      entry->object = g_object_ref (object);
+      entry->generation = priv->index_generation;
+      entry->proxy = gthree_aabb_tree_insert (priv->index, &box, object);
+      g_hash_table_insert (priv->index_entries, object, entry);
+    }
+  else
+    gthree_aabb_tree_move (priv->index, entry->proxy, &box);
+
+  entry->world_matrix_stamp = stamp;
+  entry->geometry_sphere = *geometry_sphere;
+}
+
+static void
+update_index_object (GthreeScene  *scene,
+                     GthreeObject *object,
+                     GthreeCamera *camera,
+                     float         viewport_height)
+{
+  GthreeScenePrivate *priv = gthree_scene_get_instance_private (scene);
+  GthreeObjectIter iter;
+  GthreeObject *child;
+
+  if (!gthree_object_get_visible (object))
+    return;
+
+  if (GTHREE_IS_LIGHT (object))
+    g_ptr_array_add (priv->lights, object);
+  else if (GTHREE_IS_LOD (object))
+    {
+      if (camera != NULL && gthree_lod_get_auto_update (GTHREE_LOD (object)) &&
+          gthree_object_check_layer (object, gthree_object_get_layer_mask (GTHREE_OBJECT (camera))))
+        gthree_lod_update (GTHREE_LOD (object), camera, viewport_height);
+    }
+  else if (GTHREE_IS_MESH (object) || GTHREE_IS_LINE_SEGMENTS (object) ||
+           GTHREE_IS_SPRITE (object) || GTHREE_IS_POINTS (object))
+    {
+      GthreeGeometry *geometry = get_indexable_geometry (object);
+
+      if (geometry)
+        update_index_entry (scene, object, geometry);
+      else
+        g_ptr_array_add (priv->unindexed, object);
+    }
+
+  gthree_object_iter_init (&iter, object);
+  while (gthree_object_iter_next (&iter, &child))
+    update_index_object (scene, child, camera, viewport_height);
+}
+
+/* Brings the index up to date with the world matrices. Objects whose
+ * world matrix stamp didn't change are not touched, and objects that
+ * were not seen this time (removed or hidden) are dropped. With a
+ * camera, lods pick their level for it first. */
+void
+gthree_scene_update_spatial_index (GthreeScene  *scene,
+                                   GthreeCamera *camera,
+                                   float         viewport_height)
+{
+  GthreeScenePrivate *priv = gthree_scene_get_instance_private (scene);
+  GHashTableIter iter;
+  IndexEntry *entry;
+
+  if (priv->index == NULL)
+    return;
+
+  priv->index_generation++;
+  g_ptr_array_set_size (priv->unindexed, 0);
+  g_ptr_array_set_size (priv->lights, 0);
+
+  update_index_object (scene, GTHREE_OBJECT (scene), camera, viewport_height);
+
+  g_hash_table_iter_init (&iter, priv->index_entries);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&entry))
+    {
+      if (entry->generation != priv->index_generation)
+        {
+          gthree_aabb_tree_remove (priv->index, entry->proxy);
+          g_hash_table_iter_remove (&iter);
+        }
+    }
+}
+
+/* Visible lights, in scene graph order */
+GPtrArray *
+gthree_scene_get_index_lights (GthreeScene *scene)
+{
+  GthreeScenePrivate *priv = gthree_scene_get_instance_private (scene);
+
+  return priv->lights;
+}
+
+/* These call func for all visible renderables that may intersect, the
+ * caller still has to do the exact test. */
+void
+gthree_scene_query_frustum (GthreeScene              *scene,
+                            const graphene_frustum_t *frustum,
+                            GthreeAabbTreeFunc        func,
+                            gpointer                  user_data)
+{
+  GthreeScenePrivate *priv = gthree_scene_get_instance_private (scene);
+
+  gthree_aabb_tree_query_frustum (priv->index, frustum, func, user_data);
+  for (guint i = 0; i < priv->unindexed->len; i++)
+    func (g_ptr_array_index (priv->unindexed, i), user_data);
+}
+
+void
+gthree_scene_query_ray (GthreeScene          *scene,
+                        const graphene_ray_t *ray,
+                        GthreeAabbTreeFunc    func,
+                        gpointer              user_data)
+{
+  GthreeScenePrivate *priv = gthree_scene_get_instance_private (scene);
+
+  gthree_aabb_tree_query_ray (priv->index, ray, func, user_data);
+  for (guint i = 0; i < priv->unindexed->len; i++)
+    func (g_ptr_array_index (priv->unindexed, i), user_data);
+}
+
+static void
+gthree_scene_set_property (GObject *obj,
+                           guint prop_id,
+                           const GValue *value,
+                           GParamSpec *pspec)
+{
+  GthreeScene *scene = GTHREE_SCENE (obj);
+
+  switch (prop_id)
+    {
+    case PROP_PARALLEL_MATRIX_UPDATE:
+      gthree_scene_set_parallel_matrix_update (scene, g_value_get_boolean (value));
+      break;
+
+    case PROP_SPATIAL_INDEX:
+      gthree_scene_set_spatial_index (scene, g_value_get_boolean (value));
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
+    }
+}
+
+static void
+gthree_scene_get_property (GObject *obj,
+                           guint prop_id,
+                           GValue *value,
+                           GParamSpec *pspec)
+{
+  GthreeScene *scene = GTHREE_SCENE (obj);
+
+  switch (prop_id)
+    {
+    case PROP_PARALLEL_MATRIX_UPDATE:
+      g_value_set_boolean (value, gthree_scene_get_parallel_matrix_update (scene));
+      break;
+
+    case PROP_SPATIAL_INDEX:
+      g_value_set_boolean (value, gthree_scene_get_spatial_index (scene));
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
+    }
+}
+
 static void
 gthree_scene_class_init (GthreeSceneClass *klass)
 {
-  G_OBJECT_CLASS (klass)->finalize = gthree_scene_finalize;
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+
+  gobject_class->set_property = gthree_scene_set_property;
+  gobject_class->get_property = gthree_scene_get_property;
+  gobject_class->finalize = gthree_scene_finalize;
+
+  obj_props[PROP_PARALLEL_MATRIX_UPDATE] =
+    g_param_spec_boolean ("parallel-matrix-update", "Parallel matrix update", "Update world matrices on worker threads",
+                          FALSE,
+                          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  obj_props[PROP_SPATIAL_INDEX] =
+    g_param_spec_boolean ("spatial-index", "Spatial index", "Keep a bounding volume hierarchy of the scene objects",
+                          FALSE,
+                          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  g_object_class_install_properties (gobject_class, N_PROPS, obj_props);
 }
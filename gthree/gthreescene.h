@@ -50,6 +50,18 @@ GthreeTexture * gthree_scene_get_background_texture (GthreeScene   *scene);
 GTHREE_API
 void            gthree_scene_set_background_texture (GthreeScene   *scene,
                                                      GthreeTexture *texture);
+GTHREE_API
+gboolean        gthree_scene_get_parallel_matrix_update (GthreeScene *scene);
+GTHREE_API
+void            gthree_scene_set_parallel_matrix_update (GthreeScene *scene,
+                                                         gboolean     parallel);
+GTHREE_API
+gboolean        gthree_scene_get_spatial_index      (GthreeScene *scene);
+GTHREE_API
+void            gthree_scene_set_spatial_index      (GthreeScene *scene,
+                                                     gboolean     spatial_index);
+GTHREE_API
+GthreeObject *  gthree_scene_build_static_batches   (GthreeScene *scene);
 
 G_END_DECLS
 
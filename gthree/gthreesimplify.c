@@ -0,0 +1,556 @@
+#include <math.h>
+#include <string.h>
+
+#include "gthreegeometry.h"
+#include "gthreeprivate.h"
+
+/* Mesh simplification by edge collapse, ordered by quadric error.
+ *
+ * Vertices are only ever moved onto one of their neighbours, so the
+ * result can reuse the vertex data of the original geometry and only
+ * needs a new index. Vertices with the same position but different
+ * attributes (uv seams, hard edges), vertices on a border and vertices
+ * on a non-manifold edge are never moved, which keeps the outline and
+ * the texture mapping intact.
+ */
+
+typedef struct {
+  /* Symmetric 4x4 plane quadric, and the sum of the area weights */
+  double a2, ab, ac, ad, b2, bc, bd, c2, cd, d2;
+  double weight;
+} Quadric;
+
+typedef struct {
+  guint32 from;
+  guint32 to;
+  guint32 to_wedge;
+  float error;
+} Collapse;
+
+typedef struct {
+  const float *data;
+  int stride;
+} VertexData;
+
+static void
+quadric_add (Quadric       *q,
+             const Quadric *other)
+{
+  q->a2 += other->a2; q->ab += other->ab; q->ac += other->ac; q->ad += other->ad;
+  q->b2 += other->b2; q->bc += other->bc; q->bd += other->bd;
+  q->c2 += other->c2; q->cd += other->cd;
+  q->d2 += other->d2;
+  q->weight += other->weight;
+}
+
+static void
+quadric_add_triangle (Quadric     *q,
+                      const float *p0,
+                      const float *p1,
+                      const float *p2)
+{
+  double e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+  double e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+  double n[3] = { e1[1] * e2[2] - e1[2] * e2[1],
+                  e1[2] * e2[0] - e1[0] * e2[2],
+                  e1[0] * e2[1] - e1[1] * e2[0] };
+  double len = sqrt (n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+  double a, b, c, d, w;
+
+  if (len == 0)
+    return;
+
+  a = n[0] / len;
+  b = n[1] / len;
+  c = n[2] / len;
+  d = -(a * p0[0] + b * p0[1] + c * p0[2]);
+  w = len * 0.5; /* Triangle area */
+
+  q->a2 += w * a * a; q->ab += w * a * b; q->ac += w * a * c; q->ad += w * a * d;
+  q->b2 += w * b * b; q->bc += w * b * c; q->bd += w * b * d;
+  q->c2 += w * c * c; q->cd += w * c * d;
+  q->d2 += w * d * d;
+  q->weight += w;
+}
+
+/* Mean squared distance of p to the planes of the quadric */
+static float
+quadric_error (const Quadric *q,
+               const float   *p)
+{
+  double x = p[0], y = p[1], z = p[2];
+  double e;
+
+  e = q->a2 * x * x + 2 * q->ab * x * y + 2 * q->ac * x * z + 2 * q->ad * x
+    + q->b2 * y * y + 2 * q->bc * y * z + 2 * q->bd * y
+    + q->c2 * z * z + 2 * q->cd * z
+    + q->d2;
+
+  return (float) (fabs (e) / MAX (q->weight, 1e-20));
+}
+
+static int
+compare_vertices (gconstpointer a,
+                  gconstpointer b,
+                  gpointer      user_data)
+{
+  const VertexData *vd = user_data;
+  guint32 va = *(const guint32 *)a;
+  guint32 vb = *(const guint32 *)b;
+  int res;
+
+  res = memcmp (vd->data + va * vd->stride, vd->data + vb * vd->stride, vd->stride * sizeof (float));
+  if (res != 0)
+    return res;
+
+  return va < vb ? -1 : (va > vb ? 1 : 0);
+}
+
+static int
+compare_collapses (gconstpointer a,
+                   gconstpointer b)
+{
+  const Collapse *ca = a;
+  const Collapse *cb = b;
+
+  if (ca->error < cb->error)
+    return -1;
+  if (ca->error > cb->error)
+    return 1;
+  return 0;
+}
+
+static int
+compare_edges (gconstpointer a,
+               gconstpointer b)
+{
+  guint64 ea = *(const guint64 *)a;
+  guint64 eb = *(const guint64 *)b;
+
+  return ea < eb ? -1 : (ea > eb ? 1 : 0);
+}
+
+/* Position first, so vertices at the same place sort next to each other */
+static float *
+read_vertex_data (GthreeGeometry *geometry,
+                  int             n_vertices,
+                  int            *stride_out)
+{
+  GList *names = gthree_geometry_get_attribute_names (geometry);
+  GthreeAttribute *position = gthree_geometry_get_position (geometry);
+  g_autoptr(GPtrArray) attributes = g_ptr_array_new ();
+  float *data;
+  int stride, offset;
+  GList *l;
+  int i;
+  guint j;
+
+  g_ptr_array_add (attributes, position);
+  for (l = names; l != NULL; l = l->next)
+    {
+      GthreeAttribute *attribute = gthree_geometry_get_attribute (geometry, l->data);
+      if (attribute != position)
+        g_ptr_array_add (attributes, attribute);
+    }
+  g_list_free (names);
+
+  stride = 0;
+  for (j = 0; j < attributes->len; j++)
+    stride += gthree_attribute_get_item_size (g_ptr_array_index (attributes, j));
+
+  data = g_new0 (float, (gsize) n_vertices * stride);
+  offset = 0;
+  for (j = 0; j < attributes->len; j++)
+    {
+      GthreeAttribute *attribute = g_ptr_array_index (attributes, j);
+      int item_size = gthree_attribute_get_item_size (attribute);
+
+      for (i = 0; i < n_vertices && i < gthree_attribute_get_count (attribute); i++)
+        gthree_attribute_array_get_elements_as_float (gthree_attribute_get_array (attribute), i,
+                                                      gthree_attribute_get_item_offset (attribute),
+                                                      data + (gsize) i * stride + offset, item_size);
+      offset += item_size;
+    }
+
+  /* Make -0 and 0 compare equal */
+  for (i = 0; i < n_vertices * stride; i++)
+    if (data[i] == 0)
+      data[i] = 0;
+
+  *stride_out = stride;
+  return data;
+}
+
+/* Triangle normal, unnormalized */
+static void
+triangle_normal (const float *p0,
+                 const float *p1,
+                 const float *p2,
+                 float       *n)
+{
+  float e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+  float e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+
+  n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+  n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+  n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+}
+
+/* Simplifies the triangles in indices (of corners referencing
+ * welded vertices) in place, returning the new index count. */
+static int
+simplify_triangles (guint32        *indices,
+                    int             n_indices,
+                    int             target_triangles,
+                    float           max_error,
+                    const float    *data,
+                    int             stride,
+                    const guint32  *position_of,
+                    const gboolean *seam,
+                    int             n_vertices)
+{
+  g_autofree Quadric *quadrics = g_new0 (Quadric, n_vertices);
+  g_autofree guint8 *locked = g_new0 (guint8, n_vertices);
+  g_autofree guint8 *dirty = g_new0 (guint8, n_vertices);
+  g_autofree guint32 *wedge_remap = g_new (guint32, n_vertices);
+  g_autofree int *adjacency_offsets = g_new (int, n_vertices + 1);
+  g_autofree int *adjacency = NULL;
+  g_autoptr(GArray) edges = g_array_new (FALSE, FALSE, sizeof (guint64));
+  g_autoptr(GArray) collapses = g_array_new (FALSE, FALSE, sizeof (Collapse));
+  int n_triangles = n_indices / 3;
+  int i, k;
+
+#define POS(v) (data + (gsize) position_of[v] * stride)
+
+  /* Edges used by other than two triangles, per position, are borders */
+  for (i = 0; i < n_triangles; i++)
+    for (k = 0; k < 3; k++)
+      {
+        guint32 a = position_of[indices[i * 3 + k]];
+        guint32 b = position_of[indices[i * 3 + (k + 1) % 3]];
+        guint64 edge = ((guint64) MIN (a, b) << 32) | MAX (a, b);
+
+        g_array_append_val (edges, edge);
+      }
+
+  g_array_sort (edges, compare_edges);
+  for (i = 0; i < edges->len; i = k)
+    {
+      guint64 edge = g_array_index (edges, guint64, i);
+
+      for (k = i + 1; k < edges->len && g_array_index (edges, guint64, k) == edge; k++)
+        ;
+
+      if (k - i != 2)
+        {
+          locked[edge >> 32] = 1;
+          locked[edge & 0xffffffff] = 1;
+        }
+    }
+
+  for (i = 0; i < n_vertices; i++)
+    {
+      if (seam[position_of[i]])
+        locked[position_of[i]] = 1;
+      wedge_remap[i] = i;
+    }
+
+  for (i = 0; i < n_triangles; i++)
+    {
+      Quadric q = { 0, };
+      quadric_add_triangle (&q, POS (indices[i * 3]), POS (indices[i * 3 + 1]), POS (indices[i * 3 + 2]));
+      for (k = 0; k < 3; k++)
+        quadric_add (&quadrics[position_of[indices[i * 3 + k]]], &q);
+    }
+
+  adjacency = g_new (int, n_indices);
+
+  while (n_triangles > target_triangles)
+    {
+      int n_collapsed = 0, removed = 0;
+      guint c;
+
+      /* Triangles around each position */
+      memset (adjacency_offsets, 0, (n_vertices + 1) * sizeof (int));
+      for (i = 0; i < n_triangles * 3; i++)
+        adjacency_offsets[position_of[indices[i]] + 1]++;
+      for (i = 0; i < n_vertices; i++)
+        adjacency_offsets[i + 1] += adjacency_offsets[i];
+      for (i = 0; i < n_triangles * 3; i++)
+        adjacency[adjacency_offsets[position_of[indices[i]]]++] = i / 3;
+      for (i = n_vertices; i > 0; i--)
+        adjacency_offsets[i] = adjacency_offsets[i - 1];
+      adjacency_offsets[0] = 0;
+
+      g_array_set_size (collapses, 0);
+      for (i = 0; i < n_triangles; i++)
+        for (k = 0; k < 3; k++)
+          {
+            guint32 from = position_of[indices[i * 3 + k]];
+            guint32 to_wedge = indices[i * 3 + (k + 1) % 3];
+            guint32 to = position_of[to_wedge];
+            Quadric q;
+            Collapse collapse;
+
+            if (locked[from] || from == to)
+              continue;
+
+            q = quadrics[from];
+            quadric_add (&q, &quadrics[to]);
+            collapse.from = from;
+            collapse.to = to;
+            collapse.to_wedge = to_wedge;
+            collapse.error = quadric_error (&q, POS (to));
+            if (collapse.error <= max_error)
+              g_array_append_val (collapses, collapse);
+          }
+
+      g_array_sort (collapses, compare_collapses);
+      memset (dirty, 0, n_vertices);
+
+      for (c = 0; c < collapses->len && n_triangles - removed > target_triangles; c++)
+        {
+          Collapse *collapse = &g_array_index (collapses, Collapse, c);
+          gboolean flips = FALSE;
+          int t, n_removed = 0;
+
+          if (dirty[collapse->from] || dirty[collapse->to])
+            continue;
+
+          for (t = adjacency_offsets[collapse->from]; t < adjacency_offsets[collapse->from + 1]; t++)
+            {
+              guint32 *tri = indices + adjacency[t] * 3;
+              const float *p[3], *moved[3];
+              float before[3], after[3];
+              gboolean has_to = FALSE;
+
+              for (k = 0; k < 3; k++)
+                {
+                  guint32 pos = position_of[tri[k]];
+                  has_to |= pos == collapse->to;
+                  p[k] = POS (tri[k]);
+                  moved[k] = pos == collapse->from ? POS (collapse->to_wedge) : p[k];
+                }
+
+              if (has_to)
+                {
+                  n_removed++;
+                  continue;
+                }
+
+              triangle_normal (p[0], p[1], p[2], before);
+              triangle_normal (moved[0], moved[1], moved[2], after);
+              if (before[0] * after[0] + before[1] * after[1] + before[2] * after[2] <= 0)
+                {
+                  flips = TRUE;
+                  break;
+                }
+            }
+
+          if (flips)
+            continue;
+
+          /* Everything around is about to change, leave it to the next pass */
+          for (t = adjacency_offsets[collapse->from]; t < adjacency_offsets[collapse->from + 1]; t++)
+            for (k = 0; k < 3; k++)
+              dirty[position_of[indices[adjacency[t] * 3 + k]]] = 1;
+
+          /* Not a seam, so all corners at from use the same vertex */
+          for (t = adjacency_offsets[collapse->from]; t < adjacency_offsets[collapse->from + 1]; t++)
+            for (k = 0; k < 3; k++)
+              {
+                guint32 v = indices[adjacency[t] * 3 + k];
+                if (position_of[v] == collapse->from)
+                  wedge_remap[v] = collapse->to_wedge;
+              }
+
+          quadric_add (&quadrics[collapse->to], &quadrics[collapse->from]);
+          removed += n_removed;
+          n_collapsed++;
+        }
+
+      if (n_collapsed == 0)
+        break;
+
+      /* Apply the collapses and drop the triangles that became degenerate */
+      k = 0;
+      for (i = 0; i < n_triangles; i++)
+        {
+          guint32 a = wedge_remap[indices[i * 3]];
+          guint32 b = wedge_remap[indices[i * 3 + 1]];
+          guint32 c2 = wedge_remap[indices[i * 3 + 2]];
+
+          if (position_of[a] == position_of[b] ||
+              position_of[b] == position_of[c2] ||
+              position_of[c2] == position_of[a])
+            continue;
+
+          indices[k * 3] = a;
+          indices[k * 3 + 1] = b;
+          indices[k * 3 + 2] = c2;
+          k++;
+        }
+      n_triangles = k;
+
+      for (i = 0; i < n_vertices; i++)
+        wedge_remap[i] = i;
+    }
+
+#undef POS
+
+  return n_triangles * 3;
+}
+
+/**
+ * gthree_geometry_simplify:
+ * @geometry: a #GthreeGeometry with triangles
+ * @ratio: the fraction of triangles to keep, between 0 and 1
+ * @max_error: the largest error to accept, relative to the size of
+ *   the geometry, or 1 for no limit
+ *
+ * Makes a version of @geometry with fewer triangles, for example for
+ * a less detailed level of a #GthreeLOD. Vertices are merged along the
+ * edges that change the shape the least, until @ratio of the triangles
+ * are left or no collapse is below @max_error. Uv seams and open
+ * borders are kept in place.
+ *
+ * The new geometry shares the attributes of @geometry and only has a
+ * new index, so the two must not be modified independently. Groups
+ * are simplified separately.
+ *
+ * Returns: (transfer full): the simplified geometry
+ */
+GthreeGeometry *
+gthree_geometry_simplify (GthreeGeometry *geometry,
+                          float           ratio,
+                          float           max_error)
+{
+  GthreeAttribute *index = gthree_geometry_get_index (geometry);
+  g_autofree float *data = NULL;
+  g_autofree guint32 *order = NULL;
+  g_autofree guint32 *welded = NULL;
+  g_autofree guint32 *position_of = NULL;
+  g_autofree gboolean *seam = NULL;
+  g_autofree guint32 *indices = NULL;
+  g_autofree guint32 *result = NULL;
+  g_autoptr(GArray) groups = NULL;
+  GthreeGeometry *simplified;
+  const graphene_sphere_t *sphere;
+  float error_limit;
+  VertexData vd;
+  GList *names, *l;
+  int n_vertices, n_indices, n_result, stride;
+  int i, j;
+
+  g_return_val_if_fail (GTHREE_IS_GEOMETRY (geometry), NULL);
+  g_return_val_if_fail (gthree_geometry_get_position (geometry) != NULL, NULL);
+
+  n_vertices = gthree_geometry_get_position_count (geometry);
+  n_indices = index ? gthree_attribute_get_count (index) : n_vertices;
+  n_indices -= n_indices % 3;
+
+  /* Weld vertices that are identical in all attributes, and find the
+   * ones that share a position with a different vertex */
+  data = read_vertex_data (geometry, n_vertices, &stride);
+  order = g_new (guint32, n_vertices);
+  for (i = 0; i < n_vertices; i++)
+    order[i] = i;
+
+  vd.data = data;
+  vd.stride = stride;
+  g_qsort_with_data (order, n_vertices, sizeof (guint32), compare_vertices, &vd);
+
+  welded = g_new (guint32, n_vertices);
+  position_of = g_new (guint32, n_vertices);
+  seam = g_new0 (gboolean, n_vertices);
+  for (i = 0; i < n_vertices; i++)
+    {
+      guint32 v = order[i];
+
+      if (i > 0 && memcmp (data + (gsize) v * stride, data + (gsize) order[i - 1] * stride, stride * sizeof (float)) == 0)
+        {
+          welded[v] = welded[order[i - 1]];
+          position_of[v] = position_of[order[i - 1]];
+        }
+      else if (i > 0 && memcmp (data + (gsize) v * stride, data + (gsize) order[i - 1] * stride, 3 * sizeof (float)) == 0)
+        {
+          welded[v] = v;
+          position_of[v] = position_of[order[i - 1]];
+          seam[position_of[v]] = TRUE;
+        }
+      else
+        {
+          welded[v] = v;
+          position_of[v] = v;
+        }
+    }
+
+  indices = g_new (guint32, MAX (n_indices, 1));
+  for (i = 0; i < n_indices; i++)
+    {
+      guint32 v = index ? gthree_attribute_get_uint (index, i) : i;
+      indices[i] = v < n_vertices ? welded[v] : 0;
+    }
+
+  sphere = gthree_geometry_get_bounding_sphere (geometry);
+  error_limit = max_error >= 1 ? G_MAXFLOAT : powf (max_error * graphene_sphere_get_radius (sphere), 2);
+
+  /* Each group is simplified on its own, its outline is a border there */
+  groups = g_array_new (FALSE, FALSE, sizeof (GthreeGeometryGroup));
+  for (i = 0; i < gthree_geometry_get_n_groups (geometry); i++)
+    {
+      GthreeGeometryGroup group = *gthree_geometry_get_group (geometry, i);
+
+      group.start = CLAMP (group.start - group.start % 3, 0, n_indices);
+      group.count = CLAMP (group.count - group.count % 3, 0, n_indices - group.start);
+      g_array_append_val (groups, group);
+    }
+  if (groups->len == 0)
+    {
+      GthreeGeometryGroup group = { 0, n_indices, 0 };
+      g_array_append_val (groups, group);
+    }
+
+  result = g_new (guint32, MAX (n_indices, 1));
+  n_result = 0;
+  for (i = 0; i < groups->len; i++)
+    {
+      GthreeGeometryGroup *group = &g_array_index (groups, GthreeGeometryGroup, i);
+      int target = (int) ceilf (group->count / 3 * CLAMP (ratio, 0.0f, 1.0f));
+      int count;
+
+      memcpy (result + n_result, indices + group->start, group->count * sizeof (guint32));
+      count = simplify_triangles (result + n_result, group->count, target, error_limit,
+                                  data, stride, position_of, seam, n_vertices);
+      group->start = n_result;
+      group->count = count;
+      n_result += count;
+    }
+
+  simplified = gthree_geometry_new ();
+
+  names = gthree_geometry_get_attribute_names (geometry);
+  for (l = names; l != NULL; l = l->next)
+    gthree_geometry_add_attribute (simplified, l->data, gthree_geometry_get_attribute (geometry, l->data));
+  g_list_free (names);
+
+  names = gthree_geometry_get_morph_attributes_names (geometry);
+  for (l = names; l != NULL; l = l->next)
+    {
+      GPtrArray *morph = gthree_geometry_get_morph_attributes (geometry, l->data);
+      for (j = 0; j < morph->len; j++)
+        gthree_geometry_add_morph_attribute (simplified, l->data, g_ptr_array_index (morph, j));
+    }
+  g_list_free (names);
+
+  gthree_geometry_set_index_from_uint32 (simplified, result, n_result);
+
+  if (gthree_geometry_get_n_groups (geometry) > 0)
+    for (i = 0; i < groups->len; i++)
+      {
+        GthreeGeometryGroup *group = &g_array_index (groups, GthreeGeometryGroup, i);
+        gthree_geometry_add_group (simplified, group->start, group->count, group->material_index);
+      }
+
+  return simplified;
+}
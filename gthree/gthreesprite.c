@@ -218,7 +218,8 @@ gthree_sprite_set_material (GthreeSprite *sprite,
 {
   GthreeSpritePrivate *priv = gthree_sprite_get_instance_private (sprite);
 
-  g_set_object (&priv->material, material);
+  if (g_set_object (&priv->material, material))
+    gthree_object_mark_changed (GTHREE_OBJECT (sprite));
 }
 
 const graphene_vec2_t *
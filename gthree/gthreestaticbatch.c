@@ -0,0 +1,588 @@
+#include <math.h>
+#include <string.h>
+
+#include "gthreescene.h"
+#include "gthreegroup.h"
+#include "gthreemesh.h"
+#include "gthreeprivate.h"
+
+/* Chunks stay below this so they can use 16bit indices, and so each
+ * chunk covers a small enough area to be culled on its own */
+#define STATIC_BATCH_MAX_VERTICES 65535
+
+typedef struct {
+  GthreeMesh *mesh;
+  GthreeGeometry *geometry;
+  int start; /* Triangle range, in index (or vertex) units */
+  int end;
+  int n_vertices; /* Distinct vertices used by the range */
+  guint32 morton;
+} BatchSource;
+
+typedef struct {
+  GthreeMaterial *material;
+  gboolean cast_shadow;
+  gboolean receive_shadow;
+  guint32 layer_mask;
+  GArray *sources;
+  graphene_box_t box;
+} BatchBucket;
+
+static void
+batch_bucket_free (gpointer data)
+{
+  BatchBucket *bucket = data;
+
+  g_array_unref (bucket->sources);
+  g_free (bucket);
+}
+
+static gint
+compare_names (gconstpointer a,
+               gconstpointer b)
+{
+  return strcmp (*(const char **)a, *(const char **)b);
+}
+
+/* Only geometries with the same attributes can share buffers */
+static char *
+get_attribute_signature (GthreeGeometry *geometry)
+{
+  GList *names = gthree_geometry_get_attribute_names (geometry);
+  g_autoptr(GPtrArray) sorted = g_ptr_array_new ();
+  GString *s = g_string_new ("");
+  GList *l;
+  guint i;
+
+  for (l = names; l != NULL; l = l->next)
+    g_ptr_array_add (sorted, l->data);
+  g_list_free (names);
+  g_ptr_array_sort (sorted, compare_names);
+
+  for (i = 0; i < sorted->len; i++)
+    {
+      const char *name = g_ptr_array_index (sorted, i);
+      GthreeAttribute *attribute = gthree_geometry_get_attribute (geometry, name);
+
+      g_string_append_printf (s, "%s:%d;", name, gthree_attribute_get_item_size (attribute));
+    }
+
+  return g_string_free (s, FALSE);
+}
+
+static int
+count_used_vertices (GthreeGeometry *geometry,
+                     int             start,
+                     int             end)
+{
+  GthreeAttribute *index = gthree_geometry_get_index (geometry);
+  g_autofree guint8 *used = NULL;
+  int i, n_used;
+
+  if (index == NULL)
+    return end - start;
+
+  used = g_malloc0 (gthree_geometry_get_position_count (geometry));
+  n_used = 0;
+  for (i = start; i < end; i++)
+    {
+      guint v = gthree_attribute_get_uint (index, i);
+      if (!used[v])
+        {
+          used[v] = 1;
+          n_used++;
+        }
+    }
+
+  return n_used;
+}
+
+static gboolean
+can_batch_mesh (GthreeObject *object)
+{
+  GthreeMesh *mesh;
+  GthreeGeometry *geometry;
+
+  /* Skinned and instanced meshes transform their vertices on the GPU */
+  if (G_OBJECT_TYPE (object) != GTHREE_TYPE_MESH)
+    return FALSE;
+
+  /* Hiding the source would hide its children too */
+  if (gthree_object_get_matrix_auto_update (object) ||
+      gthree_object_get_n_children (object) > 0)
+    return FALSE;
+
+  mesh = GTHREE_MESH (object);
+  geometry = gthree_mesh_get_geometry (mesh);
+  if (geometry == NULL ||
+      gthree_geometry_get_position (geometry) == NULL ||
+      gthree_mesh_get_draw_mode (mesh) != GTHREE_DRAW_MODE_TRIANGLES ||
+      gthree_mesh_has_morph_targets (mesh) ||
+      gthree_geometry_has_morph_attributes (geometry))
+    return FALSE;
+
+  return TRUE;
+}
+
+static void
+add_source (GHashTable     *buckets,
+            GthreeMesh     *mesh,
+            GthreeMaterial *material,
+            int             start,
+            int             count)
+{
+  GthreeGeometry *geometry = gthree_mesh_get_geometry (mesh);
+  GthreeAttribute *index = gthree_geometry_get_index (geometry);
+  int range_start = gthree_geometry_get_draw_range_start (geometry);
+  int range_count = gthree_geometry_get_draw_range_count (geometry);
+  int n = index ? gthree_attribute_get_count (index) : gthree_geometry_get_position_count (geometry);
+  g_autofree char *signature = NULL;
+  g_autofree char *key = NULL;
+  BatchBucket *bucket;
+  BatchSource source = { mesh, geometry };
+  int end;
+
+  end = count < 0 ? n : start + count;
+  if (range_count >= 0)
+    end = MIN (end, range_start + range_count);
+  start = MAX (start, range_start);
+  end = MIN (end, n);
+
+  /* Whole triangles only */
+  end = start + (MAX (end - start, 0) / 3) * 3;
+  if (end <= start)
+    return;
+
+  signature = get_attribute_signature (geometry);
+  key = g_strdup_printf ("%p/%d/%d/%x/%s", material,
+                         gthree_object_get_cast_shadow (GTHREE_OBJECT (mesh)),
+                         gthree_object_get_receive_shadow (GTHREE_OBJECT (mesh)),
+                         gthree_object_get_layer_mask (GTHREE_OBJECT (mesh)),
+                         signature);
+
+  bucket = g_hash_table_lookup (buckets, key);
+  if (bucket == NULL)
+    {
+      bucket = g_new0 (BatchBucket, 1);
+      bucket->material = material;
+      bucket->cast_shadow = gthree_object_get_cast_shadow (GTHREE_OBJECT (mesh));
+      bucket->receive_shadow = gthree_object_get_receive_shadow (GTHREE_OBJECT (mesh));
+      bucket->layer_mask = gthree_object_get_layer_mask (GTHREE_OBJECT (mesh));
+      bucket->sources = g_array_new (FALSE, FALSE, sizeof (BatchSource));
+      graphene_box_init_from_box (&bucket->box, graphene_box_empty ());
+      g_hash_table_insert (buckets, g_steal_pointer (&key), bucket);
+    }
+
+  source.start = start;
+  source.end = end;
+  source.n_vertices = count_used_vertices (geometry, start, end);
+  g_array_append_val (bucket->sources, source);
+}
+
+static void
+collect_sources (GthreeObject *object,
+                 GHashTable   *buckets,
+                 GPtrArray    *batched)
+{
+  GthreeObjectIter iter;
+  GthreeObject *child;
+
+  if (!gthree_object_get_visible (object))
+    return;
+
+  if (can_batch_mesh (object))
+    {
+      GthreeMesh *mesh = GTHREE_MESH (object);
+      GthreeGeometry *geometry = gthree_mesh_get_geometry (mesh);
+      int n_groups = gthree_geometry_get_n_groups (geometry);
+      gboolean batchable = TRUE;
+      int i;
+
+      /* Transparent meshes need to be sorted individually */
+      for (i = 0; i < MAX (n_groups, 1); i++)
+        {
+          int material_index = n_groups > 0 ? gthree_geometry_get_group (geometry, i)->material_index : 0;
+          GthreeMaterial *material = gthree_mesh_get_material (mesh, material_index);
+
+          if (material == NULL || gthree_material_get_is_transparent (material))
+            batchable = FALSE;
+        }
+
+      if (batchable)
+        {
+          if (n_groups > 0)
+            {
+              for (i = 0; i < n_groups; i++)
+                {
+                  GthreeGeometryGroup *group = gthree_geometry_get_group (geometry, i);
+                  add_source (buckets, mesh, gthree_mesh_get_material (mesh, group->material_index),
+                              group->start, group->count);
+                }
+            }
+          else
+            add_source (buckets, mesh, gthree_mesh_get_material (mesh, 0), 0, -1);
+
+          g_ptr_array_add (batched, object);
+        }
+    }
+
+  gthree_object_iter_init (&iter, object);
+  while (gthree_object_iter_next (&iter, &child))
+    collect_sources (child, buckets, batched);
+}
+
+static guint32
+expand_bits (guint32 v)
+{
+  v = (v * 0x00010001u) & 0xFF0000FFu;
+  v = (v * 0x00000101u) & 0x0F00F00Fu;
+  v = (v * 0x00000011u) & 0xC30C30C3u;
+  v = (v * 0x00000005u) & 0x49249249u;
+  return v;
+}
+
+static gint
+compare_morton (gconstpointer a,
+                gconstpointer b)
+{
+  const BatchSource *aa = a;
+  const BatchSource *bb = b;
+
+  return aa->morton < bb->morton ? -1 : (aa->morton > bb->morton ? 1 : 0);
+}
+
+/* Orders the sources along a space filling curve, so that consecutive
+ * chunks are spatially compact and cull well */
+static void
+sort_sources (BatchBucket *bucket)
+{
+  graphene_point3d_t min, max;
+  guint i;
+
+  for (i = 0; i < bucket->sources->len; i++)
+    {
+      BatchSource *source = &g_array_index (bucket->sources, BatchSource, i);
+      const graphene_box_t *box = gthree_geometry_get_bounding_box (source->geometry);
+      graphene_box_t world_box;
+
+      graphene_matrix_transform_box (gthree_object_get_world_matrix (GTHREE_OBJECT (source->mesh)),
+                                     box, &world_box);
+      graphene_box_union (&bucket->box, &world_box, &bucket->box);
+    }
+
+  graphene_box_get_min (&bucket->box, &min);
+  graphene_box_get_max (&bucket->box, &max);
+
+  for (i = 0; i < bucket->sources->len; i++)
+    {
+      BatchSource *source = &g_array_index (bucket->sources, BatchSource, i);
+      const graphene_sphere_t *sphere = gthree_geometry_get_bounding_sphere (source->geometry);
+      graphene_point3d_t c, w;
+      float q[3];
+      int k;
+
+      graphene_sphere_get_center (sphere, &c);
+      graphene_matrix_transform_point3d (gthree_object_get_world_matrix (GTHREE_OBJECT (source->mesh)), &c, &w);
+
+      q[0] = max.x > min.x ? (w.x - min.x) / (max.x - min.x) : 0;
+      q[1] = max.y > min.y ? (w.y - min.y) / (max.y - min.y) : 0;
+      q[2] = max.z > min.z ? (w.z - min.z) / (max.z - min.z) : 0;
+      for (k = 0; k < 3; k++)
+        q[k] = CLAMP (q[k] * 1023.0f, 0, 1023.0f);
+
+      source->morton = (expand_bits ((guint32) q[0]) << 2) | (expand_bits ((guint32) q[1]) << 1) | expand_bits ((guint32) q[2]);
+    }
+
+  g_array_sort (bucket->sources, compare_morton);
+}
+
+static void
+read_as_float (GthreeAttribute *attribute,
+               int              index,
+               float           *dest)
+{
+  int item_size = gthree_attribute_get_item_size (attribute);
+  float scale = 1.0f;
+  gboolean is_signed = FALSE;
+  int k;
+
+  gthree_attribute_array_get_elements_as_float (gthree_attribute_get_array (attribute), index,
+                                                gthree_attribute_get_item_offset (attribute),
+                                                dest, item_size);
+
+  if (!gthree_attribute_get_normalized (attribute))
+    return;
+
+  switch (gthree_attribute_get_attribute_type (attribute))
+    {
+    case GTHREE_ATTRIBUTE_TYPE_UINT32:
+      scale = 1.0f / 4294967295.0f;
+      break;
+    case GTHREE_ATTRIBUTE_TYPE_INT32:
+      scale = 1.0f / 2147483647.0f;
+      is_signed = TRUE;
+      break;
+    case GTHREE_ATTRIBUTE_TYPE_UINT16:
+      scale = 1.0f / 65535.0f;
+      break;
+    case GTHREE_ATTRIBUTE_TYPE_INT16:
+      scale = 1.0f / 32767.0f;
+      is_signed = TRUE;
+      break;
+    case GTHREE_ATTRIBUTE_TYPE_UINT8:
+      scale = 1.0f / 255.0f;
+      break;
+    case GTHREE_ATTRIBUTE_TYPE_INT8:
+      scale = 1.0f / 127.0f;
+      is_signed = TRUE;
+      break;
+    default:
+      return;
+    }
+
+  for (k = 0; k < item_size; k++)
+    {
+      dest[k] *= scale;
+      /* The most negative value maps below -1 */
+      if (is_signed)
+        dest[k] = MAX (dest[k], -1.0f);
+    }
+}
+
+static void
+transform_direction (const graphene_matrix_t *m,
+                     float                   *v)
+{
+  graphene_vec3_t d;
+
+  graphene_vec3_init (&d, v[0], v[1], v[2]);
+  graphene_matrix_transform_vec3 (m, &d, &d);
+  graphene_vec3_normalize (&d, &d);
+  v[0] = graphene_vec3_get_x (&d);
+  v[1] = graphene_vec3_get_y (&d);
+  v[2] = graphene_vec3_get_z (&d);
+}
+
+/* Appends the triangles of source to the chunk buffers, pre-transformed
+ * to the space of the scene (scene_inverse undoes the scene transform) */
+static void
+append_source (BatchSource             *source,
+               const graphene_matrix_t *scene_inverse,
+               GPtrArray               *names,
+               GPtrArray               *attributes,
+               int                     *n_vertices,
+               GArray                  *indices)
+{
+  graphene_matrix_t matrix;
+  GthreeAttribute *index = gthree_geometry_get_index (source->geometry);
+  int n_source_vertices = gthree_geometry_get_position_count (source->geometry);
+  g_autofree int *remap = g_new (int, n_source_vertices);
+  graphene_matrix_t normal_matrix;
+  gboolean flip;
+  int i, k;
+
+  graphene_matrix_multiply (gthree_object_get_world_matrix (GTHREE_OBJECT (source->mesh)),
+                            scene_inverse, &matrix);
+
+  /* Normals transform with the inverse transpose */
+  if (!graphene_matrix_inverse (&matrix, &normal_matrix))
+    graphene_matrix_init_from_matrix (&normal_matrix, &matrix);
+  graphene_matrix_transpose (&normal_matrix, &normal_matrix);
+
+  /* Mirroring transforms flip the winding order */
+  flip = graphene_matrix_determinant (&matrix) < 0;
+
+  for (i = 0; i < n_source_vertices; i++)
+    remap[i] = -1;
+
+  for (i = source->start; i < source->end; i += 3)
+    {
+      for (k = 0; k < 3; k++)
+        {
+          int corner = flip && k > 0 ? 3 - k : k;
+          int v = index ? (int) gthree_attribute_get_uint (index, i + corner) : i + corner;
+          guint32 dest;
+
+          if (remap[v] < 0)
+            {
+              guint a;
+
+              remap[v] = (*n_vertices)++;
+
+              for (a = 0; a < names->len; a++)
+                {
+                  const char *name = g_ptr_array_index (names, a);
+                  GthreeAttribute *from = gthree_geometry_get_attribute (source->geometry, name);
+                  GthreeAttribute *to = g_ptr_array_index (attributes, a);
+                  float *f = gthree_attribute_peek_float_at (to, remap[v]);
+
+                  read_as_float (from, v, f);
+
+                  if (strcmp (name, "position") == 0)
+                    {
+                      graphene_point3d_t p, w;
+
+                      graphene_point3d_init (&p, f[0], f[1], f[2]);
+                      graphene_matrix_transform_point3d (&matrix, &p, &w);
+                      f[0] = w.x;
+                      f[1] = w.y;
+                      f[2] = w.z;
+                    }
+                  else if (strcmp (name, "normal") == 0)
+                    transform_direction (&normal_matrix, f);
+                  else if (strcmp (name, "tangent") == 0)
+                    {
+                      transform_direction (&matrix, f);
+                      if (flip && gthree_attribute_get_item_size (to) == 4)
+                        f[3] = -f[3];
+                    }
+                }
+            }
+
+          dest = remap[v];
+          g_array_append_val (indices, dest);
+        }
+    }
+}
+
+static GthreeMesh *
+build_chunk (BatchBucket             *bucket,
+             const graphene_matrix_t *scene_inverse,
+             guint                    first,
+             guint                    last,
+             int                      n_vertices)
+{
+  GthreeGeometry *first_geometry = g_array_index (bucket->sources, BatchSource, first).geometry;
+  g_autoptr(GthreeGeometry) geometry = gthree_geometry_new ();
+  g_autoptr(GPtrArray) names = g_ptr_array_new ();
+  g_autoptr(GPtrArray) attributes = g_ptr_array_new_with_free_func (g_object_unref);
+  g_autoptr(GArray) indices = g_array_new (FALSE, FALSE, sizeof (guint32));
+  GList *attribute_names, *l;
+  GthreeMesh *mesh;
+  int n_written = 0;
+  guint32 changed_layers;
+  guint i, layer;
+
+  attribute_names = gthree_geometry_get_attribute_names (first_geometry);
+  for (l = attribute_names; l != NULL; l = l->next)
+    {
+      const char *name = l->data;
+      GthreeAttribute *from = gthree_geometry_get_attribute (first_geometry, name);
+      GthreeAttribute *to = gthree_attribute_new (name, GTHREE_ATTRIBUTE_TYPE_FLOAT, n_vertices,
+                                                  gthree_attribute_get_item_size (from), FALSE);
+
+      g_ptr_array_add (names, (char *)name);
+      g_ptr_array_add (attributes, to);
+      gthree_geometry_add_attribute (geometry, name, to);
+    }
+  g_list_free (attribute_names);
+
+  for (i = first; i <= last; i++)
+    append_source (&g_array_index (bucket->sources, BatchSource, i), scene_inverse,
+                   names, attributes, &n_written, indices);
+
+  g_assert (n_written == n_vertices);
+
+  gthree_geometry_set_index_from_uint32 (geometry, (guint32 *)indices->data, indices->len);
+
+  mesh = gthree_mesh_new (geometry, bucket->material);
+  gthree_object_set_cast_shadow (GTHREE_OBJECT (mesh), bucket->cast_shadow);
+  gthree_object_set_receive_shadow (GTHREE_OBJECT (mesh), bucket->receive_shadow);
+  changed_layers = bucket->layer_mask ^ gthree_object_get_layer_mask (GTHREE_OBJECT (mesh));
+  for (layer = 0; layer < 32; layer++)
+    {
+      if (changed_layers & (1u << layer))
+        gthree_object_toggle_layer (GTHREE_OBJECT (mesh), layer);
+    }
+  gthree_object_set_matrix_auto_update (GTHREE_OBJECT (mesh), FALSE);
+
+  return mesh;
+}
+
+static void
+build_bucket (BatchBucket             *bucket,
+              const graphene_matrix_t *scene_inverse,
+              GthreeObject            *parent)
+{
+  guint first, i;
+  int n_vertices;
+
+  sort_sources (bucket);
+
+  first = 0;
+  n_vertices = 0;
+  for (i = 0; i < bucket->sources->len; i++)
+    {
+      BatchSource *source = &g_array_index (bucket->sources, BatchSource, i);
+
+      if (i > first && n_vertices + source->n_vertices > STATIC_BATCH_MAX_VERTICES)
+        {
+          g_autoptr(GthreeMesh) mesh = build_chunk (bucket, scene_inverse, first, i - 1, n_vertices);
+          gthree_object_add_child (parent, GTHREE_OBJECT (mesh));
+          first = i;
+          n_vertices = 0;
+        }
+
+      n_vertices += source->n_vertices;
+    }
+
+  if (i > first)
+    {
+      g_autoptr(GthreeMesh) mesh = build_chunk (bucket, scene_inverse, first, i - 1, n_vertices);
+      gthree_object_add_child (parent, GTHREE_OBJECT (mesh));
+    }
+}
+
+/**
+ * gthree_scene_build_static_batches:
+ * @scene: a #GthreeScene
+ *
+ * Merges the static meshes in @scene that share a material into a few
+ * large meshes, to cut down on the number of draw calls.
+ *
+ * A mesh is static if it has automatic matrix updates disabled with
+ * gthree_object_set_matrix_auto_update(). Its current transform
+ * relative to @scene is baked into the merged vertices, so neither it
+ * nor its ancestors below @scene may move afterwards. Meshes are only
+ * merged with others on the same layers. Meshes that are invisible,
+ * transparent, skinned, instanced, morphed, or that have children are
+ * left alone.
+ *
+ * The merged geometries are split into spatially compact chunks that
+ * can be culled independently. The merged meshes are added to a new
+ * group in @scene, and the meshes they replace are hidden.
+ *
+ * Returns: (transfer none): the group holding the merged meshes. Remove
+ *   it, and show the hidden meshes again, to undo the batching.
+ */
+GthreeObject *
+gthree_scene_build_static_batches (GthreeScene *scene)
+{
+  g_autoptr(GHashTable) buckets = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, batch_bucket_free);
+  g_autoptr(GPtrArray) batched = g_ptr_array_new ();
+  g_autoptr(GthreeGroup) group = gthree_group_new ();
+  GHashTableIter iter;
+  BatchBucket *bucket;
+  graphene_matrix_t scene_inverse;
+  guint i;
+
+  gthree_object_update_matrix_world (GTHREE_OBJECT (scene), FALSE);
+
+  /* The group is added to the scene, which applies its transform again */
+  if (!graphene_matrix_inverse (gthree_object_get_world_matrix (GTHREE_OBJECT (scene)), &scene_inverse))
+    graphene_matrix_init_identity (&scene_inverse);
+
+  collect_sources (GTHREE_OBJECT (scene), buckets, batched);
+
+  g_hash_table_iter_init (&iter, buckets);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&bucket))
+    build_bucket (bucket, &scene_inverse, GTHREE_OBJECT (group));
+
+  for (i = 0; i < batched->len; i++)
+    gthree_object_set_visible (g_ptr_array_index (batched, i), FALSE);
+
+  gthree_object_set_matrix_auto_update (GTHREE_OBJECT (group), FALSE);
+  gthree_object_add_child (GTHREE_OBJECT (scene), GTHREE_OBJECT (group));
+
+  return GTHREE_OBJECT (group);
+}
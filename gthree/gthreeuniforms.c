@@ -891,6 +891,82 @@ gthree_uniform_load (GthreeUniform *uniform,
     }
 }
 
+static void
+std140_align (GByteArray *buffer,
+              guint       alignment)
+{
+  static const guint8 zeros[16] = { 0 };
+  guint pad = (alignment - buffer->len % alignment) % alignment;
+
+  if (pad)
+    g_byte_array_append (buffer, zeros, pad);
+}
+
+static void
+gthree_uniform_append_std140 (GthreeUniform *uniform,
+                              GByteArray    *buffer)
+{
+  switch (uniform->type)
+    {
+    case GTHREE_UNIFORM_TYPE_INT:
+      std140_align (buffer, 4);
+      g_byte_array_append (buffer, (guint8 *)uniform->value.ints, 4);
+      break;
+    case GTHREE_UNIFORM_TYPE_FLOAT:
+      std140_align (buffer, 4);
+      g_byte_array_append (buffer, (guint8 *)uniform->value.floats, 4);
+      break;
+    case GTHREE_UNIFORM_TYPE_FLOAT2:
+    case GTHREE_UNIFORM_TYPE_VECTOR2:
+      std140_align (buffer, 8);
+      g_byte_array_append (buffer, (guint8 *)uniform->value.floats, 8);
+      break;
+    case GTHREE_UNIFORM_TYPE_FLOAT3:
+    case GTHREE_UNIFORM_TYPE_VECTOR3:
+      std140_align (buffer, 16);
+      g_byte_array_append (buffer, (guint8 *)uniform->value.floats, 12);
+      break;
+    case GTHREE_UNIFORM_TYPE_FLOAT4:
+    case GTHREE_UNIFORM_TYPE_VECTOR4:
+      std140_align (buffer, 16);
+      g_byte_array_append (buffer, (guint8 *)uniform->value.floats, 16);
+      break;
+    case GTHREE_UNIFORM_TYPE_MATRIX4:
+      std140_align (buffer, 16);
+      g_byte_array_append (buffer, (guint8 *)uniform->value.more_floats, 64);
+      break;
+    default:
+      g_warning ("gthree_uniform_append_std140() - unsupported uniform type %d\n", uniform->type);
+    }
+}
+
+/* Appends the named members as a std140 struct, in the given order,
+ * which must match the order of the members in the GLSL struct. */
+void
+gthree_uniforms_append_std140 (GthreeUniforms    *uniforms,
+                               const char *const *members,
+                               GByteArray        *buffer)
+{
+  int i;
+
+  std140_align (buffer, 16);
+
+  for (i = 0; members[i] != NULL; i++)
+    {
+      GthreeUniform *uni = gthree_uniforms_lookup_from_string (uniforms, members[i]);
+
+      if (uni == NULL)
+        {
+          g_warning ("gthree_uniforms_append_std140() - no uniform named %s\n", members[i]);
+          continue;
+        }
+
+      gthree_uniform_append_std140 (uni, buffer);
+    }
+
+  std140_align (buffer, 16);
+}
+
 static int i0 = 0;
 static float f0 = 0.0;
 static float f1 = 1.0;
@@ -1,4 +1,4 @@
-#ifdef USE_COLOR
+#if defined( USE_COLOR ) || defined( USE_INSTANCING_COLOR )
 
 	diffuseColor.rgb *= vColor;
 
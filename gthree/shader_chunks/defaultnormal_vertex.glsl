@@ -1,4 +1,19 @@
-vec3 transformedNormal = normalMatrix * objectNormal;
+vec3 transformedNormal = objectNormal;
+
+#ifdef USE_INSTANCING
+
+	// this is in lieu of a per-instance normal-matrix
+	// shear transforms in the instance matrix are not supported
+
+	mat3 m = mat3( instanceMatrix );
+
+	transformedNormal /= vec3( dot( m[ 0 ], m[ 0 ] ), dot( m[ 1 ], m[ 1 ] ), dot( m[ 2 ], m[ 2 ] ) );
+
+	transformedNormal = m * transformedNormal;
+
+#endif
+
+transformedNormal = normalMatrix * transformedNormal;
 
 #ifdef FLIP_SIDED
 
@@ -8,7 +23,15 @@ vec3 transformedNormal = normalMatrix * objectNormal;
 
 #ifdef USE_TANGENT
 
-	vec3 transformedTangent = normalMatrix * objectTangent;
+	vec3 transformedTangent = objectTangent;
+
+	#ifdef USE_INSTANCING
+
+		transformedTangent = mat3( instanceMatrix ) * transformedTangent;
+
+	#endif
+
+	transformedTangent = normalMatrix * transformedTangent;
 
 	#ifdef FLIP_SIDED
 
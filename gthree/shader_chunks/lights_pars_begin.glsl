@@ -1,4 +1,3 @@
-uniform vec3 ambientLightColor;
 uniform vec3 lightProbe[ 9 ];
 
 // get the irradiance (radiance convolved with cosine lobe) at the point 'normal' on the unit sphere
@@ -64,8 +63,6 @@ vec3 getAmbientLightIrradiance( const in vec3 ambientLightColor ) {
 		vec2 shadowMapSize;
 	};
 
-	uniform DirectionalLight directionalLights[ NUM_DIR_LIGHTS ];
-
 	void getDirectionalDirectLightIrradiance( const in DirectionalLight directionalLight, const in GeometricContext geometry, out IncidentLight directLight ) {
 
 		directLight.color = directionalLight.color;
@@ -93,8 +90,6 @@ vec3 getAmbientLightIrradiance( const in vec3 ambientLightColor ) {
 		float shadowCameraFar;
 	};
 
-	uniform PointLight pointLights[ NUM_POINT_LIGHTS ];
-
 	// directLight is an out parameter as having it as a return value caused compiler errors on some devices
 	void getPointDirectLightIrradiance( const in PointLight pointLight, const in GeometricContext geometry, out IncidentLight directLight ) {
 
@@ -129,8 +124,6 @@ vec3 getAmbientLightIrradiance( const in vec3 ambientLightColor ) {
 		vec2 shadowMapSize;
 	};
 
-	uniform SpotLight spotLights[ NUM_SPOT_LIGHTS ];
-
 	// directLight is an out parameter as having it as a return value caused compiler errors on some devices
 	void getSpotDirectLightIrradiance( const in SpotLight spotLight, const in GeometricContext geometry, out IncidentLight directLight  ) {
 
@@ -206,3 +199,40 @@ vec3 getAmbientLightIrradiance( const in vec3 ambientLightColor ) {
 	}
 
 #endif
+
+
+#ifdef USE_UNIFORM_BUFFERS
+
+	layout(std140) uniform GthreeLightsBlock {
+		vec3 ambientLightColor;
+
+		#if NUM_DIR_LIGHTS > 0
+			DirectionalLight directionalLights[ NUM_DIR_LIGHTS ];
+		#endif
+
+		#if NUM_POINT_LIGHTS > 0
+			PointLight pointLights[ NUM_POINT_LIGHTS ];
+		#endif
+
+		#if NUM_SPOT_LIGHTS > 0
+			SpotLight spotLights[ NUM_SPOT_LIGHTS ];
+		#endif
+	};
+
+#else
+
+	uniform vec3 ambientLightColor;
+
+	#if NUM_DIR_LIGHTS > 0
+		uniform DirectionalLight directionalLights[ NUM_DIR_LIGHTS ];
+	#endif
+
+	#if NUM_POINT_LIGHTS > 0
+		uniform PointLight pointLights[ NUM_POINT_LIGHTS ];
+	#endif
+
+	#if NUM_SPOT_LIGHTS > 0
+		uniform SpotLight spotLights[ NUM_SPOT_LIGHTS ];
+	#endif
+
+#endif